@@ -23,6 +23,7 @@
 
 #include <type_traits>
 #include <random>
+#include <mutex>
 #include <cmath>
 #include <ctime>
 #include <cstdlib>
@@ -107,20 +108,10 @@ namespace math
     }
 
     // generate a random number in the range of min max (inclusive)
-    // the random number generator is automatically seeded.
-    template<typename T>
-    T rand(T min, T max)
+    // using the given random engine.
+    template<typename T, typename Engine>
+    T rand(T min, T max, Engine& engine)
     {
-        // if we enable this flag we always give out a deterministic
-        // sequence by initializing the engine with a predeterminted seed.
-        // this is convenient for example testing purposes, enable this
-        // flag and always get the same sequence without having to change
-        // the calling code that doesn't really care.
-    #if defined(MATH_FORCE_DETERMINISTIC_RANDOM)
-        static std::default_random_engine engine(0xdeadbeef);
-    #else
-        static std::default_random_engine engine(std::time(nullptr));
-    #endif
         if constexpr (std::is_floating_point<T>::value) {
             std::uniform_real_distribution<T> dist(min, max);
             return dist(engine);
@@ -130,18 +121,60 @@ namespace math
         }
     }
 
+    namespace detail {
+        // the shared generator behind math::rand.
+        struct RandomSource {
+            std::mutex mutex;
+            std::default_random_engine engine;
+        };
+        inline RandomSource& GetRandomSource()
+        {
+            // if we enable this flag we always give out a deterministic
+            // sequence by initializing the engine with a predeterminted seed.
+            // this is convenient for example testing purposes, enable this
+            // flag and always get the same sequence without having to change
+            // the calling code that doesn't really care.
+        #if defined(MATH_FORCE_DETERMINISTIC_RANDOM)
+            static RandomSource source { {}, std::default_random_engine(0xdeadbeef) };
+        #else
+            static RandomSource source { {}, std::default_random_engine(std::time(nullptr)) };
+        #endif
+            return source;
+        }
+    } // detail
+
+    // Seed the shared generator behind math::rand. With the same seed
+    // and the same sequence of calls the same numbers come out again.
+    // Note that when called from multiple threads the order of the calls
+    // (and therefore who gets which number) depends on the scheduling,
+    // so for repeatable results in parallel code seed a generator per
+    // work item (see below) instead.
+    inline void seed_rand(unsigned seed)
+    {
+        auto& source = detail::GetRandomSource();
+        std::lock_guard<std::mutex> lock(source.mutex);
+        source.engine.seed(seed);
+    }
+
+    // generate a random number in the range of min max (inclusive)
+    // the random number generator is automatically seeded.
+    // The generator is shared and safe to call from multiple threads.
+    template<typename T>
+    T rand(T min, T max)
+    {
+        auto& source = detail::GetRandomSource();
+        std::lock_guard<std::mutex> lock(source.mutex);
+        return rand(min, max, source.engine);
+    }
+
     // Generate pseudo random numbers based on the given seed.
+    // The sequence is shared by all the threads.
     template<typename T, size_t Seed>
     T rand(T min, T max)
     {
-        static std::default_random_engine engine(Seed);
-        if constexpr (std::is_floating_point<T>::value) {
-            std::uniform_real_distribution<T> dist(min, max);
-            return dist(engine);
-        } else {
-            std::uniform_int_distribution<T> dist(min, max);
-            return dist(engine);
-        }
+        static detail::RandomSource source { {}, std::default_random_engine(Seed) };
+        std::lock_guard<std::mutex> lock(source.mutex);
+        return rand(min, max, source.engine);
     }
 
     class NoiseGenerator
@@ -0,0 +1,164 @@
+// Copyright (C) 2020-2021 Sami Väisänen
+// Copyright (C) 2020-2021 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "config.h"
+
+#include <atomic>
+#include <algorithm>
+
+#include "base/threadpool.h"
+
+namespace base
+{
+
+ThreadPool::ThreadPool(unsigned num_workers)
+{
+    for (unsigned i=0; i<num_workers; ++i)
+    {
+        mThreads.emplace_back(&ThreadPool::ThreadMain, this, i + 1);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mShutdown = true;
+    }
+    mWakeup.notify_all();
+    for (auto& thread : mThreads)
+        thread.join();
+}
+
+void ThreadPool::Submit(Task task)
+{
+    if (mThreads.empty())
+    {
+        // no workers, just run the task right here.
+        task(0);
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mQueue.push(std::move(task));
+        ++mPending;
+    }
+    mWakeup.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDone.wait(lock, [this]() { return mPending == 0; });
+    if (mException)
+    {
+        auto exception = mException;
+        mException = nullptr;
+        std::rethrow_exception(exception);
+    }
+}
+
+void ThreadPool::ParallelFor(std::size_t count, std::size_t grain, const RangeFunc& func)
+{
+    if (count == 0)
+        return;
+
+    grain = std::max(grain, std::size_t(1));
+    const auto num_chunks = (count + grain - 1) / grain;
+    if (mThreads.empty() || num_chunks == 1)
+    {
+        for (std::size_t begin=0; begin<count; begin+=grain)
+            func(begin, std::min(begin + grain, count), 0);
+        return;
+    }
+
+    // the chunks are handed out dynamically so that a thread that finishes
+    // early can grab more work instead of idling while others are busy.
+    std::atomic<std::size_t> next_chunk(0);
+    auto work = [&next_chunk, &func, num_chunks, grain, count](unsigned slot) {
+        for (;;)
+        {
+            const auto chunk = next_chunk.fetch_add(1);
+            if (chunk >= num_chunks)
+                break;
+            const auto begin = chunk * grain;
+            const auto end   = std::min(begin + grain, count);
+            func(begin, end, slot);
+        }
+    };
+    const auto num_helpers = std::min(mThreads.size(), num_chunks - 1);
+    for (std::size_t i=0; i<num_helpers; ++i)
+        Submit(work);
+
+    std::exception_ptr exception;
+    try
+    {
+        work(0);
+    }
+    catch (...)
+    {
+        // stop handing out chunks and let the helpers finish before
+        // the stack frame they refer to goes away.
+        next_chunk = num_chunks;
+        exception = std::current_exception();
+    }
+    Wait();
+    if (exception)
+        std::rethrow_exception(exception);
+}
+
+// static
+unsigned ThreadPool::GetDefaultWorkerCount()
+{
+    const auto num_hw_threads = std::thread::hardware_concurrency();
+    if (num_hw_threads <= 1)
+        return 0;
+    return num_hw_threads - 1;
+}
+
+void ThreadPool::ThreadMain(unsigned slot)
+{
+    for (;;)
+    {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWakeup.wait(lock, [this]() { return mShutdown || !mQueue.empty(); });
+            if (mShutdown && mQueue.empty())
+                return;
+            task = std::move(mQueue.front());
+            mQueue.pop();
+        }
+
+        std::exception_ptr exception;
+        try
+        {
+            task(slot);
+        }
+        catch (...)
+        {
+            exception = std::current_exception();
+        }
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (exception && !mException)
+            mException = exception;
+        if (--mPending == 0)
+            mDone.notify_all();
+    }
+}
+
+} // namespace
@@ -0,0 +1,96 @@
+// Copyright (C) 2020-2021 Sami Väisänen
+// Copyright (C) 2020-2021 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "config.h"
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <queue>
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+namespace base
+{
+    // A simple pool of worker threads for running short lived tasks.
+    // The intended use is to split some per frame work, such as updating
+    // a bunch of entities, into chunks that can be processed in parallel
+    // and then wait for all of them to complete before continuing.
+    // The pool itself is not thread safe, i.e. tasks should only be
+    // submitted and waited on by the thread that owns the pool and the
+    // tasks themselves must not submit more tasks into the same pool.
+    class ThreadPool
+    {
+    public:
+        // A task receives the index of the thread slot that is running it.
+        // Slot 0 is the thread calling ParallelFor and slots 1...N are the
+        // worker threads. The slot index can be used to index per thread
+        // data without needing to lock anything.
+        using Task = std::function<void (unsigned slot)>;
+        using RangeFunc = std::function<void (std::size_t begin, std::size_t end, unsigned slot)>;
+
+        // Create a new pool with the given number of worker threads.
+        // With zero workers all the work is done on the calling thread.
+        explicit ThreadPool(unsigned num_workers);
+        ThreadPool(const ThreadPool&) = delete;
+       ~ThreadPool();
+
+        // Submit a new task for execution by some worker thread.
+        // Returns immediately.
+        void Submit(Task task);
+        // Wait until all the submitted tasks have completed. If any of the
+        // tasks threw an exception the first one is re-thrown here.
+        void Wait();
+        // Split the index range [0, count) into chunks of at most grain
+        // items and call the function on each chunk in parallel. The calling
+        // thread participates in the work and the call returns once all
+        // chunks have been processed.
+        void ParallelFor(std::size_t count, std::size_t grain, const RangeFunc& func);
+
+        // Get the number of thread slots, i.e. the number of workers + 1
+        // for the calling thread.
+        unsigned GetNumSlots() const
+        { return static_cast<unsigned>(mThreads.size()) + 1; }
+        unsigned GetNumWorkers() const
+        { return static_cast<unsigned>(mThreads.size()); }
+
+        // Get a suggested number of worker threads for the current
+        // hardware, i.e. the number of hardware threads minus one
+        // for the main thread.
+        static unsigned GetDefaultWorkerCount();
+
+        ThreadPool& operator=(const ThreadPool&) = delete;
+    private:
+        void ThreadMain(unsigned slot);
+    private:
+        std::vector<std::thread> mThreads;
+        std::queue<Task> mQueue;
+        std::mutex mMutex;
+        // signalled when a new task is available or when shutting down.
+        std::condition_variable mWakeup;
+        // signalled when the number of pending tasks drops to zero.
+        std::condition_variable mDone;
+        std::size_t mPending = 0;
+        std::exception_ptr mException;
+        bool mShutdown = false;
+    };
+
+} // namespace
@@ -0,0 +1,103 @@
+// Copyright (C) 2020-2021 Sami Väisänen
+// Copyright (C) 2020-2021 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "config.h"
+
+#include <atomic>
+#include <vector>
+#include <numeric>
+#include <stdexcept>
+
+#include "base/test_minimal.h"
+#include "base/threadpool.h"
+
+void unit_test_submit()
+{
+    base::ThreadPool pool(3);
+    TEST_REQUIRE(pool.GetNumWorkers() == 3);
+    TEST_REQUIRE(pool.GetNumSlots() == 4);
+
+    std::atomic<int> counter(0);
+    for (int i=0; i<100; ++i)
+    {
+        pool.Submit([&counter](unsigned slot) {
+            TEST_REQUIRE(slot >= 1 && slot <= 3);
+            ++counter;
+        });
+    }
+    pool.Wait();
+    TEST_REQUIRE(counter == 100);
+
+    // exception is propagated to the waiting thread.
+    pool.Submit([](unsigned) { throw std::runtime_error("doh"); });
+    bool caught = false;
+    try
+    {
+        pool.Wait();
+    }
+    catch (const std::runtime_error& e)
+    {
+        caught = true;
+    }
+    TEST_REQUIRE(caught);
+    // and the pool is still usable after that.
+    pool.Submit([&counter](unsigned) { ++counter; });
+    pool.Wait();
+    TEST_REQUIRE(counter == 101);
+}
+
+void unit_test_parallel_for()
+{
+    for (unsigned workers : {0u, 1u, 4u})
+    {
+        base::ThreadPool pool(workers);
+
+        std::vector<int> values(1000, 0);
+        std::vector<std::size_t> per_slot_sum(pool.GetNumSlots(), 0);
+        pool.ParallelFor(values.size(), 16, [&](std::size_t begin, std::size_t end, unsigned slot) {
+            TEST_REQUIRE(begin < end);
+            TEST_REQUIRE(end - begin <= 16);
+            TEST_REQUIRE(slot < pool.GetNumSlots());
+            for (auto i=begin; i<end; ++i)
+            {
+                values[i] += 1;
+                per_slot_sum[slot] += i;
+            }
+        });
+        // every index was visited exactly once.
+        for (auto v : values)
+            TEST_REQUIRE(v == 1);
+        const auto sum = std::accumulate(per_slot_sum.begin(), per_slot_sum.end(), std::size_t(0));
+        TEST_REQUIRE(sum == 999 * 1000 / 2);
+
+        // empty range and a range smaller than the grain.
+        int calls = 0;
+        pool.ParallelFor(0, 16, [&](std::size_t, std::size_t, unsigned) { ++calls; });
+        TEST_REQUIRE(calls == 0);
+        pool.ParallelFor(10, 16, [&](std::size_t begin, std::size_t end, unsigned slot) {
+            TEST_REQUIRE(begin == 0 && end == 10 && slot == 0);
+            ++calls;
+        });
+        TEST_REQUIRE(calls == 1);
+    }
+}
+
+int test_main(int argc, char* argv[])
+{
+    unit_test_submit();
+    unit_test_parallel_for();
+    return 0;
+}
@@ -22,10 +22,12 @@
 #include <cwctype>
 #include <filesystem>
 #include <fstream>
-#include <random>
 #include <cstring>
+#include <random>
+#include <mutex>
 
 #include "base/utility.h"
+#include "base/math.h"
 
 #if defined(__MSVC__)
 #  pragma warning(push)
@@ -45,21 +47,39 @@ double GetRuntimeSec()
     return ms.count() / 1000.0;
 }
 
+static const char* RandomAlphabet =
+        "ABCDEFGHIJKLMNOPQRSTUWXYZ"
+        "abdefghijlkmnopqrstuvwxyz"
+        "1234567890";
+
 std::string RandomString(size_t len)
 {
-    static const char* alphabet =
-            "ABCDEFGHIJKLMNOPQRSTUWXYZ"
-            "abdefghijlkmnopqrstuvwxyz"
-            "1234567890";
-    static unsigned max_len = std::strlen(alphabet) - 1;
+    static unsigned max_len = std::strlen(RandomAlphabet) - 1;
     static std::random_device rd;
+    static std::mutex mutex;
     std::uniform_int_distribution<unsigned> dist(0, max_len);
 
+    std::lock_guard<std::mutex> lock(mutex);
     std::string ret;
     for (size_t i=0; i<len; ++i)
     {
         const auto letter = dist(rd);
-        ret.push_back(alphabet[letter]);
+        ret.push_back(RandomAlphabet[letter]);
+    }
+    return ret;
+}
+
+std::string RandomInstanceId(size_t len)
+{
+    static unsigned max_len = std::strlen(RandomAlphabet) - 1;
+
+    // use the same generator with math::rand so that seeding it
+    // makes both repeatable.
+    std::string ret;
+    for (size_t i=0; i<len; ++i)
+    {
+        const auto letter = math::rand<unsigned>(0, max_len);
+        ret.push_back(RandomAlphabet[letter]);
     }
     return ret;
 }
@@ -117,6 +137,22 @@ return std::filesystem::exists(p);
 #endif
 }
 
+std::uint64_t GetFileModificationTime(const std::string& filename)
+{
+#if defined(WINDOWS_OS)
+    const std::filesystem::path p(base::FromUtf8(filename));
+#elif defined(POSIX_OS)
+    const std::filesystem::path p(filename);
+#endif
+    std::error_code err;
+    const auto time = std::filesystem::last_write_time(p, err);
+    if (err)
+        return 0;
+    // the epoch/resolution of the file clock is unspecified but
+    // it's good enough for comparing two values for the same file.
+    return static_cast<std::uint64_t>(time.time_since_epoch().count());
+}
+
 std::string JoinPath(const std::string& a, const std::string& b)
 {
     const std::filesystem::path pa(a);
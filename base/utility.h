@@ -25,6 +25,7 @@
 #include <algorithm>
 #include <iterator>
 #include <unordered_map>
+#include <cstdint>
 
 #include "base/assert.h"
 #include "base/platform.h"
@@ -174,7 +175,15 @@ inline bool EndsWith(const std::wstring& str, const std::wstring& what)
     return std::equal(what.rbegin(), what.rend(), str.rbegin());
 }
 
+// Generate a random string from a non-deterministic source. Use this
+// for the persistent IDs (classes, resources) that get saved in the
+// content and must not collide between sessions.
 std::string RandomString(size_t len);
+// Generate a random string for a runtime object instance. The characters
+// are drawn from the same generator as math::rand so seeding it with
+// math::seed_rand makes the IDs repeatable, for example for replays.
+// Don't use this for anything persistent.
+std::string RandomInstanceId(size_t len);
 std::string ToUtf8(const std::wstring& str);
 std::wstring FromUtf8(const std::string& str);
 // ToUpper/Lower are only provided for wide strings in order to avoid
@@ -190,6 +199,10 @@ std::ifstream OpenBinaryInputStream(const std::string& filename);
 std::ofstream OpenBinaryOutputStream(const std::string& filename);
 bool OverwriteTextFile(const std::string& file, const std::string& text);
 bool FileExists(const std::string& filename);
+// Get an opaque file modification time stamp. The value is only
+// useful for comparing against another value obtained for the same
+// file in order to detect changes. Returns 0 if the file doesn't exist.
+std::uint64_t GetFileModificationTime(const std::string& filename);
 
 } // base
 
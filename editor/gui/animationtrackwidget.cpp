@@ -639,6 +639,7 @@ bool AnimationTrackWidget::GetStats(Stats* stats) const
     }
     stats->fps  = mUI.widget->getCurrentFPS();
     stats->vsync = mUI.widget->haveVSYNC();
+    stats->graphics = mUI.widget->getDeviceStats();
     return true;
 }
 
@@ -135,6 +135,8 @@ void ChildWindow::Render()
         SetValue(mUI.statTime, QString::number(stats.time));
         SetValue(mUI.statFps,  QString::number((int)stats.fps));
         SetValue(mUI.statVsync, stats.vsync ? QString("ON") : QString("OFF"));
+        SetValue(mUI.statDraws, QString::number(stats.graphics.draw_calls));
+        mUI.statDraws->setToolTip(stats.GetGraphicsToolTip());
     }
 }
 
@@ -844,6 +844,7 @@ bool EntityWidget::GetStats(Stats* stats) const
     stats->time  = mEntityTime;
     stats->fps   = mUI.widget->getCurrentFPS();
     stats->vsync = mUI.widget->haveVSYNC();
+    stats->graphics = mUI.widget->getDeviceStats();
     return true;
 }
 
@@ -1134,8 +1135,10 @@ void EntityWidget::on_btnAddScript_clicked()
                       "-- in the scene during gameplay.\n").arg(name);
     stream << "-- You're free to delete functions you don't need.\n\n";
     stream << "-- Called when the game play begins for an entity in the scene.\n";
+    stream << "-- Also called when the entity is streamed in, see HasBeenStreamed.\n";
     stream << QString("function BeginPlay(%1, scene)\n\nend\n\n").arg(var);
     stream << "-- Called when the game play ends for an entity in the scene.\n";
+    stream << "-- Also called when the entity is streamed out, see HasBeenStreamed.\n";
     stream << QString("function EndPlay(%1, scene)\n\nend\n\n").arg(var);
     stream << "-- Called on every low frequency game tick.\n";
     stream << QString("function Tick(%1, game_time, dt)\n\nend\n\n").arg(var);
@@ -1554,6 +1557,14 @@ void EntityWidget::on_rbDensity_valueChanged(double value)
 {
     UpdateCurrentNodeProperties();
 }
+void EntityWidget::on_rbCollisionCategory_valueChanged(int)
+{
+    UpdateCurrentNodeProperties();
+}
+void EntityWidget::on_rbCollisionMask_valueChanged(int)
+{
+    UpdateCurrentNodeProperties();
+}
 
 void EntityWidget::on_rbLinearVeloX_valueChanged(double value)
 {
@@ -2183,6 +2194,8 @@ void EntityWidget::DisplayCurrentNodeProperties()
     SetValue(mUI.rbAngularDamping, 0.0f);
     SetValue(mUI.rbLinearDamping, 0.0f);
     SetValue(mUI.rbDensity, 0.0f);
+    SetValue(mUI.rbCollisionCategory, 0);
+    SetValue(mUI.rbCollisionMask, 0);
     SetValue(mUI.rbLinearVeloX, 0.0f);
     SetValue(mUI.rbLinearVeloY, 0.0f);
     SetValue(mUI.rbAngularVelo, 0.0f);
@@ -2250,6 +2263,8 @@ void EntityWidget::DisplayCurrentNodeProperties()
             SetValue(mUI.rbAngularDamping, body->GetAngularDamping());
             SetValue(mUI.rbLinearDamping, body->GetLinearDamping());
             SetValue(mUI.rbDensity, body->GetDensity());
+            SetValue(mUI.rbCollisionCategory, body->GetCollisionCategory());
+            SetValue(mUI.rbCollisionMask, body->GetCollisionMask());
             SetValue(mUI.rbLinearVeloX, body->GetLinearVelocity().x);
             SetValue(mUI.rbLinearVeloY, body->GetLinearVelocity().y);
             SetValue(mUI.rbAngularVelo, body->GetAngularVelocity());
@@ -2369,6 +2384,8 @@ void EntityWidget::UpdateCurrentNodeProperties()
         body->SetAngularDamping(GetValue(mUI.rbAngularDamping));
         body->SetLinearDamping(GetValue(mUI.rbLinearDamping));
         body->SetDensity(GetValue(mUI.rbDensity));
+        body->SetCollisionCategory((int)GetValue(mUI.rbCollisionCategory));
+        body->SetCollisionMask((int)GetValue(mUI.rbCollisionMask));
         body->SetAngularVelocity(GetValue(mUI.rbAngularVelo));
 
         // flags
@@ -153,6 +153,8 @@ namespace gui
         void on_rbAngularDamping_valueChanged(double value);
         void on_rbLinearDamping_valueChanged(double value);
         void on_rbDensity_valueChanged(double value);
+        void on_rbCollisionCategory_valueChanged(int);
+        void on_rbCollisionMask_valueChanged(int);
         void on_rbLinearVeloX_valueChanged(double value);
         void on_rbLinearVeloY_valueChanged(double value);
         void on_rbAngularVelo_valueChanged(double value);
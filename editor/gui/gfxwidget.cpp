@@ -260,6 +260,7 @@ void GfxWindow::paintGL()
     }
 
     mCustomGraphicsDevice->EndFrame(false /*display*/);
+    mDeviceStats = mCustomGraphicsDevice->GetFrameStats();
     // using a shared device means that this must be done now
     // centrally once per render iteration, not once per GfxWidget.
     //mCustomGraphicsDevice->CleanGarbage(60);
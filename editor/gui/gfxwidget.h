@@ -90,6 +90,8 @@ namespace gui
 
         float getCurrentFPS() const
         { return mCurrentFps; }
+        gfx::Device::FrameStats getDeviceStats() const
+        { return mDeviceStats; }
 
         // callback to invoke when paint must be done.
         // secs is the seconds elapsed since last paint.
@@ -149,6 +151,9 @@ namespace gui
     private:
         quint64 mNumFrames = 0;
         float mCurrentFps  = 0.0f;
+        // the device is shared between the windows so the stats
+        // need to be grabbed when this window has rendered.
+        gfx::Device::FrameStats mDeviceStats;
 
     private:
         std::shared_ptr<QOpenGLContext> mContext;
@@ -175,6 +180,8 @@ namespace gui
         { return mWindow->haveVSYNC(); }
         float getCurrentFPS() const
         { return mWindow->getCurrentFPS(); }
+        gfx::Device::FrameStats getDeviceStats() const
+        { return mWindow->getDeviceStats(); }
 
         gfx::Color4f getClearColor() const
         { return mWindow->getClearColor(); }
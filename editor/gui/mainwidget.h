@@ -22,6 +22,8 @@
 #  include <QtWidgets>
 #include "warnpop.h"
 
+#include "graphics/device.h"
+
 namespace gui
 {
     class Settings;
@@ -189,6 +191,23 @@ namespace gui
             double time = 0.0;
             float  fps  = 0.0f;
             bool vsync  = false;
+            // the device statistics of the last frame rendered
+            // by the widget.
+            gfx::Device::FrameStats graphics;
+
+            // Format the device statistics for the draw call stat tooltip.
+            QString GetGraphicsToolTip() const
+            {
+                return QString("Draw calls: %1\nVertices: %2\nProgram binds: %3\nTexture binds: %4\n"
+                               "Uniform uploads: %5 (skipped %6)\nUploaded bytes: %7\n"
+                               "Mip generations: %8\nResources created: %9 destroyed: %10")
+                    .arg(graphics.draw_calls).arg(graphics.vertices)
+                    .arg(graphics.program_binds).arg(graphics.texture_binds)
+                    .arg(graphics.uniform_uploads).arg(graphics.uniform_skips)
+                    .arg(graphics.buffer_upload_bytes)
+                    .arg(graphics.texture_mip_generations)
+                    .arg(graphics.resources_created).arg(graphics.resources_destroyed);
+            }
         };
         virtual bool GetStats(Stats* stats) const
         { return false; }
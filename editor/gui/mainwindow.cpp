@@ -735,6 +735,8 @@ void MainWindow::iterateGameLoop()
             SetValue(mUI.statTime, QString::number(stats.time));
             SetValue(mUI.statFps,  QString::number((int)stats.fps));
             SetValue(mUI.statVsync, stats.vsync ? QString("ON") : QString("OFF"));
+            SetValue(mUI.statDraws, QString::number(stats.graphics.draw_calls));
+            mUI.statDraws->setToolTip(stats.GetGraphicsToolTip());
         }
     }
 
@@ -810,6 +812,8 @@ void MainWindow::on_mainTab_currentChanged(int index)
     SetValue(mUI.statTime, QString(""));
     SetValue(mUI.statFps,  QString(""));
     SetValue(mUI.statVsync, QString(""));
+    SetValue(mUI.statDraws, QString(""));
+    mUI.statDraws->setToolTip(QString(""));
 
     if (index != -1)
     {
@@ -362,6 +362,7 @@ bool MaterialWidget::GetStats(Stats* stats) const
     stats->time  = mTime;
     stats->fps   = mUI.widget->getCurrentFPS();
     stats->vsync = mUI.widget->haveVSYNC();
+    stats->graphics = mUI.widget->getDeviceStats();
     return true;
 }
 
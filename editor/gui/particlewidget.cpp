@@ -437,6 +437,7 @@ bool ParticleEditorWidget::GetStats(Stats* stats) const
     stats->time  = mTime;
     stats->vsync = mUI.widget->haveVSYNC();
     stats->fps   = mUI.widget->getCurrentFPS();
+    stats->graphics = mUI.widget->getDeviceStats();
     return true;
 }
 
@@ -550,6 +550,7 @@ void PlayWindow::RunOnce()
             stats.num_frames_rendered = mNumFramesTotal;
             stats.total_wall_time     = mTimeTotal;
             stats.current_fps         = fps;
+            mApp->CollectStats(&stats);
             mApp->UpdateStats(stats);
 
             SetValue(mUI.fps, fps);
@@ -864,7 +865,7 @@ void PlayWindow::on_actionScreenshot_triggered()
     {
         mContext.makeCurrent(mSurface);
         mApp->TakeScreenshot("screenshot.png");
-        INFO("Wrote screenshot '%1'", "screenshot.png");
+        INFO("Taking screenshot '%1'", "screenshot.png");
     }
     catch (const std::exception& e)
     {
@@ -1129,6 +1130,9 @@ void PlayWindow::SetDebugOptions() const
     debug.debug_font      = "app://fonts/orbitron-medium.otf";
     debug.debug_show_fps  = InFullScreen();
     debug.debug_print_fps = false;
+    // when playing inside the editor we're iterating on the game
+    // so pick up any changes to the scripts without a restart.
+    debug.debug_reload_scripts = true;
     mApp->SetDebugOptions(debug);
 }
 
@@ -310,6 +310,7 @@ bool ShapeWidget::GetStats(Stats* stats) const
     stats->time  = mTime;
     stats->vsync = mUI.widget->haveVSYNC();
     stats->fps   = mUI.widget->getCurrentFPS();
+    stats->graphics = mUI.widget->getDeviceStats();
     return true;
 }
 
@@ -336,6 +336,7 @@ SceneWidget::SceneWidget(app::Workspace* workspace) : mUndoStack(3)
     SetValue(mUI.cmbGrid, GridDensity::Grid50x50);
     SetValue(mUI.ID, mState.scene.GetId());
     SetValue(mUI.name, mState.scene.GetName());
+    SetValue(mUI.streamingCellSize, mState.scene.GetStreamingCellSize());
     setWindowTitle("My Scene");
 
     RebuildMenus();
@@ -360,6 +361,7 @@ SceneWidget::SceneWidget(app::Workspace* workspace, const app::Resource& resourc
 
     SetValue(mUI.name, content->GetName());
     SetValue(mUI.ID, content->GetId());
+    SetValue(mUI.streamingCellSize, content->GetStreamingCellSize());
     GetUserProperty(resource, "zoom", mUI.zoom);
     GetUserProperty(resource, "grid", mUI.cmbGrid);
     GetUserProperty(resource, "snap", mUI.chkSnap);
@@ -478,6 +480,7 @@ bool SceneWidget::LoadState(const Settings& settings)
     mState.scene  = std::move(ret.value());
     mOriginalHash = mState.scene.GetHash();
     UpdateResourceReferences();
+    SetValue(mUI.streamingCellSize, mState.scene.GetStreamingCellSize());
 
     const auto vars = mState.scene.GetNumScriptVars();
     SetEnabled(mUI.btnEditScriptVar, vars > 0);
@@ -764,6 +767,7 @@ bool SceneWidget::GetStats(Stats* stats) const
     stats->time  = mSceneTime;
     stats->fps   = mUI.widget->getCurrentFPS();
     stats->vsync = mUI.widget->haveVSYNC();
+    stats->graphics = mUI.widget->getDeviceStats();
     return true;
 }
 
@@ -771,6 +775,10 @@ void SceneWidget::on_name_textChanged(const QString&)
 {
     mState.scene.SetName(GetValue(mUI.name));
 }
+void SceneWidget::on_streamingCellSize_valueChanged(double value)
+{
+    mState.scene.SetStreamingCellSize(value);
+}
 
 void SceneWidget::on_actionPlay_triggered()
 {
@@ -686,6 +686,7 @@ bool UIWidget::GetStats(Stats* stats) const
     stats->time  = mPlayTime;
     stats->fps   = mUI.widget->getCurrentFPS();
     stats->vsync = mUI.widget->haveVSYNC();
+    stats->graphics = mUI.widget->getDeviceStats();
     return true;
 }
 
@@ -29,6 +29,7 @@
 #include "data/reader.h"
 #include "engine/animation.h"
 #include "engine/entity.h"
+#include "engine/snapshot.h"
 
 namespace game
 {
@@ -643,6 +644,39 @@ bool AnimationTrack::IsComplete() const
     return false;
 }
 
+void AnimationTrack::SaveState(SnapshotWriter& out) const
+{
+    out.Write(mCurrentTime);
+    out.Write(mDelay);
+    out.Write(static_cast<std::uint32_t>(mTracks.size()));
+    for (const auto& track : mTracks)
+    {
+        const std::uint8_t state = (track.started ? 0x1 : 0x0) |
+                                   (track.ended   ? 0x2 : 0x0);
+        out.Write(state);
+    }
+}
+
+bool AnimationTrack::RestoreState(SnapshotReader& in)
+{
+    std::uint32_t num_tracks = 0;
+    if (!in.Read(&mCurrentTime) || !in.Read(&mDelay) || !in.Read(&num_tracks))
+        return false;
+    if (num_tracks != mTracks.size())
+        return false;
+    for (auto& track : mTracks)
+    {
+        std::uint8_t state = 0;
+        if (!in.Read(&state))
+            return false;
+        // an actuator in progress needs to be started again in order
+        // to capture its start state from the node.
+        track.ended   = (state & 0x2) != 0;
+        track.started = track.ended;
+    }
+    return true;
+}
+
 std::unique_ptr<AnimationTrack> CreateAnimationTrackInstance(std::shared_ptr<const AnimationTrackClass> klass)
 {
     return std::make_unique<AnimationTrack>(klass);
@@ -39,6 +39,8 @@
 namespace game
 {
     class EntityNode;
+    class SnapshotWriter;
+    class SnapshotReader;
 
     // ActuatorClass defines an interface for classes of actuators.
     // Actuators are objects that modify the state of some render
@@ -681,6 +683,15 @@ namespace game
         // actions have been performed.
         bool IsComplete() const;
 
+        // Save the playback state of the track into a snapshot.
+        void SaveState(SnapshotWriter& out) const;
+        // Restore the playback state of the track from a snapshot that
+        // was saved from a track of the same class. The actuators don't
+        // keep their start state in the snapshot, so any actuator that
+        // was in progress will start over from the current node state.
+        // Returns false if the snapshot data is not valid.
+        bool RestoreState(SnapshotReader& in);
+
         // Set one time animation delay that takes place
         // before the animation starts.
         void SetDelay(float delay)
@@ -0,0 +1,138 @@
+// Copyright (C) 2020-2021 Sami Väisänen
+// Copyright (C) 2020-2021 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "config.h"
+
+#include <cstdint>
+#include <exception>
+
+#include "base/logging.h"
+#include "base/utility.h"
+#include "engine/capture.h"
+
+namespace game
+{
+
+FrameWriter::FrameWriter()
+{
+    mThread = std::thread(&FrameWriter::ThreadMain, this);
+}
+
+FrameWriter::~FrameWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mShutdown = true;
+    }
+    mCondition.notify_one();
+    mThread.join();
+}
+
+bool FrameWriter::Write(gfx::Bitmap<gfx::RGBA>&& frame, const std::string& file,
+                        Format format, unsigned frame_number)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mQueue.size() >= mMaxQueueSize)
+        {
+            WARN("Frame writer queue is full. Dropping frame '%1'.", file);
+            return false;
+        }
+        Frame f;
+        f.bitmap = std::move(frame);
+        f.file   = file;
+        f.format = format;
+        f.frame_number = frame_number;
+        mQueue.push(std::move(f));
+    }
+    mCondition.notify_one();
+    return true;
+}
+
+std::size_t FrameWriter::GetQueueSize() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mQueue.size();
+}
+
+void FrameWriter::ThreadMain()
+{
+    for (;;)
+    {
+        Frame frame;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondition.wait(lock, [this]() { return mShutdown || !mQueue.empty(); });
+            if (mQueue.empty())
+                break;
+            frame = std::move(mQueue.front());
+            mQueue.pop();
+        }
+        try
+        {
+            WriteFrame(frame);
+        }
+        catch (const std::exception& e)
+        {
+            ERROR("Failed to write frame '%1' (%2).", frame.file, e.what());
+        }
+    }
+    mRawFile.close();
+}
+
+void FrameWriter::WriteFrame(const Frame& frame)
+{
+    const auto& rgba  = frame.bitmap;
+    const auto width  = rgba.GetWidth();
+    const auto height = rgba.GetHeight();
+    const auto* src   = static_cast<const gfx::RGBA*>(rgba.GetDataPtr());
+
+    if (frame.format == Format::Raw)
+    {
+        if (frame.file != mRawFileName)
+        {
+            mRawFile.close();
+            mRawFile = base::OpenBinaryOutputStream(frame.file);
+            mRawFileName = frame.file;
+            if (!mRawFile.is_open())
+                ERROR("Failed to open frame sequence file '%1'.", frame.file);
+        }
+        if (!mRawFile.is_open())
+            return;
+        const std::uint32_t header[3] = {frame.frame_number, width, height};
+        mRawFile.write(reinterpret_cast<const char*>(header), sizeof(header));
+        mRawFile.write(reinterpret_cast<const char*>(src), width * height * sizeof(gfx::RGBA));
+        return;
+    }
+
+    // pre-multiply alpha, STB image write with semi transparent pixels
+    // aren't really the expected output visually.
+    gfx::Bitmap<gfx::RGB> rgb;
+    rgb.Resize(width, height);
+    auto* dst = static_cast<gfx::RGB*>(const_cast<void*>(rgb.GetDataPtr()));
+    for (unsigned i=0; i<width*height; ++i)
+    {
+        const unsigned alpha = src[i].a;
+        dst[i].r = (src[i].r * alpha) / 255;
+        dst[i].g = (src[i].g * alpha) / 255;
+        dst[i].b = (src[i].b * alpha) / 255;
+    }
+    gfx::WritePNG(rgb, frame.file);
+    DEBUG("Wrote frame '%1'", frame.file);
+}
+
+} // namespace
@@ -0,0 +1,88 @@
+// Copyright (C) 2020-2021 Sami Väisänen
+// Copyright (C) 2020-2021 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "config.h"
+
+#include <string>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <cstddef>
+
+#include "graphics/bitmap.h"
+
+namespace game
+{
+    // Write captured frames (screenshots) out to files on a background
+    // thread so that the expensive parts, i.e. the pixel conversion, the
+    // image compression and the file IO don't stall the main loop.
+    class FrameWriter
+    {
+    public:
+        enum class Format {
+            // Write each frame into its own PNG file.
+            PNG,
+            // Append the frame into a raw frame sequence file. Each frame
+            // is written as frame number, width and height (32bit unsigned)
+            // followed by the RGBA pixels with the top row first.
+            Raw
+        };
+        FrameWriter();
+        // Any frames still in the queue are written out before the
+        // writer thread exits.
+       ~FrameWriter();
+        // Queue a frame to be written into the given file. If the queue
+        // is already full the frame is dropped and false is returned.
+        bool Write(gfx::Bitmap<gfx::RGBA>&& frame, const std::string& file,
+                   Format format, unsigned frame_number = 0);
+        // Get the number of frames waiting to be written.
+        std::size_t GetQueueSize() const;
+        // Set the maximum number of frames that can be queued. Each frame
+        // is a full resolution bitmap so this bounds the memory use when
+        // the writer can't keep up with the capture rate.
+        void SetMaxQueueSize(std::size_t size)
+        { mMaxQueueSize = size; }
+
+        FrameWriter(const FrameWriter&) = delete;
+        FrameWriter& operator=(const FrameWriter&) = delete;
+    private:
+        struct Frame {
+            gfx::Bitmap<gfx::RGBA> bitmap;
+            std::string file;
+            Format format = Format::PNG;
+            unsigned frame_number = 0;
+        };
+        void ThreadMain();
+        void WriteFrame(const Frame& frame);
+    private:
+        mutable std::mutex mMutex;
+        std::condition_variable mCondition;
+        std::queue<Frame> mQueue;
+        std::size_t mMaxQueueSize = 30;
+        bool mShutdown = false;
+        // the currently open raw sequence file. only touched
+        // by the writer thread.
+        std::string mRawFileName;
+        std::ofstream mRawFile;
+        std::thread mThread;
+    };
+
+} // namespace
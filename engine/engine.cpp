@@ -29,9 +29,17 @@
 #include <stack>
 #include <cstring>
 #include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <filesystem>
+#include <chrono>
+#include <thread>
 
 #include "base/logging.h"
 #include "base/format.h"
+#include "base/utility.h"
+#include "base/math.h"
+#include "base/threadpool.h"
 #include "graphics/image.h"
 #include "graphics/device.h"
 #include "graphics/material.h"
@@ -53,6 +61,7 @@
 #include "engine/format.h"
 #include "engine/treeop.h"
 #include "engine/ui.h"
+#include "engine/capture.h"
 #include "uikit/window.h"
 #include "uikit/painter.h"
 #include "uikit/state.h"
@@ -80,12 +89,24 @@ public:
         DEBUG("Engine starting.");
         mGame->LoadGame(mClasslib);
     }
+    virtual void SetRandomSeed(unsigned seed) override
+    {
+        // this covers math::rand and the instance ids which are random
+        // strings that determine for example the iteration order of some
+        // containers so they need to be repeatable as well.
+        math::seed_rand(seed);
+        game::SeedLuaRandom(seed);
+        DEBUG("Random seed %1", seed);
+    }
     virtual void Init(gfx::Device::Context* context, unsigned surface_width, unsigned surface_height) override
     {
         DEBUG("Engine initializing. Surface %1x%2", surface_width, surface_height);
-        mDevice  = gfx::Device::Create(gfx::Device::Type::OpenGL_ES2, context);
+        if (mRenderOptions.render_thread)
+            mDevice = gfx::Device::CreateThreaded(gfx::Device::Type::OpenGL_ES2, context);
+        else mDevice = gfx::Device::Create(gfx::Device::Type::OpenGL_ES2, context);
         mPainter = gfx::Painter::Create(mDevice);
         mPainter->SetSurfaceSize(surface_width, surface_height);
+        mPainter->EnablePassTimers(mDebug.debug_gpu_timers);
         mSurfaceWidth  = surface_width;
         mSurfaceHeight = surface_height;
         mGame = std::make_unique<game::LuaGame>(mDirectory + "/lua");
@@ -97,10 +118,27 @@ public:
         mUIPainter.SetPainter(mPainter.get());
         mUIPainter.SetStyle(&mUIStyle);
     }
+    virtual void SetCaptureOptions(const CaptureOptions& capture) override
+    {
+        mCapture = capture;
+        mCapture.interval = std::max(1u, capture.interval);
+        if (!mCapture.directory.empty())
+            mCapture.directory = std::filesystem::absolute(capture.directory).u8string();
+        if (!mCapture.directory.empty())
+            INFO("Capturing every %1 frame(s) to '%2'", mCapture.interval, mCapture.directory);
+    }
+    virtual void SetRenderOptions(const RenderOptions& options) override
+    {
+        mRenderOptions = options;
+        if (mRenderOptions.render_thread)
+            INFO("Rendering on a separate render thread.");
+    }
     virtual void SetDebugOptions(const DebugOptions& debug) override
     {
         mDebug = debug;
         base::EnableDebugLog(mDebug.debug_log);
+        if (mPainter)
+            mPainter->EnablePassTimers(mDebug.debug_gpu_timers);
     }
     virtual void DebugPrintString(const std::string& message) override
     {
@@ -126,9 +164,29 @@ public:
         mPhysics.SetNumPositionIterations(conf.physics.num_position_iterations);
         mPhysics.SetNumVelocityIterations(conf.physics.num_velocity_iterations);
         mPhysics.SetTimestep(1.0f / conf.updates_per_second);
+        mPhysics.SetNumPartitions(conf.physics.num_partitions);
+        mPhysics.SetPartitionWidth(conf.physics.partition_width);
         mDevice->SetDefaultTextureFilter(conf.default_min_filter);
         mDevice->SetDefaultTextureFilter(conf.default_mag_filter);
         mClearColor = conf.clear_color;
+        mGCTimeBudget = conf.gc_time_budget_us;
+        mStreaming.load_margin   = conf.streaming.load_margin;
+        mStreaming.unload_margin = conf.streaming.unload_margin;
+        mStreaming.budget        = conf.streaming.budget;
+
+        const auto num_workers = conf.num_worker_threads < 0
+            ? base::ThreadPool::GetDefaultWorkerCount()
+            : static_cast<unsigned>(conf.num_worker_threads);
+        mRenderer.SetThreadPool(nullptr);
+        mPhysics.SetThreadPool(nullptr);
+        mThreadPool.reset();
+        if (num_workers)
+        {
+            mThreadPool = std::make_unique<base::ThreadPool>(num_workers);
+            mRenderer.SetThreadPool(mThreadPool.get());
+            mPhysics.SetThreadPool(mThreadPool.get());
+        }
+        DEBUG("Using %1 worker threads for scene update.", num_workers);
         mGameTimeStep = 1.0f / conf.updates_per_second;
         mGameTickStep = 1.0f / conf.ticks_per_second;
     }
@@ -137,6 +195,10 @@ public:
     {
         mDevice->BeginFrame();
         mDevice->ClearColor(mClearColor);
+        // the timings are the results of some earlier frame
+        // since the GPU runs behind.
+        if (mDebug.debug_gpu_timers)
+            mPassTimings = mPainter->GetPassTimings();
 
         // get the game's logical viewport into the game world.
         const auto& view = mGame->GetViewport();
@@ -192,10 +254,18 @@ public:
             mPainter->SetOrthographicView(view);
 
             gfx::Transform transform;
+            mPainter->BeginPass("Scene");
             mRenderer.Draw(*mScene , *mPainter , transform, nullptr, &cull);
+            mPainter->EndPass();
             if (mDebug.debug_draw && mPhysics.HaveWorld())
             {
-                mPhysics.DebugDrawObjects(*mPainter , transform);
+                game::PhysicsEngine::DebugDrawOptions options;
+                options.shapes   = mDebug.debug_draw_physics;
+                options.aabbs    = mDebug.debug_draw_physics_aabbs;
+                options.contacts = mDebug.debug_draw_physics_contacts;
+                mPainter->BeginPass("Debug");
+                mPhysics.DebugDrawObjects(*mPainter , transform, options);
+                mPainter->EndPass();
             }
         }
 
@@ -212,7 +282,9 @@ public:
             mPainter->SetViewport((surf_width - device_viewport_width)*0.5,
                                   (surf_height - device_viewport_height)*0.5,
                                   device_viewport_width, device_viewport_height);
+            mPainter->BeginPass("UI");
             ui->Paint(mUIState, mUIPainter, base::GetRuntimeSec(), nullptr);
+            mPainter->EndPass();
         }
 
         if (mDebug.debug_show_fps || mDebug.debug_show_msg)
@@ -228,15 +300,26 @@ public:
             "FPS: %.2f wall time: %.2f frames: %u",
                 mLastStats.current_fps, mLastStats.total_wall_time, mLastStats.num_frames_rendered);
 
-            const gfx::FRect rect(10, 10, 500, 20);
+            gfx::FRect rect(10, 10, 500, 20);
             gfx::FillRect(*mPainter, rect, gfx::Color4f(gfx::Color::Black, 0.4f));
             gfx::DrawTextRect(*mPainter, hallelujah,
                 mDebug.debug_font, 14, rect, gfx::Color::HotPink,
                 gfx::TextAlign::AlignLeft | gfx::TextAlign::AlignVCenter);
+            if (mDebug.debug_gpu_timers)
+            {
+                rect.Translate(0, 20);
+                rect.SetWidth(800);
+                gfx::FillRect(*mPainter, rect, gfx::Color4f(gfx::Color::Black, 0.4f));
+                gfx::DrawTextRect(*mPainter, FormatPassTimings(mPassTimings),
+                    mDebug.debug_font, 14, rect, gfx::Color::HotPink,
+                    gfx::TextAlign::AlignLeft | gfx::TextAlign::AlignVCenter);
+            }
         }
         if (mDebug.debug_show_msg && mShowDebugs)
         {
             gfx::FRect rect(10, 30, 500, 20);
+            if (mDebug.debug_show_fps && mDebug.debug_gpu_timers)
+                rect.Translate(0, 20);
             for (const auto& print : mDebugPrints)
             {
                 gfx::FillRect(*mPainter, rect, gfx::Color4f(gfx::Color::Black, 0.4f));
@@ -248,14 +331,20 @@ public:
         }
 
         mRenderer.EndFrame();
+        // the back buffer contents are undefined after it's been
+        // displayed so any captures must be read before.
+        CaptureFrame();
         mDevice->EndFrame(true);
-        mDevice->CleanGarbage(120);
+        mDevice->CleanGarbage(120, mGCTimeBudget);
     }
 
     virtual void BeginMainLoop() override
     {
         if (mScene)
         {
+            // bring the streamed scene content in/out based on the
+            // current view before the spawns and kills are realized.
+            mScene->UpdateStreaming(mGame->GetViewport());
             mScene->BeginLoop();
             mScripting->BeginLoop();
         }
@@ -269,6 +358,15 @@ public:
         // Game Engine Architecture by Jason Gregory
         mTimeAccum += dt;
 
+        // checking the script files is a few system calls per script
+        // so don't do it on every single frame.
+        if (mDebug.debug_reload_scripts && wall_time - mLastScriptCheck >= 1.0)
+        {
+            mGame->ReloadChangedScripts();
+            mScripting->ReloadChangedScripts();
+            mLastScriptCheck = wall_time;
+        }
+
         // do simulation/animation update steps.
         while (mTimeAccum >= mGameTimeStep)
         {
@@ -345,6 +443,23 @@ public:
     virtual void Shutdown() override
     {
         DEBUG("Engine shutdown");
+        // complete the pending reads while the device is still
+        // around. the frame writer will finish writing them. don't
+        // wait forever though in case some read never completes.
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (mDevice && !mCaptureReads.empty())
+        {
+            PollCaptures();
+            if (mCaptureReads.empty())
+                break;
+            if (std::chrono::steady_clock::now() >= deadline)
+            {
+                WARN("Dropping %1 pending frame capture(s).", mCaptureReads.size());
+                mCaptureReads.clear();
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
         gfx::SetResourceLoader(nullptr);
         mDevice.reset();
     }
@@ -353,6 +468,10 @@ public:
     virtual wdk::WindowListener* GetWindowListener() override
     { return this; }
 
+    virtual void CollectStats(Stats* stats) const override
+    {
+        stats->gpu_pass_timings = mPassTimings;
+    }
     virtual void UpdateStats(const Stats& stats) override
     {
         if (mDebug.debug_show_fps)
@@ -363,6 +482,11 @@ public:
         {
             DEBUG("fps: %1, wall_time: %2, frames: %3",
                   stats.current_fps, stats.total_wall_time, stats.num_frames_rendered);
+            if (mDebug.debug_gpu_timers)
+                DEBUG("%1", FormatPassTimings(stats.gpu_pass_timings));
+            if (mScene && mScene->GetNumStreamingCells())
+                DEBUG("scene entities: %1, streaming cells: %2/%3", mScene->GetNumEntities(),
+                      mScene->GetNumLoadedStreamingCells(), mScene->GetNumStreamingCells());
         }
 
         for (auto it = mDebugPrints.begin(); it != mDebugPrints.end();)
@@ -373,23 +497,13 @@ public:
             } else ++it;
         }
     }
-    virtual void TakeScreenshot(const std::string& filename) const override
-    {
-        const auto& rgba = mDevice->ReadColorBuffer(mSurfaceWidth, mSurfaceHeight);
-        // pre-multiply alpha, STB image write with semi transparent pixels
-        // aren't really the expected output visually. should this just discard alpha?
-        gfx::Bitmap<gfx::RGB> rgb;
-        rgb.Resize(rgba.GetWidth(), rgba.GetHeight());
-        for (unsigned y=0; y<rgba.GetHeight(); ++y) {
-            for (unsigned x=0; x<rgba.GetWidth(); ++x) {
-                const auto src = rgba.GetPixel(y, x);
-                const auto alpha = src.a / 255.0;
-                const auto dst = gfx::RGB(src.r * alpha, src.g * alpha, src.b * alpha);
-                rgb.SetPixel(y, x, dst);
-            }
-        }
-        gfx::WritePNG(rgb, filename);
-        INFO("Wrote screenshot '%1'", filename);
+    virtual void TakeScreenshot(const std::string& filename) override
+    {
+        // the actual read is done when the next frame has been drawn and
+        // the file is written later on the writer thread so resolve the
+        // path now while the current working directory is what the caller
+        // expects it to be.
+        mScreenshots.push_back(std::filesystem::absolute(filename).u8string());
     }
 
     virtual void OnRenderingSurfaceResized(unsigned width, unsigned height) override
@@ -592,6 +706,13 @@ private:
     void PlayGame(game::ClassHandle<game::SceneClass> klass)
     {
         mScene = game::CreateSceneInstance(klass);
+        // a margin that isn't configured keeps the scene's default.
+        const auto load_margin = mStreaming.load_margin > 0.0f
+            ? mStreaming.load_margin : mScene->GetStreamingLoadMargin();
+        const auto unload_margin = mStreaming.unload_margin > 0.0f
+            ? mStreaming.unload_margin : mScene->GetStreamingUnloadMargin();
+        mScene->SetStreamingMargins(load_margin, unload_margin);
+        mScene->SetStreamingBudget(mStreaming.budget);
         mPhysics.DeleteAll();
         mPhysics.CreateWorld(*mScene);
         mScripting->BeginPlay(mScene.get());
@@ -621,7 +742,7 @@ private:
     {
         if (mScene)
         {
-            mScene->Update(dt);
+            mScene->Update(dt, mThreadPool.get());
             if (mPhysics.HaveWorld())
             {
                 std::vector<game::ContactEvent> contacts;
@@ -684,6 +805,73 @@ private:
         DEBUG("Requesting %1 mode", full_screen ? "FullScreen" : "Window");
     }
 
+    static std::string FormatPassTimings(const std::vector<gfx::Painter::PassTiming>& timings)
+    {
+        std::string ret = "GPU:";
+        if (timings.empty())
+            ret += " n/a";
+        for (const auto& pass : timings)
+        {
+            char buff[128] = {0};
+            if (pass.gpu_time < 0.0)
+                std::snprintf(buff, sizeof(buff) - 1, " %s: lost", pass.name.c_str());
+            else std::snprintf(buff, sizeof(buff) - 1, " %s: %.2fms", pass.name.c_str(), pass.gpu_time * 1000.0);
+            ret += buff;
+        }
+        return ret;
+    }
+
+    void CaptureFrame()
+    {
+        std::vector<std::pair<std::string, FrameWriter::Format>> captures;
+        for (const auto& file : mScreenshots)
+            captures.push_back({file, FrameWriter::Format::PNG});
+        mScreenshots.clear();
+
+        if (!mCapture.directory.empty() && (mFrameCounter % mCapture.interval) == 0)
+        {
+            if (mCapture.format == CaptureOptions::Format::Raw)
+                captures.push_back({base::JoinPath(mCapture.directory, "frames.raw"), FrameWriter::Format::Raw});
+            else
+            {
+                char name[32];
+                std::snprintf(name, sizeof(name), "frame_%06u.png", mFrameCounter);
+                captures.push_back({base::JoinPath(mCapture.directory, name), FrameWriter::Format::PNG});
+            }
+        }
+        ++mFrameCounter;
+
+        if (!captures.empty())
+        {
+            // make sure to read the window surface.
+            mDevice->SetFrameBuffer(nullptr);
+            for (auto& capture : captures)
+            {
+                CaptureRead read;
+                read.handle = mDevice->ReadColorBufferAsync(0, 0, mSurfaceWidth, mSurfaceHeight);
+                read.file   = std::move(capture.first);
+                read.format = capture.second;
+                read.frame_number = mFrameCounter - 1;
+                mCaptureReads.push_back(std::move(read));
+            }
+        }
+        PollCaptures();
+    }
+    void PollCaptures()
+    {
+        for (auto it = mCaptureReads.begin(); it != mCaptureReads.end();)
+        {
+            gfx::Bitmap<gfx::RGBA> bitmap;
+            if (!mDevice->PollColorBufferRead(it->handle, &bitmap))
+            {
+                ++it;
+                continue;
+            }
+            mFrameWriter.Write(std::move(bitmap), it->file, it->format, it->frame_number);
+            it = mCaptureReads.erase(it);
+        }
+    }
+
     static std::string ModifierString(wdk::bitflag<wdk::Keymod> mods)
     {
         std::string ret;
@@ -702,6 +890,29 @@ private:
     unsigned mSurfaceWidth  = 0;
     unsigned mSurfaceHeight = 0;
     gfx::Color4f mClearColor = {0.2f, 0.3f, 0.4f, 1.0f};
+    // time budget for the graphics device garbage collection per frame.
+    unsigned mGCTimeBudget = 500;
+    // the streaming settings applied to every new scene.
+    struct {
+        float load_margin   = 0.0f;
+        float unload_margin = 0.0f;
+        unsigned budget = 256;
+    } mStreaming;
+    // frame capture settings and state.
+    struct CaptureRead {
+        unsigned handle = 0;
+        std::string file;
+        FrameWriter::Format format = FrameWriter::Format::PNG;
+        unsigned frame_number = 0;
+    };
+    RenderOptions mRenderOptions;
+    CaptureOptions mCapture;
+    std::vector<CaptureRead> mCaptureReads;
+    // screenshot requests waiting for the next frame.
+    std::vector<std::string> mScreenshots;
+    // writes the captured frames on a background thread.
+    game::FrameWriter mFrameWriter;
+    unsigned mFrameCounter = 0;
     // game dir where the executable is.
     std::string mDirectory;
     // queue of outgoing requests regarding the environment
@@ -719,6 +930,9 @@ private:
     std::shared_ptr<gfx::Device> mDevice;
     // The rendering subsystem.
     game::Renderer mRenderer;
+    // worker threads for the parallel scene update and draw.
+    // nullptr when everything is done on the main thread.
+    std::unique_ptr<base::ThreadPool> mThreadPool;
     // The physics subsystem.
     game::PhysicsEngine mPhysics;
     // The UI painter for painting UIs
@@ -746,6 +960,8 @@ private:
     game::App::DebugOptions mDebug;
     // last statistics about the rendering rate etc.
     game::App::Stats mLastStats;
+    // the latest GPU render pass timings when debug_gpu_timers is on.
+    std::vector<gfx::Painter::PassTiming> mPassTimings;
     // list of current debug print messages that
     // get printed to the display.
     struct DebugPrint {
@@ -774,6 +990,8 @@ private:
     bool mBlockMouse = false;
     // flag to control the debug string printing.
     bool mShowDebugs = true;
+    // wall time of the last check for modified scripts.
+    double mLastScriptCheck = 0.0;
 };
 
 } //namespace
@@ -32,6 +32,36 @@
 #include "engine/treeop.h"
 #include "engine/entity.h"
 #include "engine/transform.h"
+#include "engine/snapshot.h"
+
+namespace {
+using MaterialParam = game::DrawableItem::MaterialParam;
+
+void WriteSnapshotMaterialParam(game::SnapshotWriter& out, const MaterialParam& param)
+{
+    out.Write(static_cast<std::uint8_t>(param.index()));
+    std::visit([&out](const auto& value) {
+        out.Write(value);
+    }, param);
+}
+
+template<std::size_t Index = 0>
+bool ReadSnapshotMaterialParam(game::SnapshotReader& in, std::size_t index, MaterialParam* param)
+{
+    if constexpr (Index < std::variant_size_v<MaterialParam>)
+    {
+        if (index != Index)
+            return ReadSnapshotMaterialParam<Index + 1>(in, index, param);
+
+        std::variant_alternative_t<Index, MaterialParam> value;
+        if (!in.Read(&value))
+            return false;
+        *param = value;
+        return true;
+    }
+    return false;
+}
+} // namespace
 
 namespace game
 {
@@ -50,6 +80,8 @@ std::size_t RigidBodyItemClass::GetHash() const
     hash = base::hash_combine(hash, mDensity);
     hash = base::hash_combine(hash, mLinearVelocity);
     hash = base::hash_combine(hash, mAngularVelocity);
+    hash = base::hash_combine(hash, mCollisionCategory);
+    hash = base::hash_combine(hash, mCollisionMask);
     return hash;
 }
 
@@ -66,6 +98,8 @@ void RigidBodyItemClass::IntoJson(data::Writer& data) const
     data.Write("density",         mDensity);
     data.Write("linear_velocity", mLinearVelocity);
     data.Write("angular_velocity", mAngularVelocity);
+    data.Write("collision_category", mCollisionCategory);
+    data.Write("collision_mask",     mCollisionMask);
 }
 // static
 std::optional<RigidBodyItemClass> RigidBodyItemClass::FromJson(const data::Reader& data)
@@ -83,6 +117,12 @@ std::optional<RigidBodyItemClass> RigidBodyItemClass::FromJson(const data::Reade
         !data.Read("linear_velocity", &ret.mLinearVelocity) ||
         !data.Read("angular_velocity",&ret.mAngularVelocity))
         return std::nullopt;
+    // the collision filter was added later, older content doesn't
+    // have it so keep the defaults if it's missing.
+    data.Read("collision_category", &ret.mCollisionCategory);
+    data.Read("collision_mask",     &ret.mCollisionMask);
+    ret.mCollisionCategory &= 0xffff;
+    ret.mCollisionMask     &= 0xffff;
     return ret;
 }
 
@@ -431,7 +471,7 @@ EntityNodeClass& EntityNodeClass::operator=(const EntityNodeClass& other)
 EntityNode::EntityNode(std::shared_ptr<const EntityNodeClass> klass)
     : mClass(klass)
 {
-    mInstId = base::RandomString(10);
+    mInstId = base::RandomInstanceId(10);
     mName   = klass->GetName();
     Reset();
 }
@@ -521,6 +561,130 @@ glm::mat4 EntityNode::GetModelTransform() const
     return transform.GetAsMatrix();
 }
 
+void EntityNode::SaveState(SnapshotWriter& out) const
+{
+    out.Write(mInstId);
+    out.Write(mName);
+    out.Write(mPosition);
+    out.Write(mScale);
+    out.Write(mSize);
+    out.Write(mRotation);
+
+    const std::uint8_t items = (mDrawable  ? 0x1 : 0x0) |
+                               (mRigidBody ? 0x2 : 0x0) |
+                               (mTextItem  ? 0x4 : 0x0);
+    out.Write(items);
+    if (mDrawable)
+    {
+        const DrawableItem& drawable = *mDrawable;
+        out.WriteFlags<DrawableItem::Flags>(drawable);
+        out.Write(drawable.GetTimeScale());
+        // write the params in name order so that the same state
+        // always produces the same bytes regardless of the map order.
+        const auto& params = drawable.GetMaterialParams();
+        std::vector<const std::string*> names;
+        for (const auto& param : params)
+            names.push_back(&param.first);
+        std::sort(names.begin(), names.end(), [](const std::string* lhs, const std::string* rhs) {
+            return *lhs < *rhs;
+        });
+        out.Write(static_cast<std::uint32_t>(names.size()));
+        for (const auto* name : names)
+        {
+            out.Write(*name);
+            WriteSnapshotMaterialParam(out, params.find(*name)->second);
+        }
+    }
+    if (mRigidBody)
+    {
+        out.WriteFlags<RigidBodyItem::Flags>(*mRigidBody);
+        out.Write(mRigidBody->GetLinearVelocity());
+        out.Write(mRigidBody->GetAngularVelocity());
+        out.Write(static_cast<std::uint32_t>(mRigidBody->GetCollisionCategory()));
+        out.Write(static_cast<std::uint32_t>(mRigidBody->GetCollisionMask()));
+    }
+    if (mTextItem)
+    {
+        out.WriteFlags<TextItem::Flags>(*mTextItem);
+        out.Write(mTextItem->GetText());
+        out.Write(mTextItem->GetTextColor());
+    }
+}
+
+bool EntityNode::RestoreState(SnapshotReader& in)
+{
+    std::uint8_t items = 0;
+    in.Read(&mInstId);
+    in.Read(&mName);
+    in.Read(&mPosition);
+    in.Read(&mScale);
+    in.Read(&mSize);
+    in.Read(&mRotation);
+    if (!in.Read(&items))
+        return false;
+    // the items are defined by the class so these must match.
+    if (!!(items & 0x1) != HasDrawable() ||
+        !!(items & 0x2) != HasRigidBody() ||
+        !!(items & 0x4) != HasTextItem())
+        return false;
+
+    if (mDrawable)
+    {
+        float time_scale = 1.0f;
+        std::uint32_t num_params = 0;
+        in.ReadFlags<DrawableItem::Flags>(*mDrawable);
+        in.Read(&time_scale);
+        if (!in.Read(&num_params))
+            return false;
+        mDrawable->SetTimeScale(time_scale);
+
+        std::vector<std::string> old_params;
+        for (const auto& param : static_cast<const DrawableItem&>(*mDrawable).GetMaterialParams())
+            old_params.push_back(param.first);
+        for (const auto& name : old_params)
+            mDrawable->DeleteMaterialParam(name);
+
+        for (std::uint32_t i=0; i<num_params; ++i)
+        {
+            std::string name;
+            std::uint8_t index = 0;
+            MaterialParam value;
+            if (!in.Read(&name) || !in.Read(&index) || !ReadSnapshotMaterialParam(in, index, &value))
+                return false;
+            mDrawable->SetMaterialParam(name, value);
+        }
+    }
+    if (mRigidBody)
+    {
+        glm::vec2 linear_velocity;
+        float angular_velocity = 0.0f;
+        std::uint32_t category = 0;
+        std::uint32_t mask = 0;
+        in.ReadFlags<RigidBodyItem::Flags>(*mRigidBody);
+        in.Read(&linear_velocity);
+        in.Read(&angular_velocity);
+        in.Read(&category);
+        if (!in.Read(&mask))
+            return false;
+        mRigidBody->SetLinearVelocity(linear_velocity);
+        mRigidBody->SetAngularVelocity(angular_velocity);
+        mRigidBody->SetCollisionCategory(category);
+        mRigidBody->SetCollisionMask(mask);
+    }
+    if (mTextItem)
+    {
+        std::string text;
+        Color4f color;
+        in.ReadFlags<TextItem::Flags>(*mTextItem);
+        in.Read(&text);
+        if (!in.Read(&color))
+            return false;
+        mTextItem->SetText(std::move(text));
+        mTextItem->SetTextColor(color);
+    }
+    return in.IsGood();
+}
+
 EntityClass::EntityClass(const EntityClass& other)
 {
     mClassId = other.mClassId;
@@ -558,16 +722,19 @@ EntityClass::EntityClass(const EntityClass& other)
 
 EntityNodeClass* EntityClass::AddNode(const EntityNodeClass& node)
 {
+    mTemplate.reset();
     mNodes.emplace_back(new EntityNodeClass(node));
     return mNodes.back().get();
 }
 EntityNodeClass* EntityClass::AddNode(EntityNodeClass&& node)
 {
+    mTemplate.reset();
     mNodes.emplace_back(new EntityNodeClass(std::move(node)));
     return mNodes.back().get();
 }
 EntityNodeClass* EntityClass::AddNode(std::unique_ptr<EntityNodeClass> node)
 {
+    mTemplate.reset();
     mNodes.push_back(std::move(node));
     return mNodes.back().get();
 }
@@ -686,21 +853,25 @@ const AnimationTrackClass* EntityClass::FindAnimationTrackByName(const std::stri
 
 void EntityClass::LinkChild(EntityNodeClass* parent, EntityNodeClass* child)
 {
+    mTemplate.reset();
     game::LinkChild(mRenderTree, parent, child);
 }
 
 void EntityClass::BreakChild(EntityNodeClass* child, bool keep_world_transform)
 {
+    mTemplate.reset();
     game::BreakChild(mRenderTree, child, keep_world_transform);
 }
 
 void EntityClass::ReparentChild(EntityNodeClass* parent, EntityNodeClass* child, bool keep_world_transform)
 {
+    mTemplate.reset();
     game::ReparentChild(mRenderTree, parent, child, keep_world_transform);
 }
 
 void EntityClass::DeleteNode(EntityNodeClass* node)
 {
+    mTemplate.reset();
     game::DeleteNode(mRenderTree, node, mNodes);
 }
 
@@ -708,6 +879,7 @@ EntityNodeClass* EntityClass::DuplicateNode(const EntityNodeClass* node)
 {
     std::vector<std::unique_ptr<EntityNodeClass>> clones;
 
+    mTemplate.reset();
     auto* ret = game::DuplicateNode(mRenderTree, node, &clones);
     for (auto& clone : clones)
         mNodes.push_back(std::move(clone));
@@ -717,11 +889,13 @@ EntityNodeClass* EntityClass::DuplicateNode(const EntityNodeClass* node)
 
 void EntityClass::CoarseHitTest(float x, float y, std::vector<EntityNodeClass*>* hits, std::vector<glm::vec2>* hitbox_positions)
 {
-    game::CoarseHitTest(mRenderTree, x, y, hits, hitbox_positions);
+    mBoundsCache.Update(mRenderTree);
+    mBoundsCache.CoarseHitTest(x, y, hits, hitbox_positions);
 }
 void EntityClass::CoarseHitTest(float x, float y, std::vector<const EntityNodeClass*>* hits, std::vector<glm::vec2>* hitbox_positions) const
 {
-    game::CoarseHitTest(mRenderTree, x, y, hits, hitbox_positions);
+    mBoundsCache.Update(mRenderTree);
+    mBoundsCache.CoarseHitTest(x, y, hits, hitbox_positions);
 }
 glm::vec2 EntityClass::MapCoordsFromNodeModel(float x, float y, const EntityNodeClass* node) const
 {
@@ -737,7 +911,8 @@ FRect EntityClass::FindNodeBoundingRect(const EntityNodeClass* node) const
 }
 FRect EntityClass::GetBoundingRect() const
 {
-    return game::GetBoundingRect(mRenderTree);
+    mBoundsCache.Update(mRenderTree);
+    return mBoundsCache.GetBoundingRect();
 }
 
 FBox EntityClass::FindNodeBoundingBox(const EntityNodeClass* node) const
@@ -969,28 +1144,58 @@ EntityClass& EntityClass::operator=(const EntityClass& other)
     mLifetime    = tmp.mLifetime;
     mRenderTree  = tmp.mRenderTree;
     mAnimationTracks = std::move(tmp.mAnimationTracks);
+    mTemplate.reset();
+    mBoundsCache.Invalidate();
     return *this;
 }
 
+const EntityClass::InstanceTemplate& EntityClass::GetInstanceTemplate() const
+{
+    if (mTemplate)
+        return *mTemplate;
+
+    std::unordered_map<const EntityNodeClass*, int> index;
+    for (size_t i=0; i<mNodes.size(); ++i)
+        index[mNodes[i].get()] = static_cast<int>(i);
+
+    // walk the tree in pre-order so that the children get
+    // linked in the same order as they're in the class.
+    auto temp = std::make_unique<InstanceTemplate>();
+    temp->links.reserve(mNodes.size());
+    mRenderTree.PreOrderTraverseForEach([&](const EntityNodeClass* node) {
+        // skip the root.
+        if (node == nullptr)
+            return;
+        const auto* parent = mRenderTree.GetParent(node);
+        InstanceTemplate::Link link;
+        link.parent = parent ? index[parent] : -1;
+        link.child  = index[node];
+        temp->links.push_back(link);
+    });
+    mTemplate = std::move(temp);
+    return *mTemplate;
+}
+
 Entity::Entity(std::shared_ptr<const EntityClass> klass)
     : mClass(klass)
 {
-    std::unordered_map<const EntityNodeClass*, const EntityNode*> map;
-
-    // build render tree, first create instances of all node classes
-    // then build the render tree based on the node instances
-    for (size_t i=0; i<mClass->GetNumNodes(); ++i)
+    // create the node instances in the same order as the class nodes
+    // and then link them based on the flattened class hierarchy.
+    // this avoids having to map each node class to its instance
+    // and walking the class render tree for every new entity.
+    const auto& temp = mClass->GetInstanceTemplate();
+    const auto num_nodes = mClass->GetNumNodes();
+    mNodes.reserve(num_nodes);
+    for (size_t i=0; i<num_nodes; ++i)
+        mNodes.push_back(CreateEntityNodeInstance(mClass->GetSharedEntityNodeClass(i)));
+
+    mRenderTree.Reserve(num_nodes);
+    for (const auto& link : temp.links)
     {
-        auto node_klass = mClass->GetSharedEntityNodeClass(i);
-        auto node_inst  = CreateEntityNodeInstance(node_klass);
-        map[node_klass.get()] = node_inst.get();
-        mNodes.push_back(std::move(node_inst));
+        const EntityNode* parent = link.parent >= 0 ? mNodes[link.parent].get() : nullptr;
+        mRenderTree.LinkChild(parent, mNodes[link.child].get());
     }
 
-    mRenderTree.FromTree(mClass->GetRenderTree(), [&map](const EntityNodeClass* node) {
-            return map[node];
-        });
-
     // assign the script variables.
     for (size_t i=0; i<klass->GetNumScriptVars(); ++i)
     {
@@ -999,7 +1204,7 @@ Entity::Entity(std::shared_ptr<const EntityClass> klass)
             mScriptVars.push_back(*var);
     }
 
-    mInstanceId  = base::RandomString(10);
+    mInstanceId  = base::RandomInstanceId(10);
     mIdleTrackId = mClass->GetIdleTrackId();
     mFlags       = mClass->GetFlags();
     mLifetime    = mClass->GetLifetime();
@@ -1125,12 +1330,14 @@ void Entity::DeleteNode(EntityNode* node)
 
 void Entity::CoarseHitTest(float x, float y, std::vector<EntityNode*>* hits, std::vector<glm::vec2>* hitbox_positions)
 {
-    game::CoarseHitTest(mRenderTree, x, y, hits, hitbox_positions);
+    mBoundsCache.Update(mRenderTree);
+    mBoundsCache.CoarseHitTest(x, y, hits, hitbox_positions);
 }
 
 void Entity::CoarseHitTest(float x, float y, std::vector<const EntityNode*>* hits, std::vector<glm::vec2>* hitbox_positions) const
 {
-    game::CoarseHitTest(mRenderTree, x, y, hits, hitbox_positions);
+    mBoundsCache.Update(mRenderTree);
+    mBoundsCache.CoarseHitTest(x, y, hits, hitbox_positions);
 }
 
 glm::vec2 Entity::MapCoordsFromNodeModel(float x, float y, const EntityNode* node) const
@@ -1159,7 +1366,8 @@ FRect Entity::FindNodeBoundingRect(const EntityNode* node) const
 
 FRect Entity::GetBoundingRect() const
 {
-    return game::GetBoundingRect(mRenderTree);
+    mBoundsCache.Update(mRenderTree);
+    return mBoundsCache.GetBoundingRect();
 }
 
 FBox Entity::FindNodeBoundingBox(const EntityNode* node) const
@@ -1263,6 +1471,8 @@ bool Entity::HasBeenKilled() const
 
 bool Entity::HasBeenSpawned() const
 { return TestFlag(ControlFlags::Spawned); }
+bool Entity::HasBeenStreamed() const
+{ return TestFlag(ControlFlags::Streamed); }
 
 const ScriptVar* Entity::FindScriptVar(const std::string& name) const
 {
@@ -1275,6 +1485,161 @@ const ScriptVar* Entity::FindScriptVar(const std::string& name) const
     return mClass->FindScriptVar(name);
 }
 
+void Entity::SaveState(SnapshotWriter& out) const
+{
+    out.Write(mParentNodeId);
+    out.Write(mIdleTrackId);
+    out.Write(static_cast<std::int32_t>(mLayer));
+    out.Write(mLifetime);
+    out.Write(mCurrentTime);
+    out.WriteFlags<Flags>(*this);
+    out.WriteFlags<ControlFlags>(*this);
+
+    out.Write(static_cast<std::uint32_t>(mScriptVars.size()));
+    for (const auto& var : mScriptVars)
+        out.Write(var);
+
+    std::unordered_map<const EntityNode*, std::int32_t> index;
+    index.reserve(mNodes.size());
+    out.Write(static_cast<std::uint32_t>(mNodes.size()));
+    for (size_t i=0; i<mNodes.size(); ++i)
+    {
+        const auto& node = mNodes[i];
+        index[node.get()] = static_cast<std::int32_t>(i);
+        out.Write(node->GetClassId());
+        node->SaveState(out);
+    }
+
+    // write the links in pre-order so that the children end up
+    // in the same order under their parents when restoring.
+    out.Write(static_cast<std::uint32_t>(mRenderTree.GetNumNodes()));
+    mRenderTree.PreOrderTraverseForEach([&](const EntityNode* node) {
+        if (!node)
+            return;
+        const auto* parent = mRenderTree.GetParent(node);
+        out.Write(index[node]);
+        out.Write(parent ? index[parent] : std::int32_t(-1));
+    });
+
+    // only tracks that are part of the class can be restored.
+    const AnimationTrackClass* track = nullptr;
+    if (mAnimationTrack)
+    {
+        for (size_t i=0; i<mClass->GetNumTracks(); ++i)
+        {
+            const auto& klass = mClass->GetAnimationTrack(i);
+            if (klass.GetId() != mAnimationTrack->GetClass().GetId())
+                continue;
+            track = &klass;
+            break;
+        }
+    }
+    out.Write(static_cast<std::uint8_t>(track ? 1 : 0));
+    if (track)
+    {
+        out.Write(track->GetId());
+        mAnimationTrack->SaveState(out);
+    }
+}
+
+bool Entity::RestoreState(SnapshotReader& in)
+{
+    std::int32_t layer = 0;
+    in.Read(&mParentNodeId);
+    in.Read(&mIdleTrackId);
+    in.Read(&layer);
+    in.Read(&mLifetime);
+    in.Read(&mCurrentTime);
+    in.ReadFlags<Flags>(*this);
+    in.ReadFlags<ControlFlags>(*this);
+    mLayer = layer;
+
+    std::uint32_t num_vars = 0;
+    if (!in.Read(&num_vars) || num_vars != mScriptVars.size())
+        return false;
+    for (const auto& var : mScriptVars)
+    {
+        if (!in.Read(var))
+            return false;
+    }
+
+    // reuse the nodes that were created based on the class when
+    // they match with the snapshot which should be the usual case
+    // unless nodes have been added or deleted at runtime.
+    std::uint32_t num_nodes = 0;
+    if (!in.Read(&num_nodes))
+        return false;
+    std::vector<std::unique_ptr<EntityNode>> nodes;
+    nodes.reserve(num_nodes);
+    for (std::uint32_t i=0; i<num_nodes; ++i)
+    {
+        std::string class_id;
+        if (!in.Read(&class_id))
+            return false;
+        std::unique_ptr<EntityNode> node;
+        if (i < mNodes.size() && mNodes[i]->GetClassId() == class_id)
+            node = std::move(mNodes[i]);
+        else
+        {
+            for (size_t j=0; j<mClass->GetNumNodes(); ++j)
+            {
+                auto klass = mClass->GetSharedEntityNodeClass(j);
+                if (klass->GetId() != class_id)
+                    continue;
+                node = CreateEntityNodeInstance(klass);
+                break;
+            }
+        }
+        if (!node || !node->RestoreState(in))
+            return false;
+        nodes.push_back(std::move(node));
+    }
+    mNodes = std::move(nodes);
+
+    std::uint32_t num_links = 0;
+    if (!in.Read(&num_links))
+        return false;
+    mRenderTree.Clear();
+    mRenderTree.Reserve(num_links);
+    for (std::uint32_t i=0; i<num_links; ++i)
+    {
+        std::int32_t child  = 0;
+        std::int32_t parent = 0;
+        if (!in.Read(&child) || !in.Read(&parent))
+            return false;
+        if (child < 0 || child >= static_cast<std::int32_t>(mNodes.size()) ||
+            parent < -1 || parent >= static_cast<std::int32_t>(mNodes.size()))
+            return false;
+        const EntityNode* child_node  = mNodes[child].get();
+        const EntityNode* parent_node = parent >= 0 ? mNodes[parent].get() : nullptr;
+        if (mRenderTree.HasNode(child_node))
+            return false;
+        mRenderTree.LinkChild(parent_node, child_node);
+    }
+
+    std::uint8_t has_track = 0;
+    if (!in.Read(&has_track))
+        return false;
+    mAnimationTrack.reset();
+    if (has_track)
+    {
+        std::string track_id;
+        if (!in.Read(&track_id))
+            return false;
+        for (size_t i=0; i<mClass->GetNumTracks(); ++i)
+        {
+            const auto& klass = mClass->GetSharedAnimationTrackClass(i);
+            if (klass->GetId() != track_id)
+                continue;
+            mAnimationTrack = std::make_unique<AnimationTrack>(klass);
+            break;
+        }
+        if (!mAnimationTrack || !mAnimationTrack->RestoreState(in))
+            return false;
+    }
+    return in.IsGood();
+}
+
 std::unique_ptr<Entity> CreateEntityInstance(std::shared_ptr<const EntityClass> klass)
 { return std::make_unique<Entity>(klass); }
 
@@ -38,6 +38,7 @@
 #include "base/hash.h"
 #include "data/fwd.h"
 #include "engine/tree.h"
+#include "engine/treeop.h"
 #include "engine/types.h"
 #include "engine/enum.h"
 #include "engine/animation.h"
@@ -45,6 +46,8 @@
 
 namespace game
 {
+    class SnapshotWriter;
+    class SnapshotReader;
     class RigidBodyItemClass
     {
     public:
@@ -143,6 +146,10 @@ namespace game
         { mPolygonShapeId.clear(); }
         base::bitflag<Flags> GetFlags() const
         { return mBitFlags; }
+        unsigned GetCollisionCategory() const
+        { return mCollisionCategory; }
+        unsigned GetCollisionMask() const
+        { return mCollisionMask; }
 
         void SetCollisionShape(CollisionShape shape)
         { mCollisionShape = shape; }
@@ -166,6 +173,14 @@ namespace game
         { mPolygonShapeId = id; }
         void SetLinearVelocity(const glm::vec2& velocity)
         { mLinearVelocity = velocity; }
+        // Set the collision category (layer) bits for this body.
+        // Only the lower 16 bits are used.
+        void SetCollisionCategory(unsigned bits)
+        { mCollisionCategory = bits & 0xffff; }
+        // Set the mask of collision categories that this body
+        // will collide with. Only the lower 16 bits are used.
+        void SetCollisionMask(unsigned bits)
+        { mCollisionMask = bits & 0xffff; }
 
         void IntoJson(data::Writer& data) const;
 
@@ -186,6 +201,12 @@ namespace game
         // Initial angular velocity of rotation around the
         // center of mass. Pertains to kinematic bodies.
         float mAngularVelocity = 0.0f;
+        // Collision filtering. Two bodies can collide only when
+        // each body's category bits are included in the other
+        // body's mask bits. By default everything is in the first
+        // category and collides with everything.
+        unsigned mCollisionCategory = 0x0001;
+        unsigned mCollisionMask     = 0xffff;
     };
 
     // Drawable item defines a drawable item and its material and
@@ -511,6 +532,8 @@ namespace game
             mLinearVelocity = mClass->GetLinearVelocity();
             mAngularVelocity = mClass->GetAngularVelocity();
             mInstanceFlags = mClass->GetFlags();
+            mCollisionCategory = mClass->GetCollisionCategory();
+            mCollisionMask = mClass->GetCollisionMask();
         }
 
         Simulation GetSimulation() const
@@ -531,6 +554,16 @@ namespace game
         { return mInstanceFlags.test(flag); }
         std::string GetPolygonShapeId() const
         { return mClass->GetPolygonShapeId(); }
+        unsigned GetCollisionCategory() const
+        { return mCollisionCategory; }
+        unsigned GetCollisionMask() const
+        { return mCollisionMask; }
+        // Change the collision filtering of this instance. The physics
+        // engine picks up the new bits on the next scene update.
+        void SetCollisionCategory(unsigned bits)
+        { mCollisionCategory = bits & 0xffff; }
+        void SetCollisionMask(unsigned bits)
+        { mCollisionMask = bits & 0xffff; }
 
         // Get the instantaneous current velocities of the
         // rigid body under the simulation.
@@ -574,6 +607,9 @@ namespace game
         float mAngularVelocity = 0.0f;
         // Flags specific to this instance.
         base::bitflag<Flags> mInstanceFlags;
+        // Collision filtering bits of this instance.
+        unsigned mCollisionCategory = 0x0001;
+        unsigned mCollisionMask     = 0xffff;
     };
 
     class TextItem
@@ -901,6 +937,14 @@ namespace game
         // and rigid bodies.
         glm::mat4 GetModelTransform() const;
 
+        // Save the node's instance state (transform and the state
+        // of its items) into a snapshot.
+        void SaveState(SnapshotWriter& out) const;
+        // Restore the node's instance state from a snapshot that was
+        // saved from a node of the same class. Returns false if the
+        // snapshot data is not valid.
+        bool RestoreState(SnapshotReader& in);
+
         const EntityNodeClass& GetClass() const
         { return *mClass.get(); }
         const EntityNodeClass* operator->() const
@@ -1141,7 +1185,11 @@ namespace game
         { return mFlags.test(flag); }
 
         RenderTree& GetRenderTree()
-        { return mRenderTree; }
+        {
+            // the caller could change the hierarchy.
+            mTemplate.reset();
+            return mRenderTree;
+        }
         const RenderTree& GetRenderTree() const
         { return mRenderTree; }
 
@@ -1172,6 +1220,24 @@ namespace game
         std::shared_ptr<const ScriptVar> GetSharedScriptVar(size_t index) const
         { return mScriptVars[index]; }
 
+        // Flattened version of the node hierarchy for creating entity
+        // instances quickly. Nodes are referred to by their index
+        // in the entity class' node list.
+        struct InstanceTemplate {
+            struct Link {
+                // index of the parent node or -1 for the root.
+                int parent = -1;
+                // index of the child node.
+                int child = 0;
+            };
+            // the render tree links in the order that produces the
+            // same order of children as in the class render tree.
+            std::vector<Link> links;
+        };
+        // Get the instance template. The template is built when first
+        // needed and then discarded whenever the node hierarchy changes.
+        const InstanceTemplate& GetInstanceTemplate() const;
+
         // Serialize the entity into JSON.
         void IntoJson(data::Writer& data) const;
 
@@ -1206,6 +1272,10 @@ namespace game
         // maximum lifetime after which the entity is
         // deleted if LimitLifetime flag is set.
         float mLifetime = 0.0f;
+        // lazily built instance template if any.
+        mutable std::unique_ptr<InstanceTemplate> mTemplate;
+        // lazily updated node bounds for hit testing.
+        mutable RenderTreeBoundsCache<EntityNodeClass> mBoundsCache;
     };
 
     // Collection of arguments for creating a new entity
@@ -1233,7 +1303,7 @@ namespace game
         // the entity rotation relative to parent
         float      rotation = 0.0f;
         EntityArgs() {
-            id = base::RandomString(10);
+            id = base::RandomInstanceId(10);
         }
     };
 
@@ -1250,7 +1320,12 @@ namespace game
             // cleared at the end of the main loop iteration
             // and is thus on only from spawn until the end of
             // loop iteration.
-            Spawned
+            Spawned,
+            // The entity has been just created or removed by
+            // scene streaming (together with the spawn or kill
+            // flag) instead of the game. Cleared at the end of
+            // the main loop iteration like the spawn flag.
+            Streamed
         };
         using Flags = EntityClass::Flags;
 
@@ -1376,6 +1451,19 @@ namespace game
         bool HasBeenKilled() const;
         // Returns true the spawn control flag has been set.
         bool HasBeenSpawned() const;
+        // Returns true if the streamed control flag has been set.
+        bool HasBeenStreamed() const;
+
+        // Save the entity's instance state, i.e. the nodes, the node
+        // hierarchy, script variables and the current animation into
+        // a snapshot. The class, instance id and name are not included
+        // since they're needed to create the entity in the first place.
+        void SaveState(SnapshotWriter& out) const;
+        // Restore the entity's instance state from a snapshot that was
+        // saved from an entity of the same class. Returns false if the
+        // snapshot data is not valid in which case the entity is left
+        // in a partially restored state and should be discarded.
+        bool RestoreState(SnapshotReader& in);
 
         // Find a scripting variable.
         // Returns nullptr if there was no variable by this name.
@@ -1472,6 +1560,8 @@ namespace game
         std::string mIdleTrackId;
         // control flags for the engine itself
         base::bitflag<ControlFlags> mControlFlags;
+        // lazily updated node bounds for hit testing.
+        mutable RenderTreeBoundsCache<EntityNode> mBoundsCache;
     };
 
     std::unique_ptr<Entity> CreateEntityInstance(std::shared_ptr<const EntityClass> klass);
@@ -48,7 +48,7 @@ namespace game
 
         virtual ~Game() = default;
         // Set physics engine instance.
-        virtual void SetPhysicsEngine(const PhysicsEngine* engine) = 0;
+        virtual void SetPhysicsEngine(PhysicsEngine* engine) = 0;
         // Load the game. This is called once by the engine after the
         // application has started. In the implementation you should
         // start with some initial game state and possibly request some
@@ -101,6 +101,13 @@ namespace game
         // an empty viewport (width and height are 0) *nothing* will be shown.
         virtual FRect GetViewport() const = 0;
 
+        // Check whether any of the game's script files have changed
+        // since they were loaded and if so recompile them without
+        // restarting the game. This is a development aid and the
+        // engine will only call this when so configured.
+        virtual void ReloadChangedScripts()
+        {}
+
         // Event listeners.
         virtual void OnUIOpen(uik::Window* ui)
         {}
@@ -28,7 +28,10 @@
 #include "warnpop.h"
 
 #include <unordered_set>
+#include <algorithm>
+#include <cmath>
 #include <random>
+#include <optional>
 
 #include "base/assert.h"
 #include "base/logging.h"
@@ -315,11 +318,38 @@ private:
 };
 boost::random::mt19937 RandomEngine::mTwister;
 
+// the seed for the Lua math.random generator in every new Lua state
+// when the random generators have been seeded explicitly.
+std::optional<unsigned> LuaRandomSeed;
+
+void SeedStateRandom(sol::state& L)
+{
+    if (!LuaRandomSeed.has_value())
+        return;
+    L["math"]["randomseed"](LuaRandomSeed.value());
+}
+
 } // namespace
 
 namespace game
 {
 
+// the amount of game time covered by each timer wheel slot.
+static constexpr double TimerWheelResolution = 1.0 / 60.0;
+// the number of slots in the timer wheel. timers that expire further
+// in the future than one full rotation will just stay in their slot
+// for multiple rotations.
+static constexpr unsigned TimerWheelSize = 256;
+
+struct ScriptEngine::Coroutine {
+    // the id of the entity instance that owns the coroutine
+    // or empty if the coroutine isn't owned by any entity.
+    std::string owner;
+    // the Lua thread on which the coroutine is run.
+    sol::thread thread;
+    sol::coroutine routine;
+};
+
 LuaGame::LuaGame(std::shared_ptr<sol::state> state)
   : mLuaState(state)
 { }
@@ -329,6 +359,7 @@ LuaGame::LuaGame(const std::string& lua_path)
     mLuaState = std::make_shared<sol::state>();
     // todo: should this specify which libraries to load?
     mLuaState->open_libraries();
+    SeedStateRandom(*mLuaState);
     // ? is a wildcard (usually denoted by kleene star *)
     // todo: setup a package loader instead of messing with the path?
     // https://github.com/ThePhD/sol2/issues/90
@@ -353,12 +384,14 @@ LuaGame::LuaGame(const std::string& lua_path)
     };
 
     // todo: maybe this needs some configuring or whatever?
-    mLuaState->script_file(lua_path + "/game.lua");
+    mGameScript = base::JoinPath(lua_path, "game.lua");
+    mGameScriptTime = base::GetFileModificationTime(mGameScript);
+    mLuaState->script_file(mGameScript);
 }
 
 LuaGame::~LuaGame() = default;
 
-void LuaGame::SetPhysicsEngine(const PhysicsEngine* engine)
+void LuaGame::SetPhysicsEngine(PhysicsEngine* engine)
 {
     mPhysicsEngine = engine;
 }
@@ -474,9 +507,36 @@ void LuaGame::OnMousePress(const wdk::WindowEventMousePress& mouse)
 void LuaGame::OnMouseRelease(const wdk::WindowEventMouseRelease& mouse)
 {
 }
+void LuaGame::ReloadChangedScripts()
+{
+    if (mGameScript.empty())
+        return;
+    // the file might be (temporarily) missing while some editor
+    // is writing it out. just try again later.
+    const auto time = base::GetFileModificationTime(mGameScript);
+    if (time == 0 || time == mGameScriptTime)
+        return;
+    mGameScriptTime = time;
+
+    // re-run the game script in the global environment. this will
+    // replace the callback functions with the new versions while any
+    // global game state lives on unless the script explicitly resets it
+    // at the top level. Modules that are loaded with require are cached
+    // by Lua and are not reloaded.
+    auto result = mLuaState->safe_script_file(mGameScript, sol::script_pass_on_error);
+    if (!result.valid())
+    {
+        const sol::error err = result;
+        ERROR("Failed to reload game script '%1'. %2", mGameScript, err.what());
+        return;
+    }
+    INFO("Reloaded game script '%1'.", mGameScript);
+}
 
 ScriptEngine::ScriptEngine(const std::string& lua_path) : mLuaPath(lua_path)
-{}
+{
+    mTimerWheel.resize(TimerWheelSize);
+}
 
 ScriptEngine::~ScriptEngine() = default;
 
@@ -487,6 +547,7 @@ void ScriptEngine::BeginPlay(Scene* scene)
 
     auto state = std::make_unique<sol::state>();
     state->open_libraries();
+    SeedStateRandom(*state);
     // ? is a wildcard (usually denoted by kleene star *)
     // todo: setup a package loader instead of messing with the path?
     // https://github.com/ThePhD/sol2/issues/90
@@ -502,15 +563,22 @@ void ScriptEngine::BeginPlay(Scene* scene)
     BindWDK(*state);
     BindGameLib(*state);
 
-    // table that maps entity types to their scripting
-    // environments. then we later invoke the script per
+    // careful here, make sure to clean up the environment objects
+    // and coroutines first since they depend on lua state. changing
+    // the order of these lines will crash.
+    ClearCoroutines();
+    mTypeEnvs.clear();
+    mTypeScripts.clear();
+    mLuaState = std::move(state);
+
+    // create the scripting environments for the entity types.
+    // then we later invoke the script per
     // each instance's type on each instance of that type.
     // In other words if there's an EntityClass 'foobar'
     // it has a "foobar.lua" script and there are 2 entities
     // a and b, the same script foobar.lua will be invoked
     // for a total of two times (per script function), once
     // per each instance.
-    std::unordered_map<std::string, std::unique_ptr<sol::environment>> envs;
     std::unordered_set<std::string> ids;
 
     for (size_t i=0; i<scene->GetNumEntities(); ++i)
@@ -522,24 +590,15 @@ void ScriptEngine::BeginPlay(Scene* scene)
         ids.insert(klass.GetId());
         if (!klass.HasScriptFile())
             continue;
-        else if (envs.find(klass.GetId()) != envs.end())
-            continue;
         const auto& script = klass.GetScriptFileId();
         const auto& file = base::JoinPath(mLuaPath, script + ".lua");
         if (!base::FileExists(file)) {
             ERROR("Entity '%1' Lua file '%2' was not found.", klass.GetName(), file);
             continue;
         }
-        auto env = std::make_unique<sol::environment>(*state, sol::create, state->globals());
-        state->script_file(file, *env);
-        envs[klass.GetId()] = std::move(env);
+        LoadTypeEnv(klass);
         DEBUG("Entity class '%1' script loaded.", klass.GetName());
     }
-    // careful here, make sure to clean up the environment objects
-    // first since they depend on lua state. changing the order
-    // of these two lines will crash.
-    mTypeEnvs = std::move(envs);
-    mLuaState = std::move(state);
 
     mScene    = scene;
     (*mLuaState)["Physics"]  = mPhysicsEngine;
@@ -549,6 +608,26 @@ void ScriptEngine::BeginPlay(Scene* scene)
     auto table = (*mLuaState)["game"].get_or_create<sol::table>();
     auto engine = table.new_usertype<ScriptEngine>("Engine");
     BindEngine(engine, *this);
+    engine["StartCoroutine"] = sol::overload(
+        [](ScriptEngine& self, sol::function func) {
+            self.StartCoroutine("", func);
+        },
+        [](ScriptEngine& self, Entity* owner, sol::function func) {
+            if (owner == nullptr)
+                throw std::runtime_error("Nil coroutine owner entity.");
+            self.StartCoroutine(owner->GetId(), func);
+        });
+    // the waits are plain yields from the currently running coroutine.
+    // the engine looks at the yielded value when the coroutine suspends
+    // in order to figure out when to resume it again.
+    mLuaState->script(R"(
+function game.Wait(seconds)
+    return coroutine.yield(seconds)
+end
+function game.WaitUntilAnimationDone(entity)
+    return coroutine.yield(entity)
+end
+)");
 
     for (size_t i=0; i<scene->GetNumEntities(); ++i)
     {
@@ -565,7 +644,9 @@ void ScriptEngine::BeginPlay(Scene* scene)
 
 void ScriptEngine::EndPlay(Scene* scene)
 {
+    ClearCoroutines();
     mTypeEnvs.clear();
+    mTypeScripts.clear();
     mScene = nullptr;
     (*mLuaState)["Scene"] = nullptr;
 }
@@ -595,6 +676,7 @@ void ScriptEngine::Update(double game_time, double dt)
             CallLua((*env)["Update"], entity, game_time, dt);
         }
     }
+    UpdateCoroutines(game_time);
 }
 void ScriptEngine::BeginLoop()
 {
@@ -627,6 +709,9 @@ void ScriptEngine::EndLoop()
          {
              CallLua((*env)["EndPlay"], entity, mScene);
          }
+         // any coroutines started for the entity must die with it
+         // since they'd be referring to the deleted entity.
+         DeleteCoroutines(entity->GetId());
      }
 }
 
@@ -719,6 +804,178 @@ void ScriptEngine::OnMouseRelease(const wdk::WindowEventMouseRelease& mouse)
 
 }
 
+void ScriptEngine::ReloadChangedScripts()
+{
+    for (auto& pair : mTypeScripts)
+    {
+        auto& script = pair.second;
+        // the file might be (temporarily) missing while some editor
+        // is writing it out. just try again later.
+        const auto time = base::GetFileModificationTime(script.file);
+        if (time == 0 || time == script.time)
+            continue;
+        script.time = time;
+
+        // re-run the script inside the existing environment object.
+        // the script functions are replaced with the new versions but
+        // the environment itself stays the same so nothing that refers
+        // to it is invalidated and the entity instance state (script vars)
+        // is not touched at all. If the new script fails to compile the
+        // previous functions are (mostly) left in place.
+        auto* env = mTypeEnvs[pair.first].get();
+        auto result = mLuaState->safe_script_file(script.file, *env, sol::script_pass_on_error);
+        if (!result.valid())
+        {
+            const sol::error err = result;
+            ERROR("Failed to reload entity script '%1'. %2", script.file, err.what());
+            continue;
+        }
+        INFO("Reloaded entity script '%1'.", script.file);
+    }
+}
+
+void ScriptEngine::StartCoroutine(const std::string& owner, const sol::function& func)
+{
+    auto co = std::make_unique<Coroutine>();
+    co->owner   = owner;
+    co->thread  = sol::thread::create(*mLuaState);
+    co->routine = sol::coroutine(co->thread.state(), func);
+    const auto id = ++mCoroutineId;
+    mCoroutines[id] = std::move(co);
+    // run the coroutine immediately up to its first wait.
+    ResumeCoroutine(id, sol::nil);
+}
+
+void ScriptEngine::ResumeCoroutine(unsigned id, const sol::object& value)
+{
+    auto it = mCoroutines.find(id);
+    // the coroutine might have been deleted while it was
+    // waiting, for example when the owning entity was killed.
+    if (it == mCoroutines.end())
+        return;
+
+    auto& routine = it->second->routine;
+    sol::protected_function_result result = routine(value);
+    if (!result.valid())
+    {
+        const sol::error err = result;
+        ERROR(err.what());
+        mCoroutines.erase(id);
+        return;
+    }
+    // coroutine has run to completion.
+    if (routine.status() != sol::call_status::yielded)
+    {
+        mCoroutines.erase(id);
+        return;
+    }
+    // figure out what the coroutine is now waiting on.
+    const sol::object what = result;
+    if (what.get_type() == sol::type::number)
+    {
+        ScheduleCoroutine(id, what.as<double>());
+        return;
+    }
+    // careful here, nil also passes as a (null) Entity* in sol2.
+    if (what.get_type() == sol::type::userdata && what.is<Entity*>())
+    {
+        if (const auto* entity = what.as<Entity*>())
+        {
+            AnimationWait wait;
+            wait.entity    = entity->GetId();
+            wait.coroutine = id;
+            mAnimationWaits.push_back(std::move(wait));
+            return;
+        }
+    }
+    WARN("Coroutine yielded unsupported value. Use game.Wait or game.WaitUntilAnimationDone.");
+    mCoroutines.erase(id);
+}
+
+void ScriptEngine::ScheduleCoroutine(unsigned id, double seconds)
+{
+    Timer timer;
+    timer.time      = mGameTime + std::max(seconds, 0.0);
+    timer.coroutine = id;
+    // hash into the first slot that begins at or after the expiry time
+    // so that when the slot is processed the timer has expired unless
+    // it's still waiting for some later rotation of the wheel.
+    auto slot = static_cast<std::uint64_t>(std::ceil(timer.time / TimerWheelResolution));
+    slot = std::max(slot, mTimerWheelPos);
+    mTimerWheel[slot % TimerWheelSize].push_back(timer);
+}
+
+void ScriptEngine::UpdateCoroutines(double game_time)
+{
+    mGameTime = game_time;
+
+    const auto current = static_cast<std::uint64_t>(game_time / TimerWheelResolution);
+    // never need to go around the wheel more than once.
+    if (current >= mTimerWheelPos + TimerWheelSize)
+        mTimerWheelPos = current - TimerWheelSize + 1;
+
+    while (mTimerWheelPos <= current)
+    {
+        // advance the position first so that any timers scheduled
+        // while processing this slot go into the later slots.
+        const auto pos = mTimerWheelPos++;
+        auto& slot = mTimerWheel[pos % TimerWheelSize];
+        if (slot.empty())
+            continue;
+        // resuming the coroutines can schedule new timers so swap
+        // the timers out of the slot before processing them.
+        std::vector<Timer> timers;
+        timers.swap(slot);
+        for (const auto& timer : timers)
+        {
+            // still waiting for some later rotation of the wheel. the
+            // tolerance of one slot is for floating point inaccuracies
+            // when accumulating the game time.
+            if (timer.time > game_time + TimerWheelResolution)
+                slot.push_back(timer);
+            else ResumeCoroutine(timer.coroutine, sol::nil);
+        }
+    }
+
+    if (mAnimationWaits.empty())
+        return;
+
+    std::vector<AnimationWait> waits;
+    waits.swap(mAnimationWaits);
+    for (auto& wait : waits)
+    {
+        if (mCoroutines.find(wait.coroutine) == mCoroutines.end())
+            continue;
+        const auto* entity = mScene->FindEntityByInstanceId(wait.entity);
+        // if the entity is gone resume with false so that the
+        // script knows that the animation didn't actually finish.
+        if (entity == nullptr)
+            ResumeCoroutine(wait.coroutine, sol::make_object(*mLuaState, false));
+        else if (!entity->IsPlaying())
+            ResumeCoroutine(wait.coroutine, sol::make_object(*mLuaState, true));
+        else mAnimationWaits.push_back(std::move(wait));
+    }
+}
+
+void ScriptEngine::DeleteCoroutines(const std::string& owner)
+{
+    for (auto it = mCoroutines.begin(); it != mCoroutines.end();)
+    {
+        if (it->second->owner == owner)
+            it = mCoroutines.erase(it);
+        else ++it;
+    }
+}
+
+void ScriptEngine::ClearCoroutines()
+{
+    mCoroutines.clear();
+    mAnimationWaits.clear();
+    for (auto& slot : mTimerWheel)
+        slot.clear();
+    mTimerWheelPos = 0;
+}
+
 sol::environment* ScriptEngine::GetTypeEnv(const EntityClass& klass)
 {
     if (!klass.HasScriptFile())
@@ -727,15 +984,31 @@ sol::environment* ScriptEngine::GetTypeEnv(const EntityClass& klass)
     auto it = mTypeEnvs.find(klassId);
     if (it != mTypeEnvs.end())
         return it->second.get();
+    return LoadTypeEnv(klass);
+}
 
+sol::environment* ScriptEngine::LoadTypeEnv(const EntityClass& klass)
+{
     const auto& script = klass.GetScriptFileId();
     const auto& file   = base::JoinPath(mLuaPath, script + ".lua");
     if (!base::FileExists(file))
         return nullptr;
+    TypeScript type_script;
+    type_script.file = file;
+    type_script.time = base::GetFileModificationTime(file);
+
     auto env = std::make_unique<sol::environment>(*mLuaState, sol::create, mLuaState->globals());
     mLuaState->script_file(file, *env);
-    it = mTypeEnvs.insert({klassId, std::move(env)}).first;
-    return it->second.get();
+    auto* ret = env.get();
+    mTypeEnvs[klass.GetId()] = std::move(env);
+    mTypeScripts[klass.GetId()] = std::move(type_script);
+    return ret;
+}
+
+void SeedLuaRandom(unsigned seed)
+{
+    RandomEngine::Seed(seed);
+    LuaRandomSeed = seed;
 }
 
 void BindUtil(sol::state& L)
@@ -1094,6 +1367,10 @@ void BindGameLib(sol::state& L)
     body["GetLinearDamping"]   = &RigidBodyItem::GetLinearDamping;
     body["GetDensity"]         = &RigidBodyItem::GetDensity;
     body["GetPolygonShapeId"]  = &RigidBodyItem::GetPolygonShapeId;
+    body["GetCollisionCategory"] = &RigidBodyItem::GetCollisionCategory;
+    body["GetCollisionMask"]     = &RigidBodyItem::GetCollisionMask;
+    body["SetCollisionCategory"] = &RigidBodyItem::SetCollisionCategory;
+    body["SetCollisionMask"]     = &RigidBodyItem::SetCollisionMask;
     body["GetLinearVelocity"]  = &RigidBodyItem::GetLinearVelocity;
     body["GetAngularVelocity"] = &RigidBodyItem::GetAngularVelocity;
     body["SetLinearVelocity"]  = &RigidBodyItem::SetLinearVelocity;
@@ -1152,6 +1429,7 @@ void BindGameLib(sol::state& L)
     entity["SetLayer"]             = &Entity::SetLayer;
     entity["IsPlaying"]            = &Entity::IsPlaying;
     entity["HasExpired"]           = &Entity::HasExpired;
+    entity["HasBeenStreamed"]      = &Entity::HasBeenStreamed;
     entity["GetNode"]              = (EntityNode&(Entity::*)(size_t))&Entity::GetNode;
     entity["FindNodeByClassName"]  = (EntityNode*(Entity::*)(const std::string&))&Entity::FindNodeByClassName;
     entity["FindNodeByClassId"]    = (EntityNode*(Entity::*)(const std::string&))&Entity::FindNodeByClassId;
@@ -1182,10 +1460,19 @@ void BindGameLib(sol::state& L)
     scene["GetTime"]                  = &Scene::GetTime;
     scene["GetClassName"]             = &Scene::GetClassName;
     scene["GetClassId"]               = &Scene::GetClassId;
+    scene["SetStreamingMargins"]      = &Scene::SetStreamingMargins;
+    scene["SetStreamingBudget"]       = &Scene::SetStreamingBudget;
+    scene["GetStreamingLoadMargin"]   = &Scene::GetStreamingLoadMargin;
+    scene["GetStreamingUnloadMargin"] = &Scene::GetStreamingUnloadMargin;
+    scene["GetStreamingBudget"]       = &Scene::GetStreamingBudget;
+    scene["GetNumStreamingCells"]     = &Scene::GetNumStreamingCells;
+    scene["GetNumLoadedStreamingCells"] = &Scene::GetNumLoadedStreamingCells;
 
     auto physics = table.new_usertype<PhysicsEngine>("Physics");
     physics["ApplyImpulseToCenter"] = (void(PhysicsEngine::*)(const std::string&, const glm::vec2&) const)&PhysicsEngine::ApplyImpulseToCenter;
     physics["ApplyImpulseToCenter"] = (void(PhysicsEngine::*)(const EntityNode&, const glm::vec2&) const)&PhysicsEngine::ApplyImpulseToCenter;
+    physics["SubscribeContacts"]         = &PhysicsEngine::SubscribeContacts;
+    physics["ClearContactSubscriptions"] = &PhysicsEngine::ClearContactSubscriptions;
 
 }
 
@@ -23,8 +23,11 @@
 #include "warnpop.h"
 
 #include <memory>
+#include <string>
+#include <cstdint>
 #include <queue>
 #include <unordered_map>
+#include <vector>
 
 #include "engine/game.h"
 #include "engine/types.h"
@@ -40,7 +43,7 @@ namespace game
         LuaGame(std::shared_ptr<sol::state> state);
         LuaGame(const std::string& lua_path);
        ~LuaGame();
-        virtual void SetPhysicsEngine(const PhysicsEngine* engine) override;
+        virtual void SetPhysicsEngine(PhysicsEngine* engine) override;
         virtual void LoadGame(const ClassLibrary* loader) override;
         virtual void Tick(double game_time, double dt) override;
         virtual void Update(double game_time,  double dt) override;
@@ -59,13 +62,16 @@ namespace game
         virtual void OnMouseMove(const wdk::WindowEventMouseMove& mouse) override;
         virtual void OnMousePress(const wdk::WindowEventMousePress& mouse) override;
         virtual void OnMouseRelease(const wdk::WindowEventMouseRelease& mouse) override;
+        virtual void ReloadChangedScripts() override;
         void PushAction(Action action)
         { mActionQueue.push(std::move(action)); }
         const ClassLibrary* GetClassLib() const
         { return mClasslib; }
     private:
+        std::string mGameScript;
+        std::uint64_t mGameScriptTime = 0;
         const ClassLibrary* mClasslib = nullptr;
-        const PhysicsEngine* mPhysicsEngine = nullptr;
+        PhysicsEngine* mPhysicsEngine = nullptr;
         std::shared_ptr<sol::state> mLuaState;
         std::queue<Action> mActionQueue;
         FRect mView;
@@ -81,7 +87,7 @@ namespace game
        ~ScriptEngine();
         void SetLoader(const ClassLibrary* loader)
         { mClassLib = loader; }
-        void SetPhysicsEngine(const PhysicsEngine* engine)
+        void SetPhysicsEngine(PhysicsEngine* engine)
         { mPhysicsEngine = engine; }
         void BeginPlay(Scene* scene);
         void EndPlay(Scene* scene);
@@ -97,23 +103,77 @@ namespace game
         void OnMouseMove(const wdk::WindowEventMouseMove& mouse);
         void OnMousePress(const wdk::WindowEventMousePress& mouse);
         void OnMouseRelease(const wdk::WindowEventMouseRelease& mouse);
+        // Check the entity script files for modifications and recompile
+        // the changed scripts into their existing environments. The
+        // environment objects stay the same so any entity state and
+        // references to the environments remain valid.
+        void ReloadChangedScripts();
         void PushAction(Action action)
         { mActionQueue.push(std::move(action)); }
         const ClassLibrary* GetClassLib() const
         { return mClassLib; }
     private:
         sol::environment* GetTypeEnv(const EntityClass& klass);
+        sol::environment* LoadTypeEnv(const EntityClass& klass);
+        void StartCoroutine(const std::string& owner, const sol::function& func);
+        void ResumeCoroutine(unsigned id, const sol::object& value);
+        void ScheduleCoroutine(unsigned id, double seconds);
+        void UpdateCoroutines(double game_time);
+        void DeleteCoroutines(const std::string& owner);
+        void ClearCoroutines();
     private:
+        // A Lua coroutine that has been started through the engine
+        // and is currently suspended waiting for something to happen,
+        // i.e. some amount of time to pass or an animation to finish.
+        struct Coroutine;
+        // A pending wake up of a coroutine that is waiting on a timer.
+        struct Timer {
+            // the game time when the coroutine should be resumed.
+            double time = 0.0;
+            // the id of the coroutine to resume.
+            unsigned coroutine = 0;
+        };
+        // A pending wake up of a coroutine that is waiting for an
+        // entity's animation to finish.
+        struct AnimationWait {
+            std::string entity;
+            unsigned coroutine = 0;
+        };
+        // the script file that was loaded for some entity class
+        // and the file modification time at the time of loading.
+        struct TypeScript {
+            std::string file;
+            std::uint64_t time = 0;
+        };
         const std::string mLuaPath;
         const ClassLibrary* mClassLib = nullptr;
-        const PhysicsEngine* mPhysicsEngine = nullptr;
+        PhysicsEngine* mPhysicsEngine = nullptr;
         std::unique_ptr<sol::state> mLuaState;
         std::unordered_map<std::string, std::unique_ptr<sol::environment>> mTypeEnvs;
+        std::unordered_map<std::string, TypeScript> mTypeScripts;
         std::queue<Action> mActionQueue;
         Scene* mScene = nullptr;
+        // currently suspended coroutines keyed by coroutine id.
+        std::unordered_map<unsigned, std::unique_ptr<Coroutine>> mCoroutines;
+        // timer wheel for the coroutines that are waiting on time.
+        // each slot covers a fixed interval of game time and timers
+        // are hashed into the slots based on their expiry time so that
+        // each update only needs to look at the slot(s) that are due.
+        std::vector<std::vector<Timer>> mTimerWheel;
+        // the next (absolute) timer wheel slot to process.
+        std::uint64_t mTimerWheelPos = 0;
+        // coroutines that are waiting on entity animations.
+        std::vector<AnimationWait> mAnimationWaits;
+        unsigned mCoroutineId = 0;
+        double mGameTime = 0.0;
     };
 
 
+    // Seed the random number generators available to the Lua code.
+    // This covers util.Random* functions and math.random in every
+    // Lua state created after this call.
+    void SeedLuaRandom(unsigned seed);
+
     void BindUtil(sol::state& L);
     void BindBase(sol::state& L);
     void BindGLM(sol::state& L);
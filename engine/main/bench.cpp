@@ -0,0 +1,615 @@
+// Copyright (C) 2020-2021 Sami Väisänen
+// Copyright (C) 2020-2021 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "config.h"
+
+#include "warnpush.h"
+#  include <nlohmann/json.hpp>
+#include "warnpop.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <map>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <new>
+#include <cstdlib>
+
+#if defined(POSIX_OS)
+#  include <sys/resource.h>
+#elif defined(WINDOWS_OS)
+#  include <Windows.h>
+#  include <Psapi.h>
+#endif
+
+#include "base/platform.h"
+#include "base/logging.h"
+#include "base/cmdline.h"
+#include "base/utility.h"
+#include "base/math.h"
+#include "base/json.h"
+#include "base/hash.h"
+#include "base/threadpool.h"
+#include "graphics/device.h"
+#include "graphics/painter.h"
+#include "graphics/transform.h"
+#include "graphics/resource.h"
+#include "engine/main/offscreen.h"
+#include "engine/main/replay.h"
+#include "engine/loader.h"
+#include "engine/entity.h"
+#include "engine/scene.h"
+#include "engine/physics.h"
+#include "engine/renderer.h"
+#include "engine/lua.h"
+
+// Benchmark runner that plays a scene for a fixed amount of simulated
+// time without any window or human and prints the timings as JSON.
+// Unlike GameMain this doesn't load the game library and there's no
+// game.lua. Instead the engine subsystems are driven directly so that
+// they can be timed individually. Entity scripts are run if the scene
+// has any, but there's no input.
+
+namespace {
+// Count the heap allocations done through the global new.
+std::atomic<std::uint64_t> AllocationCount;
+std::atomic<std::uint64_t> AllocationBytes;
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    AllocationCount.fetch_add(1, std::memory_order_relaxed);
+    AllocationBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace {
+
+// Peak resident memory usage of the process in bytes.
+std::uint64_t GetPeakMemoryUsage()
+{
+#if defined(POSIX_OS)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024; // ru_maxrss is in kilobytes
+#elif defined(WINDOWS_OS)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+#endif
+    return 0;
+}
+
+// Accumulate the time spent in some subsystem per frame.
+class Timer
+{
+public:
+    using clock = std::chrono::steady_clock;
+    Timer(std::vector<double>& samples) : mSamples(samples)
+    { mStart = clock::now(); }
+   ~Timer()
+    {
+        const auto gone = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - mStart);
+        mSamples.back() += gone.count() / (1000.0 * 1000.0 * 1000.0);
+    }
+private:
+    std::vector<double>& mSamples;
+    clock::time_point mStart;
+};
+
+nlohmann::json StatsToJson(const std::vector<double>& samples)
+{
+    // report in milliseconds, easier to read.
+    const auto& stats = game::ComputeFrameTimeStats(samples);
+    nlohmann::json json;
+    json["total"] = stats.total * 1000.0;
+    json["min"]   = stats.min * 1000.0;
+    json["max"]   = stats.max * 1000.0;
+    json["mean"]  = stats.mean * 1000.0;
+    json["p50"]   = stats.p50 * 1000.0;
+    json["p90"]   = stats.p90 * 1000.0;
+    json["p95"]   = stats.p95 * 1000.0;
+    json["p99"]   = stats.p99 * 1000.0;
+    return json;
+}
+
+bool WriteOutput(const nlohmann::json& out, const std::string& output_file)
+{
+    if (output_file.empty())
+    {
+        std::cout << out.dump(2) << std::endl;
+        return true;
+    }
+    std::ofstream file(output_file, std::ios::out | std::ios::trunc);
+    if (!file.is_open())
+    {
+        ERROR("Failed to open output file '%1'.", output_file);
+        return false;
+    }
+    file << out.dump(2) << std::endl;
+    return true;
+}
+
+// Physics stress test with a generated scene, a static floor and a grid
+// of small dynamic boxes that drop onto it and pile up. This doesn't need
+// any game content. The checksum is computed over the final body positions
+// so that runs with different thread counts can be compared for determinism.
+nlohmann::json RunPhysicsBenchmark(unsigned num_bodies, unsigned num_partitions,
+                                   unsigned num_threads, float seconds, float updates_per_second)
+{
+    // the sizes are in meters, box2d is happiest with sizes between 0.1 and 10.
+    const float box_size = 0.5f;
+    const float spacing  = 0.6f;
+    const unsigned columns = 200;
+    const unsigned rows = (num_bodies + columns - 1) / columns;
+    const float width = columns * spacing;
+
+    auto debris = std::make_shared<game::EntityClass>();
+    {
+        game::RigidBodyItemClass body;
+        body.SetSimulation(game::RigidBodyItemClass::Simulation::Dynamic);
+        body.SetCollisionShape(game::RigidBodyItemClass::CollisionShape::Box);
+        game::EntityNodeClass node;
+        node.SetName("debris");
+        node.SetSize(glm::vec2(box_size, box_size));
+        node.SetRigidBody(body);
+        debris->LinkChild(nullptr, debris->AddNode(std::move(node)));
+    }
+    auto floor = std::make_shared<game::EntityClass>();
+    {
+        game::RigidBodyItemClass body;
+        body.SetSimulation(game::RigidBodyItemClass::Simulation::Static);
+        body.SetCollisionShape(game::RigidBodyItemClass::CollisionShape::Box);
+        game::EntityNodeClass node;
+        node.SetName("floor");
+        node.SetSize(glm::vec2(width + 10.0f, 1.0f));
+        node.SetRigidBody(body);
+        floor->LinkChild(nullptr, floor->AddNode(std::move(node)));
+    }
+
+    game::SceneClass klass;
+    {
+        game::SceneNodeClass node;
+        node.SetName("floor");
+        node.SetEntity(floor);
+        node.SetTranslation(glm::vec2(width * 0.5f, rows * spacing + 1.0f));
+        klass.LinkChild(nullptr, klass.AddNode(node));
+    }
+    for (unsigned i=0; i<num_bodies; ++i)
+    {
+        game::SceneNodeClass node;
+        node.SetName("debris");
+        node.SetEntity(debris);
+        // offset every other row a little so that the boxes don't stack perfectly.
+        const float offset = (i / columns) % 2 ? spacing * 0.25f : 0.0f;
+        node.SetTranslation(glm::vec2((i % columns) * spacing + offset, (i / columns) * spacing));
+        klass.LinkChild(nullptr, klass.AddNode(node));
+    }
+
+    std::unique_ptr<base::ThreadPool> threads;
+    if (num_threads)
+        threads = std::make_unique<base::ThreadPool>(num_threads);
+
+    game::PhysicsEngine physics;
+    physics.SetTimestep(1.0f / updates_per_second);
+    physics.SetGravity(glm::vec2(0.0f, 10.0f));
+    physics.SetNumPartitions(num_partitions);
+    physics.SetThreadPool(threads.get());
+
+    auto scene = game::CreateSceneInstance(klass);
+    physics.CreateWorld(*scene);
+
+    std::vector<double> step_times;
+    std::vector<double> update_times;
+    std::size_t num_contacts = 0;
+    const auto num_frames = static_cast<unsigned>(seconds * updates_per_second);
+    for (unsigned i=0; i<num_frames; ++i)
+    {
+        step_times.push_back(0.0);
+        update_times.push_back(0.0);
+        std::vector<game::ContactEvent> contacts;
+        {
+            Timer timer(step_times);
+            physics.Tick(&contacts);
+        }
+        {
+            Timer timer(update_times);
+            physics.UpdateScene(*scene);
+        }
+        num_contacts += contacts.size();
+    }
+
+    std::size_t checksum = 0;
+    for (size_t i=0; i<scene->GetNumEntities(); ++i)
+    {
+        const auto& entity = scene->GetEntity(i);
+        for (size_t j=0; j<entity.GetNumNodes(); ++j)
+        {
+            const auto& node = entity.GetNode(j);
+            checksum = base::hash_combine(checksum, node.GetTranslation());
+            checksum = base::hash_combine(checksum, node.GetRotation());
+        }
+    }
+
+    nlohmann::json out;
+    out["physics"]["bodies"]     = num_bodies;
+    out["physics"]["partitions"] = physics.GetNumPartitions();
+    out["physics"]["threads"]    = num_threads;
+    out["physics"]["frames"]     = num_frames;
+    out["physics"]["contacts"]   = num_contacts;
+    out["physics"]["checksum"]   = checksum;
+    out["physics"]["step"]          = StatsToJson(step_times);
+    out["physics"]["update_scene"]  = StatsToJson(update_times);
+    return out;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        std::string cmdline_error;
+        base::CommandLineArgumentStack args(argc-1, (const char**)&argv[1]);
+        base::CommandLineOptions opt;
+        opt.Add("--config", "Application configuration JSON file.", std::string("config.json"));
+        opt.Add("--scene", "Name of the scene to play.", std::string(""));
+        opt.Add("--seconds", "Number of seconds of game time to simulate.", 10.0f);
+        opt.Add("--output", "Output JSON file. Default is stdout.", std::string(""));
+        opt.Add("--width", "Off-screen rendering surface width.", 1280u);
+        opt.Add("--height", "Off-screen rendering surface height.", 720u);
+        opt.Add("--no-render", "Skip rendering completely.");
+        opt.Add("--no-scripts", "Don't run entity scripts.");
+        opt.Add("--threads", "Number of worker threads for the scene update and draw.", 0u);
+        opt.Add("--render-thread", "Do the rendering on a separate render thread.");
+        opt.Add("--gpu-timers", "Measure the GPU time of each render pass.");
+        opt.Add("--spawn", "Name of an entity class to measure the spawn throughput with.", std::string(""));
+        opt.Add("--spawn-count", "Number of entities to spawn.", 1000u);
+        opt.Add("--physics-bodies", "Run the physics stress test with this many bodies instead of a scene.", 0u);
+        opt.Add("--physics-partitions", "Number of partitions to split the physics world into.", 1u);
+        opt.Add("--debug-log", "Enable debug logging.");
+        opt.Add("--help", "Print this help and exit.");
+        if (!opt.Parse(args, &cmdline_error, true))
+        {
+            std::cerr << "Error parsing args: " << cmdline_error;
+            std::cerr << std::endl;
+            return EXIT_FAILURE;
+        }
+        else if (opt.WasGiven("--help"))
+        {
+            opt.Print(std::cout);
+            return EXIT_SUCCESS;
+        }
+        const auto config_file = opt.GetValue<std::string>("--config");
+        const auto scene_name  = opt.GetValue<std::string>("--scene");
+        const auto seconds     = opt.GetValue<float>("--seconds");
+        const auto output_file = opt.GetValue<std::string>("--output");
+        const auto width       = opt.GetValue<unsigned>("--width");
+        const auto height      = opt.GetValue<unsigned>("--height");
+        const bool render      = !opt.WasGiven("--no-render");
+        const bool scripts     = !opt.WasGiven("--no-scripts");
+        const auto num_threads = opt.GetValue<unsigned>("--threads");
+        const bool render_thread = opt.WasGiven("--render-thread");
+        const bool gpu_timers  = render && opt.WasGiven("--gpu-timers");
+        const auto spawn_name  = opt.GetValue<std::string>("--spawn");
+        const auto spawn_count = opt.GetValue<unsigned>("--spawn-count");
+        const auto physics_bodies = opt.GetValue<unsigned>("--physics-bodies");
+        const auto physics_partitions = opt.GetValue<unsigned>("--physics-partitions");
+        if (scene_name.empty() && !physics_bodies)
+        {
+            std::cerr << "No scene was given. Use --scene.";
+            std::cerr << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        // log to stderr so that stdout can be used for the JSON output.
+        base::LockedLogger<base::OStreamLogger> logger((base::OStreamLogger(std::cerr)));
+        base::SetGlobalLog(&logger);
+        base::EnableDebugLog(opt.WasGiven("--debug-log"));
+
+        if (physics_bodies)
+        {
+            const auto& out = RunPhysicsBenchmark(physics_bodies, physics_partitions, num_threads, seconds, 60.0f);
+            const bool ok = WriteOutput(out, output_file);
+            base::SetGlobalLog(nullptr);
+            return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        const auto [json_ok, json, json_error] = base::JsonParseFile(config_file);
+        if (!json_ok)
+        {
+            ERROR("Failed to parse '%1'", config_file);
+            ERROR(json_error);
+            return EXIT_FAILURE;
+        }
+        std::string content;
+        float updates_per_second = 60.0f;
+        float ticks_per_second   = 1.0f;
+        base::JsonReadSafe(json["application"], "content", &content);
+        base::JsonReadSafe(json["application"], "updates_per_second", &updates_per_second);
+        base::JsonReadSafe(json["application"], "ticks_per_second", &ticks_per_second);
+
+        // the game directory is where the config file is.
+        const auto& config_path = std::filesystem::absolute(config_file).parent_path().generic_u8string();
+        auto resources = game::FileResourceLoader::Create();
+        resources->SetApplicationPath(config_path);
+        resources->SetContentPath(config_path);
+        gfx::SetResourceLoader(resources.get());
+        auto classlib = game::JsonFileClassLoader::Create();
+        classlib->LoadFromFile(base::JoinPath(config_path, content));
+
+        auto klass = classlib->FindSceneClassByName(scene_name);
+        if (!klass)
+        {
+            ERROR("No such scene '%1'.", scene_name);
+            return EXIT_FAILURE;
+        }
+        game::ClassHandle<const game::EntityClass> spawn_klass;
+        if (!spawn_name.empty())
+        {
+            spawn_klass = classlib->FindEntityClassByName(spawn_name);
+            if (!spawn_klass)
+            {
+                ERROR("No such entity '%1'.", spawn_name);
+                return EXIT_FAILURE;
+            }
+        }
+
+        std::shared_ptr<OffscreenContext> context;
+        std::shared_ptr<gfx::Device> device;
+        std::unique_ptr<gfx::Painter> painter;
+        if (render)
+        {
+            wdk::Config::Attributes attrs;
+            attrs.surfaces.pbuffer = true;
+            attrs.double_buffer    = false;
+            attrs.stencil_size     = 8;
+            context = std::make_shared<OffscreenContext>(attrs, width, height);
+            device  = render_thread
+                ? gfx::Device::CreateThreaded(gfx::Device::Type::OpenGL_ES2, context.get())
+                : gfx::Device::Create(gfx::Device::Type::OpenGL_ES2, context);
+            painter = gfx::Painter::Create(device);
+            painter->SetSurfaceSize(width, height);
+            painter->SetViewport(0, 0, width, height);
+            // there's no game to provide a viewport so just map the
+            // scene units 1:1 to the surface.
+            painter->SetOrthographicView(0.0f, 0.0f, width, height);
+            painter->EnablePassTimers(gpu_timers);
+        }
+
+        game::PhysicsEngine physics;
+        physics.SetLoader(classlib.get());
+        physics.SetTimestep(1.0f / updates_per_second);
+        if (json.contains("physics"))
+        {
+            const auto& physics_settings = json["physics"];
+            unsigned velocity_iterations = 8;
+            unsigned position_iterations = 3;
+            glm::vec2 gravity = {0.0f, 1.0f};
+            glm::vec2 scale   = {1.0f, 1.0f};
+            base::JsonReadSafe(physics_settings, "num_velocity_iterations", &velocity_iterations);
+            base::JsonReadSafe(physics_settings, "num_position_iterations", &position_iterations);
+            base::JsonReadSafe(physics_settings, "gravity", &gravity);
+            base::JsonReadSafe(physics_settings, "scale",   &scale);
+            physics.SetNumVelocityIterations(velocity_iterations);
+            physics.SetNumPositionIterations(position_iterations);
+            physics.SetGravity(gravity);
+            physics.SetScale(scale);
+        }
+        physics.SetNumPartitions(physics_partitions);
+        std::unique_ptr<base::ThreadPool> threads;
+        if (num_threads)
+            threads = std::make_unique<base::ThreadPool>(num_threads);
+        physics.SetThreadPool(threads.get());
+
+        game::Renderer renderer(classlib.get());
+        renderer.SetThreadPool(threads.get());
+        game::ScriptEngine scripting(base::JoinPath(config_path, "lua"));
+        scripting.SetLoader(classlib.get());
+        scripting.SetPhysicsEngine(&physics);
+
+        // make the runs repeatable.
+        math::seed_rand(0);
+        game::SeedLuaRandom(0);
+
+        const auto allocations_before_play = AllocationCount.load();
+
+        auto scene = game::CreateSceneInstance(klass);
+        physics.CreateWorld(*scene);
+        if (scripts)
+            scripting.BeginPlay(scene.get());
+
+        std::vector<double> frame_times;
+        std::vector<double> scene_times;
+        std::vector<double> physics_times;
+        std::vector<double> script_times;
+        std::vector<double> animation_times;
+        std::vector<double> render_times;
+        // the GPU timings lag behind the frames so these are the
+        // results of some earlier frame, one sample per frame.
+        std::map<std::string, std::vector<double>> gpu_pass_times;
+
+        const double dt = 1.0 / updates_per_second;
+        const double tick_step = 1.0 / ticks_per_second;
+        const auto num_frames = static_cast<unsigned>(seconds / dt);
+        const auto allocations_before_loop = AllocationCount.load();
+        const auto allocated_bytes_before_loop = AllocationBytes.load();
+        double game_time = 0.0;
+        double tick_accum = 0.0;
+
+        for (unsigned i=0; i<num_frames; ++i)
+        {
+            for (auto* samples : {&frame_times, &scene_times, &physics_times,
+                                  &script_times, &animation_times, &render_times})
+                samples->push_back(0.0);
+
+            Timer frame(frame_times);
+
+            game_time  += dt;
+            tick_accum += dt;
+            {
+                Timer timer(scene_times);
+                scene->BeginLoop();
+                scene->Update(dt, threads.get());
+            }
+            if (scripts)
+            {
+                Timer timer(script_times);
+                scripting.BeginLoop();
+            }
+            if (physics.HaveWorld())
+            {
+                Timer timer(physics_times);
+                std::vector<game::ContactEvent> contacts;
+                physics.Tick(&contacts);
+                physics.UpdateScene(*scene);
+                if (scripts)
+                {
+                    for (const auto& contact : contacts)
+                        scripting.OnContactEvent(contact);
+                }
+            }
+            {
+                Timer timer(animation_times);
+                renderer.Update(*scene, game_time, dt);
+            }
+            if (scripts)
+            {
+                Timer timer(script_times);
+                scripting.Update(game_time, dt);
+                while (tick_accum >= tick_step)
+                {
+                    scripting.Tick(game_time, tick_step);
+                    tick_accum -= tick_step;
+                }
+            }
+            if (render)
+            {
+                Timer timer(render_times);
+                device->BeginFrame();
+                device->ClearColor(gfx::Color4f(0.2f, 0.3f, 0.4f, 1.0f));
+                renderer.BeginFrame();
+                gfx::Transform transform;
+                renderer.Draw(*scene, *painter, transform);
+                renderer.EndFrame();
+                device->EndFrame(true);
+                device->CleanGarbage(120);
+            }
+            if (gpu_timers)
+            {
+                for (const auto& pass : painter->GetPassTimings())
+                {
+                    if (pass.gpu_time >= 0.0)
+                        gpu_pass_times[pass.name].push_back(pass.gpu_time);
+                }
+            }
+            if (scripts)
+            {
+                Timer timer(script_times);
+                scripting.EndLoop();
+            }
+            {
+                Timer timer(scene_times);
+                scene->EndLoop();
+            }
+        }
+
+        if (scripts)
+            scripting.EndPlay(scene.get());
+
+        nlohmann::json out;
+        out["scene"]     = scene_name;
+        out["frames"]    = num_frames;
+        out["time_step"] = dt;
+        out["render"]    = render;
+        out["scripts"]   = scripts;
+        out["threads"]   = num_threads;
+        out["render_thread"] = render_thread;
+        out["physics_partitions"] = physics.GetNumPartitions();
+        out["frame_time"] = StatsToJson(frame_times);
+        out["subsystems"]["scene"]     = StatsToJson(scene_times);
+        out["subsystems"]["physics"]   = StatsToJson(physics_times);
+        out["subsystems"]["scripts"]   = StatsToJson(script_times);
+        out["subsystems"]["animation"] = StatsToJson(animation_times);
+        out["subsystems"]["render"]    = StatsToJson(render_times);
+        for (const auto& [name, samples] : gpu_pass_times)
+            out["gpu_passes"][name] = StatsToJson(samples);
+        out["memory"]["peak_bytes"] = GetPeakMemoryUsage();
+        out["memory"]["allocations_setup"] = allocations_before_loop - allocations_before_play;
+        out["memory"]["allocations_loop"]  = AllocationCount.load() - allocations_before_loop;
+        out["memory"]["allocated_bytes_loop"] = AllocationBytes.load() - allocated_bytes_before_loop;
+        out["memory"]["allocations_per_frame"] = num_frames
+            ? double(AllocationCount.load() - allocations_before_loop) / num_frames : 0.0;
+
+        if (spawn_klass && spawn_count)
+        {
+            // measure the raw throughput of creating new entity instances.
+            // the entities are only created, not added to the scene.
+            std::vector<std::unique_ptr<game::Entity>> entities;
+            entities.reserve(spawn_count);
+            const auto allocations_before_spawn = AllocationCount.load();
+            const auto start = std::chrono::steady_clock::now();
+            for (unsigned i=0; i<spawn_count; ++i)
+            {
+                game::EntityArgs args;
+                args.klass    = spawn_klass;
+                args.position = glm::vec2(i % 100, i / 100);
+                entities.push_back(game::CreateEntityInstance(args));
+            }
+            const auto end = std::chrono::steady_clock::now();
+            const auto seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()
+                / (1000.0 * 1000.0 * 1000.0);
+            out["spawn"]["entity"] = spawn_name;
+            out["spawn"]["nodes"]  = spawn_klass->GetNumNodes();
+            out["spawn"]["count"]  = spawn_count;
+            out["spawn"]["total"]  = seconds * 1000.0;
+            out["spawn"]["per_second"] = seconds > 0.0 ? spawn_count / seconds : 0.0;
+            out["spawn"]["allocations_per_spawn"] =
+                double(AllocationCount.load() - allocations_before_spawn) / spawn_count;
+        }
+
+        scene.reset();
+        painter.reset();
+        device.reset();
+        if (context)
+            context->Dispose();
+
+        if (!WriteOutput(out, output_file))
+            return EXIT_FAILURE;
+        base::SetGlobalLog(nullptr);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Oops there was a problem:\n";
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
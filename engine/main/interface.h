@@ -31,6 +31,7 @@
 #include "engine/classlib.h"
 #include "engine/loader.h"
 #include "graphics/device.h"
+#include "graphics/painter.h"
 #include "graphics/resource.h"
 #include "graphics/color4f.h"
 #include "wdk/events.h"
@@ -140,6 +141,20 @@ namespace game
             bool debug_show_fps = false;
             bool debug_print_fps = false;
             bool debug_show_msg = false;
+            // Periodically check the game's Lua scripts for changes
+            // and reload the modified scripts on the fly.
+            bool debug_reload_scripts = false;
+            // What to visualize from the physics world when debug_draw
+            // is on. The body shapes are drawn by default, the AABBs
+            // and the contact points are more useful for debugging
+            // collision problems.
+            bool debug_draw_physics = true;
+            bool debug_draw_physics_aabbs = false;
+            bool debug_draw_physics_contacts = false;
+            // Measure the GPU time taken by the render passes. Without
+            // GPU timer support this stalls the rendering on every pass
+            // so it's not part of the "all debug" set.
+            bool debug_gpu_timers = false;
             std::string debug_font;
         };
         // Set the debug options.
@@ -204,9 +219,33 @@ namespace game
                 // if scale is for example {100.0f, 100.0f} it means 100 scene units
                 // to a single physics world unit. 
                 glm::vec2 scale = {1.0f, 1.0f};
+                // number of partitions to split the physics world into
+                // for stepping the simulation in parallel.
+                unsigned num_partitions = 1;
+                // the width of a single partition in physics world units.
+                // 0 to split the level into equal strips based on the bodies
+                // in the level when the world is created.
+                float partition_width = 0.0f;
             } physics;
             // the default clear color.
             gfx::Color4f clear_color = {0.2f, 0.3f, 0.4f, 1.0f};
+            // the time budget in microseconds per frame for cleaning up
+            // graphics resources that are no longer used. 0 for no limit.
+            unsigned gc_time_budget_us = 500;
+            // the number of worker threads for updating and drawing the
+            // scene in parallel. 0 (the default) to do everything on the
+            // main thread and -1 to pick the number based on the hardware.
+            int num_worker_threads = 0;
+            // settings for streaming in the scenes that have a streaming
+            // cell size. See Scene::UpdateStreaming.
+            struct {
+                // the margins around the view in scene units. 0 to use
+                // the defaults based on the scene's streaming cell size.
+                float load_margin   = 0.0f;
+                float unload_margin = 0.0f;
+                // the maximum number of entities to create per frame.
+                unsigned budget = 256;
+            } streaming;
         };
         // Set the game engine configuration. Called once in the beginning
         // before Start is called.
@@ -221,6 +260,14 @@ namespace game
         virtual bool ParseArgs(int argc, const char* argv[])
         { return true; }
 
+        // Seed all the random number generators used by the application.
+        // When the seed is the same and the application is given the
+        // same sequence of inputs and time steps it should behave the
+        // same way. This is used for recording and replaying game sessions.
+        // Called once before Init when needed. If not called the application
+        // is free to seed the generators as it wishes.
+        virtual void SetRandomSeed(unsigned seed) {}
+
         // Initialize the application and it's graphics resources.
         // The context is the current rendering context that can be used
         // to create the graphics device(s).
@@ -283,14 +330,57 @@ namespace game
             double total_wall_time = 0.0f;
             // The total number of frames rendered.
             unsigned num_frames_rendered = 0;
+            // The GPU render pass timings of the latest frame whose
+            // results are available. Only when the GPU timers are on.
+            std::vector<gfx::Painter::PassTiming> gpu_pass_timings;
         };
+        // Fill in the statistics that only the application itself
+        // knows about such as the GPU pass timings. Called right
+        // before UpdateStats.
+        virtual void CollectStats(Stats* stats) const {}
         // Update the collected runtime statistics. This is called
         // approximately once per second.
         virtual void UpdateStats(const Stats& stats) {}
 
         // Ask the engine to take a screenshot of the current default (window)
         // rendering surface and write it out as an image file.
-        virtual void TakeScreenshot(const std::string& filename) const {}
+        // The screenshot is taken from the next rendered frame and written
+        // out asynchronously, i.e. the file doesn't exist yet when this
+        // returns.
+        virtual void TakeScreenshot(const std::string& filename) {}
+
+        // Continuous capture of the rendered frames. Useful for example
+        // for bug reports and for visual regression testing.
+        struct CaptureOptions {
+            // The directory where to write the captured frames. If empty
+            // then no frames are captured.
+            std::string directory;
+            // Capture every Nth rendered frame.
+            unsigned interval = 1;
+            enum class Format {
+                // Write each captured frame into its own PNG file.
+                PNG,
+                // Write the frames into a single raw (uncompressed) frame
+                // sequence file. Faster to capture but takes a lot of space.
+                Raw
+            };
+            Format format = Format::PNG;
+        };
+        // Set the frame capture options. Called once in the beginning
+        // before Start is called.
+        virtual void SetCaptureOptions(const CaptureOptions& capture) {}
+
+        // Rendering setup options.
+        struct RenderOptions {
+            // Do the actual device rendering on a separate render thread.
+            // The main thread then records the rendering commands for the
+            // next frame while the render thread is executing the previous
+            // frame's commands.
+            bool render_thread = false;
+        };
+        // Set the rendering options. Called once in the beginning
+        // before Init is called.
+        virtual void SetRenderOptions(const RenderOptions& options) {}
         // Called when the primary rendering surface in which the application
         // renders for display has been resized. Note that this may not be
         // the same as the current window and its size if an off-screen rendering
@@ -27,6 +27,8 @@
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
+#include <random>
+#include <filesystem>
 
 #if defined(LINUX_OS)
 #  include <fenv.h>
@@ -43,6 +45,8 @@
 #include "base/utility.h"
 #include "base/json.h"
 #include "engine/main/interface.h"
+#include "engine/main/replay.h"
+#include "engine/main/offscreen.h"
 #include "engine/classlib.h"
 #include "wdk/opengl/config.h"
 #include "wdk/opengl/context.h"
@@ -161,6 +165,10 @@ public:
     {
         mContext->MakeCurrent(mSurface.get());
     }
+    virtual void ReleaseCurrent() override
+    {
+        mContext->MakeCurrent(nullptr);
+    }
     wdk::uint_t GetVisualID() const
     { return mVisualID; }
 
@@ -213,6 +221,93 @@ double CurrentRuntime()
         (1000.0 * 1000.0);
 }
 
+game::App::EngineConfig ReadEngineConfig(const nlohmann::json& json)
+{
+    // the times here are in the application timeline which
+    // is not the same as the real wall time but can drift
+    float updates_per_second = 60.0f;
+    float ticks_per_second = 1.0f;
+    base::JsonReadSafe(json["application"], "updates_per_second", &updates_per_second);
+    base::JsonReadSafe(json["application"], "ticks_per_second", &ticks_per_second);
+    DEBUG("time_step = 1.0/%1, tick_step = 1.0/%2", updates_per_second, ticks_per_second);
+
+    game::App::EngineConfig config;
+    base::JsonReadSafe(json["application"], "default_min_filter", &config.default_min_filter);
+    base::JsonReadSafe(json["application"], "default_mag_filter", &config.default_mag_filter);
+    config.updates_per_second = updates_per_second;
+    config.ticks_per_second   = ticks_per_second;
+    if (json.contains("physics"))
+    {
+        const auto& physics_settings = json["physics"];
+        base::JsonReadSafe(physics_settings, "num_velocity_iterations", &config.physics.num_velocity_iterations);
+        base::JsonReadSafe(physics_settings, "num_position_iterations", &config.physics.num_position_iterations);
+        base::JsonReadSafe(physics_settings, "gravity", &config.physics.gravity);
+        base::JsonReadSafe(physics_settings, "scale",   &config.physics.scale);
+        base::JsonReadSafe(physics_settings, "num_partitions", &config.physics.num_partitions);
+        base::JsonReadSafe(physics_settings, "partition_width", &config.physics.partition_width);
+    }
+    if (json.contains("engine"))
+    {
+        const auto& engine_settings = json["engine"];
+        base::JsonReadSafe(engine_settings, "clear_color", &config.clear_color);
+        base::JsonReadSafe(engine_settings, "gc_time_budget_us", &config.gc_time_budget_us);
+        base::JsonReadSafe(engine_settings, "num_worker_threads", &config.num_worker_threads);
+        base::JsonReadSafe(engine_settings, "streaming_load_margin", &config.streaming.load_margin);
+        base::JsonReadSafe(engine_settings, "streaming_unload_margin", &config.streaming.unload_margin);
+        base::JsonReadSafe(engine_settings, "streaming_budget", &config.streaming.budget);
+    }
+    return config;
+}
+
+// Run the main loop by feeding the app with the recorded session data
+// as fast as possible. Returns the app's exit code.
+int ReplaySession(game::App& app, game::SessionPlayer& player)
+{
+    using clock = std::chrono::steady_clock;
+
+    int exit_code = EXIT_SUCCESS;
+    bool quit = false;
+    std::vector<double> frame_times;
+
+    while (app.IsRunning() && !quit)
+    {
+        const auto frame_start = clock::now();
+
+        app.BeginMainLoop();
+
+        double wall_time = 0.0;
+        double time_step = 0.0;
+        if (!player.NextFrame(app, &wall_time, &time_step))
+            break;
+
+        // there's no window so all the other requests are just ignored.
+        game::App::Request request;
+        while (app.GetNextRequest(&request))
+        {
+            if (auto* ptr = std::get_if<game::App::QuitApp>(&request))
+            {
+                quit = true;
+                exit_code = ptr->exit_code;
+                INFO("Quit with exit code %1", exit_code);
+            }
+        }
+        app.Update(wall_time, time_step);
+        app.Draw();
+        app.EndMainLoop();
+
+        const auto frame_end = clock::now();
+        const auto frame_time = std::chrono::duration_cast<std::chrono::microseconds>(frame_end - frame_start);
+        frame_times.push_back(frame_time.count() / (1000.0 * 1000.0));
+    }
+
+    const auto& stats = game::ComputeFrameTimeStats(std::move(frame_times));
+    INFO("Replayed %1 frames in %2 s.", stats.num_frames, stats.total);
+    INFO("Frame time (ms) min: %1, max: %2, mean: %3", stats.min * 1000.0, stats.max * 1000.0, stats.mean * 1000.0);
+    INFO("Frame time (ms) p50: %1, p90: %2, p95: %3, p99: %4", stats.p50 * 1000.0,
+        stats.p90 * 1000.0, stats.p95 * 1000.0, stats.p99 * 1000.0);
+    return exit_code;
+}
+
 int main(int argc, char* argv[])
 {
 #if defined(LINUX_OS)
@@ -244,10 +339,20 @@ int main(int argc, char* argv[])
         opt.Add("--debug", "Enable all debug features.");
         opt.Add("--debug-log", "Enable debug logging.");
         opt.Add("--debug-draw", "Enable debug drawing.");
+        opt.Add("--debug-draw-aabbs", "Debug draw the physics bodies' bounding boxes.");
+        opt.Add("--debug-draw-contacts", "Debug draw the physics contact points.");
         opt.Add("--debug-font", "Debug font for debug messages.", std::string(""));
         opt.Add("--debug-show-fps", "Show FPS counter and stats. You'll need to use --debug-font.");
         opt.Add("--debug-show-msg", "Show debug messages. You'll need to use --debug-font.");
         opt.Add("--debug-print-fps", "Print FPS counter and stats to log.");
+        opt.Add("--debug-reload-scripts", "Reload Lua scripts when they're modified.");
+        opt.Add("--debug-gpu-timers", "Measure the GPU time of the render passes. Use with the FPS options.");
+        opt.Add("--record", "Record the game session into a file.", std::string(""));
+        opt.Add("--replay", "Replay a recorded game session (headless) and print frame stats.", std::string(""));
+        opt.Add("--capture", "Capture rendered frames into the given directory.", std::string(""));
+        opt.Add("--capture-interval", "Capture every Nth frame.", 1u);
+        opt.Add("--capture-raw", "Capture into a raw frame sequence file instead of PNGs.");
+        opt.Add("--render-thread", "Do the rendering on a separate render thread.");
         if (!opt.Parse(args, &cmdline_error, true))
         {
             std::cerr << "Error parsing args: " << cmdline_error;
@@ -267,6 +372,7 @@ int main(int argc, char* argv[])
             debug.debug_show_fps = true;
             debug.debug_show_msg = true;
             debug.debug_print_fps = true;
+            debug.debug_reload_scripts = true;
         }
         else
         {
@@ -275,8 +381,12 @@ int main(int argc, char* argv[])
             debug.debug_log       = opt.WasGiven("--debug-log");
             debug.debug_draw      = opt.WasGiven("--debug-draw");
             debug.debug_show_msg  = opt.WasGiven("--debug-show-msg");
+            debug.debug_reload_scripts = opt.WasGiven("--debug-reload-scripts");
         }
 
+        debug.debug_draw_physics_aabbs    = opt.WasGiven("--debug-draw-aabbs");
+        debug.debug_draw_physics_contacts = opt.WasGiven("--debug-draw-contacts");
+        debug.debug_gpu_timers = opt.WasGiven("--debug-gpu-timers");
         debug.debug_font = opt.GetValue<std::string>("--debug-font");
         if ((debug.debug_show_msg || debug.debug_show_fps) && debug.debug_font.empty())
         {
@@ -287,6 +397,23 @@ int main(int argc, char* argv[])
 
         config_file = opt.GetValue<std::string>("--config");
 
+        const std::string record_file = opt.GetValue<std::string>("--record");
+        const std::string replay_file = opt.GetValue<std::string>("--replay");
+        if (!record_file.empty() && !replay_file.empty())
+        {
+            std::cerr << "Can't both record and replay a session.";
+            std::cerr << std::endl;
+            return 0;
+        }
+        game::App::CaptureOptions capture;
+        capture.directory = opt.GetValue<std::string>("--capture");
+        capture.interval  = opt.GetValue<unsigned>("--capture-interval");
+        capture.format    = opt.WasGiven("--capture-raw")
+            ? game::App::CaptureOptions::Format::Raw
+            : game::App::CaptureOptions::Format::PNG;
+        game::App::RenderOptions render;
+        render.render_thread = opt.WasGiven("--render-thread");
+
         // setting the logger is a bit dangerous here since the current
         // build configuration builds logging.cpp into this executable
         // and possibly the library we're going to load has also built logging.cpp
@@ -349,6 +476,40 @@ int main(int argc, char* argv[])
             return 0;
 
         app->SetDebugOptions(debug);
+        if (!capture.directory.empty())
+        {
+            std::error_code error;
+            std::filesystem::create_directories(capture.directory, error);
+            if (error)
+            {
+                ERROR("Failed to create capture directory '%1' (%2).", capture.directory, error.message());
+                return 0;
+            }
+            app->SetCaptureOptions(capture);
+        }
+        app->SetRenderOptions(render);
+
+        // when recording or replaying the random generators are seeded
+        // with a known seed that is stored in the session file.
+        game::SessionHeader session;
+        std::unique_ptr<game::SessionPlayer> player;
+        if (!replay_file.empty())
+        {
+            player = std::make_unique<game::SessionPlayer>(replay_file);
+            if (!player->IsOpen())
+            {
+                ERROR("Failed to open replay file '%1'.", replay_file);
+                return EXIT_FAILURE;
+            }
+            if (!player->ReadHeader(&session))
+                return EXIT_FAILURE;
+            app->SetRandomSeed(session.random_seed);
+        }
+        else if (!record_file.empty())
+        {
+            session.random_seed = std::random_device{}();
+            app->SetRandomSeed(session.random_seed);
+        }
 
         game::App::Environment env;
         env.classlib  = loaders.ContentLoader.get();
@@ -376,6 +537,31 @@ int main(int argc, char* argv[])
             attrs.stencil_size, attrs.depth_size);
         DEBUG("Sampling: %1", attrs.sampling);
 
+        if (player)
+        {
+            // replay the session headless on an off-screen surface.
+            attrs.surfaces.window  = false;
+            attrs.surfaces.pbuffer = true;
+            attrs.double_buffer    = false;
+            auto context = std::make_shared<OffscreenContext>(attrs,
+                session.surface_width, session.surface_height);
+
+            app->Init(context.get(), session.surface_width, session.surface_height);
+            app->SetEngineConfig(ReadEngineConfig(json));
+            app->Load();
+            app->Start();
+
+            exit_code = ReplaySession(*app, *player);
+
+            app->Save();
+            app->Shutdown();
+            app.reset();
+
+            context->Dispose();
+
+            GameLibSetGlobalLogger(nullptr, false);
+            return exit_code;
+        }
 
         auto context = std::make_shared<WindowContext>(attrs);
 
@@ -394,10 +580,26 @@ int main(int argc, char* argv[])
         base::JsonReadSafe(json["window"], "vsync", &window_vsync);
         base::JsonReadSafe(json["window"], "cursor", &window_show_cursor);
 
+        std::unique_ptr<game::SessionRecorder> recorder;
+        if (!record_file.empty())
+        {
+            recorder = std::make_unique<game::SessionRecorder>(record_file, app->GetWindowListener());
+            if (!recorder->IsOpen())
+            {
+                ERROR("Failed to open record file '%1'.", record_file);
+                return EXIT_FAILURE;
+            }
+        }
+
         wdk::Window window;
         // makes sure to connect the listener before creating the window
         // so that the listener can get the initial events, (resize, etc)
-        if (auto* listener = app->GetWindowListener())
+        // when recording the recorder sits between the window and the app.
+        if (recorder)
+        {
+            wdk::Connect(window, *recorder);
+        }
+        else if (auto* listener = app->GetWindowListener())
         {
             wdk::Connect(window, *listener);
         }
@@ -408,6 +610,13 @@ int main(int argc, char* argv[])
         window.SetFullscreen(window_set_fullscreen);
         window.ShowCursor(window_show_cursor);
 
+        if (recorder)
+        {
+            session.surface_width  = window.GetSurfaceWidth();
+            session.surface_height = window.GetSurfaceHeight();
+            recorder->WriteHeader(session);
+        }
+
         // Setup context to render in the window.
         context->SetWindowSurface(window);
         context->SetSwapInterval(window_vsync ? 1 : 0);
@@ -416,33 +625,7 @@ int main(int argc, char* argv[])
         // setup application
         app->Init(context.get(), window.GetSurfaceWidth(), window.GetSurfaceHeight());
 
-        // the times here are in the application timeline which
-        // is not the same as the real wall time but can drift
-        float updates_per_second = 60.0f;
-        float ticks_per_second = 1.0f;
-        base::JsonReadSafe(json["application"], "updates_per_second", &updates_per_second);
-        base::JsonReadSafe(json["application"], "ticks_per_second", &ticks_per_second);
-        DEBUG("time_step = 1.0/%1, tick_step = 1.0/%2", updates_per_second, ticks_per_second);
-
-        game::App::EngineConfig config;
-        base::JsonReadSafe(json["application"], "default_min_filter", &config.default_min_filter);
-        base::JsonReadSafe(json["application"], "default_mag_filter", &config.default_mag_filter);
-        config.updates_per_second = updates_per_second;
-        config.ticks_per_second   = ticks_per_second;
-        if (json.contains("physics"))
-        {
-            const auto& physics_settings = json["physics"];
-            base::JsonReadSafe(physics_settings, "num_velocity_iterations", &config.physics.num_velocity_iterations);
-            base::JsonReadSafe(physics_settings, "num_position_iterations", &config.physics.num_position_iterations);
-            base::JsonReadSafe(physics_settings, "gravity", &config.physics.gravity);
-            base::JsonReadSafe(physics_settings, "scale",   &config.physics.scale);
-        }
-        if (json.contains("engine"))
-        {
-            const auto& engine_settings = json["engine"];
-            base::JsonReadSafe(engine_settings, "clear_color", &config.clear_color);
-        }
-        app->SetEngineConfig(config);
+        app->SetEngineConfig(ReadEngineConfig(json));
         app->Load();
         app->Start();
 
@@ -465,10 +648,16 @@ int main(int argc, char* argv[])
                 // if the window was resized notify the app that the rendering
                 // surface has been resized.
                 if (event.identity() == wdk::native_event_t::type::window_resize)
+                {
+                    if (recorder)
+                        recorder->RecordSurfaceResize(window.GetSurfaceWidth(), window.GetSurfaceHeight());
                     app->OnRenderingSurfaceResized(window.GetSurfaceWidth(), window.GetSurfaceHeight());
+                }
 
                 if (fullscreen != window.IsFullscreen())
                 {
+                    if (recorder)
+                        recorder->RecordFullScreen(window.IsFullscreen());
                     if (window.IsFullscreen())
                         app->OnEnterFullScreen();
                     else app->OnLeaveFullScreen();
@@ -504,6 +693,9 @@ int main(int argc, char* argv[])
             const auto time_step = ElapsedSeconds();
             const auto wall_time = CurrentRuntime();
 
+            if (recorder)
+                recorder->RecordFrame(wall_time, time_step);
+
             // ask the application to take its simulation steps.
             app->Update(wall_time, time_step);
 
@@ -525,6 +717,7 @@ int main(int argc, char* argv[])
                 stats.current_fps = fps;
                 stats.num_frames_rendered = frames_total;
                 stats.total_wall_time = CurrentRuntime();
+                app->CollectStats(&stats);
                 app->UpdateStats(stats);
 
                 frames  = 0;
@@ -534,6 +727,9 @@ int main(int argc, char* argv[])
             app->EndMainLoop();
         } // main loop
 
+        if (recorder)
+            recorder->Close();
+
         app->Save();
         app->Shutdown();
         app.reset();
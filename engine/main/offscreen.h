@@ -0,0 +1,69 @@
+// Copyright (C) 2020-2021 Sami Väisänen
+// Copyright (C) 2020-2021 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "config.h"
+
+#include <memory>
+
+#include "graphics/device.h"
+#include "wdk/opengl/config.h"
+#include "wdk/opengl/context.h"
+#include "wdk/opengl/surface.h"
+
+// Context for rendering into an off-screen surface when there's
+// no window, for example when replaying a recorded session
+// or when running benchmarks.
+class OffscreenContext : public gfx::Device::Context
+{
+public:
+    OffscreenContext(const wdk::Config::Attributes& attrs, unsigned width, unsigned height)
+    {
+        mConfig  = std::make_unique<wdk::Config>(attrs);
+        mContext = std::make_unique<wdk::Context>(*mConfig, 2, 0, false, // debug
+            wdk::Context::Type::OpenGL_ES);
+        mSurface = std::make_unique<wdk::Surface>(*mConfig, width, height);
+        mContext->MakeCurrent(mSurface.get());
+        mConfig.reset();
+    }
+    virtual void Display() override
+    {
+        mContext->SwapBuffers();
+    }
+    virtual void* Resolve(const char* name) override
+    {
+        return mContext->Resolve(name);
+    }
+    virtual void MakeCurrent() override
+    {
+        mContext->MakeCurrent(mSurface.get());
+    }
+    virtual void ReleaseCurrent() override
+    {
+        mContext->MakeCurrent(nullptr);
+    }
+    void Dispose()
+    {
+        mContext->MakeCurrent(nullptr);
+        mSurface->Dispose();
+        mSurface.reset();
+    }
+private:
+    std::unique_ptr<wdk::Context> mContext;
+    std::unique_ptr<wdk::Surface> mSurface;
+    std::unique_ptr<wdk::Config>  mConfig;
+};
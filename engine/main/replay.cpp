@@ -0,0 +1,356 @@
+// Copyright (C) 2020-2021 Sami Väisänen
+// Copyright (C) 2020-2021 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "config.h"
+
+#include <algorithm>
+#include <numeric>
+#include <type_traits>
+#include <cstring>
+#include <cmath>
+
+#include "base/logging.h"
+#include "base/utility.h"
+#include "engine/main/interface.h"
+#include "engine/main/replay.h"
+#include "wdk/keys.h"
+
+namespace {
+// increment the version whenever the file format changes.
+constexpr char SessionFileMagic[4] = {'G', 'S', 'R', 'P'};
+constexpr std::uint32_t SessionFileVersion = 1;
+
+enum class RecordType : std::uint8_t {
+    Frame,
+    SurfaceResize,
+    FullScreen,
+    WantClose,
+    KeyDown,
+    KeyUp,
+    Char,
+    MouseMove,
+    MousePress,
+    MouseRelease
+};
+
+template<typename T>
+void Write(std::ofstream& out, const T& value)
+{
+    static_assert(std::is_trivially_copyable<T>::value);
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+template<typename T>
+bool Read(std::ifstream& in, T* value)
+{
+    static_assert(std::is_trivially_copyable<T>::value);
+    in.read(reinterpret_cast<char*>(value), sizeof(T));
+    return !in.fail();
+}
+
+std::uint8_t PackModifiers(wdk::bitflag<wdk::Keymod> mods)
+{
+    std::uint8_t bits = 0;
+    if (mods.test(wdk::Keymod::Shift))
+        bits |= 0x1;
+    if (mods.test(wdk::Keymod::Control))
+        bits |= 0x2;
+    if (mods.test(wdk::Keymod::Alt))
+        bits |= 0x4;
+    return bits;
+}
+wdk::bitflag<wdk::Keymod> UnpackModifiers(std::uint8_t bits)
+{
+    wdk::bitflag<wdk::Keymod> mods;
+    mods.set(wdk::Keymod::Shift,   (bits & 0x1) != 0);
+    mods.set(wdk::Keymod::Control, (bits & 0x2) != 0);
+    mods.set(wdk::Keymod::Alt,     (bits & 0x4) != 0);
+    return mods;
+}
+
+template<typename KeyEvent>
+void WriteKey(std::ofstream& out, RecordType type, const KeyEvent& key)
+{
+    Write(out, type);
+    Write(out, static_cast<std::int32_t>(key.symbol));
+    Write(out, PackModifiers(key.modifiers));
+}
+template<typename KeyEvent>
+bool ReadKey(std::ifstream& in, KeyEvent* key)
+{
+    std::int32_t symbol = 0;
+    std::uint8_t mods = 0;
+    if (!Read(in, &symbol) || !Read(in, &mods))
+        return false;
+    key->symbol    = static_cast<wdk::Keysym>(symbol);
+    key->modifiers = UnpackModifiers(mods);
+    return true;
+}
+
+template<typename MouseEvent>
+void WriteMouse(std::ofstream& out, RecordType type, const MouseEvent& mouse)
+{
+    Write(out, type);
+    Write(out, static_cast<std::int32_t>(mouse.window_x));
+    Write(out, static_cast<std::int32_t>(mouse.window_y));
+    Write(out, static_cast<std::int32_t>(mouse.global_x));
+    Write(out, static_cast<std::int32_t>(mouse.global_y));
+    Write(out, static_cast<std::int32_t>(mouse.btn));
+    Write(out, PackModifiers(mouse.modifiers));
+}
+template<typename MouseEvent>
+bool ReadMouse(std::ifstream& in, MouseEvent* mouse)
+{
+    std::int32_t values[5] = {0};
+    std::uint8_t mods = 0;
+    if (!Read(in, &values) || !Read(in, &mods))
+        return false;
+    mouse->window_x  = values[0];
+    mouse->window_y  = values[1];
+    mouse->global_x  = values[2];
+    mouse->global_y  = values[3];
+    mouse->btn       = static_cast<wdk::MouseButton>(values[4]);
+    mouse->modifiers = UnpackModifiers(mods);
+    return true;
+}
+
+} // namespace
+
+namespace game
+{
+
+SessionRecorder::SessionRecorder(const std::string& file, wdk::WindowListener* listener)
+  : mOut(base::OpenBinaryOutputStream(file))
+  , mListener(listener)
+{}
+
+void SessionRecorder::WriteHeader(const SessionHeader& header)
+{
+    mOut.write(SessionFileMagic, sizeof(SessionFileMagic));
+    Write(mOut, SessionFileVersion);
+    Write(mOut, static_cast<std::uint32_t>(header.random_seed));
+    Write(mOut, static_cast<std::uint32_t>(header.surface_width));
+    Write(mOut, static_cast<std::uint32_t>(header.surface_height));
+}
+void SessionRecorder::RecordFrame(double wall_time, double time_step)
+{
+    Write(mOut, RecordType::Frame);
+    Write(mOut, wall_time);
+    Write(mOut, time_step);
+}
+void SessionRecorder::RecordSurfaceResize(unsigned width, unsigned height)
+{
+    Write(mOut, RecordType::SurfaceResize);
+    Write(mOut, static_cast<std::uint32_t>(width));
+    Write(mOut, static_cast<std::uint32_t>(height));
+}
+void SessionRecorder::RecordFullScreen(bool fullscreen)
+{
+    Write(mOut, RecordType::FullScreen);
+    Write(mOut, static_cast<std::uint8_t>(fullscreen));
+}
+void SessionRecorder::Close()
+{
+    mOut.flush();
+    mOut.close();
+}
+
+void SessionRecorder::OnWantClose(const wdk::WindowEventWantClose& close)
+{
+    Write(mOut, RecordType::WantClose);
+    if (mListener)
+        mListener->OnWantClose(close);
+}
+void SessionRecorder::OnKeydown(const wdk::WindowEventKeydown& key)
+{
+    WriteKey(mOut, RecordType::KeyDown, key);
+    if (mListener)
+        mListener->OnKeydown(key);
+}
+void SessionRecorder::OnKeyup(const wdk::WindowEventKeyup& key)
+{
+    WriteKey(mOut, RecordType::KeyUp, key);
+    if (mListener)
+        mListener->OnKeyup(key);
+}
+void SessionRecorder::OnChar(const wdk::WindowEventChar& text)
+{
+    // the char event is just a small blob of utf8 so write it as is.
+    Write(mOut, RecordType::Char);
+    Write(mOut, text);
+    if (mListener)
+        mListener->OnChar(text);
+}
+void SessionRecorder::OnMouseMove(const wdk::WindowEventMouseMove& mouse)
+{
+    WriteMouse(mOut, RecordType::MouseMove, mouse);
+    if (mListener)
+        mListener->OnMouseMove(mouse);
+}
+void SessionRecorder::OnMousePress(const wdk::WindowEventMousePress& mouse)
+{
+    WriteMouse(mOut, RecordType::MousePress, mouse);
+    if (mListener)
+        mListener->OnMousePress(mouse);
+}
+void SessionRecorder::OnMouseRelease(const wdk::WindowEventMouseRelease& mouse)
+{
+    WriteMouse(mOut, RecordType::MouseRelease, mouse);
+    if (mListener)
+        mListener->OnMouseRelease(mouse);
+}
+
+SessionPlayer::SessionPlayer(const std::string& file)
+  : mIn(base::OpenBinaryInputStream(file))
+{}
+
+bool SessionPlayer::ReadHeader(SessionHeader* header)
+{
+    char magic[4] = {0};
+    std::uint32_t version = 0;
+    std::uint32_t seed = 0;
+    std::uint32_t width = 0;
+    std::uint32_t height = 0;
+    mIn.read(magic, sizeof(magic));
+    if (mIn.fail() || std::memcmp(magic, SessionFileMagic, sizeof(magic)))
+    {
+        ERROR("Not a session file.");
+        return false;
+    }
+    if (!Read(mIn, &version) || version != SessionFileVersion)
+    {
+        ERROR("Unsupported session file version %1.", version);
+        return false;
+    }
+    if (!Read(mIn, &seed) || !Read(mIn, &width) || !Read(mIn, &height))
+    {
+        ERROR("Session file header is truncated.");
+        return false;
+    }
+    header->random_seed    = seed;
+    header->surface_width  = width;
+    header->surface_height = height;
+    return true;
+}
+
+bool SessionPlayer::NextFrame(App& app, double* wall_time, double* time_step)
+{
+    auto* listener = app.GetWindowListener();
+
+    RecordType type;
+    while (Read(mIn, &type))
+    {
+        bool ok = true;
+        if (type == RecordType::Frame)
+        {
+            return Read(mIn, wall_time) && Read(mIn, time_step);
+        }
+        else if (type == RecordType::SurfaceResize)
+        {
+            std::uint32_t width  = 0;
+            std::uint32_t height = 0;
+            if ((ok = Read(mIn, &width) && Read(mIn, &height)))
+                app.OnRenderingSurfaceResized(width, height);
+        }
+        else if (type == RecordType::FullScreen)
+        {
+            std::uint8_t fullscreen = 0;
+            if ((ok = Read(mIn, &fullscreen)))
+            {
+                if (fullscreen)
+                    app.OnEnterFullScreen();
+                else app.OnLeaveFullScreen();
+            }
+        }
+        else if (type == RecordType::WantClose)
+        {
+            if (listener)
+                listener->OnWantClose(wdk::WindowEventWantClose{});
+        }
+        else if (type == RecordType::KeyDown)
+        {
+            wdk::WindowEventKeydown key;
+            if ((ok = ReadKey(mIn, &key)) && listener)
+                listener->OnKeydown(key);
+        }
+        else if (type == RecordType::KeyUp)
+        {
+            wdk::WindowEventKeyup key;
+            if ((ok = ReadKey(mIn, &key)) && listener)
+                listener->OnKeyup(key);
+        }
+        else if (type == RecordType::Char)
+        {
+            wdk::WindowEventChar text;
+            if ((ok = Read(mIn, &text)) && listener)
+                listener->OnChar(text);
+        }
+        else if (type == RecordType::MouseMove)
+        {
+            wdk::WindowEventMouseMove mouse;
+            if ((ok = ReadMouse(mIn, &mouse)) && listener)
+                listener->OnMouseMove(mouse);
+        }
+        else if (type == RecordType::MousePress)
+        {
+            wdk::WindowEventMousePress mouse;
+            if ((ok = ReadMouse(mIn, &mouse)) && listener)
+                listener->OnMousePress(mouse);
+        }
+        else if (type == RecordType::MouseRelease)
+        {
+            wdk::WindowEventMouseRelease mouse;
+            if ((ok = ReadMouse(mIn, &mouse)) && listener)
+                listener->OnMouseRelease(mouse);
+        }
+        else
+        {
+            ERROR("Unknown session record type %1.", static_cast<int>(type));
+            return false;
+        }
+        if (!ok)
+        {
+            ERROR("Session file is truncated.");
+            return false;
+        }
+    }
+    return false;
+}
+
+FrameTimeStats ComputeFrameTimeStats(std::vector<double> frame_times)
+{
+    FrameTimeStats stats;
+    if (frame_times.empty())
+        return stats;
+
+    std::sort(frame_times.begin(), frame_times.end());
+    // nearest rank percentile.
+    const auto percentile = [&frame_times](double p) {
+        const auto rank = static_cast<size_t>(std::ceil(p * frame_times.size()));
+        return frame_times[std::clamp<size_t>(rank, 1, frame_times.size()) - 1];
+    };
+    stats.num_frames = frame_times.size();
+    stats.total = std::accumulate(frame_times.begin(), frame_times.end(), 0.0);
+    stats.min   = frame_times.front();
+    stats.max   = frame_times.back();
+    stats.mean  = stats.total / frame_times.size();
+    stats.p50   = percentile(0.50);
+    stats.p90   = percentile(0.90);
+    stats.p95   = percentile(0.95);
+    stats.p99   = percentile(0.99);
+    return stats;
+}
+
+} // namespace
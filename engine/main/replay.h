@@ -0,0 +1,127 @@
+// Copyright (C) 2020-2021 Sami Väisänen
+// Copyright (C) 2020-2021 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "config.h"
+
+#include <string>
+#include <fstream>
+#include <vector>
+#include <cstdint>
+
+#include "wdk/events.h"
+#include "wdk/window_listener.h"
+
+namespace game
+{
+    class App;
+
+    // Session files capture everything that goes into the game from the
+    // outside, i.e. the window events, the time steps taken and the seed
+    // for the random number generators. Given the same game build and
+    // content playing back the session file will then reproduce the same
+    // game session.
+    // The file is a simple binary file with a header followed by a
+    // sequence of records. Each record starts with a record type byte
+    // followed by the type specific payload. Everything is written in
+    // the native byte order, the files are not meant to be portable
+    // across platforms.
+
+    // Header of the session file.
+    struct SessionHeader {
+        // the seed for the application's random number generators.
+        unsigned random_seed = 0;
+        // the initial rendering surface size.
+        unsigned surface_width  = 0;
+        unsigned surface_height = 0;
+    };
+
+    // Record the game session into a file. The recorder acts as the
+    // window listener between the actual window and the application
+    // so that it sees the same events as the application. Each event
+    // is written out and then forwarded to the application's listener.
+    class SessionRecorder : public wdk::WindowListener
+    {
+    public:
+        SessionRecorder(const std::string& file, wdk::WindowListener* listener);
+
+        // Returns true if the output file was opened successfully.
+        bool IsOpen() const
+        { return mOut.is_open(); }
+        // Write the header. This must be the first thing written.
+        void WriteHeader(const SessionHeader& header);
+        // Record an iteration of the main loop. Any events recorded
+        // before this call will be dispatched before the frame when
+        // playing back.
+        void RecordFrame(double wall_time, double time_step);
+        void RecordSurfaceResize(unsigned width, unsigned height);
+        void RecordFullScreen(bool fullscreen);
+        // Flush and close the file. This is done automatically when
+        // the recorder is destroyed.
+        void Close();
+
+        // WindowListener implementation.
+        virtual void OnWantClose(const wdk::WindowEventWantClose& close) override;
+        virtual void OnKeydown(const wdk::WindowEventKeydown& key) override;
+        virtual void OnKeyup(const wdk::WindowEventKeyup& key) override;
+        virtual void OnChar(const wdk::WindowEventChar& text) override;
+        virtual void OnMouseMove(const wdk::WindowEventMouseMove& mouse) override;
+        virtual void OnMousePress(const wdk::WindowEventMousePress& mouse) override;
+        virtual void OnMouseRelease(const wdk::WindowEventMouseRelease& mouse) override;
+    private:
+        std::ofstream mOut;
+        wdk::WindowListener* mListener = nullptr;
+    };
+
+    // Play back a game session from a file recorded earlier with
+    // the SessionRecorder.
+    class SessionPlayer
+    {
+    public:
+        SessionPlayer(const std::string& file);
+
+        // Returns true if the input file was opened successfully.
+        bool IsOpen() const
+        { return mIn.is_open(); }
+        // Read the header. This must be the first thing read. Returns
+        // false if the file is not a valid session file.
+        bool ReadHeader(SessionHeader* header);
+        // Read and dispatch the recorded events to the application up to
+        // the next recorded frame and then return the time values for the
+        // frame. Returns false when there are no more frames.
+        bool NextFrame(App& app, double* wall_time, double* time_step);
+    private:
+        std::ifstream mIn;
+    };
+
+    // Some simple statistics about the frame times of a session.
+    struct FrameTimeStats {
+        unsigned num_frames = 0;
+        double total = 0.0;
+        double min = 0.0;
+        double max = 0.0;
+        double mean = 0.0;
+        // percentiles.
+        double p50 = 0.0;
+        double p90 = 0.0;
+        double p95 = 0.0;
+        double p99 = 0.0;
+    };
+    // Compute the statistics from a series of frame times (in seconds).
+    FrameTimeStats ComputeFrameTimeStats(std::vector<double> frame_times);
+
+} // namespace
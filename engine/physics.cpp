@@ -17,9 +17,14 @@
 #include "config.h"
 
 #include <algorithm>
+#include <iterator>
+#include <limits>
+#include <cstdint>
+#include <cmath>
 
 #include "base/logging.h"
 #include "base/math.h"
+#include "base/threadpool.h"
 #include "graphics/transform.h"
 #include "graphics/painter.h"
 #include "graphics/drawable.h"
@@ -76,25 +81,14 @@ void PhysicsEngine::UpdateScene(Scene& scene)
         transform.Pop();
     }
     // cull physics nodes that were not touched.
-    for (auto it = mNodes.begin(); it != mNodes.end();)
+    for (const auto& pair : mNodes)
     {
-        auto& node = it->second;
-        if (node.alive)
-        {
-            ++it;
-            continue;
-        }
-        DEBUG("Deleting physics node '%1'", node.debug_name);
-
-        b2Fixture* fixture_list_head = node.world_body->GetFixtureList();
-        while (fixture_list_head) {
-            mFixtures.erase(fixture_list_head);
-            fixture_list_head = fixture_list_head->GetNext();
-        }
-        mWorld->DestroyBody(node.world_body);
-
-        it = mNodes.erase(it);
+        if (!pair.second.alive)
+            mKillList.push_back(pair.first);
     }
+    // apply all the creates and deletes found during the update
+    // in one go instead of doing them one by one while traversing.
+    FlushBodies();
 }
 
 void PhysicsEngine::UpdateEntity(Entity& entity)
@@ -102,6 +96,7 @@ void PhysicsEngine::UpdateEntity(Entity& entity)
     Transform transform;
     transform.Scale(glm::vec2(1.0f, 1.0f) / mScale);
     UpdateEntity(transform.GetAsMatrix(), entity);
+    FlushBodies();
 }
 
 void PhysicsEngine::Tick(std::vector<ContactEvent>* contacts)
@@ -119,17 +114,7 @@ void PhysicsEngine::Tick(std::vector<ContactEvent>* contacts)
         virtual void BeginContact(b2Contact* contact) override
         {
             //DEBUG("BeginContact");
-            auto* A = contact->GetFixtureA();
-            auto* B = contact->GetFixtureB();
-            ASSERT(mEngine.mFixtures.find(A) != mEngine.mFixtures.end());
-            ASSERT(mEngine.mFixtures.find(B) != mEngine.mFixtures.end());
-            ContactEvent event;
-            event.type = ContactEvent::Type::BeginContact;
-            event.nodeA = mEngine.mFixtures[A];
-            event.nodeB = mEngine.mFixtures[B];
-            event.entityA = mEngine.mNodes[event.nodeA].entity;
-            event.entityB = mEngine.mNodes[event.nodeB].entity;
-            mContacts->push_back(std::move(event));
+            ReportContact(contact, ContactEvent::Type::BeginContact);
         }
 
         // This is called when two fixtures cease to overlap.
@@ -139,17 +124,7 @@ void PhysicsEngine::Tick(std::vector<ContactEvent>* contacts)
         virtual void EndContact(b2Contact* contact) override
         {
             //DEBUG("EndContact");
-            auto* A = contact->GetFixtureA();
-            auto* B = contact->GetFixtureB();
-            ASSERT(mEngine.mFixtures.find(A) != mEngine.mFixtures.end());
-            ASSERT(mEngine.mFixtures.find(B) != mEngine.mFixtures.end());
-            ContactEvent event;
-            event.type = ContactEvent::Type::EndContact;
-            event.nodeA = mEngine.mFixtures[A];
-            event.nodeB = mEngine.mFixtures[B];
-            event.entityA = mEngine.mNodes[event.nodeA].entity;
-            event.entityB = mEngine.mNodes[event.nodeB].entity;
-            mContacts->push_back(std::move(event));
+            ReportContact(contact, ContactEvent::Type::EndContact);
         }
 
         // This is called after collision detection, but before collision resolution.
@@ -166,47 +141,332 @@ void PhysicsEngine::Tick(std::vector<ContactEvent>* contacts)
         // If you don't care about the impulses, you should probably just implement the pre-solve event.
         virtual void PostSolve(b2Contact* contact, const b2ContactImpulse* impulse) override
         { }
+    private:
+        void ReportContact(b2Contact* contact, ContactEvent::Type type)
+        {
+            auto* A = contact->GetFixtureA();
+            auto* B = contact->GetFixtureB();
+            // check the subscriptions first using only the filter data
+            // that is already in the fixtures so that the contacts nobody
+            // cares about never cost us any string lookups or copies.
+            if (!mEngine.IsSubscribed(A->GetFilterData().categoryBits,
+                                      B->GetFilterData().categoryBits))
+                return;
+            auto itA = mEngine.mFixtures.find(A);
+            auto itB = mEngine.mFixtures.find(B);
+            ASSERT(itA != mEngine.mFixtures.end());
+            ASSERT(itB != mEngine.mFixtures.end());
+            ContactEvent event;
+            event.type   = type;
+            event.sensor = A->IsSensor() || B->IsSensor();
+            event.nodeA  = itA->second;
+            event.nodeB  = itB->second;
+            // careful, with partitions this runs concurrently on
+            // several threads so only lookups are allowed here.
+            event.entityA = mEngine.mNodes.find(event.nodeA)->second.entity;
+            event.entityB = mEngine.mNodes.find(event.nodeB)->second.entity;
+            mContacts->push_back(std::move(event));
+        }
     private:
         PhysicsEngine& mEngine;
         std::vector<ContactEvent>* mContacts = nullptr;
     };
+
+    // apply any pending deletes before stepping.
+    FlushBodies();
+
+    if (mWorlds.size() == 1)
+    {
+        ContactListener listener(*this, contacts);
+        auto& world = mWorlds[0];
+        world->SetContactListener(contacts ? &listener : (b2ContactListener*)nullptr);
+        world->Step(mTimestep, mNumVelocityIterations, mNumPositionIterations);
+        world->SetContactListener(nullptr);
+        return;
+    }
+
+    // The partitions are completely independent worlds so they can be
+    // stepped on any thread in any order and the result is still the same.
+    // The contacts are collected per partition and then combined in the
+    // partition order so that they're also reported in the same order
+    // every time.
+    // Note that Box2D has a few global statistics counters (b2_gjkCalls
+    // etc.) that get bumped from every world without any synchronization,
+    // but nothing uses them for anything.
+    mPartitionContacts.resize(mWorlds.size());
+    const auto step = [this, contacts](std::size_t begin, std::size_t end, unsigned) {
+        for (std::size_t i=begin; i<end; ++i)
+        {
+            auto& events = mPartitionContacts[i];
+            events.clear();
+            ContactListener listener(*this, &events);
+            auto& world = mWorlds[i];
+            world->SetContactListener(contacts ? &listener : (b2ContactListener*)nullptr);
+            world->Step(mTimestep, mNumVelocityIterations, mNumPositionIterations);
+            world->SetContactListener(nullptr);
+        }
+    };
+    if (mThreadPool)
+        mThreadPool->ParallelFor(mWorlds.size(), 1, step);
+    else step(0, mWorlds.size(), 0);
+
+    if (contacts)
+    {
+        for (auto& events : mPartitionContacts)
+        {
+            std::move(events.begin(), events.end(), std::back_inserter(*contacts));
+            events.clear();
+        }
+    }
+    // the contacts of the bodies that are handed off end in the old world
+    // and get reported after the contacts from the step.
     ContactListener listener(*this, contacts);
+    HandoffBodies(contacts ? &listener : nullptr);
+}
 
-    mWorld->SetContactListener(contacts ? &listener : (b2ContactListener*)nullptr);
-    mWorld->Step(mTimestep, mNumVelocityIterations, mNumPositionIterations);
-    mWorld->SetContactListener(nullptr);
+unsigned PhysicsEngine::FindPartition(float x) const
+{
+    if (mPartitionWidth <= 0.0f)
+        return 0;
+    const auto last  = static_cast<int>(mWorlds.size()) - 1;
+    const auto index = static_cast<int>(std::floor((x - mPartitionOrigin) / mPartitionWidth));
+    return static_cast<unsigned>(std::clamp(index, 0, last));
+}
+
+void PhysicsEngine::CreatePartitions()
+{
+    const b2Vec2 gravity(mGravity.x, mGravity.y);
+
+    mWorlds.clear();
+    mPartitionContacts.clear();
+    mPartitionOrigin = 0.0f;
+    mPartitionWidth  = 0.0f;
+    for (unsigned i=0; i<mNumPartitions; ++i)
+        mWorlds.push_back(std::make_unique<b2World>(gravity));
+    if (mWorlds.size() == 1)
+        return;
+
+    // find the extents of the level from all the bodies. the static
+    // bodies count too since they're what usually spans the level
+    // (the ground, walls etc.) and the moving bodies will end up
+    // moving around inside the level.
+    float min_x = std::numeric_limits<float>::max();
+    float max_x = std::numeric_limits<float>::lowest();
+    for (const auto& spawn : mSpawnList)
+    {
+        const FBox box(spawn.model_to_world);
+        const auto center = box.GetCenter().x;
+        const auto radius = glm::length(box.GetSize()) * 0.5f;
+        min_x = std::min(min_x, center - radius);
+        max_x = std::max(max_x, center + radius);
+    }
+    if (mPartitionWidthHint > 0.0f)
+    {
+        // use the given width and center the strips on the level.
+        const auto center = max_x >= min_x ? (min_x + max_x) * 0.5f : 0.0f;
+        mPartitionWidth  = mPartitionWidthHint;
+        mPartitionOrigin = center - mPartitionWidth * mWorlds.size() * 0.5f;
+    }
+    else if (max_x > min_x)
+    {
+        // split the level into equal strips.
+        mPartitionOrigin = min_x;
+        mPartitionWidth  = (max_x - min_x) / mWorlds.size();
+    }
+    else
+    {
+        WARN("No bodies to figure out the physics partition width from. Set the partition width explicitly.");
+    }
+    DEBUG("Created %1 physics partitions %2 units wide.", mWorlds.size(), mPartitionWidth);
+}
+
+void PhysicsEngine::HandoffBodies(b2ContactListener* listener)
+{
+    if (mPartitionWidth <= 0.0f)
+        return;
+
+    // find the moving bodies that have left their partition. Don't move
+    // them while walking the body lists, that would break the walk.
+    // The moves are done in the partition and body list order which
+    // is the same every time, so the handoff is deterministic too.
+    std::vector<std::pair<b2Body*, unsigned>> moves;
+    for (unsigned i=0; i<mWorlds.size(); ++i)
+    {
+        const auto strip_min = mPartitionOrigin + i * mPartitionWidth;
+        const auto strip_max = strip_min + mPartitionWidth;
+        // only move once the body is clearly over the border in order to
+        // avoid bodies that rest on the border bouncing between the worlds.
+        const auto margin = mPartitionWidth * 0.05f;
+        for (b2Body* body = mWorlds[i]->GetBodyList(); body; body = body->GetNext())
+        {
+            if (body->GetType() == b2_staticBody)
+                continue;
+            const auto x = body->GetPosition().x;
+            if (x >= strip_min - margin && x <= strip_max + margin)
+                continue;
+            const auto target = FindPartition(x);
+            if (target != i)
+                moves.push_back({body, target});
+        }
+    }
+
+    for (const auto& move : moves)
+    {
+        b2Body* old_body = move.first;
+        b2Fixture* fixture = old_body->GetFixtureList();
+        auto it = mFixtures.find(fixture);
+        ASSERT(it != mFixtures.end());
+        auto& node = mNodes[it->second];
+
+        b2BodyDef def;
+        def.type            = old_body->GetType();
+        def.position        = old_body->GetPosition();
+        def.angle           = old_body->GetAngle();
+        def.linearVelocity  = old_body->GetLinearVelocity();
+        def.angularVelocity = old_body->GetAngularVelocity();
+        def.linearDamping   = old_body->GetLinearDamping();
+        def.angularDamping  = old_body->GetAngularDamping();
+        def.allowSleep      = old_body->IsSleepingAllowed();
+        def.awake           = old_body->IsAwake();
+        def.fixedRotation   = old_body->IsFixedRotation();
+        def.bullet          = old_body->IsBullet();
+        def.enabled         = old_body->IsEnabled();
+        def.gravityScale    = old_body->GetGravityScale();
+        b2Body* new_body = mWorlds[move.second]->CreateBody(&def);
+        for (; fixture; fixture = fixture->GetNext())
+        {
+            b2FixtureDef fixture_def;
+            fixture_def.shape       = fixture->GetShape();
+            fixture_def.density     = fixture->GetDensity();
+            fixture_def.friction    = fixture->GetFriction();
+            fixture_def.restitution = fixture->GetRestitution();
+            fixture_def.isSensor    = fixture->IsSensor();
+            fixture_def.filter      = fixture->GetFilterData();
+            mFixtures[new_body->CreateFixture(&fixture_def)] = node.node;
+        }
+        // destroying the body ends its contacts in the old world. Box2D
+        // calls EndContact for each touching contact so let the listener
+        // report them. the fixtures must still be mapped to the node
+        // for that. new contacts will begin in the new world on the next step.
+        std::vector<b2Fixture*> old_fixtures;
+        for (fixture = old_body->GetFixtureList(); fixture; fixture = fixture->GetNext())
+            old_fixtures.push_back(fixture);
+
+        b2World* old_world = old_body->GetWorld();
+        old_world->SetContactListener(listener);
+        old_world->DestroyBody(old_body);
+        old_world->SetContactListener(nullptr);
+        for (auto* old : old_fixtures)
+            mFixtures.erase(old);
+        node.world_body = new_body;
+    }
+}
+
+void PhysicsEngine::SubscribeContacts(unsigned categoryA, unsigned categoryB)
+{
+    ContactSubscription sub;
+    sub.categoryA = categoryA & 0xffff;
+    sub.categoryB = categoryB & 0xffff;
+    // scripts will likely subscribe every time the level starts
+    // so don't let the same subscription pile up.
+    for (const auto& old : mContactSubscriptions)
+    {
+        if (old.categoryA == sub.categoryA && old.categoryB == sub.categoryB)
+            return;
+    }
+    mContactSubscriptions.push_back(sub);
+}
+
+void PhysicsEngine::ClearContactSubscriptions()
+{
+    mContactSubscriptions.clear();
+}
+
+bool PhysicsEngine::IsSubscribed(unsigned categoryA, unsigned categoryB) const
+{
+    if (mContactSubscriptions.empty())
+        return true;
+    for (const auto& sub : mContactSubscriptions)
+    {
+        if ((categoryA & sub.categoryA) && (categoryB & sub.categoryB))
+            return true;
+        if ((categoryA & sub.categoryB) && (categoryB & sub.categoryA))
+            return true;
+    }
+    return false;
 }
 
 void PhysicsEngine::DeleteAll()
 {
     for (auto& node : mNodes)
     {
-        mWorld->DestroyBody(node.second.world_body);
+        for (auto* copy : node.second.static_copies)
+            copy->GetWorld()->DestroyBody(copy);
+        node.second.world_body->GetWorld()->DestroyBody(node.second.world_body);
     }
     mNodes.clear();
     mFixtures.clear();
+    mSpawnList.clear();
+    mKillList.clear();
 }
 
 void PhysicsEngine::DeleteBody(const std::string& id)
+{
+    mKillList.push_back(id);
+}
+void PhysicsEngine::DeleteBody(const EntityNode& node)
+{
+    DeleteBody(node.GetId());
+}
+
+void PhysicsEngine::DestroyBody(const std::string& id)
 {
     auto it = mNodes.find(id);
     if (it == mNodes.end())
         return;
     auto& node = it->second;
 
+    for (auto* copy : node.static_copies)
+    {
+        for (auto* fixture = copy->GetFixtureList(); fixture; fixture = fixture->GetNext())
+            mFixtures.erase(fixture);
+        copy->GetWorld()->DestroyBody(copy);
+    }
     b2Fixture* fixture = node.world_body->GetFixtureList();
     while (fixture)
     {
         mFixtures.erase(fixture);
         fixture = fixture->GetNext();
     }
-    mWorld->DestroyBody(node.world_body);
+    DEBUG("Deleting physics node '%1'", node.debug_name);
+    node.world_body->GetWorld()->DestroyBody(node.world_body);
 
     mNodes.erase(it);
 }
-void PhysicsEngine::DeleteBody(const EntityNode& node)
+
+void PhysicsEngine::FlushBodies()
+{
+    for (const auto& id : mKillList)
+        DestroyBody(id);
+    mKillList.clear();
+
+    if (mSpawnList.empty())
+        return;
+
+    mNodes.reserve(mNodes.size() + mSpawnList.size());
+    mFixtures.reserve(mFixtures.size() + mSpawnList.size());
+    for (const auto& spawn : mSpawnList)
+        AddEntityNode(spawn.model_to_world, *spawn.entity, *spawn.node);
+    mSpawnList.clear();
+}
+
+void PhysicsEngine::QueueEntityNode(const glm::mat4& model_to_world, const Entity& entity, const EntityNode& node)
 {
-    DeleteBody(node->GetId());
+    BodyRequest request;
+    request.model_to_world = model_to_world;
+    request.entity = &entity;
+    request.node   = &node;
+    mSpawnList.push_back(request);
 }
 
 void PhysicsEngine::ApplyImpulseToCenter(const std::string& id, const glm::vec2& impulse) const
@@ -234,11 +494,15 @@ void PhysicsEngine::ApplyImpulseToCenter(const EntityNode& node, const glm::vec2
 
 void PhysicsEngine::CreateWorld(const Scene& scene)
 {
-    const b2Vec2 gravity(mGravity.x, mGravity.y);
-
     mNodes.clear();
-    mWorld.reset();
-    mWorld = std::make_unique<b2World>(gravity);
+    mFixtures.clear();
+    mSpawnList.clear();
+    mKillList.clear();
+    // the polygon classes could have changed since.
+    mPolygonHulls.clear();
+    mPolygonShapes.clear();
+    mPolygonShapeIndex.clear();
+    mWorlds.clear();
 
     Transform transform;
     transform.Scale(glm::vec2(1.0f, 1.0f) / mScale);
@@ -250,75 +514,164 @@ void PhysicsEngine::CreateWorld(const Scene& scene)
           AddEntity(transform.GetAsMatrix(), *node.entity);
         transform.Pop();
     }
+    // the partitions are laid out based on where the bodies are
+    // so they can only be created once all bodies are known.
+    CreatePartitions();
+    FlushBodies();
 }
 
 void PhysicsEngine::CreateWorld(const Entity& entity)
 {
-    const b2Vec2 gravity(mGravity.x, mGravity.y);
-
     mNodes.clear();
-    mWorld.reset();
-    mWorld = std::make_unique<b2World>(gravity);
+    mFixtures.clear();
+    mSpawnList.clear();
+    mKillList.clear();
+    mPolygonHulls.clear();
+    mPolygonShapes.clear();
+    mPolygonShapeIndex.clear();
+    mWorlds.clear();
 
     Transform transform;
     transform.Scale(glm::vec2(1.0f, 1.0f) / mScale);
     AddEntity(transform.GetAsMatrix(), entity);
+    CreatePartitions();
+    FlushBodies();
 }
 
 #if defined(GAMESTUDIO_ENABLE_PHYSICS_DEBUG)
-void PhysicsEngine::DebugDrawObjects(gfx::Painter& painter, gfx::Transform& view)
+void PhysicsEngine::DebugDrawObjects(gfx::Painter& painter, gfx::Transform& view, const DebugDrawOptions& options)
 {
-    auto mat = gfx::CreateMaterialFromColor(gfx::Color::HotPink);
-    mat.SetSurfaceType(gfx::MaterialClass::SurfaceType::Transparent);
-    mat.SetBaseAlpha(0.6);
-
-    view.Push();
-    view.Scale(mScale);
-
     // there's b2Draw api for debug drawing but it seems that
     // when wanting to debug the *game* (not the physics engine
     // integration issues itself) this is actually more straightforward
     // than using the b2Draw way of visualizing the physics world.
-    for (const auto& p : mNodes)
-    {
-        const auto& physics_node = p.second;
-        const float angle = physics_node.world_body->GetAngle();
-        const b2Vec2& pos = physics_node.world_body->GetPosition();
-
-        view.Push();
-        view.Rotate(angle);
-        view.Translate(pos.x, pos.y);
-
-        view.Push();
-        view.Scale(physics_node.world_extents);
-        view.Translate(physics_node.world_extents * -0.5f);
-
-        if (physics_node.shape == (unsigned)RigidBodyItemClass::CollisionShape::Box)
-            painter.Draw(gfx::Rectangle(), view, mat);
-        else if (physics_node.shape == (unsigned)RigidBodyItemClass::CollisionShape::Circle)
-            painter.Draw(gfx::Circle(), view, mat);
-        else if (physics_node.shape == (unsigned)RigidBodyItemClass::CollisionShape::SemiCircle)
-            painter.Draw(gfx::SemiCircle(), view, mat);
-        else if (physics_node.shape == (unsigned)RigidBodyItemClass::CollisionShape::RightTriangle)
-            painter.Draw(gfx::RightTriangle(), view, mat);
-        else if (physics_node.shape == (unsigned)RigidBodyItemClass::CollisionShape::IsoscelesTriangle)
-            painter.Draw(gfx::IsoscelesTriangle(), view, mat);
-        else if (physics_node.shape == (unsigned)RigidBodyItemClass::CollisionShape::Trapezoid)
-            painter.Draw(gfx::Trapezoid(), view, mat);
-        else if (physics_node.shape == (unsigned)RigidBodyItemClass::CollisionShape::Parallelogram)
-            painter.Draw(gfx::Parallelogram(), view, mat);
-        else if (physics_node.shape == (unsigned)RigidBodyItemClass::CollisionShape::Polygon) {
-            const auto& klass = mLoader->FindDrawableClassById(physics_node.polygonId);
-            if (klass == nullptr) {
-                WARN("No polygon class found for node '%1'", physics_node.debug_name);
-            } else {
-                auto poly = gfx::CreateDrawableInstance(klass);
-                painter.Draw(*poly, view, mat);
+    // Everything is expressed as lines in the physics world coordinates
+    // and collected into a single dynamic line list so that the whole
+    // world is just one draw call instead of one per body.
+    if (!mDebugLines)
+    {
+        mDebugLines = std::make_shared<gfx::PolygonClass>();
+        mDebugLines->SetDynamic(true);
+    }
+    std::vector<gfx::Vertex> lines;
+
+    // the vertex array shader flips the y axis (model space is in the
+    // lower right quadrant) so flip here as well to cancel it out.
+    const auto AddLine = [&lines](const b2Vec2& a, const b2Vec2& b) {
+        gfx::Vertex v;
+        v.aPosition = gfx::Vec2 { a.x, -a.y };
+        lines.push_back(v);
+        v.aPosition = gfx::Vec2 { b.x, -b.y };
+        lines.push_back(v);
+    };
+    const auto DrawLines = [&](const gfx::Color4f& color) {
+        if (lines.empty())
+            return;
+        mDebugLines->ClearDrawCommands();
+        mDebugLines->ClearVertices();
+        gfx::PolygonClass::DrawCommand cmd;
+        cmd.type   = gfx::PolygonClass::DrawType::Lines;
+        cmd.offset = 0;
+        cmd.count  = lines.size();
+        mDebugLines->AddDrawCommand(std::move(lines), cmd);
+        lines.clear();
+
+        auto mat = gfx::CreateMaterialFromColor(color);
+        mat.SetSurfaceType(gfx::MaterialClass::SurfaceType::Transparent);
+        mat.SetBaseAlpha(0.8);
+        gfx::Polygon poly(mDebugLines);
+        poly.SetCulling(gfx::Drawable::Culling::None);
+        painter.Draw(poly, view, mat);
+    };
+
+    view.Push();
+    view.Scale(mScale);
+
+    if (options.shapes)
+    {
+        for (const auto& p : mNodes)
+        {
+            const auto* body = p.second.world_body;
+            const auto& xf = body->GetTransform();
+            for (const auto* fixture = body->GetFixtureList(); fixture; fixture = fixture->GetNext())
+            {
+                const auto* shape = fixture->GetShape();
+                if (shape->GetType() == b2Shape::e_polygon)
+                {
+                    const auto* poly = static_cast<const b2PolygonShape*>(shape);
+                    for (int i=0; i<poly->m_count; ++i)
+                    {
+                        const auto& a = b2Mul(xf, poly->m_vertices[i]);
+                        const auto& b = b2Mul(xf, poly->m_vertices[(i + 1) % poly->m_count]);
+                        AddLine(a, b);
+                    }
+                }
+                else if (shape->GetType() == b2Shape::e_circle)
+                {
+                    const auto* circle = static_cast<const b2CircleShape*>(shape);
+                    const auto& center = b2Mul(xf, circle->m_p);
+                    const float radius = circle->m_radius;
+                    const unsigned segments = 16;
+                    for (unsigned i=0; i<segments; ++i)
+                    {
+                        const float a0 = math::Pi * 2.0f * i / segments;
+                        const float a1 = math::Pi * 2.0f * (i + 1) / segments;
+                        AddLine(center + radius * b2Vec2(std::cos(a0), std::sin(a0)),
+                                center + radius * b2Vec2(std::cos(a1), std::sin(a1)));
+                    }
+                    // a line from the center to visualize the rotation.
+                    AddLine(center, center + radius * xf.q.GetXAxis());
+                }
             }
-        } else BUG("!unhandled collision shape for debug drawing.");
+        }
+        DrawLines(gfx::Color::HotPink);
+    }
 
-        view.Pop();
-        view.Pop();
+    if (options.aabbs)
+    {
+        for (const auto& p : mNodes)
+        {
+            const auto* body = p.second.world_body;
+            for (const auto* fixture = body->GetFixtureList(); fixture; fixture = fixture->GetNext())
+            {
+                const auto& aabb = fixture->GetAABB(0);
+                const b2Vec2 top_left(aabb.lowerBound.x, aabb.lowerBound.y);
+                const b2Vec2 top_right(aabb.upperBound.x, aabb.lowerBound.y);
+                const b2Vec2 bot_left(aabb.lowerBound.x, aabb.upperBound.y);
+                const b2Vec2 bot_right(aabb.upperBound.x, aabb.upperBound.y);
+                AddLine(top_left, top_right);
+                AddLine(top_right, bot_right);
+                AddLine(bot_right, bot_left);
+                AddLine(bot_left, top_left);
+            }
+        }
+        DrawLines(gfx::Color::Cyan);
+    }
+
+    if (options.contacts)
+    {
+        // draw a small cross at each contact point and a line
+        // along the contact normal.
+        const float size = 0.1f;
+        for (const auto& world : mWorlds)
+        {
+            for (auto* contact = world->GetContactList(); contact; contact = contact->GetNext())
+            {
+                if (!contact->IsTouching())
+                    continue;
+                b2WorldManifold manifold;
+                contact->GetWorldManifold(&manifold);
+                const auto num_points = contact->GetManifold()->pointCount;
+                for (int i=0; i<num_points; ++i)
+                {
+                    const auto& point = manifold.points[i];
+                    AddLine(point - b2Vec2(size, size), point + b2Vec2(size, size));
+                    AddLine(point - b2Vec2(size, -size), point + b2Vec2(size, -size));
+                    AddLine(point, point + 4.0f * size * manifold.normal);
+                }
+            }
+        }
+        DrawLines(gfx::Color::Yellow);
     }
     view.Pop();
 }
@@ -353,25 +706,37 @@ void PhysicsEngine::UpdateEntity(const glm::mat4& model_to_world, Entity& entity
                 // no node, no rigid body, nothing to do.
                 if (!node->HasRigidBody())
                     return;
-                // add a new rigid body based on this node.
+                // queue a new rigid body to be created based on this node.
+                // the body is created from the node's current state so
+                // there's nothing to update until the next time.
                 mTransform.Push(node->GetModelTransform());
-                    mEngine.AddEntityNode(mTransform.GetAsMatrix(), mEntity, *node);
+                    mEngine.QueueEntityNode(mTransform.GetAsMatrix(), mEntity, *node);
                 mTransform.Pop();
+                return;
             }
-            else
+            else if (!node->HasRigidBody())
             {
                 // physics node has been created before but the rigid body
                 // was removed from the node. erase the physics node.
-                if (!node->HasRigidBody())
-                {
-                    mEngine.mWorld->DestroyBody(it->second.world_body);
-                    mEngine.mNodes.erase(it);
-                    return;
-                }
+                mEngine.mKillList.push_back(it->first);
+                return;
             }
 
             auto& physics_node = it->second;
             physics_node.alive = true;
+
+            // the collision filtering can be changed at runtime.
+            const auto* item = node->GetRigidBody();
+            b2Filter filter = physics_node.world_body->GetFixtureList()->GetFilterData();
+            if (filter.categoryBits != item->GetCollisionCategory() ||
+                filter.maskBits != item->GetCollisionMask())
+            {
+                filter.categoryBits = static_cast<std::uint16_t>(item->GetCollisionCategory());
+                filter.maskBits     = static_cast<std::uint16_t>(item->GetCollisionMask());
+                physics_node.world_body->GetFixtureList()->SetFilterData(filter);
+                for (auto* copy : physics_node.static_copies)
+                    copy->GetFixtureList()->SetFilterData(filter);
+            }
             if (physics_node.world_body->GetType() == b2BodyType::b2_staticBody)
             {
                 auto* body = physics_node.world_body;
@@ -382,6 +747,8 @@ void PhysicsEngine::UpdateEntity(const glm::mat4& model_to_world, Entity& entity
                     const FBox box(mTransform.GetAsMatrix());
                     const auto& node_pos_in_world   = box.GetCenter();
                     body->SetTransform(b2Vec2(node_pos_in_world.x, node_pos_in_world.y), box.GetRotation());
+                    for (auto* copy : physics_node.static_copies)
+                        copy->SetTransform(b2Vec2(node_pos_in_world.x, node_pos_in_world.y), box.GetRotation());
                 mTransform.Pop();
             }
             else
@@ -471,7 +838,7 @@ void PhysicsEngine::AddEntity(const glm::mat4& model_to_world, const Entity& ent
                 return;
 
             mTransform.Push(node->GetModelTransform());
-            mEngine.AddEntityNode(mTransform.GetAsMatrix(), mEntity, *node);
+            mEngine.QueueEntityNode(mTransform.GetAsMatrix(), mEntity, *node);
             mTransform.Pop();
         }
         virtual void LeaveNode(const EntityNode* node) override
@@ -514,17 +881,17 @@ void PhysicsEngine::AddEntityNode(const glm::mat4& model_to_world, const Entity&
     body_def.angularDamping = body->GetAngularDamping();
     body_def.linearDamping  = body->GetLinearDamping();
     body_def.enabled        = body->TestFlag(RigidBodyItem::Flags::Enabled);
-    body_def.bullet         = body->TestFlag(RigidBodyItem::Flags::Bullet);
+    // sensors never take part in the continuous collision (time of impact)
+    // solving so there's no point paying for bullet handling for them.
+    body_def.bullet         = body->TestFlag(RigidBodyItem::Flags::Bullet) &&
+                             !body->TestFlag(RigidBodyItem::Flags::Sensor);
     body_def.fixedRotation  = body->TestFlag(RigidBodyItem::Flags::DiscardRotation);
     body_def.allowSleep     = body->TestFlag(RigidBodyItem::Flags::CanSleep);
-    b2Body* world_body = mWorld->CreateBody(&body_def);
-    const auto& velo = body->GetLinearVelocity();
-    // set initial velocities.
-    world_body->SetLinearVelocity(b2Vec2(velo.x, velo.y));
-    world_body->SetAngularVelocity(body->GetAngularVelocity());
 
     // collision shape used for collision resolver for the body.
     std::unique_ptr<b2Shape> collision_shape;
+    // the polygon shapes come from the shape cache.
+    const b2Shape* shared_shape = nullptr;
     std::string polygonId;
     if (body->GetCollisionShape() == RigidBodyItemClass::CollisionShape::Box)
     {
@@ -611,60 +978,27 @@ void PhysicsEngine::AddEntityNode(const glm::mat4& model_to_world, const Entity&
             WARN("Rigid body '%1' has no polygon shape id set.", debug_name);
             return;
         }
-        const auto& drawable = mLoader->FindDrawableClassById(polygonId);
-        if (!drawable || drawable->GetType() != gfx::DrawableClass::Type::Polygon) {
-            WARN("No polygon class found for rigid body '%1'.", debug_name);
+        shared_shape = FindPolygonShape(polygonId, node_size_in_world, debug_name);
+        if (shared_shape == nullptr)
             return;
-        }
-        const auto& polygon = std::static_pointer_cast<const gfx::PolygonClass>(drawable);
-        const float width   = node_size_in_world.x;
-        const float height  = node_size_in_world.y;
-        std::vector<b2Vec2> verts;
-        for (size_t i=0; i<polygon->GetNumVertices(); ++i)
-        {
-            const auto& vertex = polygon->GetVertex(i);
-            // polygon vertices are in normalized coordinate space in the lower
-            // right quadrant, i.e. x = [0, 1] and y = [0, -1], flip about x axis
-            const auto x = vertex.aPosition.x * width;
-            const auto y = vertex.aPosition.y * height * -1.0;
-            b2Vec2 v2;
-            // offset the vertices to be around origin.
-            // the vertices must be relative to the body when the shape
-            // is attached to a body.
-            v2.x = x - width * 0.5f;
-            v2.y = y - height * 0.5f;
-            verts.push_back(v2);
-        }
-        // invert the order of polygons in order to invert the winding
-        // oder. This is done because of the flip around axis inverts
-        // the winding order
-        std::reverse(verts.begin(), verts.end());
-
-        // it's possible that the set of vertices for a convex hull has
-        // less vertices than the polygon itself. I'm not sure how Box2D
-        // will behave when the number of vertices exceeds b2_maxPolygonVertices.
-        // Finding the convex hull here can at least help us discard some
-        // irrelevant vertices already.
-        verts = math::FindConvexHull(verts);
-        // still too many?
-        if (verts.size() > b2_maxPolygonVertices) {
-            // todo: deal with situation when we have more than b2_maxPolygonVertices (8?)
-            WARN("The convex hull for rigid body '%1' has too many vertices.", debug_name);
-        }
-
-        auto poly = std::make_unique<b2PolygonShape>();
-        poly->Set(&verts[0], verts.size());
-        // todo: radius??
-        collision_shape = std::move(poly);
     }
 
+    const auto partition = FindPartition(node_pos_in_world.x);
+    b2Body* world_body = mWorlds[partition]->CreateBody(&body_def);
+    const auto& velo = body->GetLinearVelocity();
+    // set initial velocities.
+    world_body->SetLinearVelocity(b2Vec2(velo.x, velo.y));
+    world_body->SetAngularVelocity(body->GetAngularVelocity());
+
     // fixture attaches a collision shape to the body.
     b2FixtureDef fixture;
-    fixture.shape       = collision_shape.get();
+    fixture.shape       = shared_shape ? shared_shape : collision_shape.get();
     fixture.density     = body->GetDensity();
     fixture.friction    = body->GetFriction();
     fixture.restitution = body->GetRestitution();
     fixture.isSensor    = body->TestFlag(RigidBodyItem::Flags::Sensor);
+    fixture.filter.categoryBits = static_cast<std::uint16_t>(body->GetCollisionCategory());
+    fixture.filter.maskBits     = static_cast<std::uint16_t>(body->GetCollisionMask());
     b2Fixture* fixture_ptr = world_body->CreateFixture(&fixture);
 
     PhysicsNode physics_node;
@@ -676,9 +1010,119 @@ void PhysicsEngine::AddEntityNode(const glm::mat4& model_to_world, const Entity&
     physics_node.polygonId     = polygonId;
     physics_node.shape         = (unsigned)body->GetCollisionShape();
 
-    mNodes[node.GetId()]   = physics_node;
+    // static bodies don't move by themselves so simply copy them into
+    // all the other partitions they overlap with in order to have the
+    // moving bodies in those partitions collide with them too.
+    if (body_def.type == b2_staticBody && mWorlds.size() > 1)
+    {
+        const auto radius = glm::length(node_size_in_world) * 0.5f;
+        const auto first  = FindPartition(node_pos_in_world.x - radius);
+        const auto last   = FindPartition(node_pos_in_world.x + radius);
+        for (unsigned i=first; i<=last; ++i)
+        {
+            if (i == partition)
+                continue;
+            b2Body* copy = mWorlds[i]->CreateBody(&body_def);
+            mFixtures[copy->CreateFixture(&fixture)] = node.GetId();
+            physics_node.static_copies.push_back(copy);
+        }
+    }
+
+    mNodes[node.GetId()]   = std::move(physics_node);
     mFixtures[fixture_ptr] = node.GetId();
     DEBUG("Created new physics body '%1'", debug_name);
 }
 
+const std::vector<b2Vec2>* PhysicsEngine::FindPolygonHull(const std::string& polygonId, const std::string& debug_name)
+{
+    auto it = mPolygonHulls.find(polygonId);
+    if (it != mPolygonHulls.end())
+        return &it->second;
+
+    const auto& drawable = mLoader->FindDrawableClassById(polygonId);
+    if (!drawable || drawable->GetType() != gfx::DrawableClass::Type::Polygon) {
+        WARN("No polygon class found for rigid body '%1'.", debug_name);
+        return nullptr;
+    }
+    const auto& polygon = std::static_pointer_cast<const gfx::PolygonClass>(drawable);
+    std::vector<b2Vec2> verts;
+    for (size_t i=0; i<polygon->GetNumVertices(); ++i)
+    {
+        const auto& vertex = polygon->GetVertex(i);
+        // polygon vertices are in normalized coordinate space in the lower
+        // right quadrant, i.e. x = [0, 1] and y = [0, -1], flip about x axis
+        const auto x = vertex.aPosition.x;
+        const auto y = vertex.aPosition.y * -1.0;
+        b2Vec2 v2;
+        // offset the vertices to be around origin.
+        // the vertices must be relative to the body when the shape
+        // is attached to a body.
+        v2.x = x - 0.5f;
+        v2.y = y - 0.5f;
+        verts.push_back(v2);
+    }
+    // invert the order of polygons in order to invert the winding
+    // oder. This is done because of the flip around axis inverts
+    // the winding order
+    std::reverse(verts.begin(), verts.end());
+
+    // it's possible that the set of vertices for a convex hull has
+    // less vertices than the polygon itself. I'm not sure how Box2D
+    // will behave when the number of vertices exceeds b2_maxPolygonVertices.
+    // Finding the convex hull here can at least help us discard some
+    // irrelevant vertices already.
+    verts = math::FindConvexHull(verts);
+    // still too many?
+    if (verts.size() > b2_maxPolygonVertices) {
+        // todo: deal with situation when we have more than b2_maxPolygonVertices (8?)
+        WARN("The convex hull for rigid body '%1' has too many vertices.", debug_name);
+    }
+    auto& ret = mPolygonHulls[polygonId];
+    ret = std::move(verts);
+    return &ret;
+}
+
+const b2PolygonShape* PhysicsEngine::FindPolygonShape(const std::string& polygonId, const glm::vec2& size,
+                                                      const std::string& debug_name)
+{
+    // bodies whose sizes differ by less than the quantum share the shape.
+    // the difference is well below anything that matters for the collisions.
+    constexpr auto kSizeQuantum = 1.0f / 1024.0f;
+    constexpr auto kMaxPolygonShapes = 256u;
+    const auto width  = std::round(size.x / kSizeQuantum);
+    const auto height = std::round(size.y / kSizeQuantum);
+    const auto& key = polygonId + "/" + std::to_string((long)width) + "x" + std::to_string((long)height);
+
+    auto it = mPolygonShapeIndex.find(key);
+    if (it != mPolygonShapeIndex.end())
+    {
+        mPolygonShapes.splice(mPolygonShapes.begin(), mPolygonShapes, it->second);
+        return &it->second->shape;
+    }
+
+    const auto* hull = FindPolygonHull(polygonId, debug_name);
+    if (hull == nullptr)
+        return nullptr;
+    // the hull is for a unit size body. scaling by a positive factor
+    // keeps the hull convex and the winding order the same.
+    std::vector<b2Vec2> verts;
+    verts.reserve(hull->size());
+    for (const auto& vertex : *hull)
+        verts.push_back(b2Vec2(vertex.x * width * kSizeQuantum, vertex.y * height * kSizeQuantum));
+
+    PolygonShape shape;
+    shape.key = key;
+    shape.shape.Set(&verts[0], verts.size());
+    // todo: radius??
+    mPolygonShapes.push_front(std::move(shape));
+    mPolygonShapeIndex[key] = mPolygonShapes.begin();
+
+    while (mPolygonShapes.size() > kMaxPolygonShapes)
+    {
+        mPolygonShapeIndex.erase(mPolygonShapes.back().key);
+        mPolygonShapes.pop_back();
+    }
+    return &mPolygonShapes.front().shape;
+}
+
 } // namespace
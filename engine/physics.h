@@ -26,13 +26,19 @@
 #include <string>
 #include <memory>
 #include <vector>
+#include <list>
 #include <unordered_map>
 
 class b2World;
 
+namespace base {
+    class ThreadPool;
+}
+
 namespace gfx {
     class Painter;
     class Transform;
+    class PolygonClass;
 }
 
 namespace game
@@ -50,6 +56,9 @@ namespace game
             EndContact
         };
         Type type = Type::BeginContact;
+        // True when either body is a sensor, i.e. the event
+        // only reports an overlap and there's no collision response.
+        bool sensor = false;
         std::string entityA;
         std::string entityB;
         std::string nodeA;
@@ -92,10 +101,41 @@ namespace game
         { mNumVelocityIterations = iter; }
         void SetNumPositionIterations(unsigned iter)
         { mNumPositionIterations = iter; }
+        // Set the number of partitions to split the physics world into.
+        // Each partition is a vertical strip of the world (along the x axis)
+        // simulated as an independent Box2D world and the partitions are
+        // stepped in parallel when a thread pool is set. Dynamic bodies are
+        // handed off to the neighbouring partition after they cross the
+        // border. Bodies in different partitions don't collide with each
+        // other, so this is meant for levels with lots of (debris) bodies
+        // that are small compared to the width of a partition. A handed
+        // off body ends its contacts in the old partition and begins them
+        // again in the new partition.
+        // The result of the simulation doesn't depend on the number of
+        // threads.
+        // Takes effect on the next call to CreateWorld. The default is 1.
+        void SetNumPartitions(unsigned count)
+        { mNumPartitions = count ? count : 1; }
+        // Set the width of a single partition in physics world units.
+        // When zero the width is figured out from the extents of the
+        // bodies (both static and moving) in the world when it's created,
+        // i.e. the level is split into equal strips. Worlds that start out
+        // empty need an explicit width in order to be partitioned.
+        // Takes effect on the next call to CreateWorld. The default is 0.
+        void SetPartitionWidth(float width)
+        { mPartitionWidthHint = width; }
+        // Set the thread pool to use for stepping the world partitions
+        // in parallel. The pool must outlive the physics engine or be
+        // reset before it's destroyed.
+        void SetThreadPool(base::ThreadPool* pool)
+        { mThreadPool = pool; }
+        // Get the number of partitions in the current world.
+        unsigned GetNumPartitions() const
+        { return static_cast<unsigned>(mWorlds.size()); }
 
         // Returns if we have a current world simulation.
         bool HaveWorld() const
-        { return !!mWorld; }
+        { return !mWorlds.empty(); }
 
         // Update the scene with the changes from the physics simulation.
         void UpdateScene(Scene& scene);
@@ -108,9 +148,21 @@ namespace game
         // Tick the physics simulation forward by one time step.
         void Tick(std::vector<ContactEvent>* contacts = nullptr);
 
+        // Returns whether there's a physics body for the entity node with
+        // the given id. Note that the pending creates and deletes are only
+        // applied on the next call to Tick, UpdateScene or UpdateEntity.
+        bool HasBody(const std::string& node) const
+        { return mNodes.find(node) != mNodes.end(); }
+        // Get the number of physics bodies currently in the system.
+        std::size_t GetNumBodies() const
+        { return mNodes.size(); }
+
         // Delete all physics bodies currently in the system.
         void DeleteAll();
-        // Delete a physics body with the given node id.
+        // Delete a physics body with the given node id. The body isn't
+        // deleted immediately but the request is queued and all queued
+        // requests are applied in a single batch on the next call to
+        // Tick, UpdateScene or UpdateEntity.
         void DeleteBody(const std::string& node);
         void DeleteBody(const EntityNode& node);
 
@@ -120,6 +172,18 @@ namespace game
         void ApplyImpulseToCenter(const EntityNode& node, const glm::vec2& impulse) const;
         void ApplyImpulseToCenter(const std::string& node, const glm::vec2& impulse) const;
 
+        // Subscribe to contact events between bodies in the given collision
+        // categories (see RigidBodyItemClass::SetCollisionCategory). A contact
+        // is reported when one body's category bits match categoryA and the
+        // other body's category bits match categoryB. When there are no
+        // subscriptions every contact is reported. The subscriptions only
+        // affect which contact events are reported from Tick, the simulation
+        // itself isn't changed, and they remain in effect when a new world
+        // is created.
+        void SubscribeContacts(unsigned categoryA, unsigned categoryB);
+        // Clear all contact subscriptions, i.e. go back to reporting every contact.
+        void ClearContactSubscriptions();
+
         // Initialize the physics world based on the scene.
         // The scene is traversed and then for each scene entity
         // that has a rigid bodies a physics simulation body is
@@ -141,13 +205,36 @@ namespace game
         void CreateWorld(const Entity& entity);
 
 #if defined(GAMESTUDIO_ENABLE_PHYSICS_DEBUG)
-        // Visualize the physics world object's by drawing OOBs around them.
-        void DebugDrawObjects(gfx::Painter& painter, gfx::Transform& view);
+        struct DebugDrawOptions {
+            // draw the outlines of the bodies' collision shapes.
+            bool shapes = true;
+            // draw the axis aligned bounding boxes of the fixtures.
+            bool aabbs = false;
+            // draw the contact points and normals of touching contacts.
+            bool contacts = false;
+        };
+        // Visualize the physics world's objects by drawing their collision
+        // shapes as lines. All the lines are collected into a single dynamic
+        // line list geometry so that each kind of visualization (shapes,
+        // AABBs, contacts) is a single draw call no matter how many bodies
+        // there are.
+        void DebugDrawObjects(gfx::Painter& painter, gfx::Transform& view,
+                              const DebugDrawOptions& options = DebugDrawOptions());
 #endif
     private:
         void UpdateEntity(const glm::mat4& model_to_world, Entity& scene);
         void AddEntity(const glm::mat4& model_to_world, const Entity& entity);
         void AddEntityNode(const glm::mat4& model_to_world, const Entity& entity, const EntityNode& node);
+        void QueueEntityNode(const glm::mat4& model_to_world, const Entity& entity, const EntityNode& node);
+        void DestroyBody(const std::string& node);
+        void FlushBodies();
+        void CreatePartitions();
+        void HandoffBodies(b2ContactListener* listener);
+        unsigned FindPartition(float x) const;
+        bool IsSubscribed(unsigned categoryA, unsigned categoryB) const;
+        const std::vector<b2Vec2>* FindPolygonHull(const std::string& polygonId, const std::string& debug_name);
+        const b2PolygonShape* FindPolygonShape(const std::string& polygonId, const glm::vec2& size,
+                                               const std::string& debug_name);
     private:
         // The class loader instance for loading resources.
         const ClassLibrary* mLoader = nullptr;
@@ -170,13 +257,65 @@ namespace game
             std::string polygonId;
             // RigidBodyItemClass::Collision shape
             unsigned shape = 0;
+            // copies of a static body in the other world partitions
+            // that the body overlaps with.
+            std::vector<b2Body*> static_copies;
+        };
+        // Body creation request for an entity node that has been
+        // discovered during the scene update. The pointers are only
+        // valid until the end of the update when the requests are
+        // flushed.
+        struct BodyRequest {
+            glm::mat4 model_to_world;
+            const Entity* entity = nullptr;
+            const EntityNode* node = nullptr;
         };
         // The nodes represented in the physics simulation.
         std::unordered_map<std::string, PhysicsNode> mNodes;
+        // pending bodies to be created in the next batch.
+        std::vector<BodyRequest> mSpawnList;
+        // pending bodies (node ids) to be deleted in the next batch.
+        std::vector<std::string> mKillList;
+        // Convex hulls of the polygon classes used as collision shapes keyed
+        // by the polygon class id. The hulls are for a unit size body and
+        // get scaled to the size of the body when the fixture is created.
+        std::unordered_map<std::string, std::vector<b2Vec2>> mPolygonHulls;
+        // The polygon collision shapes scaled to the body size keyed by the
+        // polygon class id and the quantized body size. Bodies with the same
+        // polygon and size share the shape which Box2D copies into each
+        // fixture. Most recently used shape first, the least recently used
+        // shapes are dropped when there are more than kMaxPolygonShapes.
+        struct PolygonShape {
+            std::string key;
+            b2PolygonShape shape;
+        };
+        std::list<PolygonShape> mPolygonShapes;
+        std::unordered_map<std::string, std::list<PolygonShape>::iterator> mPolygonShapeIndex;
+        // The collision category pairs for which contact events are reported.
+        struct ContactSubscription {
+            unsigned categoryA = 0;
+            unsigned categoryB = 0;
+        };
+        std::vector<ContactSubscription> mContactSubscriptions;
         // the fixtures in the physics world that map to nodes.
         std::unordered_map<b2Fixture*, std::string> mFixtures;
-        // The current physics world if any.
-        std::unique_ptr<b2World> mWorld;
+        // The current physics world partitions if any. With a single
+        // partition this is simply the whole physics world.
+        std::vector<std::unique_ptr<b2World>> mWorlds;
+        // contact events collected from each partition during a step.
+        std::vector<std::vector<ContactEvent>> mPartitionContacts;
+        // the left edge and the width of the partition strips in physics
+        // world units. Zero width means everything is in the first partition.
+        float mPartitionOrigin = 0.0f;
+        float mPartitionWidth  = 0.0f;
+        // the partition width set by the user if any.
+        float mPartitionWidthHint = 0.0f;
+        unsigned mNumPartitions = 1;
+        base::ThreadPool* mThreadPool = nullptr;
+#if defined(GAMESTUDIO_ENABLE_PHYSICS_DEBUG)
+        // the debug lines, kept around to reuse the vertex storage.
+        std::shared_ptr<gfx::PolygonClass> mDebugLines;
+#endif
         // Gravity vector of the world.
         glm::vec2 mGravity = {0.0f, 1.0f};
         // The scaling factor for transforming nodes into
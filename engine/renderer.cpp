@@ -25,6 +25,7 @@
 
 #include "base/logging.h"
 #include "base/utility.h"
+#include "base/threadpool.h"
 #include "graphics/drawable.h"
 #include "graphics/material.h"
 #include "graphics/painter.h"
@@ -62,8 +63,11 @@ void Renderer::Draw(const Scene& scene,
                     SceneInstanceDrawHook* scene_hook,
                     EntityInstanceDrawHook* entity_hook)
 {
-    DrawScene<Scene, Entity, EntityNode>(scene,
-        painter, transform, scene_hook, entity_hook);
+    // the scene hook is given the painter to do its own drawing
+    // so any drawing with a scene hook must be done serially.
+    if (mThreadPool && !scene_hook)
+        DrawSceneParallel(scene, painter, transform, entity_hook);
+    else DrawScene<Scene, Entity, EntityNode>(scene, painter, transform, scene_hook, entity_hook);
 }
 
 void Renderer::Draw(const SceneClass& scene,
@@ -129,11 +133,19 @@ void Renderer::Update(const SceneClass& scene, float time, float dt)
 }
 void Renderer::Update(const Scene& scene, float time, float dt)
 {
-    for (size_t i=0; i<scene.GetNumEntities(); ++i)
-    {
-        const auto& entity = scene.GetEntity(i);
-        Update(entity, time, dt);
-    }
+    const auto update = [this, &scene, time, dt](size_t begin, size_t end, unsigned) {
+        for (size_t i=begin; i<end; ++i)
+        {
+            const auto& entity = scene.GetEntity(i);
+            Update(entity, time, dt);
+        }
+    };
+    // the paint nodes are only looked up here and each paint node
+    // belongs to exactly one entity node, so the entities can be
+    // split across threads without any locking.
+    if (mThreadPool)
+        mThreadPool->ParallelFor(scene.GetNumEntities(), 32, update);
+    else update(0, scene.GetNumEntities(), 0);
 }
 
 void Renderer::EndFrame()
@@ -217,19 +229,75 @@ void Renderer::DrawScene(const SceneType& scene,
     }
 }
 
+void Renderer::DrawSceneParallel(const Scene& scene,
+                                 gfx::Painter& painter, gfx::Transform& transform,
+                                 EntityInstanceDrawHook* entity_hook)
+{
+    auto nodes = scene.CollectNodes();
+
+    // todo: use a faster sorting. (see the entity draw)
+    std::sort(nodes.begin(), nodes.end(), [](const auto& a, const auto& b) {
+        return a.node->GetLayer() < b.node->GetLayer();
+    });
+    nodes.erase(std::remove_if(nodes.begin(), nodes.end(), [](const auto& p) {
+        return !p.entity || !p.node->TestFlag(Entity::Flags::VisibleInGame);
+    }), nodes.end());
+
+    // creating the material and drawable instances isn't thread safe
+    // so do that first here. After this the paint nodes are only looked up.
+    for (const auto& p : nodes)
+    {
+        PreparePaintNodes<Entity, EntityNode>(*p.entity);
+    }
+
+    mPacketBuffers.resize(mThreadPool->GetNumSlots());
+    for (auto& buffer : mPacketBuffers)
+    {
+        buffer.packets.clear();
+        buffer.spans.clear();
+    }
+
+    mThreadPool->ParallelFor(nodes.size(), 8, [this, &nodes, &transform, entity_hook](size_t begin, size_t end, unsigned slot) {
+        auto& buffer = mPacketBuffers[slot];
+        for (size_t i=begin; i<end; ++i)
+        {
+            const auto& p = nodes[i];
+            gfx::Transform entity_transform(transform);
+            entity_transform.Push(p.node_to_scene);
+
+            PacketSpan span;
+            span.entity = i;
+            span.slot   = slot;
+            span.begin  = buffer.packets.size();
+            GeneratePackets<Entity, EntityNode>(*p.entity, entity_transform, entity_hook, buffer.packets);
+            span.end    = buffer.packets.size();
+            buffer.spans.push_back(span);
+        }
+    });
+
+    // merge the per thread packet lists back into the scene's draw order.
+    // the packets of each entity then get sorted into layers when drawing.
+    mPacketSpans.clear();
+    for (const auto& buffer : mPacketBuffers)
+    {
+        base::AppendVector(mPacketSpans, buffer.spans);
+    }
+    std::sort(mPacketSpans.begin(), mPacketSpans.end(), [](const auto& a, const auto& b) {
+        return a.entity < b.entity;
+    });
+    for (const auto& span : mPacketSpans)
+    {
+        auto* packets = mPacketBuffers[span.slot].packets.data();
+        DrawPackets(packets + span.begin, packets + span.end, painter);
+    }
+}
+
 template<typename EntityType, typename Node>
 void Renderer::DrawEntity(const EntityType& entity,
                           gfx::Painter& painter, gfx::Transform& transform,
                           EntityDrawHook<Node>* hook)
 
 {
-    using RenderTree = game::RenderTree<Node>;
-    using DrawPacket = DrawPacket;
-    using DrawHook   = EntityDrawHook<Node>;
-    using DrawableItemType = typename Node::DrawableItemType;
-
-    auto tree = entity.GetRenderTree();
-
     // here we could apply operations that would apply to the whole
     // animation but currently we don't need such things.
     // if we did we could begin new transformation scope for this
@@ -237,6 +305,24 @@ void Renderer::DrawEntity(const EntityType& entity,
     // transfrom.Push();
 
     std::vector<DrawPacket> packets;
+    GeneratePackets<EntityType, Node>(entity, transform, hook, packets);
+    DrawPackets(packets.data(), packets.data() + packets.size(), painter);
+
+    // if we used a new transformation scope pop it here.
+    //transform.Pop();
+}
+
+template<typename EntityType, typename Node>
+void Renderer::GeneratePackets(const EntityType& entity, gfx::Transform& transform,
+                               EntityDrawHook<Node>* hook,
+                               std::vector<DrawPacket>& packets)
+{
+    using RenderTree = game::RenderTree<Node>;
+    using DrawPacket = DrawPacket;
+    using DrawHook   = EntityDrawHook<Node>;
+    using DrawableItemType = typename Node::DrawableItemType;
+
+    const auto& tree = entity.GetRenderTree();
 
     class Visitor : public RenderTree::ConstVisitor {
     public:
@@ -273,49 +359,7 @@ void Renderer::DrawEntity(const EntityType& entity,
 
             if (text)
             {
-                const auto& size = node->GetSize();
-                auto& paint_node = mRenderer.mPaintNodes["text/" + node->GetId()];
-                paint_node.visited = true;
-                // use the instance hash as a material id to realize whether
-                // we need to re-create the material. (i.e. the text in the text item has changed)
-                // or the rasterization parameters have changed (node size -> raster buffer size)
-                size_t hash = 0;
-                hash = base::hash_combine(hash, text->GetHash());
-                hash = base::hash_combine(hash, size.x);
-                hash = base::hash_combine(hash, size.y);
-                const auto& material = std::to_string(hash);
-                if (paint_node.material_class_id != material)
-                {
-                    gfx::TextBuffer::Text text_and_style;
-                    text_and_style.text = text->GetText();
-                    text_and_style.font = text->GetFontName();
-                    text_and_style.fontsize = text->GetFontSize();
-                    text_and_style.lineheight = text->GetLineHeight();
-                    text_and_style.underline  = text->TestFlag(TextItem::Flags::UnderlineText);
-                    gfx::TextBuffer buffer(size.x, size.y);
-                    if (text->GetVAlign() == TextItem::VerticalTextAlign::Top)
-                        buffer.SetAlignment(gfx::TextBuffer::VerticalAlignment::AlignTop);
-                    else if (text->GetVAlign() == TextItem::VerticalTextAlign::Center)
-                        buffer.SetAlignment(gfx::TextBuffer::VerticalAlignment::AlignCenter);
-                    else if (text->GetVAlign() == TextItem::VerticalTextAlign::Bottom)
-                        buffer.SetAlignment(gfx::TextBuffer::VerticalAlignment::AlignBottom);
-                    if (text->GetHAlign() == TextItem::HorizontalTextAlign::Left)
-                        buffer.SetAlignment(gfx::TextBuffer::HorizontalAlignment::AlignLeft);
-                    else if (text->GetHAlign() == TextItem::HorizontalTextAlign::Center)
-                        buffer.SetAlignment(gfx::TextBuffer::HorizontalAlignment::AlignCenter);
-                    else if (text->GetHAlign() == TextItem::HorizontalTextAlign::Right)
-                        buffer.SetAlignment(gfx::TextBuffer::HorizontalAlignment::AlignRight);
-                    buffer.AddText(std::move(text_and_style));
-
-                    // setup material to shade text.
-                    auto klass = std::make_shared<gfx::TextureMap2DClass>();
-                    klass->SetSurfaceType(gfx::MaterialClass::SurfaceType::Transparent);
-                    klass->SetBaseColor(text->GetTextColor());
-                    klass->SetTexture(CreateTextureFromText(std::move(buffer)));
-                    klass->EnableGC(true); // enable gc
-                    paint_node.material = gfx::CreateMaterialInstance(klass);
-                    paint_node.material_class_id = material;
-                }
+                auto& paint_node = mRenderer.SyncTextPaintNode(*node);
                 bool visible_now = true;
                 if (text->TestFlag(TextItemClass::Flags::BlinkText))
                 {
@@ -348,31 +392,7 @@ void Renderer::DrawEntity(const EntityType& entity,
 
             if (item)
             {
-                const auto& material = item->GetMaterialId();
-                const auto& drawable = item->GetDrawableId();
-                auto& paint_node = mRenderer.mPaintNodes["item/" + node->GetId()];
-                paint_node.visited = true;
-                if (item->GetRenderPass() == RenderPass::Draw && paint_node.material_class_id != material)
-                {
-                    paint_node.material.reset();
-                    paint_node.material_class_id = material;
-                    auto klass = mRenderer.mLoader->FindMaterialClassById(item->GetMaterialId());
-                    if (klass)
-                        paint_node.material = gfx::CreateMaterialInstance(klass);
-                    if (!paint_node.material)
-                        WARN("No such material class '%1' found for '%2/%3')", material, mEntity.GetName(), node->GetName());
-                }
-                if (paint_node.drawable_class_id != drawable)
-                {
-                    paint_node.drawable.reset();
-                    paint_node.drawable_class_id = drawable;
-
-                    auto klass = mRenderer.mLoader->FindDrawableClassById(item->GetDrawableId());
-                    if (klass)
-                        paint_node.drawable = gfx::CreateDrawableInstance(klass);
-                    if (!paint_node.drawable)
-                        WARN("No such drawable class '%1' found for '%2/%3'", drawable, mEntity.GetName(), node->GetName());
-                }
+                auto& paint_node = mRenderer.SyncItemPaintNode(mEntity, *node);
                 if (paint_node.material)
                 {
                     paint_node.material->ResetUniforms();
@@ -452,18 +472,22 @@ void Renderer::DrawEntity(const EntityType& entity,
 
     Visitor visitor(entity, packets, *this, transform, hook);
     tree.PreOrderTraverse(visitor);
+}
 
+// static
+void Renderer::DrawPackets(DrawPacket* begin, DrawPacket* end, gfx::Painter& painter)
+{
     // the layer value is negative but for the indexing below
     // we must have positive values only.
     int first_layer_index = 0;
-    for (auto &packet : packets)
+    for (auto* packet = begin; packet != end; ++packet)
     {
-        first_layer_index = std::min(first_layer_index, packet.layer);
+        first_layer_index = std::min(first_layer_index, packet->layer);
     }
     // offset the layers.
-    for (auto &packet : packets)
+    for (auto* packet = begin; packet != end; ++packet)
     {
-        packet.layer += std::abs(first_layer_index);
+        packet->layer += std::abs(first_layer_index);
     }
 
     struct Layer {
@@ -472,43 +496,152 @@ void Renderer::DrawEntity(const EntityType& entity,
     };
     std::vector<Layer> layers;
 
-    for (auto &packet : packets)
+    for (auto* packet = begin; packet != end; ++packet)
     {
-        if (packet.pass == RenderPass::Draw && !packet.material)
+        if (packet->pass == RenderPass::Draw && !packet->material)
             continue;
-        else if (!packet.drawable)
+        else if (!packet->drawable)
             continue;
 
-        const auto layer_index = packet.layer;
+        const auto layer_index = packet->layer;
         if (layer_index >= layers.size())
             layers.resize(layer_index + 1);
 
         Layer &layer = layers[layer_index];
-        if (packet.pass == RenderPass::Draw)
+        if (packet->pass == RenderPass::Draw)
         {
             gfx::Painter::DrawShape shape;
-            shape.transform = &packet.transform;
-            shape.drawable = packet.drawable.get();
-            shape.material = packet.material.get();
+            shape.transform = &packet->transform;
+            shape.drawable = packet->drawable.get();
+            shape.material = packet->material.get();
             layer.draw_list.push_back(shape);
         }
-        else if (packet.pass == RenderPass::Mask)
+        else if (packet->pass == RenderPass::Mask)
         {
             gfx::Painter::MaskShape shape;
-            shape.transform = &packet.transform;
-            shape.drawable = packet.drawable.get();
+            shape.transform = &packet->transform;
+            shape.drawable = packet->drawable.get();
             layer.mask_list.push_back(shape);
         }
     }
-    for (const auto &layer : layers)
+    const auto pass_timers = painter.HasPassTimers();
+    for (size_t i=0; i<layers.size(); ++i)
     {
+        const auto& layer = layers[i];
+        if (pass_timers)
+            painter.BeginPass("Layer " + std::to_string(i));
         if (layer.mask_list.empty())
             painter.Draw(layer.draw_list);
         else painter.Draw(layer.draw_list, layer.mask_list);
+        if (pass_timers)
+            painter.EndPass();
     }
-    // if we used a new transformation scope pop it here.
-    //transform.Pop();
+}
 
+template<typename EntityType, typename Node>
+void Renderer::PreparePaintNodes(const EntityType& entity)
+{
+    for (size_t i=0; i<entity.GetNumNodes(); ++i)
+    {
+        const auto& node = entity.GetNode(i);
+        if (node.GetTextItem())
+            SyncTextPaintNode(node);
+        if (node.GetDrawable())
+            SyncItemPaintNode(entity, node);
+    }
+}
+
+template<typename Node>
+Renderer::PaintNode& Renderer::SyncTextPaintNode(const Node& node)
+{
+    const auto* text = node.GetTextItem();
+    const auto& size = node.GetSize();
+    auto& paint_node = FindPaintNode("text/" + node.GetId());
+    paint_node.visited = true;
+    // use the instance hash as a material id to realize whether
+    // we need to re-create the material. (i.e. the text in the text item has changed)
+    // or the rasterization parameters have changed (node size -> raster buffer size)
+    size_t hash = 0;
+    hash = base::hash_combine(hash, text->GetHash());
+    hash = base::hash_combine(hash, size.x);
+    hash = base::hash_combine(hash, size.y);
+    const auto& material = std::to_string(hash);
+    if (paint_node.material_class_id != material)
+    {
+        gfx::TextBuffer::Text text_and_style;
+        text_and_style.text = text->GetText();
+        text_and_style.font = text->GetFontName();
+        text_and_style.fontsize = text->GetFontSize();
+        text_and_style.lineheight = text->GetLineHeight();
+        text_and_style.underline  = text->TestFlag(TextItem::Flags::UnderlineText);
+        gfx::TextBuffer buffer(size.x, size.y);
+        if (text->GetVAlign() == TextItem::VerticalTextAlign::Top)
+            buffer.SetAlignment(gfx::TextBuffer::VerticalAlignment::AlignTop);
+        else if (text->GetVAlign() == TextItem::VerticalTextAlign::Center)
+            buffer.SetAlignment(gfx::TextBuffer::VerticalAlignment::AlignCenter);
+        else if (text->GetVAlign() == TextItem::VerticalTextAlign::Bottom)
+            buffer.SetAlignment(gfx::TextBuffer::VerticalAlignment::AlignBottom);
+        if (text->GetHAlign() == TextItem::HorizontalTextAlign::Left)
+            buffer.SetAlignment(gfx::TextBuffer::HorizontalAlignment::AlignLeft);
+        else if (text->GetHAlign() == TextItem::HorizontalTextAlign::Center)
+            buffer.SetAlignment(gfx::TextBuffer::HorizontalAlignment::AlignCenter);
+        else if (text->GetHAlign() == TextItem::HorizontalTextAlign::Right)
+            buffer.SetAlignment(gfx::TextBuffer::HorizontalAlignment::AlignRight);
+        buffer.AddText(std::move(text_and_style));
+
+        // setup material to shade text.
+        auto klass = std::make_shared<gfx::TextureMap2DClass>();
+        klass->SetSurfaceType(gfx::MaterialClass::SurfaceType::Transparent);
+        klass->SetBaseColor(text->GetTextColor());
+        klass->SetTexture(CreateTextureFromText(std::move(buffer)));
+        klass->EnableGC(true); // enable gc
+        paint_node.material = gfx::CreateMaterialInstance(klass);
+        paint_node.material_class_id = material;
+    }
+    return paint_node;
+}
+
+template<typename EntityType, typename Node>
+Renderer::PaintNode& Renderer::SyncItemPaintNode(const EntityType& entity, const Node& node)
+{
+    const auto* item = node.GetDrawable();
+    const auto& material = item->GetMaterialId();
+    const auto& drawable = item->GetDrawableId();
+    auto& paint_node = FindPaintNode("item/" + node.GetId());
+    paint_node.visited = true;
+    if (item->GetRenderPass() == RenderPass::Draw && paint_node.material_class_id != material)
+    {
+        paint_node.material.reset();
+        paint_node.material_class_id = material;
+        auto klass = mLoader->FindMaterialClassById(item->GetMaterialId());
+        if (klass)
+            paint_node.material = gfx::CreateMaterialInstance(klass);
+        if (!paint_node.material)
+            WARN("No such material class '%1' found for '%2/%3')", material, entity.GetName(), node.GetName());
+    }
+    if (paint_node.drawable_class_id != drawable)
+    {
+        paint_node.drawable.reset();
+        paint_node.drawable_class_id = drawable;
+
+        auto klass = mLoader->FindDrawableClassById(item->GetDrawableId());
+        if (klass)
+            paint_node.drawable = gfx::CreateDrawableInstance(klass);
+        if (!paint_node.drawable)
+            WARN("No such drawable class '%1' found for '%2/%3'", drawable, entity.GetName(), node.GetName());
+    }
+    return paint_node;
+}
+
+Renderer::PaintNode& Renderer::FindPaintNode(const std::string& key)
+{
+    // look up with find first so that the map is never modified when the
+    // paint node already exists. This is what makes it possible to generate
+    // the draw packets in parallel after the paint nodes have been prepared.
+    auto it = mPaintNodes.find(key);
+    if (it != mPaintNodes.end())
+        return it->second;
+    return mPaintNodes[key];
 }
 
 } // namespace
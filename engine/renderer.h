@@ -32,6 +32,10 @@
 #include "engine/scene.h"
 #include "engine/tree.h"
 
+namespace base {
+    class ThreadPool;
+}
+
 namespace gfx {
     class Painter;
     class Transform;
@@ -70,6 +74,8 @@ namespace game
         // based on the node.
         // Transform is the combined transformation hierarchy containing the transformations
         // from this current node to "view".
+        // Note that when the renderer is drawing in parallel (see Renderer::SetThreadPool)
+        // these functions can be called concurrently from multiple threads.
         virtual void AppendPackets(const Node* node, gfx::Transform& trans, std::vector<DrawPacket>& packets) {}
     protected:
     };
@@ -135,7 +141,37 @@ namespace game
         void EndFrame();
 
         void ClearPaintState();
+
+        // Set the thread pool to use for updating the drawables and for
+        // generating the draw packets of a scene in parallel. Only the
+        // scene instance drawing without a scene draw hook is done in
+        // parallel and when that's the case the entity draw hook functions
+        // can be called concurrently from multiple threads.
+        // nullptr turns off the parallel processing.
+        void SetThreadPool(base::ThreadPool* pool)
+        { mThreadPool = pool; }
     private:
+        struct PaintNode {
+            bool visited = false;
+            std::shared_ptr<gfx::Material> material;
+            std::shared_ptr<gfx::Drawable> drawable;
+            std::string material_class_id;
+            std::string drawable_class_id;
+        };
+        // Packets generated by a single thread while drawing a scene
+        // in parallel. Each span maps a range of packets to the
+        // entity (index) that generated them.
+        struct PacketSpan {
+            size_t entity = 0;
+            size_t begin  = 0;
+            size_t end    = 0;
+            unsigned slot = 0;
+        };
+        struct PacketBuffer {
+            std::vector<DrawPacket> packets;
+            std::vector<PacketSpan> spans;
+        };
+
         template<typename NodeType>
         void UpdateNode(const NodeType& node, float time, float dt);
 
@@ -144,21 +180,39 @@ namespace game
                        gfx::Painter& painter, gfx::Transform& transform,
                        SceneDrawHook<EntityType>* scene_hook,
                        EntityDrawHook<NodeType>* entity_hook);
+        void DrawSceneParallel(const Scene& scene,
+                       gfx::Painter& painter, gfx::Transform& transform,
+                       EntityInstanceDrawHook* entity_hook);
 
         template<typename EntityType, typename NodeType>
         void DrawEntity(const EntityType& entity,
                             gfx::Painter& painter, gfx::Transform& transform,
                             EntityDrawHook<NodeType>* hook);
+        template<typename EntityType, typename NodeType>
+        void GeneratePackets(const EntityType& entity, gfx::Transform& transform,
+                             EntityDrawHook<NodeType>* hook,
+                             std::vector<DrawPacket>& packets);
+        static void DrawPackets(DrawPacket* begin, DrawPacket* end, gfx::Painter& painter);
+
+        // Create or update the paint nodes of the entity's nodes, i.e. create
+        // the material and drawable instances as needed. When the paint nodes
+        // are prepared up front the packet generation never has to modify the
+        // paint node map and can then run on multiple threads.
+        template<typename EntityType, typename NodeType>
+        void PreparePaintNodes(const EntityType& entity);
+        template<typename NodeType>
+        PaintNode& SyncTextPaintNode(const NodeType& node);
+        template<typename EntityType, typename NodeType>
+        PaintNode& SyncItemPaintNode(const EntityType& entity, const NodeType& node);
+        PaintNode& FindPaintNode(const std::string& key);
     private:
         const ClassLibrary* mLoader = nullptr;
-        struct PaintNode {
-            bool visited = false;
-            std::shared_ptr<gfx::Material> material;
-            std::shared_ptr<gfx::Drawable> drawable;
-            std::string material_class_id;
-            std::string drawable_class_id;
-        };
+        base::ThreadPool* mThreadPool = nullptr;
         std::unordered_map<std::string, PaintNode> mPaintNodes;
+        // per thread packet buffers, kept around to avoid
+        // re-allocating them on every frame.
+        std::vector<PacketBuffer> mPacketBuffers;
+        std::vector<PacketSpan> mPacketSpans;
     };
 
 } // namespace
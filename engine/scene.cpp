@@ -22,16 +22,65 @@
 
 #include <unordered_set>
 #include <stack>
+#include <optional>
+#include <cstring>
+#include <cmath>
 
 #include "base/format.h"
 #include "base/logging.h"
 #include "base/hash.h"
+#include "base/threadpool.h"
 #include "data/reader.h"
 #include "data/writer.h"
 #include "engine/scene.h"
 #include "engine/entity.h"
 #include "engine/treeop.h"
 #include "engine/transform.h"
+#include "engine/classlib.h"
+#include "engine/snapshot.h"
+
+namespace {
+// increment the version whenever the snapshot format changes.
+constexpr char SnapshotMagic[4] = {'G', 'S', 'N', 'P'};
+constexpr std::uint32_t SnapshotVersion = 4;
+
+// Create a new entity instance based on a scene placement node.
+std::unique_ptr<game::Entity> CreatePlacementEntity(const game::SceneNodeClass& node)
+{
+    game::EntityArgs args;
+    args.klass    = node.GetEntityClass();
+    args.rotation = node.GetRotation();
+    args.position = node.GetTranslation();
+    args.scale    = node.GetScale();
+    args.name     = node.GetName();
+    args.id       = node.GetId();
+    ASSERT(args.klass);
+    auto entity   = game::CreateEntityInstance(args);
+
+    // these need always be set for each entity spawned from scene
+    // placement node.
+    entity->SetParentNodeClassId(node.GetParentRenderTreeNodeId());
+    entity->SetLayer(node.GetLayer());
+
+    // optionally set instance settings, if these are not set then
+    // entity class defaults apply.
+    if (node.HasIdleAnimationSetting())
+        entity->SetIdleTrackId(node.GetIdleAnimationId());
+    if (node.HasLifetimeSetting())
+        entity->SetLifetime(node.GetLifetime());
+
+    // check which flags the scene node has set and set those on the
+    // entity instance. for any flag setting that is not set entity class
+    // default will apply.
+    for (const auto& flag : magic_enum::enum_values<game::Entity::Flags>())
+    {
+        if (node.HasFlagSetting(flag))
+            entity->SetFlag(flag, node.TestFlag(flag));
+    }
+    return entity;
+}
+
+} // namespace
 
 namespace game
 {
@@ -122,6 +171,7 @@ SceneClass::SceneClass(const SceneClass& other)
     mClassId    = other.mClassId;
     mName       = other.mName;
     mScriptVars = other.mScriptVars;
+    mStreamingCellSize = other.mStreamingCellSize;
     for (const auto& node : other.mNodes)
     {
         auto copy = std::make_unique<SceneNodeClass>(*node);
@@ -487,6 +537,7 @@ size_t SceneClass::GetHash() const
     size_t hash = 0;
     hash = base::hash_combine(hash, mClassId);
     hash = base::hash_combine(hash, mName);
+    hash = base::hash_combine(hash, mStreamingCellSize);
     // include the node hashes in the animation hash
     // this covers both the node values and their traversal order
     mRenderTree.PreOrderTraverseForEach([&](const SceneNodeClass* node) {
@@ -503,6 +554,7 @@ void SceneClass::IntoJson(data::Writer& data) const
 {
     data.Write("id", mClassId);
     data.Write("name", mName);
+    data.Write("streaming_cell_size", mStreamingCellSize);
     for (const auto& node : mNodes)
     {
         auto chunk = data.NewWriteChunk();
@@ -527,6 +579,8 @@ std::optional<SceneClass> SceneClass::FromJson(const data::Reader& data)
     if (!data.Read("id", &ret.mClassId) ||
         !data.Read("name", &ret.mName))
         return std::nullopt;
+    // optional, older scenes don't have this.
+    data.Read("streaming_cell_size", &ret.mStreamingCellSize);
     for (unsigned i=0; i<data.GetNumChunks("nodes"); ++i)
     {
         const auto& chunk = data.GetReadChunk("nodes", i);
@@ -564,6 +618,7 @@ SceneClass SceneClass::Clone() const
         ret.mNodes.push_back(std::move(clone));
     }
     ret.mScriptVars = mScriptVars;
+    ret.mStreamingCellSize = mStreamingCellSize;
 
     ret.mRenderTree.FromTree(mRenderTree, [&map](const SceneNodeClass* node) {
         return map[node];
@@ -582,6 +637,7 @@ SceneClass& SceneClass::operator=(const SceneClass& other)
     mNodes      = std::move(tmp.mNodes);
     mScriptVars = std::move(tmp.mScriptVars);
     mRenderTree = tmp.mRenderTree;
+    mStreamingCellSize = tmp.mStreamingCellSize;
     return *this;
 }
 
@@ -589,51 +645,64 @@ Scene::Scene(std::shared_ptr<const SceneClass> klass)
   : mClass(klass)
 {
     std::unordered_map<const SceneNodeClass*, const Entity*> map;
+    std::unordered_set<const SceneNodeClass*> streamed;
+
+    // when streaming group the top level placements and their
+    // children into cells. these are created later on demand
+    // by UpdateStreaming.
+    if (klass->IsStreaming())
+    {
+        const auto& tree = klass->GetRenderTree();
+        for (size_t i=0; i<klass->GetNumNodes(); ++i)
+        {
+            const auto& node = klass->GetNode(i);
+            if (!tree.HasNode(&node) || tree.GetParent(&node))
+                continue;
+            mCells[GetStreamingCellKey(node.GetTranslation())].roots.push_back(&node);
+            tree.PreOrderTraverseForEach([&streamed](const SceneNodeClass* node) {
+                streamed.insert(node);
+            }, &node);
+        }
+        const auto cell_size = klass->GetStreamingCellSize();
+        mStreamingLoadMargin   = cell_size * 0.5f;
+        mStreamingUnloadMargin = cell_size * 1.5f;
+        DEBUG("Scene '%1' has %2 streaming cells with %3 placements.", klass->GetName(),
+              mCells.size(), streamed.size());
+    }
 
     // spawn an entity instance for each scene node class
     // in the scene class
     for (size_t i=0; i<klass->GetNumNodes(); ++i)
     {
         const auto& node = klass->GetNode(i);
-        EntityArgs args;
-        args.klass    = node.GetEntityClass();
-        args.rotation = node.GetRotation();
-        args.position = node.GetTranslation();
-        args.scale    = node.GetScale();
-        args.name     = node.GetName();
-        args.id       = node.GetId();
-        ASSERT(args.klass);
-        auto entity   = CreateEntityInstance(args);
-
-        // these need always be set for each entity spawned from scene
-        // placement node.
-        entity->SetParentNodeClassId(node.GetParentRenderTreeNodeId());
-        entity->SetLayer(node.GetLayer());
-
-        // optionally set instance settings, if these are not set then
-        // entity class defaults apply.
-        if (node.HasIdleAnimationSetting())
-            entity->SetIdleTrackId(node.GetIdleAnimationId());
-        if (node.HasLifetimeSetting())
-            entity->SetLifetime(node.GetLifetime());
-
-        // check which flags the scene node has set and set those on the
-        // entity instance. for any flag setting that is not set entity class
-        // default will apply.
-        for (const auto& flag : magic_enum::enum_values<Entity::Flags>())
-        {
-            if (node.HasFlagSetting(flag))
-                entity->SetFlag(flag, node.TestFlag(flag));
-        }
-
+        if (streamed.count(&node))
+            continue;
+        auto entity = CreatePlacementEntity(node);
         map[&node] = entity.get();
         mIdMap[entity->GetId()] = entity.get();
         mNameMap[entity->GetName()] = entity.get();
         mEntities.push_back(std::move(entity));
     }
-    mRenderTree.FromTree(mClass->GetRenderTree(), [&map](const SceneNodeClass* node) {
-        return map[node];
-    });
+    if (streamed.empty())
+    {
+        mRenderTree.FromTree(mClass->GetRenderTree(), [&map](const SceneNodeClass* node) {
+            return map[node];
+        });
+    }
+    else
+    {
+        // link only the nodes that were created. the streamed subtrees
+        // are self contained so any parent of a created node has also
+        // been created.
+        const auto& tree = klass->GetRenderTree();
+        tree.PreOrderTraverseForEach([&](const SceneNodeClass* node) {
+            auto it = map.find(node);
+            if (it == map.end())
+                return;
+            const auto* parent = tree.GetParent(node);
+            mRenderTree.LinkChild(parent ? map[parent] : nullptr, it->second);
+        });
+    }
 
     // make copies of mutable script variables.
     for (size_t i=0; i<klass->GetNumScriptVars(); ++i)
@@ -742,6 +811,7 @@ void Scene::EndLoop()
     {
         // turn off spawn flags.
         entity->SetFlag(Entity::ControlFlags::Spawned, false);
+        entity->SetFlag(Entity::ControlFlags::Streamed, false);
 
         if (!entity->TestFlag(Entity::ControlFlags::Killed))
             continue;
@@ -966,27 +1036,533 @@ const ScriptVar* Scene::FindScriptVar(const std::string& name) const
     return mClass->FindScriptVar(name);
 }
 
-void Scene::Update(float dt)
+void Scene::SaveSnapshot(std::vector<std::uint8_t>* snapshot) const
 {
-    mCurrentTime += dt;
+    snapshot->clear();
 
-    // todo: limit which entities are getting updated.
+    SnapshotWriter out(snapshot);
+    out.Write(SnapshotMagic);
+    out.Write(SnapshotVersion);
+    out.Write(mClass->GetId());
+    out.Write(mCurrentTime);
+
+    out.Write(static_cast<std::uint32_t>(mScriptVars.size()));
+    for (const auto& var : mScriptVars)
+        out.Write(var);
+
+    // the spawned entities are indexed after the entities in the scene.
+    std::unordered_map<const Entity*, std::int32_t> index;
+    index.reserve(mEntities.size() + mSpawnList.size());
+
+    const auto WriteEntity = [&out](const Entity& entity) {
+        out.Write(entity.GetClassId());
+        out.Write(entity.GetId());
+        out.Write(entity.GetName());
+        entity.SaveState(out);
+    };
+
+    std::int32_t next_index = 0;
+    out.Write(static_cast<std::uint32_t>(mEntities.size()));
+    for (const auto& entity : mEntities)
+    {
+        index[entity.get()] = next_index++;
+        WriteEntity(*entity);
+    }
+    out.Write(static_cast<std::uint32_t>(mSpawnList.size()));
+    for (const auto& entity : mSpawnList)
+    {
+        index[entity.get()] = next_index++;
+        WriteEntity(*entity);
+    }
+
+    // write the links in pre-order so that the children end up
+    // in the same order under their parents when restoring.
+    out.Write(static_cast<std::uint32_t>(mRenderTree.GetNumNodes()));
+    mRenderTree.PreOrderTraverseForEach([&](const Entity* entity) {
+        if (!entity)
+            return;
+        const auto* parent = mRenderTree.GetParent(entity);
+        out.Write(index[entity]);
+        out.Write(parent ? index[parent] : std::int32_t(-1));
+    });
+
+    out.Write(static_cast<std::uint32_t>(mKillList.size()));
+    for (const auto* entity : mKillList)
+        out.Write(index[entity]);
+
+    // the streaming cells that have been loaded at some point, i.e. the
+    // ones that are loaded now or have saved state. the loaded flag can't
+    // be worked out from the entities since all of the cell's placements
+    // could have been killed.
+    std::uint32_t num_cells = 0;
+    for (const auto& [key, cell] : mCells)
+        num_cells += cell.loaded || !cell.state.empty();
+    out.Write(num_cells);
+    for (const auto& [key, cell] : mCells)
+    {
+        if (!cell.loaded && cell.state.empty())
+            continue;
+        out.Write(key);
+        out.Write(std::uint8_t(cell.loaded));
+        out.Write(cell.state);
+    }
+
+    DEBUG("Saved scene '%1' snapshot with %2 entities (%3 bytes).", mClass->GetName(),
+          mEntities.size() + mSpawnList.size(), out.GetSize());
+}
+
+bool Scene::RestoreSnapshot(const std::vector<std::uint8_t>& snapshot, const ClassLibrary& classlib)
+{
+    SnapshotReader in(snapshot);
+
+    char magic[4] = {0};
+    std::uint32_t version = 0;
+    std::string class_id;
+    double time = 0.0;
+    in.Read(&magic);
+    in.Read(&version);
+    if (!in.IsGood() || std::memcmp(magic, SnapshotMagic, sizeof(magic)) || version != SnapshotVersion)
+    {
+        ERROR("Not a valid scene snapshot.");
+        return false;
+    }
+    in.Read(&class_id);
+    in.Read(&time);
+    if (class_id != mClass->GetId())
+    {
+        ERROR("Scene snapshot is for a different scene class.");
+        return false;
+    }
+
+    // restore into new containers first and only swap them in once the
+    // whole snapshot has been read successfully.
+    auto vars = mScriptVars;
+    std::uint32_t num_vars = 0;
+    if (!in.Read(&num_vars) || num_vars != vars.size())
+    {
+        ERROR("Scene snapshot script variables don't match the scene.");
+        return false;
+    }
+    for (const auto& var : vars)
+        in.Read(var);
+
+    // entity class lookup is quite expensive so remember the classes.
+    std::unordered_map<std::string, ClassHandle<const EntityClass>> classes;
+    const auto ReadEntity = [&in, &classes, &classlib]() -> std::unique_ptr<Entity> {
+        std::string class_id;
+        EntityArgs args;
+        in.Read(&class_id);
+        in.Read(&args.id);
+        if (!in.Read(&args.name))
+            return nullptr;
+
+        auto& klass = classes[class_id];
+        if (!klass)
+            klass = classlib.FindEntityClassById(class_id);
+        if (!klass)
+        {
+            ERROR("No such entity class '%1'.", class_id);
+            return nullptr;
+        }
+        args.klass = klass;
+        auto entity = CreateEntityInstance(args);
+        if (!entity->RestoreState(in))
+            return nullptr;
+        return entity;
+    };
+
+    std::vector<std::unique_ptr<Entity>> entities;
+    std::vector<std::unique_ptr<Entity>> spawns;
+    std::vector<Entity*> index;
+
+    std::uint32_t num_entities = 0;
+    in.Read(&num_entities);
+    for (std::uint32_t i=0; i<num_entities && in.IsGood(); ++i)
+    {
+        auto entity = ReadEntity();
+        if (!entity)
+            break;
+        index.push_back(entity.get());
+        entities.push_back(std::move(entity));
+    }
+    std::uint32_t num_spawns = 0;
+    in.Read(&num_spawns);
+    for (std::uint32_t i=0; i<num_spawns && in.IsGood(); ++i)
+    {
+        auto entity = ReadEntity();
+        if (!entity)
+            break;
+        index.push_back(entity.get());
+        spawns.push_back(std::move(entity));
+    }
+    if (entities.size() != num_entities || spawns.size() != num_spawns)
+    {
+        ERROR("Failed to restore scene snapshot entities.");
+        return false;
+    }
+
+    RenderTree tree;
+    std::uint32_t num_links = 0;
+    in.Read(&num_links);
+    tree.Reserve(num_links);
+    for (std::uint32_t i=0; i<num_links && in.IsGood(); ++i)
+    {
+        std::int32_t child  = 0;
+        std::int32_t parent = 0;
+        in.Read(&child);
+        in.Read(&parent);
+        // only the entities in the scene are linked, the spawns are
+        // linked when they're added to the scene.
+        if (child < 0 || child >= static_cast<std::int32_t>(num_entities) ||
+            parent < -1 || parent >= static_cast<std::int32_t>(num_entities) ||
+            tree.HasNode(index[child]))
+        {
+            ERROR("Scene snapshot render tree is broken.");
+            return false;
+        }
+        tree.LinkChild(parent >= 0 ? index[parent] : nullptr, index[child]);
+    }
+
+    std::vector<Entity*> kills;
+    std::uint32_t num_kills = 0;
+    in.Read(&num_kills);
+    for (std::uint32_t i=0; i<num_kills && in.IsGood(); ++i)
+    {
+        std::int32_t kill = 0;
+        if (in.Read(&kill) && kill >= 0 && kill < static_cast<std::int32_t>(index.size()))
+            kills.push_back(index[kill]);
+    }
+
+    std::unordered_map<std::uint64_t, StreamingCell> cells;
+    std::uint32_t num_cells = 0;
+    in.Read(&num_cells);
+    for (std::uint32_t i=0; i<num_cells && in.IsGood(); ++i)
+    {
+        std::uint64_t key = 0;
+        std::uint8_t loaded = 0;
+        StreamingCell cell;
+        if (in.Read(&key) && in.Read(&loaded) && in.Read(&cell.state))
+        {
+            cell.loaded = loaded;
+            cells[key] = std::move(cell);
+        }
+    }
+    if (!in.IsGood() || !in.IsEnd() || kills.size() != num_kills)
+    {
+        ERROR("Scene snapshot is truncated or broken.");
+        return false;
+    }
+
+    mEntities   = std::move(entities);
+    mSpawnList  = std::move(spawns);
+    mKillList   = std::move(kills);
+    mRenderTree = std::move(tree);
+    mScriptVars = std::move(vars);
+    mCurrentTime = time;
+    mIdMap.clear();
+    mNameMap.clear();
     for (auto& entity : mEntities)
     {
-        entity->Update(dt);
-        if (entity->HasExpired())
+        mIdMap[entity->GetId()]     = entity.get();
+        mNameMap[entity->GetName()] = entity.get();
+    }
+    SyncStreamingCells(std::move(cells));
+    DEBUG("Restored scene '%1' snapshot with %2 entities.", mClass->GetName(), index.size());
+    return true;
+}
+
+void Scene::UpdateStreaming(const FRect& view)
+{
+    if (mCells.empty())
+        return;
+
+    const auto& load_rect = FRect(view.GetX() - mStreamingLoadMargin,
+                                  view.GetY() - mStreamingLoadMargin,
+                                  view.GetWidth()  + mStreamingLoadMargin * 2.0f,
+                                  view.GetHeight() + mStreamingLoadMargin * 2.0f);
+    const auto& unload_rect = FRect(view.GetX() - mStreamingUnloadMargin,
+                                    view.GetY() - mStreamingUnloadMargin,
+                                    view.GetWidth()  + mStreamingUnloadMargin * 2.0f,
+                                    view.GetHeight() + mStreamingUnloadMargin * 2.0f);
+
+    // the cell is unloaded once both the cell itself and the entities
+    // that were placed in it are far enough. the entities can have moved
+    // out of their cell and must not disappear while still near the view.
+    const auto& IsNearView = [&](std::uint64_t key) {
+        if (DoesIntersect(GetStreamingCellRect(key), unload_rect))
+            return true;
+        for (const auto* root : mCells[key].roots)
         {
-            if (entity->TestFlag(Entity::Flags::KillAtLifetime))
-                entity->SetFlag(Entity::ControlFlags::Killed , true);
+            const auto* entity = FindEntityByInstanceId(root->GetId());
+            if (!entity || entity->HasBeenKilled())
+                continue;
+            const auto& rect = FindEntityBoundingRect(entity);
+            if (!rect.IsEmpty())
+            {
+                if (DoesIntersect(rect, unload_rect))
+                    return true;
+                continue;
+            }
+            // nodes without any size, go by the node positions.
+            for (size_t i=0; i<entity->GetNumNodes(); ++i)
+            {
+                const auto& pos = FindEntityNodeTransform(entity, &entity->GetNode(i)) *
+                                  glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+                if (unload_rect.TestPoint(pos.x, pos.y))
+                    return true;
+            }
+        }
+        return false;
+    };
+
+    for (size_t i=0; i<mLoadedCells.size();)
+    {
+        const auto key = mLoadedCells[i];
+        if (IsNearView(key))
+        {
+            ++i;
             continue;
         }
-        if (entity->IsPlaying())
+        UnloadStreamingCell(mCells[key]);
+        mLoadedCells[i] = mLoadedCells.back();
+        mLoadedCells.pop_back();
+    }
+
+    struct Candidate {
+        // visible cells go first, then the rest by distance.
+        bool visible = false;
+        float distance = 0.0f;
+        std::uint64_t key = 0;
+    };
+    std::vector<Candidate> candidates;
+    const auto& center = glm::vec2(view.GetX() + view.GetWidth() * 0.5f,
+                                   view.GetY() + view.GetHeight() * 0.5f);
+    const auto& consider = [&](std::uint64_t key, const StreamingCell& cell) {
+        if (cell.loaded)
+            return;
+        const auto& rect = GetStreamingCellRect(key);
+        if (!DoesIntersect(rect, load_rect))
+            return;
+        Candidate candidate;
+        candidate.visible  = DoesIntersect(rect, view);
+        candidate.distance = glm::length(glm::vec2(rect.GetX() + rect.GetWidth() * 0.5f,
+                                                   rect.GetY() + rect.GetHeight() * 0.5f) - center);
+        candidate.key = key;
+        candidates.push_back(candidate);
+    };
+    // check either the cells under the load rect or all the cells
+    // whichever is fewer. with a far zoomed out view the cell grid
+    // under the view can be much larger than the actual cell count.
+    const auto cell_size = mClass->GetStreamingCellSize();
+    const auto x0 = static_cast<std::int64_t>(std::floor(load_rect.GetX() / cell_size));
+    const auto y0 = static_cast<std::int64_t>(std::floor(load_rect.GetY() / cell_size));
+    const auto x1 = static_cast<std::int64_t>(std::floor((load_rect.GetX() + load_rect.GetWidth()) / cell_size));
+    const auto y1 = static_cast<std::int64_t>(std::floor((load_rect.GetY() + load_rect.GetHeight()) / cell_size));
+    if ((x1 - x0 + 1) * (y1 - y0 + 1) > static_cast<std::int64_t>(mCells.size()))
+    {
+        for (const auto& [key, cell] : mCells)
+            consider(key, cell);
+    }
+    else
+    {
+        for (auto y=y0; y<=y1; ++y)
+        {
+            for (auto x=x0; x<=x1; ++x)
+            {
+                const auto key = GetStreamingCellKey(glm::vec2(x * cell_size + cell_size * 0.5f,
+                                                               y * cell_size + cell_size * 0.5f));
+                auto it = mCells.find(key);
+                if (it != mCells.end())
+                    consider(key, it->second);
+            }
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const auto& lhs, const auto& rhs) {
+        if (lhs.visible != rhs.visible)
+            return lhs.visible;
+        return lhs.distance < rhs.distance;
+    });
+
+    size_t budget = mStreamingBudget;
+    size_t loaded = 0;
+    for (const auto& candidate : candidates)
+    {
+        // the rest will be picked up on the next update.
+        if (loaded && budget == 0 && !candidate.visible)
+            break;
+        const auto count = LoadStreamingCell(mCells[candidate.key]);
+        budget -= std::min(budget, count);
+        mLoadedCells.push_back(candidate.key);
+        ++loaded;
+    }
+}
+
+std::uint64_t Scene::GetStreamingCellKey(const glm::vec2& pos) const
+{
+    const auto cell_size = mClass->GetStreamingCellSize();
+    const auto x = static_cast<std::int32_t>(std::floor(pos.x / cell_size));
+    const auto y = static_cast<std::int32_t>(std::floor(pos.y / cell_size));
+    return (std::uint64_t(std::uint32_t(x)) << 32) | std::uint32_t(y);
+}
+
+FRect Scene::GetStreamingCellRect(std::uint64_t key) const
+{
+    const auto cell_size = mClass->GetStreamingCellSize();
+    const auto x = static_cast<std::int32_t>(key >> 32);
+    const auto y = static_cast<std::int32_t>(key & 0xffffffff);
+    return FRect(x * cell_size, y * cell_size, cell_size, cell_size);
+}
+
+size_t Scene::LoadStreamingCell(StreamingCell& cell)
+{
+    const auto& tree = mClass->GetRenderTree();
+
+    // if the cell has been loaded before the entities are restored
+    // from the saved state. otherwise they're created fresh from the
+    // placements just like when the scene is created.
+    std::optional<SnapshotReader> in;
+    if (!cell.state.empty())
+        in.emplace(cell.state);
+
+    std::unordered_map<const SceneNodeClass*, Entity*> map;
+    size_t count = 0;
+    for (const auto* root : cell.roots)
+    {
+        tree.PreOrderTraverseForEach([&](const SceneNodeClass* node) {
+            if (in)
+            {
+                std::uint8_t alive = 0;
+                in->Read(&alive);
+                if (!alive)
+                    return;
+            }
+            // the entity could still exist if it was taken out of its
+            // placement hierarchy before the cell was unloaded or if
+            // the scene was restored from a snapshot.
+            if (auto* entity = FindEntityByInstanceId(node->GetId()))
+            {
+                // skip its state but keep it around for the children.
+                if (in && !CreatePlacementEntity(*node)->RestoreState(*in))
+                    in.reset();
+                map[node] = entity;
+                return;
+            }
+            auto entity = CreatePlacementEntity(*node);
+            if (in && !entity->RestoreState(*in))
+            {
+                // can't continue with the saved state since the offset
+                // of the next entity is unknown.
+                ERROR("Failed to restore streamed entity '%1/%2' state.", entity->GetClassName(), entity->GetName());
+                in.reset();
+                entity = CreatePlacementEntity(*node);
+            }
+            Entity* parent = nullptr;
+            if (node != root)
+            {
+                auto it = map.find(tree.GetParent(node));
+                if (it != map.end())
+                    parent = it->second;
+            }
+            entity->SetFlag(Entity::ControlFlags::Spawned, true);
+            entity->SetFlag(Entity::ControlFlags::Streamed, true);
+            mIdMap[entity->GetId()]     = entity.get();
+            mNameMap[entity->GetName()] = entity.get();
+            mRenderTree.LinkChild(parent, entity.get());
+            map[node] = entity.get();
+            mEntities.push_back(std::move(entity));
+            ++count;
+        }, root);
+    }
+    // the saved state is no longer needed.
+    cell.state.clear();
+    cell.state.shrink_to_fit();
+    cell.loaded = true;
+    return count;
+}
+
+void Scene::UnloadStreamingCell(StreamingCell& cell)
+{
+    const auto& tree = mClass->GetRenderTree();
+
+    // save the state of the placement entities and remember the
+    // ones that are already dead so that they won't come back.
+    cell.state.clear();
+    SnapshotWriter out(&cell.state);
+    for (const auto* root : cell.roots)
+    {
+        tree.PreOrderTraverseForEach([&](const SceneNodeClass* node) {
+            const auto* entity = FindEntityByInstanceId(node->GetId());
+            const bool alive = entity && !entity->HasBeenKilled() &&
+                std::find(mKillList.begin(), mKillList.end(), entity) == mKillList.end();
+            out.Write(std::uint8_t(alive));
+            if (alive)
+                entity->SaveState(out);
+        }, root);
+    }
+    for (const auto* root : cell.roots)
+    {
+        auto* entity = FindEntityByInstanceId(root->GetId());
+        if (!entity || entity->HasBeenKilled() ||
+            std::find(mKillList.begin(), mKillList.end(), entity) != mKillList.end())
             continue;
-        if (entity->HasIdleTrack())
-            entity->PlayIdle();
+        // let the scripts tell this apart from the game killing the entity.
+        mRenderTree.PreOrderTraverseForEach([](Entity* entity) {
+            entity->SetFlag(Entity::ControlFlags::Streamed, true);
+        }, entity);
+        KillEntity(entity);
+    }
+    cell.loaded = false;
+}
+
+void Scene::SyncStreamingCells(std::unordered_map<std::uint64_t, StreamingCell> states)
+{
+    // after a snapshot restore the cells are exactly as they were
+    // when the snapshot was saved. the cells that aren't in the
+    // snapshot had never been loaded.
+    mLoadedCells.clear();
+    for (auto& [key, cell] : mCells)
+    {
+        cell.loaded = false;
+        cell.state.clear();
+        auto it = states.find(key);
+        if (it != states.end())
+        {
+            cell.loaded = it->second.loaded;
+            cell.state  = std::move(it->second.state);
+        }
+        if (cell.loaded)
+            mLoadedCells.push_back(key);
     }
 }
 
+void Scene::Update(float dt, base::ThreadPool* pool)
+{
+    mCurrentTime += dt;
+
+    const auto update = [this, dt](size_t begin, size_t end, unsigned) {
+        for (size_t i=begin; i<end; ++i)
+        {
+            auto& entity = mEntities[i];
+            entity->Update(dt);
+            if (entity->HasExpired())
+            {
+                if (entity->TestFlag(Entity::Flags::KillAtLifetime))
+                    entity->SetFlag(Entity::ControlFlags::Killed , true);
+                continue;
+            }
+            if (entity->IsPlaying())
+                continue;
+            if (entity->HasIdleTrack())
+                entity->PlayIdle();
+        }
+    };
+
+    // todo: limit which entities are getting updated.
+    if (pool)
+        pool->ParallelFor(mEntities.size(), 32, update);
+    else update(0, mEntities.size(), 0);
+}
+
 std::unique_ptr<Scene> CreateSceneInstance(std::shared_ptr<const SceneClass> klass)
 {
     return std::make_unique<Scene>(klass);
@@ -27,6 +27,7 @@
 #include <memory>
 #include <algorithm>
 #include <unordered_map>
+#include <cstdint>
 
 #include "base/bitflag.h"
 #include "data/fwd.h"
@@ -35,8 +36,13 @@
 #include "engine/types.h"
 #include "engine/enum.h"
 
+namespace base {
+    class ThreadPool;
+}
+
 namespace game
 {
+    class ClassLibrary;
     // SceneNodeClass holds the SceneClass node data.
     // I.e. the nodes in the scene class act as the placeholders
     // for the initial/static content in the scene. When a new
@@ -359,6 +365,18 @@ namespace game
 
         void SetName(const std::string& name)
         { mName = name; }
+        // Set the size of the square cells used for streaming the scene
+        // content. When the size is non-zero the top level placement nodes
+        // (and their children) are grouped into cells based on the node
+        // position and the scene instance only creates the entities for
+        // the cells near the view. See Scene::UpdateStreaming.
+        // Zero disables streaming and the whole scene is created up front.
+        void SetStreamingCellSize(float size)
+        { mStreamingCellSize = size; }
+        float GetStreamingCellSize() const
+        { return mStreamingCellSize; }
+        bool IsStreaming() const
+        { return mStreamingCellSize > 0.0f; }
 
         // Serialize the scene into JSON.
         void IntoJson(data::Writer& data) const;
@@ -389,6 +407,8 @@ namespace game
         RenderTree mRenderTree;
         // Scripting variables.
         std::vector<ScriptVar> mScriptVars;
+        // the size of the streaming cells or 0 for no streaming.
+        float mStreamingCellSize = 0.0f;
     };
 
     // Scene is the runtime representation of a scene based on some scene class
@@ -511,7 +531,80 @@ namespace game
         // the node is not part of the entity the result is undefined.
         FBox FindEntityNodeBoundingBox(const Entity* entity, const EntityNode* node) const;
 
-        void Update(float dt);
+        // Save the current runtime state of the scene into a compact binary
+        // snapshot. This covers the entities (their nodes, node items, script
+        // variables and current animation), the scene graph, the scene script
+        // variables, any pending spawns and kills and the saved state of the
+        // unloaded streaming cells. Any previous contents of
+        // the buffer are discarded but its capacity is reused so keeping the
+        // same buffer around for repeated snapshots avoids reallocations.
+        // Note that the physics bodies are owned by the physics engine and
+        // the physics world needs to be recreated after a restore. The rigid
+        // body velocities are saved with the nodes so the bodies will pick
+        // up where they were.
+        void SaveSnapshot(std::vector<std::uint8_t>* snapshot) const;
+        // Restore the scene state from a snapshot saved earlier from an
+        // instance of the same scene class and with the same content. The
+        // entity classes are resolved through the class library. All the
+        // entities are recreated so any pointers to the previous entities
+        // and their nodes are invalidated. Returns false if the snapshot
+        // is not valid in which case the scene is left unchanged.
+        bool RestoreSnapshot(const std::vector<std::uint8_t>& snapshot, const ClassLibrary& classlib);
+
+        // Update the scene and its entities, i.e. advance the entities'
+        // animation tracks. If a thread pool is given the entities are
+        // updated in parallel. Each entity is only ever touched by a
+        // single thread.
+        void Update(float dt, base::ThreadPool* pool = nullptr);
+
+        // Update the streamed scene content based on the current view. The
+        // view is the visible area in scene coordinates. When the scene class
+        // has a streaming cell size the top level placements are grouped into
+        // cells and only the cells near the view are instantiated. Cells that
+        // come within the load margin of the view are instantiated (closest
+        // first, up to the per update entity budget) and the cells that are
+        // further than the unload margin away are removed. The gap between the
+        // margins stops cells from thrashing when the view moves back and forth
+        // near a cell boundary. The state of the entities in a removed cell is
+        // kept around and restored when the cell is loaded again. Placement
+        // entities that have been killed stay dead. A cell isn't removed while
+        // any of its placement entities is still near the view even if the
+        // entity has moved out of the cell.
+        // The added entities appear with the spawn flag set and the removed
+        // ones are killed normally, i.e. this should be called before BeginLoop.
+        // This means that the entity scripts get BeginPlay and EndPlay calls
+        // and the entity's coroutines are deleted whenever the entity is
+        // streamed in or out. Both the added and the removed entities also
+        // have the streamed flag set (Entity::HasBeenStreamed) for the rest of
+        // the loop iteration so the scripts can tell streaming apart from
+        // the game spawning or killing the entity.
+        // Does nothing if the scene isn't streamed.
+        void UpdateStreaming(const FRect& view);
+        // Set the streaming margins (in scene units) that get added around the
+        // view. The unload margin should be larger than the load margin.
+        // The defaults are half a cell and one and a half cells respectively.
+        void SetStreamingMargins(float load_margin, float unload_margin)
+        {
+            mStreamingLoadMargin   = load_margin;
+            mStreamingUnloadMargin = unload_margin;
+        }
+        // Set the maximum number of entities to create per UpdateStreaming.
+        // The cells that are actually visible are always loaded regardless
+        // of the budget and at least one cell is loaded per update.
+        void SetStreamingBudget(unsigned max_entities)
+        { mStreamingBudget = max_entities; }
+        float GetStreamingLoadMargin() const
+        { return mStreamingLoadMargin; }
+        float GetStreamingUnloadMargin() const
+        { return mStreamingUnloadMargin; }
+        unsigned GetStreamingBudget() const
+        { return mStreamingBudget; }
+        // Get the total number of streaming cells in the scene.
+        size_t GetNumStreamingCells() const
+        { return mCells.size(); }
+        // Get the number of currently loaded streaming cells.
+        size_t GetNumLoadedStreamingCells() const
+        { return mLoadedCells.size(); }
 
         // Get the scene's render tree (scene graph). The render tree defines
         // the relative transformations and the transformation hierarchy of the
@@ -539,6 +632,22 @@ namespace game
         { return mClass.get(); }
         // Disabled.
         Scene& operator=(const Scene&) = delete;
+    private:
+        // A streaming cell of the scene.
+        struct StreamingCell {
+            // the top level placement nodes in the cell.
+            std::vector<const SceneNodeClass*> roots;
+            // the saved state of the cell's entities when the cell
+            // has been unloaded or empty if the cell was never loaded.
+            std::vector<std::uint8_t> state;
+            // true when the cell's entities are in the scene.
+            bool loaded = false;
+        };
+        std::uint64_t GetStreamingCellKey(const glm::vec2& pos) const;
+        FRect GetStreamingCellRect(std::uint64_t key) const;
+        size_t LoadStreamingCell(StreamingCell& cell);
+        void UnloadStreamingCell(StreamingCell& cell);
+        void SyncStreamingCells(std::unordered_map<std::uint64_t, StreamingCell> states);
     private:
         // the class object.
         std::shared_ptr<const SceneClass> mClass;
@@ -563,6 +672,13 @@ namespace game
         // kill list of entities that were killed but have
         // not yet been removed from the scene.
         std::vector<Entity*> mKillList;
+        // the streaming cells keyed by the cell coordinates.
+        std::unordered_map<std::uint64_t, StreamingCell> mCells;
+        // keys of the cells that are currently loaded.
+        std::vector<std::uint64_t> mLoadedCells;
+        float mStreamingLoadMargin   = 0.0f;
+        float mStreamingUnloadMargin = 0.0f;
+        unsigned mStreamingBudget = 256;
     };
 
     std::unique_ptr<Scene> CreateSceneInstance(std::shared_ptr<const SceneClass> klass);
@@ -0,0 +1,206 @@
+// Copyright (C) 2020-2021 Sami Väisänen
+// Copyright (C) 2020-2021 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "config.h"
+
+#include "warnpush.h"
+#  include <neargye/magic_enum.hpp>
+#include "warnpop.h"
+
+#include <string>
+#include <vector>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+
+#include "engine/types.h"
+
+namespace game
+{
+    // Snapshots are a compact binary representation of the runtime
+    // state of the game objects (scene, entities, nodes etc). Unlike
+    // the JSON based class serialization the snapshot is not meant to
+    // be edited or kept around across game builds but rather used for
+    // things such as quick-save, rollback and level streaming where
+    // the state needs to be captured and restored fast. Everything is
+    // written in the native byte order and the format is not portable
+    // across platforms.
+
+    // Append values into a snapshot buffer.
+    class SnapshotWriter
+    {
+    public:
+        SnapshotWriter(std::vector<std::uint8_t>* buffer)
+          : mBuffer(buffer)
+        {}
+        template<typename T>
+        void Write(const T& value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value);
+            const auto* ptr = reinterpret_cast<const std::uint8_t*>(&value);
+            mBuffer->insert(mBuffer->end(), ptr, ptr + sizeof(T));
+        }
+        void Write(const std::string& str)
+        {
+            Write(static_cast<std::uint32_t>(str.size()));
+            mBuffer->insert(mBuffer->end(), str.begin(), str.end());
+        }
+        void Write(const std::vector<std::uint8_t>& bytes)
+        {
+            Write(static_cast<std::uint32_t>(bytes.size()));
+            mBuffer->insert(mBuffer->end(), bytes.begin(), bytes.end());
+        }
+        // Write the flags set on the object as a bit mask. Each enum
+        // value of the flag type maps to one bit (by enum index).
+        template<typename Flags, typename Object>
+        void WriteFlags(const Object& object)
+        {
+            static_assert(magic_enum::enum_count<Flags>() <= 32);
+            std::uint32_t bits = 0;
+            for (const auto flag : magic_enum::enum_values<Flags>())
+            {
+                if (object.TestFlag(flag))
+                    bits |= 1u << *magic_enum::enum_index(flag);
+            }
+            Write(bits);
+        }
+        void Write(const ScriptVar& var)
+        {
+            const auto type = var.GetType();
+            Write(type);
+            if (type == ScriptVar::Type::String)
+                Write(var.GetValue<std::string>());
+            else if (type == ScriptVar::Type::Integer)
+                Write(var.GetValue<int>());
+            else if (type == ScriptVar::Type::Float)
+                Write(var.GetValue<float>());
+            else if (type == ScriptVar::Type::Vec2)
+                Write(var.GetValue<glm::vec2>());
+            else if (type == ScriptVar::Type::Boolean)
+                Write(var.GetValue<bool>());
+        }
+        // Get the current size of the buffer in bytes.
+        std::size_t GetSize() const
+        { return mBuffer->size(); }
+    private:
+        std::vector<std::uint8_t>* mBuffer = nullptr;
+    };
+
+    // Read values back from a snapshot buffer. Any read that would
+    // go past the end of the buffer fails and puts the reader in an
+    // error state after which all reads fail. This lets the callers
+    // read a bunch of values and check for errors only once.
+    class SnapshotReader
+    {
+    public:
+        SnapshotReader(const std::vector<std::uint8_t>& buffer)
+          : mData(buffer.data())
+          , mSize(buffer.size())
+        {}
+        template<typename T>
+        bool Read(T* value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value);
+            if (!mGood || mSize - mOffset < sizeof(T))
+                return mGood = false;
+            std::memcpy(value, mData + mOffset, sizeof(T));
+            mOffset += sizeof(T);
+            return true;
+        }
+        bool Read(std::string* str)
+        {
+            std::uint32_t size = 0;
+            if (!Read(&size))
+                return false;
+            if (mSize - mOffset < size)
+                return mGood = false;
+            str->assign(reinterpret_cast<const char*>(mData + mOffset), size);
+            mOffset += size;
+            return true;
+        }
+        bool Read(std::vector<std::uint8_t>* bytes)
+        {
+            std::uint32_t size = 0;
+            if (!Read(&size))
+                return false;
+            if (mSize - mOffset < size)
+                return mGood = false;
+            bytes->assign(mData + mOffset, mData + mOffset + size);
+            mOffset += size;
+            return true;
+        }
+        // Read a bit mask written by SnapshotWriter::WriteFlags and
+        // set the flags on the object.
+        template<typename Flags, typename Object>
+        bool ReadFlags(Object& object)
+        {
+            std::uint32_t bits = 0;
+            if (!Read(&bits))
+                return false;
+            for (const auto flag : magic_enum::enum_values<Flags>())
+            {
+                object.SetFlag(flag, (bits & (1u << *magic_enum::enum_index(flag))) != 0);
+            }
+            return true;
+        }
+        // Read a script variable value into an existing variable.
+        // The type must match the type of the variable.
+        bool Read(const ScriptVar& var)
+        {
+            ScriptVar::Type type;
+            if (!Read(&type))
+                return false;
+            if (type != var.GetType())
+                return mGood = false;
+
+            if (type == ScriptVar::Type::String)
+                return ReadValue<std::string>(var);
+            else if (type == ScriptVar::Type::Integer)
+                return ReadValue<int>(var);
+            else if (type == ScriptVar::Type::Float)
+                return ReadValue<float>(var);
+            else if (type == ScriptVar::Type::Vec2)
+                return ReadValue<glm::vec2>(var);
+            else if (type == ScriptVar::Type::Boolean)
+                return ReadValue<bool>(var);
+            return mGood = false;
+        }
+        // Returns true if no reads have failed so far.
+        bool IsGood() const
+        { return mGood; }
+        // Returns true if all the data has been read.
+        bool IsEnd() const
+        { return mOffset == mSize; }
+    private:
+        template<typename T>
+        bool ReadValue(const ScriptVar& var)
+        {
+            T value;
+            if (!Read(&value))
+                return false;
+            var.SetValue(std::move(value));
+            return true;
+        }
+    private:
+        const std::uint8_t* mData = nullptr;
+        const std::size_t mSize = 0;
+        std::size_t mOffset = 0;
+        bool mGood = true;
+    };
+
+} // namespace
@@ -67,6 +67,15 @@ namespace game
         {
             mParents.clear();
             mChildren.clear();
+            ++mRevision;
+        }
+
+        // Reserve space for the given number of nodes in order to
+        // avoid rehashing when building a tree of known size.
+        void Reserve(std::size_t count)
+        {
+            mParents.reserve(count);
+            mChildren.reserve(count + 1);
         }
 
         void PreOrderTraverse(Visitor& visitor, Element* parent = nullptr)
@@ -109,6 +118,7 @@ namespace game
                 }
             }
             mParents.erase(child);
+            ++mRevision;
         }
 
         // Delete all the children of a parent.
@@ -125,6 +135,7 @@ namespace game
                 mParents.erase(child);
             }
             children.clear();
+            ++mRevision;
         }
 
         // Link a child node to a parent node.
@@ -137,6 +148,7 @@ namespace game
             ASSERT(mParents.find(child) == mParents.end());
             mChildren[parent].push_back(child);
             mParents[child] = parent;
+            ++mRevision;
         }
         // Break a child node away from its parent. The descendants
         // of child are still retained as node's children.
@@ -160,6 +172,7 @@ namespace game
                 }
             }
             mParents.erase(it);
+            ++mRevision;
         }
 
         // Get the parent node of a child node.
@@ -192,6 +205,18 @@ namespace game
             return mParents.find(node) != mParents.end();
         }
 
+        // Get the number of nodes in the tree (not counting the root).
+        std::size_t GetNumNodes() const
+        { return mParents.size(); }
+
+        // Get the current revision of the tree structure. The revision
+        // changes whenever nodes are linked, broken or deleted which
+        // lets any data derived from the tree topology be cached until
+        // the tree changes. Note that this doesn't track the changes
+        // to the node objects themselves.
+        std::size_t GetRevision() const
+        { return mRevision; }
+
         template<typename Serializer>
         void IntoJson(const Serializer& to_json, data::Writer& data, const Element* parent = nullptr) const
         {
@@ -246,6 +271,7 @@ namespace game
             const Element* node = from_json(*chunk);
             mChildren[parent].push_back(node);
             mParents[node] = parent;
+            ++mRevision;
             for (unsigned i=0; i<data.GetNumChunks("children"); ++i)
             {
                 const auto& chunk = data.GetReadChunk("children", i);
@@ -290,6 +316,8 @@ namespace game
         std::unordered_map<const Element*, ChildList> mChildren;
         // lookup table for mapping children to their parents
         std::unordered_map<const Element*, const Element*> mParents;
+        // revision counter for the tree structure.
+        std::size_t mRevision = 0;
 
         template<typename T> friend class RenderTree;
     };
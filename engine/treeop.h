@@ -398,6 +398,184 @@ void CoarseHitTest(const RenderTree<Node>& tree, float x, float y,
     tree.PreOrderTraverse(visitor);
 }
 
+// Cache the world space bounds of the nodes in a render tree in order
+// to speed up hit testing. The tree is flattened into an array in
+// pre-order and for each node we keep the inverse of its model transform
+// and the axis aligned bounding rect covering the node and all of its
+// descendants. This lets the hit test reject a whole subtree (or the
+// whole tree) with a single rect test instead of computing the transforms
+// and their inverses for every node on every query.
+// The cache is validated against the tree's structural revision and the
+// transform inputs (translation, scale, size and rotation) that were used
+// to compute the cached values. If anything has changed the cache is
+// rebuilt with a single traversal.
+template<typename Node>
+class RenderTreeBoundsCache
+{
+public:
+    // Returns true if the cached data no longer matches the tree.
+    bool IsStale(const RenderTree<Node>& tree) const
+    {
+        if (!mValid || mRevision != tree.GetRevision() || mEntries.size() != tree.GetNumNodes())
+            return true;
+        for (const auto& entry : mEntries)
+        {
+            const auto* node = entry.node;
+            if (entry.translation != node->GetTranslation() ||
+                entry.scale != node->GetScale() ||
+                entry.size != node->GetSize() ||
+                entry.rotation != node->GetRotation())
+                return true;
+        }
+        return false;
+    }
+    // Rebuild the cache if the tree or any of its nodes has changed.
+    void Update(const RenderTree<Node>& tree)
+    {
+        if (IsStale(tree))
+            Rebuild(tree);
+    }
+    // Throw away the cached data. The next Update will rebuild.
+    void Invalidate()
+    {
+        mEntries.clear();
+        mBounds = FRect();
+        mValid = false;
+    }
+    // Get the bounding rect covering all the nodes in the tree.
+    // The cache must be up to date.
+    FRect GetBoundingRect() const
+    { return mBounds; }
+
+    // Perform a coarse hit test against the cached nodes. The cache
+    // must be up to date. The semantics are the same as with the
+    // free function CoarseHitTest.
+    template<typename PtrT>
+    void CoarseHitTest(float x, float y, std::vector<PtrT*>* hits,
+                       std::vector<glm::vec2>* hit_points) const
+    {
+        if (!TestRect(mBounds, x, y))
+            return;
+        const glm::vec4 point(x, y, 1.0f, 1.0f);
+
+        std::size_t i = 0;
+        while (i < mEntries.size())
+        {
+            const auto& entry = mEntries[i];
+            if (!TestRect(entry.subtree, x, y))
+            {
+                i = entry.subtree_end;
+                continue;
+            }
+            const auto& point_in_node = entry.world_to_node * point;
+            if (point_in_node.x >= 0.0f && point_in_node.x < 1.0f &&
+                point_in_node.y >= 0.0f && point_in_node.y < 1.0f)
+            {
+                hits->push_back(const_cast<PtrT*>(entry.node));
+                if (hit_points)
+                {
+                    hit_points->push_back(glm::vec2(point_in_node.x * entry.size.x,
+                                                    point_in_node.y * entry.size.y));
+                }
+            }
+            ++i;
+        }
+    }
+private:
+    static bool TestRect(const FRect& rect, float x, float y)
+    {
+        // be a little conservative here, the exact test is done
+        // with the inverse transform and a point on the edge must
+        // not get rejected because of rounding.
+        constexpr auto e = 0.0001f;
+        return x >= rect.GetX() - e && x <= rect.GetX() + rect.GetWidth() + e &&
+               y >= rect.GetY() - e && y <= rect.GetY() + rect.GetHeight() + e;
+    }
+    static FRect Merge(const FRect& lhs, const FRect& rhs)
+    {
+        if (lhs.IsEmpty())
+            return rhs;
+        else if (rhs.IsEmpty())
+            return lhs;
+        return Union(lhs, rhs);
+    }
+    void Rebuild(const RenderTree<Node>& tree)
+    {
+        class Visitor : public RenderTree<Node>::ConstVisitor {
+        public:
+            Visitor(RenderTreeBoundsCache& cache) : mCache(cache)
+            {}
+            virtual void EnterNode(const Node* node) override
+            {
+                if (!node)
+                    return;
+                mTransform.Push(node->GetNodeTransform());
+                mTransform.Push(node->GetModelTransform());
+                const auto& model = mTransform.GetAsMatrix();
+                mTransform.Pop();
+
+                Entry entry;
+                entry.node        = node;
+                entry.translation = node->GetTranslation();
+                entry.scale       = node->GetScale();
+                entry.size        = node->GetSize();
+                entry.rotation    = node->GetRotation();
+                entry.world_to_node = glm::inverse(model);
+                entry.subtree     = ComputeBoundingRect(model);
+                mStack.push(mCache.mEntries.size());
+                mCache.mEntries.push_back(entry);
+            }
+            virtual void LeaveNode(const Node* node) override
+            {
+                if (!node)
+                    return;
+                mTransform.Pop();
+
+                const auto index = mStack.top();
+                mStack.pop();
+                auto& entries = mCache.mEntries;
+                entries[index].subtree_end = entries.size();
+                if (!mStack.empty())
+                {
+                    auto& parent = entries[mStack.top()];
+                    parent.subtree = Merge(parent.subtree, entries[index].subtree);
+                }
+                else mCache.mBounds = Merge(mCache.mBounds, entries[index].subtree);
+            }
+        private:
+            RenderTreeBoundsCache& mCache;
+            std::stack<std::size_t> mStack;
+            Transform mTransform;
+        };
+        Invalidate();
+        mEntries.reserve(tree.GetNumNodes());
+
+        Visitor visitor(*this);
+        tree.PreOrderTraverse(visitor);
+        mRevision = tree.GetRevision();
+        mValid = true;
+    }
+private:
+    struct Entry {
+        const Node* node = nullptr;
+        // the transform inputs the cached values were computed with.
+        glm::vec2 translation;
+        glm::vec2 scale;
+        glm::vec2 size;
+        float rotation = 0.0f;
+        // inverse of the node's model transform.
+        glm::mat4 world_to_node;
+        // bounds of the node and all of its descendants.
+        FRect subtree;
+        // index of the first entry after this node's subtree.
+        std::size_t subtree_end = 0;
+    };
+    std::vector<Entry> mEntries;
+    std::size_t mRevision = 0;
+    FRect mBounds;
+    bool mValid = false;
+};
+
 template<typename Node>
 glm::vec2 MapCoordsFromNode(const RenderTree<Node>& tree, float x, float y, const Node* node)
 {
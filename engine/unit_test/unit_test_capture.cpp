@@ -0,0 +1,159 @@
+// Copyright (C) 2020-2021 Sami Väisänen
+// Copyright (C) 2020-2021 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "config.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <cstdint>
+
+#include "base/test_minimal.h"
+#include "graphics/bitmap.h"
+#include "graphics/image.h"
+#include "engine/capture.h"
+
+namespace {
+// a fresh temp directory for the test output.
+std::string MakeTempDir()
+{
+    const auto& dir = std::filesystem::temp_directory_path() / "unit_test_capture";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    return dir.string();
+}
+
+gfx::Bitmap<gfx::RGBA> MakeFrame(unsigned width, unsigned height, const gfx::RGBA& color)
+{
+    gfx::Bitmap<gfx::RGBA> bmp(width, height);
+    bmp.Fill(color);
+    return bmp;
+}
+} // namespace
+
+void unit_test_png()
+{
+    const auto& dir = MakeTempDir();
+    const auto& file = dir + "/frame.png";
+
+    auto frame = MakeFrame(4, 2, gfx::RGBA(255, 0, 0, 255));
+    frame.SetPixel(1, 3, gfx::RGBA(0, 255, 0, 255));
+    // the alpha is pre-multiplied into the color.
+    frame.SetPixel(0, 0, gfx::RGBA(255, 255, 255, 0));
+    frame.SetPixel(0, 1, gfx::RGBA(200, 100, 50, 51));
+    {
+        game::FrameWriter writer;
+        TEST_REQUIRE(writer.Write(std::move(frame), file, game::FrameWriter::Format::PNG));
+    }
+
+    gfx::Image img(file);
+    TEST_REQUIRE(img.IsValid());
+    TEST_REQUIRE(img.GetWidth() == 4);
+    TEST_REQUIRE(img.GetHeight() == 2);
+    TEST_REQUIRE(img.GetDepthBits() == 24);
+    const auto& rgb = img.AsBitmap<gfx::RGB>();
+    TEST_REQUIRE(rgb.GetPixel(0, 0) == gfx::RGB(0, 0, 0));
+    TEST_REQUIRE(rgb.GetPixel(0, 1) == gfx::RGB(40, 20, 10));
+    TEST_REQUIRE(rgb.GetPixel(0, 2) == gfx::RGB(255, 0, 0));
+    TEST_REQUIRE(rgb.GetPixel(1, 3) == gfx::RGB(0, 255, 0));
+}
+
+void unit_test_raw()
+{
+    const auto& dir = MakeTempDir();
+    const auto& seq = dir + "/frames.raw";
+
+    {
+        game::FrameWriter writer;
+        TEST_REQUIRE(writer.Write(MakeFrame(4, 2, gfx::RGBA(10, 20, 30, 40)), seq,
+                                  game::FrameWriter::Format::Raw, 0));
+        TEST_REQUIRE(writer.Write(MakeFrame(2, 3, gfx::RGBA(50, 60, 70, 80)), seq,
+                                  game::FrameWriter::Format::Raw, 5));
+        // another sequence file in between.
+        TEST_REQUIRE(writer.Write(MakeFrame(1, 1, gfx::RGBA(1, 2, 3, 4)), dir + "/other.raw",
+                                  game::FrameWriter::Format::Raw, 0));
+    }
+    // frame number, width and height followed by the RGBA pixels.
+    const auto header = 3 * sizeof(std::uint32_t);
+    TEST_REQUIRE(std::filesystem::file_size(seq) == header + 4*2*4 + header + 2*3*4);
+    TEST_REQUIRE(std::filesystem::file_size(dir + "/other.raw") == header + 1*1*4);
+
+    std::ifstream in(seq, std::ios::in | std::ios::binary);
+    TEST_REQUIRE(in.is_open());
+    const struct {
+        std::uint32_t frame, width, height;
+        gfx::RGBA color;
+    } expected[] = {
+        {0, 4, 2, gfx::RGBA(10, 20, 30, 40)},
+        {5, 2, 3, gfx::RGBA(50, 60, 70, 80)}
+    };
+    for (const auto& e : expected)
+    {
+        std::uint32_t values[3] = {};
+        in.read(reinterpret_cast<char*>(values), sizeof(values));
+        TEST_REQUIRE(values[0] == e.frame);
+        TEST_REQUIRE(values[1] == e.width);
+        TEST_REQUIRE(values[2] == e.height);
+        std::vector<gfx::RGBA> pixels(e.width * e.height);
+        in.read(reinterpret_cast<char*>(pixels.data()), pixels.size() * sizeof(gfx::RGBA));
+        TEST_REQUIRE(in.good());
+        for (const auto& px : pixels)
+            TEST_REQUIRE(px == e.color);
+    }
+}
+
+void unit_test_drain_on_destruction()
+{
+    const auto& dir = MakeTempDir();
+    const unsigned count = 20;
+    {
+        game::FrameWriter writer;
+        writer.SetMaxQueueSize(count);
+        for (unsigned i=0; i<count; ++i)
+        {
+            const auto& file = dir + "/frame_" + std::to_string(i) + ".png";
+            TEST_REQUIRE(writer.Write(MakeFrame(64, 64, gfx::RGBA(i, i, i, 255)), file,
+                                      game::FrameWriter::Format::PNG));
+        }
+        // the writer goes out of scope with frames possibly still in the
+        // queue, they must all be written out before the thread exits.
+    }
+    for (unsigned i=0; i<count; ++i)
+    {
+        gfx::Image img(dir + "/frame_" + std::to_string(i) + ".png");
+        TEST_REQUIRE(img.IsValid());
+        TEST_REQUIRE(img.AsBitmap<gfx::RGB>().GetPixel(0, 0) == gfx::RGB(i, i, i));
+    }
+
+    // a full queue drops the frame.
+    {
+        game::FrameWriter writer;
+        writer.SetMaxQueueSize(0);
+        TEST_REQUIRE(!writer.Write(MakeFrame(1, 1, gfx::RGBA()), dir + "/dropped.png",
+                                   game::FrameWriter::Format::PNG));
+        TEST_REQUIRE(writer.GetQueueSize() == 0);
+    }
+    TEST_REQUIRE(!std::filesystem::exists(dir + "/dropped.png"));
+}
+
+int test_main(int argc, char* argv[])
+{
+    unit_test_png();
+    unit_test_raw();
+    unit_test_drain_on_destruction();
+    return 0;
+}
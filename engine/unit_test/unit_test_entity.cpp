@@ -86,6 +86,8 @@ void unit_test_entity_node()
     body.SetLinearDamping(5.0f);
     body.SetDensity(-1.0f);
     body.SetAngularVelocity(5.0f);
+    body.SetCollisionCategory(0x4);
+    body.SetCollisionMask(0x1ff0b);
     body.SetLinearVelocity(glm::vec2(-1.0f, -2.0f));
     body.SetPolygonShapeId("shape");
 
@@ -138,6 +140,8 @@ void unit_test_entity_node()
     TEST_REQUIRE(node.GetRigidBody()->GetLinearDamping()  == real::float32(5.0f));
     TEST_REQUIRE(node.GetRigidBody()->GetDensity()        == real::float32(-1.0));
     TEST_REQUIRE(node.GetRigidBody()->GetAngularVelocity()== real::float32(5.0f));
+    TEST_REQUIRE(node.GetRigidBody()->GetCollisionCategory() == 0x4);
+    TEST_REQUIRE(node.GetRigidBody()->GetCollisionMask() == 0xff0b);
     TEST_REQUIRE(node.GetRigidBody()->GetLinearVelocity() == glm::vec2(-1.0f, -2.0f));
     TEST_REQUIRE(node.GetRigidBody()->GetPolygonShapeId() == "shape");
     TEST_REQUIRE(node.GetTextItem()->GetText() == "jeesus ajaa mopolla");
@@ -523,6 +527,20 @@ void unit_test_entity_instance()
     instance.FindScriptVar("foo")->SetValue(444);
     TEST_REQUIRE(instance.FindScriptVar("foo")->GetValue<int>() == 444);
 
+    // changing the class hierarchy must be reflected in new instances
+    // even if instances have already been created from the class.
+    {
+        auto shared = std::make_shared<game::EntityClass>(klass);
+        game::Entity before(shared);
+        TEST_REQUIRE(WalkTree(before) == "root child_1 child_3 child_2");
+        shared->ReparentChild(shared->FindNodeByName("child_2"), shared->FindNodeByName("child_3"));
+        TEST_REQUIRE(WalkTree(*shared) == "root child_1 child_2 child_3");
+        game::Entity after(shared);
+        TEST_REQUIRE(after.GetNumNodes() == 4);
+        TEST_REQUIRE(WalkTree(after) == "root child_1 child_2 child_3");
+        TEST_REQUIRE(WalkTree(before) == "root child_1 child_3 child_2");
+    }
+
     // todo: test more of the instance api
 }
 
@@ -717,6 +735,78 @@ void unit_test_entity_class_coords()
 
 }
 
+bool RectEquals(const game::FRect& rect, float x, float y, float w, float h)
+{
+    return math::equals(x, rect.GetX()) && math::equals(y, rect.GetY()) &&
+           math::equals(w, rect.GetWidth()) && math::equals(h, rect.GetHeight());
+}
+
+// the hit test and the bounding rect are computed from cached
+// node bounds. check that the cache follows the changes to the
+// nodes and to the tree.
+void unit_test_entity_hit_test_cache()
+{
+    game::EntityClass klass;
+    {
+        game::EntityNodeClass node;
+        node.SetName("parent");
+        node.SetSize(glm::vec2(10.0f, 10.0f));
+        klass.LinkChild(nullptr, klass.AddNode(std::move(node)));
+    }
+    {
+        game::EntityNodeClass node;
+        node.SetName("child");
+        node.SetTranslation(glm::vec2(20.0f, 0.0f));
+        node.SetSize(glm::vec2(10.0f, 10.0f));
+        klass.LinkChild(klass.FindNodeByName("parent"), klass.AddNode(std::move(node)));
+    }
+
+    {
+        std::vector<const game::EntityNodeClass*> hits;
+        klass.CoarseHitTest(20.0f, 0.0f, &hits);
+        TEST_REQUIRE(hits.size() == 1);
+        TEST_REQUIRE(hits[0]->GetName() == "child");
+        TEST_REQUIRE(RectEquals(klass.GetBoundingRect(), -5.0f, -5.0f, 30.0f, 10.0f));
+    }
+
+    // move the parent, the whole hierarchy moves with it.
+    klass.FindNodeByName("parent")->SetTranslation(glm::vec2(100.0f, 0.0f));
+    {
+        std::vector<const game::EntityNodeClass*> hits;
+        klass.CoarseHitTest(20.0f, 0.0f, &hits);
+        TEST_REQUIRE(hits.empty());
+        klass.CoarseHitTest(120.0f, 0.0f, &hits);
+        TEST_REQUIRE(hits.size() == 1);
+        TEST_REQUIRE(hits[0]->GetName() == "child");
+        TEST_REQUIRE(RectEquals(klass.GetBoundingRect(), 95.0f, -5.0f, 30.0f, 10.0f));
+    }
+
+    // change the tree.
+    klass.DeleteNode(klass.FindNodeByName("child"));
+    {
+        std::vector<const game::EntityNodeClass*> hits;
+        klass.CoarseHitTest(120.0f, 0.0f, &hits);
+        TEST_REQUIRE(hits.empty());
+        klass.CoarseHitTest(100.0f, 0.0f, &hits);
+        TEST_REQUIRE(hits.size() == 1);
+        TEST_REQUIRE(hits[0]->GetName() == "parent");
+        TEST_REQUIRE(RectEquals(klass.GetBoundingRect(), 95.0f, -5.0f, 10.0f, 10.0f));
+    }
+
+    // instance nodes are cached separately.
+    auto entity = game::CreateEntityInstance(klass);
+    {
+        std::vector<game::EntityNode*> hits;
+        entity->CoarseHitTest(100.0f, 0.0f, &hits);
+        TEST_REQUIRE(hits.size() == 1);
+        hits[0]->SetSize(glm::vec2(40.0f, 40.0f));
+        hits.clear();
+        entity->CoarseHitTest(115.0f, 15.0f, &hits);
+        TEST_REQUIRE(hits.size() == 1);
+        TEST_REQUIRE(RectEquals(entity->GetBoundingRect(), 80.0f, -20.0f, 40.0f, 40.0f));
+    }
+}
+
 int test_main(int argc, char* argv[])
 {
     unit_test_entity_node();
@@ -724,5 +814,6 @@ int test_main(int argc, char* argv[])
     unit_test_entity_instance();
     unit_test_entity_clone_track_bug();
     unit_test_entity_class_coords();
+    unit_test_entity_hit_test_cache();
     return 0;
 }
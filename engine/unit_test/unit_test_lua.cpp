@@ -21,6 +21,10 @@
 #  include <sol/sol.hpp>
 #include "warnpop.h"
 
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+
 #include "base/test_minimal.h"
 #include "base/test_float.h"
 #include "base/test_help.h"
@@ -483,11 +487,187 @@ end
 }
 
 
+void unit_test_coroutines()
+{
+    // the script engine loads the entity scripts from files.
+    {
+        std::ofstream out("unit_test_coroutine.lua", std::ios::out | std::ios::trunc);
+        out << R"(
+function BeginPlay(entity, scene)
+  if entity:GetName() ~= 'a' then
+    return
+  end
+  local other = scene:FindEntityByInstanceName('b')
+  -- wait on time.
+  Game:StartCoroutine(entity, function()
+    scene.timer = 1
+    game.Wait(1.0)
+    scene.timer = 2
+    game.Wait(0.5)
+    scene.timer = 3
+  end)
+  -- wait on an entity that isn't playing anything.
+  Game:StartCoroutine(entity, function()
+    if game.WaitUntilAnimationDone(entity) then
+      scene.anim = 1
+    else
+      scene.anim = -1
+    end
+  end)
+  -- wait on an entity that gets killed.
+  Game:StartCoroutine(function()
+    if game.WaitUntilAnimationDone(other) then
+      scene.killed = 1
+    else
+      scene.killed = -1
+    end
+  end)
+  -- coroutine owned by the entity that gets killed dies with it.
+  Game:StartCoroutine(other, function()
+    game.Wait(0.1)
+    scene.owned = 1
+  end)
+  -- nil isn't something that can be waited on.
+  Game:StartCoroutine(function()
+    scene.nil_yield = 1
+    coroutine.yield(nil)
+    scene.nil_yield = 2
+  end)
+end
+)";
+    }
+
+    auto entity = std::make_shared<game::EntityClass>();
+    entity->SetName("test_entity");
+    entity->SetSriptFileId("unit_test_coroutine");
+    {
+        game::EntityNodeClass node;
+        node.SetName("node");
+        entity->LinkChild(nullptr, entity->AddNode(std::move(node)));
+    }
+
+    game::SceneClass klass;
+    klass.AddScriptVar(game::ScriptVar("timer", 0, game::ScriptVar::ReadWrite));
+    klass.AddScriptVar(game::ScriptVar("anim", 0, game::ScriptVar::ReadWrite));
+    klass.AddScriptVar(game::ScriptVar("killed", 0, game::ScriptVar::ReadWrite));
+    klass.AddScriptVar(game::ScriptVar("owned", 0, game::ScriptVar::ReadWrite));
+    klass.AddScriptVar(game::ScriptVar("nil_yield", 0, game::ScriptVar::ReadWrite));
+    for (const char* name : {"a", "b"})
+    {
+        game::SceneNodeClass node;
+        node.SetName(name);
+        node.SetEntity(entity);
+        klass.LinkChild(nullptr, klass.AddNode(node));
+    }
+    game::Scene scene(klass);
+    const auto& var = [&scene](const char* name) {
+        return scene.FindScriptVar(name)->GetValue<int>();
+    };
+
+    game::ScriptEngine engine(".");
+    engine.BeginPlay(&scene);
+    TEST_REQUIRE(var("timer") == 1);
+    TEST_REQUIRE(var("anim") == 0);
+    // the coroutine was dropped at the nil yield.
+    TEST_REQUIRE(var("nil_yield") == 1);
+
+    scene.KillEntity(scene.FindEntityByInstanceName("b"));
+    scene.BeginLoop();
+    engine.BeginLoop();
+    engine.EndLoop();
+    scene.EndLoop();
+    TEST_REQUIRE(scene.FindEntityByInstanceName("b") == nullptr);
+
+    engine.Update(0.5, 0.5);
+    TEST_REQUIRE(var("timer") == 1);
+    TEST_REQUIRE(var("anim") == 1);
+    TEST_REQUIRE(var("killed") == -1);
+    TEST_REQUIRE(var("owned") == 0);
+    TEST_REQUIRE(var("nil_yield") == 1);
+
+    engine.Update(1.0, 0.5);
+    TEST_REQUIRE(var("timer") == 2);
+    engine.Update(1.25, 0.25);
+    TEST_REQUIRE(var("timer") == 2);
+    // long step past several slots of the timer wheel.
+    engine.Update(10.0, 8.75);
+    TEST_REQUIRE(var("timer") == 3);
+    TEST_REQUIRE(var("owned") == 0);
+    TEST_REQUIRE(var("nil_yield") == 1);
+
+    engine.EndPlay(&scene);
+}
+
+void unit_test_reload_scripts()
+{
+    const auto& WriteScript = [](int value) {
+        std::ofstream out("unit_test_reload.lua", std::ios::out | std::ios::trunc);
+        out << "function Update(entity, game_time, dt)\n"
+            << "  entity.value = " << value << "\n"
+            << "end\n";
+    };
+    WriteScript(1);
+
+    auto entity = std::make_shared<game::EntityClass>();
+    entity->SetName("test_entity");
+    entity->SetSriptFileId("unit_test_reload");
+    entity->AddScriptVar(game::ScriptVar("value", 0, game::ScriptVar::ReadWrite));
+    {
+        game::EntityNodeClass node;
+        node.SetName("node");
+        entity->LinkChild(nullptr, entity->AddNode(std::move(node)));
+    }
+    game::SceneClass klass;
+    {
+        game::SceneNodeClass node;
+        node.SetName("a");
+        node.SetEntity(entity);
+        klass.LinkChild(nullptr, klass.AddNode(node));
+    }
+    game::Scene scene(klass);
+    auto* a = scene.FindEntityByInstanceName("a");
+    a->FindScriptVar("value")->SetValue(0);
+
+    game::ScriptEngine engine(".");
+    engine.BeginPlay(&scene);
+    engine.Update(0.0, 0.0);
+    TEST_REQUIRE(a->FindScriptVar("value")->GetValue<int>() == 1);
+
+    // nothing has changed, nothing happens.
+    engine.ReloadChangedScripts();
+    engine.Update(0.0, 0.0);
+    TEST_REQUIRE(a->FindScriptVar("value")->GetValue<int>() == 1);
+
+    // rewrite the script and make sure that the modification time
+    // changes even if the file system time has a coarse resolution.
+    const auto time = std::filesystem::last_write_time("unit_test_reload.lua");
+    WriteScript(2);
+    std::filesystem::last_write_time("unit_test_reload.lua", time + std::chrono::seconds(2));
+    engine.ReloadChangedScripts();
+    engine.Update(0.0, 0.0);
+    TEST_REQUIRE(a->FindScriptVar("value")->GetValue<int>() == 2);
+
+    // a broken script leaves the previous functions in place.
+    {
+        std::ofstream out("unit_test_reload.lua", std::ios::out | std::ios::trunc);
+        out << "function Update(entity, game_time, dt\n";
+    }
+    std::filesystem::last_write_time("unit_test_reload.lua", time + std::chrono::seconds(4));
+    engine.ReloadChangedScripts();
+    a->FindScriptVar("value")->SetValue(0);
+    engine.Update(0.0, 0.0);
+    TEST_REQUIRE(a->FindScriptVar("value")->GetValue<int>() == 2);
+
+    engine.EndPlay(&scene);
+}
+
 int test_main(int argc, char* argv[])
 {
     unit_test_util();
     unit_test_glm();
     unit_test_base();
     unit_test_scene();
+    unit_test_coroutines();
+    unit_test_reload_scripts();
     return 0;
 }
@@ -0,0 +1,377 @@
+// Copyright (C) 2020-2021 Sami Väisänen
+// Copyright (C) 2020-2021 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "config.h"
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <cmath>
+
+#include "base/test_minimal.h"
+#include "base/threadpool.h"
+#include "engine/physics.h"
+#include "engine/scene.h"
+#include "engine/entity.h"
+
+// entity class with a single node with the given body.
+std::shared_ptr<game::EntityClass> MakeEntity(const game::RigidBodyItemClass& body, const glm::vec2& size)
+{
+    game::EntityNodeClass node;
+    node.SetName("body");
+    node.SetSize(size);
+    node.SetRigidBody(body);
+
+    auto entity = std::make_shared<game::EntityClass>();
+    entity->LinkChild(nullptr, entity->AddNode(std::move(node)));
+    return entity;
+}
+
+// entity class with a single box body.
+std::shared_ptr<game::EntityClass> MakeBoxEntity(game::RigidBodyItemClass::Simulation simulation,
+                                                 const glm::vec2& size = glm::vec2(1.0f, 1.0f),
+                                                 unsigned category = 0x1, unsigned mask = 0xffff)
+{
+    game::RigidBodyItemClass body;
+    body.SetSimulation(simulation);
+    body.SetCollisionShape(game::RigidBodyItemClass::CollisionShape::Box);
+    body.SetCollisionCategory(category);
+    body.SetCollisionMask(mask);
+    return MakeEntity(body, size);
+}
+
+game::Entity* Spawn(game::Scene& scene, std::shared_ptr<const game::EntityClass> klass,
+                    const std::string& name, const glm::vec2& position)
+{
+    game::EntityArgs args;
+    args.klass    = klass;
+    args.name     = name;
+    args.position = position;
+    return scene.SpawnEntity(args);
+}
+
+std::string GetBodyId(const game::Entity* entity)
+{
+    return entity->FindNodeByClassName("body")->GetId();
+}
+
+void unit_test_spawn_kill_batching()
+{
+    const auto entity = MakeBoxEntity(game::RigidBodyItemClass::Simulation::Dynamic);
+
+    game::SceneClass klass;
+    game::Scene scene(klass);
+    scene.BeginLoop();
+        Spawn(scene, entity, "a", glm::vec2(0.0f, 0.0f));
+        Spawn(scene, entity, "b", glm::vec2(10.0f, 0.0f));
+    scene.EndLoop();
+    scene.BeginLoop();
+    scene.EndLoop();
+    auto* a = scene.FindEntityByInstanceName("a");
+    auto* b = scene.FindEntityByInstanceName("b");
+    TEST_REQUIRE(a && b);
+    const auto a_body = GetBodyId(a);
+    const auto b_body = GetBodyId(b);
+
+    game::PhysicsEngine physics;
+    physics.CreateWorld(scene);
+    TEST_REQUIRE(physics.GetNumBodies() == 2);
+    TEST_REQUIRE(physics.HasBody(a_body));
+    TEST_REQUIRE(physics.HasBody(b_body));
+
+    // deletes are queued until the next tick.
+    physics.DeleteBody(a_body);
+    physics.DeleteBody("no such body");
+    TEST_REQUIRE(physics.HasBody(a_body));
+    physics.Tick();
+    TEST_REQUIRE(physics.HasBody(a_body) == false);
+    TEST_REQUIRE(physics.HasBody(b_body));
+    TEST_REQUIRE(physics.GetNumBodies() == 1);
+
+    // the node still has a rigid body so the scene update brings it back.
+    physics.UpdateScene(scene);
+    TEST_REQUIRE(physics.HasBody(a_body));
+    TEST_REQUIRE(physics.GetNumBodies() == 2);
+
+    // kill one entity and spawn another in the same scene loop.
+    scene.BeginLoop();
+        scene.KillEntity(b);
+        auto* c = Spawn(scene, entity, "c", glm::vec2(20.0f, 0.0f));
+    scene.EndLoop();
+    scene.BeginLoop();
+    scene.EndLoop();
+    scene.BeginLoop();
+    scene.EndLoop();
+    TEST_REQUIRE(scene.FindEntityByInstanceName("b") == nullptr);
+    TEST_REQUIRE(scene.FindEntityByInstanceName("c") == c);
+    const auto c_body = GetBodyId(c);
+
+    // nothing changes in the physics world until the scene update.
+    TEST_REQUIRE(physics.HasBody(b_body));
+    TEST_REQUIRE(physics.HasBody(c_body) == false);
+    // the culled body and the new body are applied in one go.
+    physics.UpdateScene(scene);
+    TEST_REQUIRE(physics.HasBody(a_body));
+    TEST_REQUIRE(physics.HasBody(b_body) == false);
+    TEST_REQUIRE(physics.HasBody(c_body));
+    TEST_REQUIRE(physics.GetNumBodies() == 2);
+
+    // the new body was created where the entity is and falls down with
+    // gravity like the rest. the spawn position goes into the root node.
+    for (int i=0; i<10; ++i)
+        physics.Tick();
+    physics.UpdateScene(scene);
+    const auto* node = c->FindNodeByClassName("body");
+    TEST_REQUIRE(node->GetTranslation().y > 0.0f);
+    TEST_REQUIRE(std::abs(node->GetTranslation().x - 20.0f) < 0.001f);
+
+    physics.DeleteAll();
+    TEST_REQUIRE(physics.GetNumBodies() == 0);
+}
+
+bool HaveContact(const std::vector<game::ContactEvent>& contacts, const game::Entity* entity)
+{
+    for (const auto& contact : contacts)
+    {
+        if (contact.entityA == entity->GetId() || contact.entityB == entity->GetId())
+            return true;
+    }
+    return false;
+}
+
+void unit_test_contact_filtering()
+{
+    using Simulation = game::RigidBodyItemClass::Simulation;
+    const auto ground = MakeBoxEntity(Simulation::Static, glm::vec2(10.0f, 1.0f), 0x1, 0xffff);
+    // collides with the ground.
+    const auto ball   = MakeBoxEntity(Simulation::Dynamic, glm::vec2(1.0f, 1.0f), 0x2, 0x1);
+    // the mask doesn't include the ground's category.
+    const auto ghost  = MakeBoxEntity(Simulation::Dynamic, glm::vec2(1.0f, 1.0f), 0x4, 0x2);
+
+    game::SceneClass klass;
+    game::Scene scene(klass);
+    scene.BeginLoop();
+        Spawn(scene, ground, "ground", glm::vec2(0.0f, 2.0f));
+        Spawn(scene, ball,   "ball",   glm::vec2(-3.0f, 0.0f));
+        Spawn(scene, ghost,  "ghost",  glm::vec2(3.0f, 0.0f));
+    scene.EndLoop();
+    scene.BeginLoop();
+    scene.EndLoop();
+    const auto* ground_entity = scene.FindEntityByInstanceName("ground");
+    const auto* ball_entity   = scene.FindEntityByInstanceName("ball");
+    const auto* ghost_entity  = scene.FindEntityByInstanceName("ghost");
+
+    // no subscriptions, every contact that happens is reported.
+    {
+        game::PhysicsEngine physics;
+        physics.SetGravity(glm::vec2(0.0f, 10.0f));
+        physics.CreateWorld(scene);
+
+        std::vector<game::ContactEvent> contacts;
+        for (int i=0; i<120; ++i)
+            physics.Tick(&contacts);
+        TEST_REQUIRE(HaveContact(contacts, ball_entity));
+        TEST_REQUIRE(HaveContact(contacts, ground_entity));
+        TEST_REQUIRE(HaveContact(contacts, ghost_entity) == false);
+
+        // the ball rests on the ground while the ghost fell through.
+        physics.UpdateScene(scene);
+        TEST_REQUIRE(ball_entity->FindNodeByClassName("body")->GetTranslation().y < 1.5f);
+        TEST_REQUIRE(ghost_entity->FindNodeByClassName("body")->GetTranslation().y > 2.5f);
+    }
+
+    // the subscriptions only filter the reported contacts.
+    scene.FindEntityByInstanceName("ball")->FindNodeByClassName("body")->SetTranslation(glm::vec2(-3.0f, 0.0f));
+    scene.FindEntityByInstanceName("ghost")->FindNodeByClassName("body")->SetTranslation(glm::vec2(3.0f, 0.0f));
+    {
+        game::PhysicsEngine physics;
+        physics.SetGravity(glm::vec2(0.0f, 10.0f));
+        physics.SubscribeContacts(0x2, 0x8);
+        physics.CreateWorld(scene);
+
+        std::vector<game::ContactEvent> contacts;
+        for (int i=0; i<120; ++i)
+            physics.Tick(&contacts);
+        TEST_REQUIRE(contacts.empty());
+        physics.UpdateScene(scene);
+        TEST_REQUIRE(ball_entity->FindNodeByClassName("body")->GetTranslation().y < 1.5f);
+
+        // once subscribed to ball/ground contacts they're reported again.
+        physics.ClearContactSubscriptions();
+        physics.SubscribeContacts(0x1, 0x2);
+        physics.ApplyImpulseToCenter(*ball_entity->FindNodeByClassName("body"), glm::vec2(0.0f, -5.0f));
+        for (int i=0; i<120; ++i)
+            physics.Tick(&contacts);
+        TEST_REQUIRE(HaveContact(contacts, ball_entity));
+        TEST_REQUIRE(HaveContact(contacts, ghost_entity) == false);
+    }
+
+    // the filtering can be changed at runtime.
+    scene.FindEntityByInstanceName("ghost")->FindNodeByClassName("body")->SetTranslation(glm::vec2(3.0f, 0.0f));
+    {
+        game::PhysicsEngine physics;
+        physics.SetGravity(glm::vec2(0.0f, 10.0f));
+        physics.CreateWorld(scene);
+
+        auto* body = scene.FindEntityByInstanceName("ghost")->FindNodeByClassName("body")->GetRigidBody();
+        body->SetCollisionMask(0x1);
+        physics.UpdateScene(scene);
+
+        std::vector<game::ContactEvent> contacts;
+        for (int i=0; i<120; ++i)
+            physics.Tick(&contacts);
+        TEST_REQUIRE(HaveContact(contacts, ghost_entity));
+        physics.UpdateScene(scene);
+        TEST_REQUIRE(ghost_entity->FindNodeByClassName("body")->GetTranslation().y < 1.5f);
+        body->SetCollisionMask(0x2);
+    }
+}
+
+struct BodyState {
+    glm::vec2 position;
+    float rotation = 0.0f;
+};
+
+// drop a bunch of boxes on the ground and return where they end up.
+std::vector<BodyState> RunBoxDrop(unsigned num_partitions, base::ThreadPool* pool)
+{
+    using Simulation = game::RigidBodyItemClass::Simulation;
+    const auto ground = MakeBoxEntity(Simulation::Static, glm::vec2(40.0f, 1.0f));
+    const auto box    = MakeBoxEntity(Simulation::Dynamic);
+
+    game::SceneClass klass;
+    game::Scene scene(klass);
+    scene.BeginLoop();
+        Spawn(scene, ground, "ground", glm::vec2(0.0f, 2.0f));
+        // each box in a strip of its own when there are 4 partitions.
+        Spawn(scene, box, "0", glm::vec2(-15.0f, -1.0f));
+        Spawn(scene, box, "1", glm::vec2( -5.0f, -2.0f));
+        Spawn(scene, box, "2", glm::vec2(  5.0f, -3.0f));
+        Spawn(scene, box, "3", glm::vec2( 15.0f, -4.0f));
+    scene.EndLoop();
+    scene.BeginLoop();
+    scene.EndLoop();
+
+    game::PhysicsEngine physics;
+    physics.SetGravity(glm::vec2(0.0f, 10.0f));
+    physics.SetNumPartitions(num_partitions);
+    physics.SetThreadPool(pool);
+    physics.CreateWorld(scene);
+    TEST_REQUIRE(physics.GetNumPartitions() == num_partitions);
+
+    // give them some spin to have something more than a straight drop.
+    for (int i=0; i<4; ++i)
+    {
+        const auto* node = scene.FindEntityByInstanceName(std::to_string(i))->FindNodeByClassName("body");
+        physics.ApplyImpulseToCenter(*node, glm::vec2(0.5f * (i - 1.5f), 0.0f));
+    }
+    std::vector<game::ContactEvent> contacts;
+    for (int i=0; i<180; ++i)
+        physics.Tick(&contacts);
+    physics.UpdateScene(scene);
+    TEST_REQUIRE(!contacts.empty());
+
+    std::vector<BodyState> ret;
+    for (int i=0; i<4; ++i)
+    {
+        const auto* node = scene.FindEntityByInstanceName(std::to_string(i))->FindNodeByClassName("body");
+        BodyState state;
+        state.position = node->GetTranslation();
+        state.rotation = node->GetRotation();
+        ret.push_back(state);
+    }
+    return ret;
+}
+
+void unit_test_partitions()
+{
+    // the bodies never leave their strip so the partitioned world
+    // must give the same results as the single world.
+    {
+        const auto& single = RunBoxDrop(1, nullptr);
+        const auto& serial = RunBoxDrop(4, nullptr);
+        base::ThreadPool pool(4);
+        const auto& parallel = RunBoxDrop(4, &pool);
+        for (size_t i=0; i<single.size(); ++i)
+        {
+            TEST_REQUIRE(glm::length(single[i].position - serial[i].position) < 0.0001f);
+            TEST_REQUIRE(std::abs(single[i].rotation - serial[i].rotation) < 0.0001f);
+            // the number of threads makes no difference at all.
+            TEST_REQUIRE(serial[i].position == parallel[i].position);
+            TEST_REQUIRE(serial[i].rotation == parallel[i].rotation);
+        }
+    }
+
+    // a single moving body sliding over the ground into the next partition.
+    // the partitions are laid out based on the ground since there's only
+    // one moving body. the contact with the ground ends in the old partition
+    // and begins again in the new one.
+    {
+        using Simulation = game::RigidBodyItemClass::Simulation;
+        game::RigidBodyItemClass body;
+        body.SetCollisionShape(game::RigidBodyItemClass::CollisionShape::Box);
+        body.SetFriction(0.0f);
+        body.SetSimulation(Simulation::Static);
+        const auto ground = MakeEntity(body, glm::vec2(40.0f, 1.0f));
+        body.SetSimulation(Simulation::Dynamic);
+        body.SetLinearVelocity(glm::vec2(10.0f, 0.0f));
+        const auto slider = MakeEntity(body, glm::vec2(1.0f, 1.0f));
+
+        game::SceneClass klass;
+        game::Scene scene(klass);
+        scene.BeginLoop();
+            Spawn(scene, ground, "ground", glm::vec2(0.0f, 2.0f));
+            Spawn(scene, slider, "slider", glm::vec2(-5.0f, 1.0f));
+        scene.EndLoop();
+        scene.BeginLoop();
+        scene.EndLoop();
+        const auto* entity = scene.FindEntityByInstanceName("slider");
+
+        game::PhysicsEngine physics;
+        physics.SetGravity(glm::vec2(0.0f, 10.0f));
+        physics.SetNumPartitions(2);
+        physics.CreateWorld(scene);
+
+        std::vector<game::ContactEvent> contacts;
+        for (int i=0; i<60; ++i)
+            physics.Tick(&contacts);
+        physics.UpdateScene(scene);
+        TEST_REQUIRE(entity->FindNodeByClassName("body")->GetTranslation().x > 2.0f);
+
+        unsigned begin = 0;
+        unsigned end   = 0;
+        for (const auto& contact : contacts)
+        {
+            if (contact.entityA != entity->GetId() && contact.entityB != entity->GetId())
+                continue;
+            if (contact.type == game::ContactEvent::Type::BeginContact)
+                ++begin;
+            else ++end;
+        }
+        TEST_REQUIRE(begin >= 2);
+        TEST_REQUIRE(end >= 1);
+        // still touching the ground.
+        TEST_REQUIRE(begin == end + 1);
+    }
+}
+
+int test_main(int argc, char* argv[])
+{
+    unit_test_spawn_kill_batching();
+    unit_test_contact_filtering();
+    unit_test_partitions();
+    return 0;
+}
@@ -0,0 +1,128 @@
+// Copyright (C) 2020-2021 Sami Väisänen
+// Copyright (C) 2020-2021 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+#include "base/test_minimal.h"
+#include "base/format.h"
+#include "base/math.h"
+#include "base/utility.h"
+#include "engine/main/interface.h"
+#include "engine/main/replay.h"
+
+// stand-in for the game that logs everything that goes in and
+// the random numbers it draws on every frame.
+class TestApp : public game::App,
+                public wdk::WindowListener
+{
+public:
+    virtual wdk::WindowListener* GetWindowListener() override
+    { return this; }
+    virtual void OnRenderingSurfaceResized(unsigned width, unsigned height) override
+    { log.push_back(base::FormatString("resize %1x%2", width, height)); }
+    virtual void OnEnterFullScreen() override
+    { log.push_back("fullscreen"); }
+    virtual void OnLeaveFullScreen() override
+    { log.push_back("windowed"); }
+    virtual void OnKeydown(const wdk::WindowEventKeydown& key) override
+    { log.push_back(base::FormatString("keydown %1", static_cast<int>(key.symbol))); }
+    virtual void OnMouseMove(const wdk::WindowEventMouseMove& mouse) override
+    { log.push_back(base::FormatString("mouse %1,%2", mouse.window_x, mouse.window_y)); }
+
+    void Tick(double wall_time, double dt)
+    {
+        log.push_back(base::FormatString("frame %1 %2 %3 %4", wall_time, dt,
+            math::rand(0, 1000), base::RandomInstanceId(5)));
+    }
+    std::vector<std::string> log;
+};
+
+void unit_test_record_replay()
+{
+    std::vector<std::string> recorded;
+    {
+        TestApp app;
+        game::SessionRecorder recorder("unit_test_session.bin", &app);
+        TEST_REQUIRE(recorder.IsOpen());
+        game::SessionHeader header;
+        header.random_seed    = 1234;
+        header.surface_width  = 640;
+        header.surface_height = 480;
+        recorder.WriteHeader(header);
+        math::seed_rand(header.random_seed);
+
+        double wall_time = 0.0;
+        for (int i=0; i<10; ++i)
+        {
+            wdk::WindowEventKeydown key;
+            key.symbol = wdk::Keysym::Space;
+            recorder.OnKeydown(key);
+            if (i == 3)
+            {
+                recorder.RecordSurfaceResize(800, 600);
+                app.OnRenderingSurfaceResized(800, 600);
+            }
+            if (i == 5)
+            {
+                recorder.RecordFullScreen(true);
+                app.OnEnterFullScreen();
+            }
+            wdk::WindowEventMouseMove mouse;
+            mouse.window_x = i * 10;
+            mouse.window_y = i * 20;
+            recorder.OnMouseMove(mouse);
+
+            const double dt = 1.0/60.0 + i * 0.001;
+            recorder.RecordFrame(wall_time, dt);
+            app.Tick(wall_time, dt);
+            wall_time += dt;
+        }
+        recorder.Close();
+        recorded = app.log;
+    }
+    TEST_REQUIRE(recorded.size() == 32);
+
+    // whatever happened in between shouldn't matter.
+    math::seed_rand(42);
+    math::rand(0, 1000);
+
+    {
+        TestApp app;
+        game::SessionPlayer player("unit_test_session.bin");
+        TEST_REQUIRE(player.IsOpen());
+        game::SessionHeader header;
+        TEST_REQUIRE(player.ReadHeader(&header));
+        TEST_REQUIRE(header.random_seed    == 1234);
+        TEST_REQUIRE(header.surface_width  == 640);
+        TEST_REQUIRE(header.surface_height == 480);
+        math::seed_rand(header.random_seed);
+
+        double wall_time = 0.0;
+        double dt = 0.0;
+        while (player.NextFrame(app, &wall_time, &dt))
+            app.Tick(wall_time, dt);
+        TEST_REQUIRE(app.log == recorded);
+    }
+}
+
+int test_main(int argc, char* argv[])
+{
+    unit_test_record_replay();
+    return 0;
+}
@@ -19,6 +19,8 @@
 #include <string>
 #include <cstddef>
 #include <iostream>
+#include <chrono>
+#include <vector>
 
 #include "base/test_minimal.h"
 #include "base/test_float.h"
@@ -28,6 +30,7 @@
 #include "data/json.h"
 #include "engine/scene.h"
 #include "engine/entity.h"
+#include "engine/classlib.h"
 
 // build easily comparable representation of the render tree
 // by concatenating node names into a string in the order
@@ -168,6 +171,7 @@ void unit_test_scene_class()
     klass.LinkChild(klass.FindNodeByName("root"), klass.FindNodeByName("child_1"));
     klass.LinkChild(klass.FindNodeByName("root"), klass.FindNodeByName("child_2"));
     TEST_REQUIRE(WalkTree(klass) == "root child_1 child_2");
+    klass.SetStreamingCellSize(500.0f);
 
     // to/from json
     {
@@ -185,6 +189,7 @@ void unit_test_scene_class()
         TEST_REQUIRE(ret->GetHash() == klass.GetHash());
         TEST_REQUIRE(ret->GetScriptVar(0).GetName() == "foo");
         TEST_REQUIRE(ret->GetScriptVar(1).GetName() == "bar");
+        TEST_REQUIRE(ret->GetStreamingCellSize() == real::float32(500.0f));
         TEST_REQUIRE(WalkTree(*ret) == "root child_1 child_2");
     }
 
@@ -696,6 +701,362 @@ void unit_test_scene_instance_transform()
 
 }
 
+class TestClassLib : public game::ClassLibrary
+{
+public:
+    virtual game::ClassHandle<const uik::Window> FindUIByName(const std::string& name) const override
+    { return nullptr; }
+    virtual game::ClassHandle<const uik::Window> FindUIById(const std::string& id) const override
+    { return nullptr; }
+    virtual game::ClassHandle<const gfx::MaterialClass> FindMaterialClassById(const std::string& id) const override
+    { return nullptr; }
+    virtual game::ClassHandle<const gfx::DrawableClass> FindDrawableClassById(const std::string& id) const override
+    { return nullptr; }
+    virtual game::ClassHandle<const game::EntityClass> FindEntityClassByName(const std::string& name) const override
+    { return nullptr; }
+    virtual game::ClassHandle<const game::EntityClass> FindEntityClassById(const std::string& id) const override
+    {
+        for (const auto& klass : entities)
+            if (klass->GetId() == id) return klass;
+        return nullptr;
+    }
+    virtual game::ClassHandle<const game::SceneClass> FindSceneClassByName(const std::string& name) const override
+    { return nullptr; }
+    virtual game::ClassHandle<const game::SceneClass> FindSceneClassById(const std::string& id) const override
+    { return nullptr; }
+    std::vector<std::shared_ptr<const game::EntityClass>> entities;
+};
+
+void unit_test_scene_instance_snapshot()
+{
+    auto entity = std::make_shared<game::EntityClass>();
+    {
+        // the material params are in an unordered map, insert them
+        // backwards so that the map order isn't the name order.
+        game::DrawableItemClass drawable;
+        for (int i=19; i>=0; --i)
+            drawable.SetMaterialParam("param" + std::to_string(i), (float)i);
+
+        game::EntityNodeClass node;
+        node.SetName("body");
+        node.SetDrawable(drawable);
+        entity->LinkChild(nullptr, entity->AddNode(std::move(node)));
+    }
+    {
+        game::EntityNodeClass node;
+        node.SetName("arm");
+        node.SetTranslation(glm::vec2(10.0f, 0.0f));
+        entity->LinkChild(entity->FindNodeByName("body"), entity->AddNode(std::move(node)));
+    }
+    entity->AddScriptVar(game::ScriptVar("health", 100, game::ScriptVar::ReadWrite));
+
+    auto klass = std::make_shared<game::SceneClass>();
+    {
+        game::SceneNodeClass node;
+        node.SetName("player");
+        node.SetEntity(entity);
+        klass->AddNode(node);
+        klass->LinkChild(nullptr, klass->FindNodeByName("player"));
+    }
+    {
+        game::SceneNodeClass node;
+        node.SetName("enemy");
+        node.SetEntity(entity);
+        klass->AddNode(node);
+        klass->LinkChild(klass->FindNodeByName("player"), klass->FindNodeByName("enemy"));
+    }
+    klass->AddScriptVar(game::ScriptVar("score", 0, game::ScriptVar::ReadWrite));
+
+    TestClassLib classlib;
+    classlib.entities.push_back(entity);
+
+    game::Scene scene(klass);
+    scene.Update(1.0f);
+    scene.FindScriptVar("score")->SetValue(10);
+    auto* player = scene.FindEntityByInstanceName("player");
+    player->FindNodeByClassName("arm")->SetTranslation(glm::vec2(20.0f, 5.0f));
+    player->FindScriptVar("health")->SetValue(50);
+
+    // pending spawn.
+    game::EntityArgs args;
+    args.klass = entity;
+    args.name  = "bullet";
+    scene.SpawnEntity(args);
+
+    std::vector<std::uint8_t> snapshot;
+    scene.SaveSnapshot(&snapshot);
+    TEST_REQUIRE(!snapshot.empty());
+
+    // change the scene.
+    scene.Update(1.0f);
+    scene.FindScriptVar("score")->SetValue(20);
+    player->FindNodeByClassName("arm")->SetTranslation(glm::vec2(0.0f, 0.0f));
+    player->FindScriptVar("health")->SetValue(0);
+    scene.BeginLoop();
+    scene.KillEntity(scene.FindEntityByInstanceName("enemy"));
+    scene.EndLoop();
+    scene.BeginLoop();
+    scene.EndLoop();
+    TEST_REQUIRE(scene.GetNumEntities() == 2);
+    TEST_REQUIRE(WalkTree(scene) == "player bullet");
+
+    TEST_REQUIRE(scene.RestoreSnapshot(snapshot, classlib));
+    TEST_REQUIRE(scene.GetNumEntities() == 2);
+    TEST_REQUIRE(WalkTree(scene) == "player enemy");
+    TEST_REQUIRE(scene.GetTime() == 1.0);
+    TEST_REQUIRE(scene.FindScriptVar("score")->GetValue<int>() == 10);
+    player = scene.FindEntityByInstanceName("player");
+    TEST_REQUIRE(player);
+    TEST_REQUIRE(player->GetNumNodes() == 2);
+    TEST_REQUIRE(player->FindNodeByClassName("arm")->GetTranslation() == glm::vec2(20.0f, 5.0f));
+    TEST_REQUIRE(player->GetRenderTree().GetParent(player->FindNodeByClassName("arm")) ==
+                 player->FindNodeByClassName("body"));
+    TEST_REQUIRE(player->FindScriptVar("health")->GetValue<int>() == 50);
+    TEST_REQUIRE(scene.FindEntityByInstanceName("bullet") == nullptr);
+    // the pending spawn gets added on the next loop.
+    scene.BeginLoop();
+    TEST_REQUIRE(scene.GetNumEntities() == 3);
+    TEST_REQUIRE(scene.FindEntityByInstanceName("bullet"));
+    scene.EndLoop();
+
+    // same snapshot again gives the same bytes.
+    {
+        game::Scene other(klass);
+        TEST_REQUIRE(other.RestoreSnapshot(snapshot, classlib));
+        std::vector<std::uint8_t> copy;
+        other.SaveSnapshot(&copy);
+        TEST_REQUIRE(copy == snapshot);
+    }
+
+    // broken snapshot leaves the scene alone.
+    snapshot.resize(snapshot.size() / 2);
+    TEST_REQUIRE(scene.RestoreSnapshot(snapshot, classlib) == false);
+    TEST_REQUIRE(scene.GetNumEntities() == 3);
+}
+
+// not a real benchmark but gives an idea of the snapshot cost
+// with a scene of 10k entities.
+void unit_test_scene_instance_snapshot_perf()
+{
+    auto entity = std::make_shared<game::EntityClass>();
+    {
+        game::DrawableItemClass drawable;
+        drawable.SetMaterialParam("kColor", 1.0f);
+        game::EntityNodeClass node;
+        node.SetName("body");
+        node.SetDrawable(drawable);
+        entity->LinkChild(nullptr, entity->AddNode(std::move(node)));
+    }
+    auto klass = std::make_shared<game::SceneClass>();
+
+    TestClassLib classlib;
+    classlib.entities.push_back(entity);
+
+    game::Scene scene(klass);
+    for (int i=0; i<10000; ++i)
+    {
+        game::EntityArgs args;
+        args.klass    = entity;
+        args.name     = "entity" + std::to_string(i);
+        args.position = glm::vec2(i % 100, i / 100);
+        scene.SpawnEntity(args);
+    }
+    scene.BeginLoop();
+    scene.EndLoop();
+    TEST_REQUIRE(scene.GetNumEntities() == 10000);
+
+    using clock = std::chrono::steady_clock;
+    std::vector<std::uint8_t> snapshot;
+    const auto save_start = clock::now();
+    scene.SaveSnapshot(&snapshot);
+    const auto save_end = clock::now();
+
+    game::Scene other(klass);
+    const auto restore_start = clock::now();
+    TEST_REQUIRE(other.RestoreSnapshot(snapshot, classlib));
+    const auto restore_end = clock::now();
+    TEST_REQUIRE(other.GetNumEntities() == 10000);
+
+    // the restored scene saves into the same bytes.
+    std::vector<std::uint8_t> copy;
+    other.SaveSnapshot(&copy);
+    TEST_REQUIRE(copy == snapshot);
+
+    // the budgets are generous enough for a debug build on a slow
+    // machine. the point is to catch something going quadratic.
+    const auto ms = [](clock::duration d) {
+        return std::chrono::duration<double, std::milli>(d).count();
+    };
+    TEST_REQUIRE(ms(save_end - save_start) < 1000.0);
+    TEST_REQUIRE(ms(restore_end - restore_start) < 3000.0);
+}
+
+void unit_test_scene_instance_streaming()
+{
+    auto entity = std::make_shared<game::EntityClass>();
+    {
+        game::EntityNodeClass node;
+        node.SetName("body");
+        entity->LinkChild(nullptr, entity->AddNode(std::move(node)));
+    }
+    entity->AddScriptVar(game::ScriptVar("health", 100, game::ScriptVar::ReadWrite));
+
+    auto klass = std::make_shared<game::SceneClass>();
+    klass->SetStreamingCellSize(100.0f);
+    {
+        game::SceneNodeClass node;
+        node.SetName("a");
+        node.SetEntity(entity);
+        node.SetTranslation(glm::vec2(50.0f, 50.0f));
+        klass->AddNode(node);
+        klass->LinkChild(nullptr, klass->FindNodeByName("a"));
+    }
+    {
+        game::SceneNodeClass node;
+        node.SetName("a_child");
+        node.SetEntity(entity);
+        // children go with their parent regardless of position.
+        node.SetTranslation(glm::vec2(500.0f, 0.0f));
+        klass->AddNode(node);
+        klass->LinkChild(klass->FindNodeByName("a"), klass->FindNodeByName("a_child"));
+    }
+    {
+        game::SceneNodeClass node;
+        node.SetName("b");
+        node.SetEntity(entity);
+        node.SetTranslation(glm::vec2(1050.0f, 50.0f));
+        klass->AddNode(node);
+        klass->LinkChild(nullptr, klass->FindNodeByName("b"));
+    }
+
+    TestClassLib classlib;
+    classlib.entities.push_back(entity);
+
+    game::Scene scene(klass);
+    TEST_REQUIRE(scene.GetNumEntities() == 0);
+    TEST_REQUIRE(scene.GetNumStreamingCells() == 2);
+    TEST_REQUIRE(scene.GetNumLoadedStreamingCells() == 0);
+
+    scene.UpdateStreaming(game::FRect(0.0f, 0.0f, 100.0f, 100.0f));
+    TEST_REQUIRE(scene.GetNumLoadedStreamingCells() == 1);
+    TEST_REQUIRE(scene.GetNumEntities() == 2);
+    TEST_REQUIRE(WalkTree(scene) == "a a_child");
+    TEST_REQUIRE(scene.FindEntityByInstanceName("a")->HasBeenSpawned());
+    TEST_REQUIRE(scene.FindEntityByInstanceName("a")->HasBeenStreamed());
+    scene.BeginLoop();
+    scene.FindEntityByInstanceName("a")->FindScriptVar("health")->SetValue(50);
+    scene.KillEntity(scene.FindEntityByInstanceName("a_child"));
+    scene.EndLoop();
+    scene.BeginLoop();
+    scene.EndLoop();
+    TEST_REQUIRE(WalkTree(scene) == "a");
+
+    // within the unload margin, nothing changes.
+    scene.UpdateStreaming(game::FRect(220.0f, 0.0f, 100.0f, 100.0f));
+    TEST_REQUIRE(scene.GetNumLoadedStreamingCells() == 1);
+    scene.BeginLoop();
+    scene.EndLoop();
+    TEST_REQUIRE(WalkTree(scene) == "a");
+
+    TEST_REQUIRE(!scene.FindEntityByInstanceName("a")->HasBeenStreamed());
+
+    // move over to b. the removed entity is flagged as streamed
+    // so the scripts can tell it wasn't killed by the game.
+    scene.UpdateStreaming(game::FRect(1000.0f, 0.0f, 100.0f, 100.0f));
+    TEST_REQUIRE(scene.GetNumLoadedStreamingCells() == 1);
+    TEST_REQUIRE(scene.FindEntityByInstanceName("a")->HasBeenStreamed());
+    scene.BeginLoop();
+    TEST_REQUIRE(scene.FindEntityByInstanceName("a")->HasBeenKilled());
+    TEST_REQUIRE(scene.FindEntityByInstanceName("b")->HasBeenStreamed());
+    scene.EndLoop();
+    TEST_REQUIRE(WalkTree(scene) == "b");
+
+    // back to a, the state is restored and the killed child stays dead.
+    scene.UpdateStreaming(game::FRect(0.0f, 0.0f, 100.0f, 100.0f));
+    scene.BeginLoop();
+    scene.EndLoop();
+    TEST_REQUIRE(WalkTree(scene) == "a");
+    TEST_REQUIRE(scene.FindEntityByInstanceName("a")->FindScriptVar("health")->GetValue<int>() == 50);
+
+    // snapshot keeps the unloaded cell state too.
+    {
+        std::vector<std::uint8_t> snapshot;
+        scene.SaveSnapshot(&snapshot);
+        game::Scene other(klass);
+        TEST_REQUIRE(other.RestoreSnapshot(snapshot, classlib));
+        TEST_REQUIRE(other.GetNumLoadedStreamingCells() == 1);
+        TEST_REQUIRE(WalkTree(other) == "a");
+        other.UpdateStreaming(game::FRect(0.0f, 0.0f, 100.0f, 100.0f));
+        TEST_REQUIRE(other.GetNumEntities() == 1);
+    }
+
+    // budget limits the loading of cells that aren't visible.
+    {
+        game::Scene other(klass);
+        other.SetStreamingMargins(2000.0f, 3000.0f);
+        other.SetStreamingBudget(0);
+        other.UpdateStreaming(game::FRect(0.0f, 0.0f, 100.0f, 100.0f));
+        TEST_REQUIRE(other.GetNumLoadedStreamingCells() == 1);
+        TEST_REQUIRE(WalkTree(other) == "a a_child");
+        other.UpdateStreaming(game::FRect(0.0f, 0.0f, 100.0f, 100.0f));
+        TEST_REQUIRE(other.GetNumLoadedStreamingCells() == 2);
+        TEST_REQUIRE(other.GetNumEntities() == 3);
+    }
+
+    // an entity that has moved out of its cell stays as long as
+    // it's near the view even when its cell is far away.
+    {
+        game::Scene other(klass);
+        other.UpdateStreaming(game::FRect(0.0f, 0.0f, 100.0f, 100.0f));
+        other.BeginLoop();
+        other.EndLoop();
+        other.FindEntityByInstanceName("a")->GetNode(0).SetTranslation(glm::vec2(1050.0f, 60.0f));
+        other.UpdateStreaming(game::FRect(1000.0f, 0.0f, 100.0f, 100.0f));
+        TEST_REQUIRE(other.GetNumLoadedStreamingCells() == 2);
+        other.BeginLoop();
+        other.EndLoop();
+        TEST_REQUIRE(other.FindEntityByInstanceName("a"));
+        TEST_REQUIRE(other.FindEntityByInstanceName("b"));
+
+        // once both are away the cell goes.
+        other.UpdateStreaming(game::FRect(5000.0f, 0.0f, 100.0f, 100.0f));
+        TEST_REQUIRE(other.GetNumLoadedStreamingCells() == 0);
+        other.BeginLoop();
+        other.EndLoop();
+        TEST_REQUIRE(other.GetNumEntities() == 0);
+
+        // and comes back at the position it was moved to.
+        other.UpdateStreaming(game::FRect(0.0f, 0.0f, 100.0f, 100.0f));
+        other.BeginLoop();
+        other.EndLoop();
+        TEST_REQUIRE(other.FindEntityByInstanceName("a")->GetNode(0).GetTranslation() == glm::vec2(1050.0f, 60.0f));
+    }
+
+    // a loaded cell with all of its placements killed stays
+    // empty after a snapshot restore.
+    {
+        game::Scene other(klass);
+        other.UpdateStreaming(game::FRect(0.0f, 0.0f, 100.0f, 100.0f));
+        other.BeginLoop();
+        other.EndLoop();
+        other.KillEntity(other.FindEntityByInstanceName("a"));
+        other.BeginLoop();
+        other.EndLoop();
+        TEST_REQUIRE(other.GetNumEntities() == 0);
+        TEST_REQUIRE(other.GetNumLoadedStreamingCells() == 1);
+
+        std::vector<std::uint8_t> snapshot;
+        other.SaveSnapshot(&snapshot);
+        game::Scene restored(klass);
+        TEST_REQUIRE(restored.RestoreSnapshot(snapshot, classlib));
+        TEST_REQUIRE(restored.GetNumLoadedStreamingCells() == 1);
+        restored.UpdateStreaming(game::FRect(0.0f, 0.0f, 100.0f, 100.0f));
+        restored.BeginLoop();
+        restored.EndLoop();
+        TEST_REQUIRE(restored.GetNumEntities() == 0);
+    }
+}
+
 int test_main(int argc, char* argv[])
 {
     unit_test_node();
@@ -704,5 +1065,8 @@ int test_main(int argc, char* argv[])
     unit_test_scene_instance_spawn();
     unit_test_scene_instance_kill();
     unit_test_scene_instance_transform();
+    unit_test_scene_instance_snapshot();
+    unit_test_scene_instance_snapshot_perf();
+    unit_test_scene_instance_streaming();
     return 0;
 }
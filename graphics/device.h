@@ -32,6 +32,7 @@ namespace gfx
     class Program;
     class Geometry;
     class Texture;
+    class FrameBuffer;
 
     class Device
     {
@@ -140,6 +141,11 @@ namespace gfx
             // Returns a valid pointer or nullptr if there's no such
             // function. (For example an extension function is not available).
             virtual void* Resolve(const char* name) = 0;
+            // Release the context from the calling thread, i.e. after this
+            // the calling thread has no current context. A context can only
+            // be current in a single thread at a time so it must be released
+            // before it can be made current in another thread.
+            virtual void ReleaseCurrent() {}
         private:
         };
 
@@ -147,6 +153,9 @@ namespace gfx
 
         virtual void ClearColor(const Color4f& color) = 0;
         virtual void ClearStencil(int value) = 0;
+        // Clear the stencil buffer only inside the given rectangle. The
+        // rectangle is in device coordinates, i.e. bottom left origin.
+        virtual void ClearStencil(int value, const IRect& rect) = 0;
 
         // Texture minifying filter is used whenever the
         // pixel being textured maps to an area greater than
@@ -195,23 +204,87 @@ namespace gfx
         virtual Geometry* MakeGeometry(const std::string& name) = 0;
         virtual Texture* FindTexture(const std::string& name) = 0;
         virtual Texture* MakeTexture(const std::string& name) = 0;
+        virtual FrameBuffer* FindFrameBuffer(const std::string& name) = 0;
+        virtual FrameBuffer* MakeFrameBuffer(const std::string& name) = 0;
         // Resource deletion APIs
         virtual void DeleteShaders() = 0;
         virtual void DeletePrograms() = 0;
         virtual void DeleteGeometries() = 0;
         virtual void DeleteTextures() = 0;
+        virtual void DeleteFrameBuffers() = 0;
+        // Delete a single resource by name. Does nothing if there's no
+        // such resource. Normally unused resources are deleted by the
+        // garbage collection (see CleanGarbage) but these are useful when
+        // the lifetime of the resources is managed by some other means.
+        virtual void DeleteShader(const std::string& name) = 0;
+        virtual void DeleteProgram(const std::string& name) = 0;
+        virtual void DeleteGeometry(const std::string& name) = 0;
+        virtual void DeleteTexture(const std::string& name) = 0;
+
+        // Set the current render target for any subsequent clear, draw
+        // and read operations. Passing nullptr selects the default render
+        // target, i.e. the rendering surface of the device context.
+        // Returns false if the frame buffer could not be used in which
+        // case the default render target is selected.
+        virtual bool SetFrameBuffer(FrameBuffer* fbo) = 0;
 
         // Draw the given geometry using the given program with the specified state applied.
         virtual void Draw(const Program& program, const Geometry& geometry, const State& state) = 0;
 
         virtual Type GetDeviceType() const = 0;
 
+        // Get the number of the current frame, i.e. the number of frames
+        // completed with EndFrame so far.
+        virtual std::size_t GetFrameNumber() const = 0;
+
         // Delete GPU resources that are no longer being used and that are
         // eligible for garbage collection (i.e. are marked as okay to delete).
         // Resources that have not been used in the last N frames can be deleted.
         // For example if a texture was last used to render frame N and we're
         // currently at frame N+max_num_idle_frames then the texture is deleted.
-        virtual void CleanGarbage(size_t max_num_idle_frames) = 0;
+        // Programs, geometries and shaders are always eligible, textures only
+        // when garbage collection has been enabled on them.
+        // max_time_us is the time budget for the call in microseconds. When
+        // the budget runs out any remaining expired resources are left for
+        // the next call. 0 means no limit.
+        virtual void CleanGarbage(size_t max_num_idle_frames, unsigned max_time_us = 0) = 0;
+
+        // Per frame statistics about the work done by the device.
+        struct FrameStats {
+            // number of draw calls issued to the underlying API
+            // and the total number of vertices they submitted.
+            unsigned draw_calls = 0;
+            unsigned vertices   = 0;
+            // number of times a program or a texture was bound.
+            unsigned program_binds = 0;
+            unsigned texture_binds = 0;
+            // number of uniform values uploaded and the number of uploads
+            // that were skipped because the value had not changed.
+            unsigned uniform_uploads = 0;
+            unsigned uniform_skips   = 0;
+            // number of bytes of vertex and texture data uploaded.
+            std::size_t buffer_upload_bytes = 0;
+            // number of times texture mips were (re)generated.
+            unsigned texture_mip_generations = 0;
+            // number of device resources (shaders, programs, geometries,
+            // textures, frame buffers) created and destroyed.
+            unsigned resources_created   = 0;
+            unsigned resources_destroyed = 0;
+        };
+        // Get the statistics accumulated since the last reset. The
+        // statistics are reset automatically by BeginFrame so after
+        // EndFrame they describe the frame that was just rendered.
+        // The threaded device (CreateThreaded) doesn't wait for the
+        // render thread but returns the stats of the latest frame that
+        // the render thread has completed. These lag behind the frames
+        // submitted with EndFrame and never include a frame that is
+        // still being recorded.
+        virtual FrameStats GetFrameStats() const = 0;
+        // Reset the statistics explicitly, for example to measure
+        // only some part of a frame. On the threaded device the reset
+        // applies to the frame being recorded and shows up in
+        // GetFrameStats only once that frame has been completed.
+        virtual void ResetFrameStats() = 0;
 
         // Prepare the device for the next frame.
         virtual void BeginFrame() = 0;
@@ -229,6 +302,39 @@ namespace gfx
         virtual Bitmap<RGBA> ReadColorBuffer(unsigned width, unsigned height) const = 0;
         virtual Bitmap<RGBA> ReadColorBuffer(unsigned x, unsigned y, unsigned width, unsigned height) const = 0;
 
+        // Start reading the contents of the current render target's color
+        // buffer without stalling the pipeline. Returns a handle that is used
+        // to retrieve the pixels later with PollColorBufferRead. If the device
+        // can't do the read asynchronously the read is done immediately and
+        // the result is available on the first poll.
+        virtual unsigned ReadColorBufferAsync(unsigned x, unsigned y, unsigned width, unsigned height) = 0;
+        // Check whether the asynchronous read identified by the handle has
+        // completed. If it has the pixels are stored in the bitmap, the read
+        // is done and the handle is no longer valid and true is returned.
+        // Otherwise returns false and you should check again later, for
+        // example on the next frame.
+        virtual bool PollColorBufferRead(unsigned handle, Bitmap<RGBA>* bitmap) = 0;
+
+        // Start measuring the time the GPU spends executing the commands
+        // issued after this call until the matching call to EndTimer.
+        // Returns a handle that is used to retrieve the measured time later
+        // with PollTimer. Timers cannot be nested, i.e. only one timer can
+        // be running at a time.
+        // If the device doesn't support GPU timer queries the time is
+        // measured on the CPU by waiting for the GPU to finish the work
+        // both at the start and at the end. This stalls the pipeline so
+        // the timers should only be used when profiling.
+        virtual unsigned BeginTimer() = 0;
+        // Stop the timer identified by the handle.
+        virtual void EndTimer(unsigned handle) = 0;
+        // Check whether the result of the timer identified by the handle
+        // is available. The GPU runs behind the CPU so the result is
+        // normally available only a few frames later. When the result is
+        // available the elapsed time in seconds is stored in seconds, the
+        // handle is no longer valid and true is returned. If the measurement
+        // was lost (for example the GPU was reset) the time is negative.
+        virtual bool PollTimer(unsigned handle, double* seconds) = 0;
+
         // Create a rendering device of the requested type.
         // Context should be a valid non null context object with the
         // right version.
@@ -237,6 +343,17 @@ namespace gfx
         std::shared_ptr<Device> Create(Type type, std::shared_ptr<Context> context);
         static
         std::shared_ptr<Device> Create(Type type, Context* context);
+
+        // Create a rendering device of the requested type that does all the
+        // actual rendering on a separate render thread. The calling thread
+        // records the device calls into a command list for each frame and
+        // when the frame ends (EndFrame) the list is handed over to the render
+        // thread which then executes it while the calling thread can proceed
+        // with the next frame. The context is released from the calling
+        // thread and made current in the render thread for the lifetime of
+        // the device.
+        static
+        std::shared_ptr<Device> CreateThreaded(Type type, Context* context);
     private:
     };
 
@@ -104,6 +104,196 @@ void main()
     shader->CompileSource(src);
     return shader;
 }
+
+// Vertex for the tessellated outline geometry. Each point on the
+// line path is expanded into 2 vertices that the vertex shader then
+// pushes apart perpendicular to the line.
+struct StrokeVertex {
+    gfx::Vec2 aPosition;
+    gfx::Vec2 aTexCoord;
+    // the previous and the next point on the line path. Needed
+    // for computing the line direction (and the joins) after the
+    // model and view transformations.
+    gfx::Vec2 aPrev;
+    gfx::Vec2 aNext;
+    // signed half of the line width in pixels. The sign selects
+    // the side of the line that the vertex is extruded to.
+    float aExtrude = 0.0f;
+};
+
+// A line primitive in the generated outline vertex data.
+struct LinePrimitive {
+    // either Lines or LineLoop.
+    gfx::Geometry::DrawType type = gfx::Geometry::DrawType::LineLoop;
+    size_t offset = 0;
+    size_t count  = 0;
+};
+
+gfx::Shader* MakeStrokeShader(gfx::Device& device)
+{
+    auto* shader = device.FindShader("stroke-shader");
+    if (shader)
+        return shader;
+
+    shader = device.MakeShader("stroke-shader");
+
+    // The line is extruded in the view space scaled to pixels so that
+    // the width of the line stays the same regardless of the model
+    // scaling. Miter joins are used for the corners but the miter
+    // length is clamped so that sharp corners don't spike out.
+
+constexpr auto* src = R"(
+#version 100
+attribute vec2 aPosition;
+attribute vec2 aTexCoord;
+attribute vec2 aPrev;
+attribute vec2 aNext;
+attribute float aExtrude;
+
+uniform mat4 kProjectionMatrix;
+uniform mat4 kViewMatrix;
+uniform vec2 kPixelRatio;
+
+varying vec2 vTexCoord;
+varying float vRandomValue;
+varying float vAlpha;
+
+vec2 ToPixels(vec2 pos)
+{
+    vec4 vertex = kViewMatrix * vec4(pos.x, pos.y * -1.0, 1.0, 1.0);
+    return vertex.xy * kPixelRatio;
+}
+
+void main()
+{
+    vec2 curr = ToPixels(aPosition);
+    vec2 dir_in  = curr - ToPixels(aPrev);
+    vec2 dir_out = ToPixels(aNext) - curr;
+    if (length(dir_in) < 0.0001)
+        dir_in = dir_out;
+    if (length(dir_out) < 0.0001)
+        dir_out = dir_in;
+    if (length(dir_in) < 0.0001)
+    {
+        dir_in  = vec2(1.0, 0.0);
+        dir_out = vec2(1.0, 0.0);
+    }
+    dir_in  = normalize(dir_in);
+    dir_out = normalize(dir_out);
+
+    vec2 normal = vec2(-dir_in.y, dir_in.x);
+    vec2 miter  = normal;
+    float miter_length = 1.0;
+    vec2 tangent = dir_in + dir_out;
+    if (length(tangent) > 0.0001)
+    {
+        tangent = normalize(tangent);
+        miter = vec2(-tangent.y, tangent.x);
+        miter_length = 1.0 / max(dot(miter, normal), 0.5);
+    }
+    curr += miter * aExtrude * miter_length;
+
+    vec4 vertex  = vec4(curr / kPixelRatio, 1.0, 1.0);
+    vTexCoord    = aTexCoord;
+    vRandomValue = 0.0;
+    vAlpha       = 1.0;
+    gl_Position  = kProjectionMatrix * vertex;
+}
+)";
+    shader->CompileSource(src);
+    return shader;
+}
+
+std::string NameStroke(const std::string& name, float line_width)
+{
+    char buff[32];
+    std::snprintf(buff, sizeof(buff), "/Stroke%.2f", line_width);
+    return name + buff;
+}
+
+// Tessellate the line primitives into a single triangle strip with the
+// line width baked into the vertices. Separate lines are stitched
+// together with degenerate triangles so the whole outline is still
+// just one draw.
+gfx::Geometry* MakeStrokeGeometry(gfx::Device& device, const std::string& name, float line_width,
+                                  const std::vector<gfx::Vertex>& vertices,
+                                  const std::vector<LinePrimitive>& lines)
+{
+    const float half_width = std::max(line_width, 1.0f) * 0.5f;
+
+    std::vector<StrokeVertex> strip;
+
+    // append a single connected line path to the strip.
+    auto AppendPath = [&](const gfx::Vertex* points, size_t count, bool closed) {
+        if (count < 2)
+            return;
+        // connect to the previous path with degenerate triangles.
+        // each path has an even number of vertices so the winding
+        // stays consistent.
+        if (!strip.empty())
+            strip.push_back(strip.back());
+
+        const size_t num_points = closed ? count + 1 : count;
+        for (size_t i=0; i<num_points; ++i)
+        {
+            const size_t curr = i % count;
+            size_t prev = curr;
+            size_t next = curr;
+            if (closed)
+            {
+                prev = (curr + count - 1) % count;
+                next = (curr + 1) % count;
+            }
+            else
+            {
+                prev = i > 0 ? i - 1 : i;
+                next = i + 1 < count ? i + 1 : i;
+            }
+            StrokeVertex v;
+            v.aPosition = points[curr].aPosition;
+            v.aTexCoord = points[curr].aTexCoord;
+            v.aPrev     = points[prev].aPosition;
+            v.aNext     = points[next].aPosition;
+            v.aExtrude  = half_width;
+            if (i == 0 && !strip.empty())
+                strip.push_back(v);
+            strip.push_back(v);
+            v.aExtrude = -half_width;
+            strip.push_back(v);
+        }
+    };
+
+    for (const auto& line : lines)
+    {
+        ASSERT(line.offset + line.count <= vertices.size());
+        const auto* points = &vertices[line.offset];
+        if (line.type == gfx::Geometry::DrawType::LineLoop)
+        {
+            AppendPath(points, line.count, true);
+        }
+        else if (line.type == gfx::Geometry::DrawType::Lines)
+        {
+            for (size_t i=0; i+1<line.count; i+=2)
+                AppendPath(points + i, 2, false);
+        }
+        else BUG("Unsupported line primitive.");
+    }
+
+    static const gfx::VertexLayout layout(sizeof(StrokeVertex), {
+        {"aPosition", 0, 2, 0, offsetof(StrokeVertex, aPosition)},
+        {"aTexCoord", 0, 2, 0, offsetof(StrokeVertex, aTexCoord)},
+        {"aPrev",     0, 2, 0, offsetof(StrokeVertex, aPrev)},
+        {"aNext",     0, 2, 0, offsetof(StrokeVertex, aNext)},
+        {"aExtrude",  0, 1, 0, offsetof(StrokeVertex, aExtrude)}
+    });
+
+    auto* geom = device.MakeGeometry(name);
+    geom->SetVertexBuffer(std::move(strip));
+    geom->SetVertexLayout(layout);
+    geom->AddDrawCmd(gfx::Geometry::DrawType::TriangleStrip);
+    return geom;
+}
+
 } // namespace
 
 namespace gfx {
@@ -111,9 +301,12 @@ namespace detail {
 // static
 Shader* GeometryBase::GetShader(Device& device)
 { return MakeVertexArrayShader(device); }
+// static
+Shader* GeometryBase::GetStrokeShader(Device& device)
+{ return MakeStrokeShader(device); }
 
 // static
-Geometry* ArrowGeometry::Generate(const Environment& env, Style style, Device& device)
+Geometry* ArrowGeometry::Generate(const Environment& env, Style style, float line_width, Device& device)
 {
     if (style == Style::Points)
         return nullptr;
@@ -122,10 +315,11 @@ Geometry* ArrowGeometry::Generate(const Environment& env, Style style, Device& d
 
     if (style == Style::Outline)
     {
-        geom = device.FindGeometry("ArrowOutline");
+        const auto& name = NameStroke("ArrowOutline", line_width);
+        geom = device.FindGeometry(name);
         if (!geom)
         {
-            const Vertex verts[] = {
+            const std::vector<Vertex> verts = {
                 {{0.0f, -0.25f}, {0.0f, 0.25f}},
                 {{0.0f, -0.75f}, {0.0f, 0.75f}},
                 {{0.7f, -0.75f}, {0.7f, 0.75f}},
@@ -134,9 +328,8 @@ Geometry* ArrowGeometry::Generate(const Environment& env, Style style, Device& d
                 {{0.7f, -0.0f}, {0.7f, 0.0f}},
                 {{0.7f, -0.25f}, {0.7f, 0.25f}},
             };
-            geom = device.MakeGeometry("ArrowOutline");
-            geom->SetVertexBuffer(verts, 7);
-            geom->AddDrawCmd(Geometry::DrawType::LineLoop);
+            geom = MakeStrokeGeometry(device, name, line_width, verts,
+                {{Geometry::DrawType::LineLoop, 0, verts.size()}});
         }
     }
     else if (style == Style::Solid)
@@ -166,10 +359,11 @@ Geometry* ArrowGeometry::Generate(const Environment& env, Style style, Device& d
     }
     else if (style == Style::Wireframe)
     {
-        geom = device.FindGeometry("ArrowWireframe");
+        const auto& name = NameStroke("ArrowWireframe", line_width);
+        geom = device.FindGeometry(name);
         if (!geom)
         {
-            const Vertex verts[] = {
+            const std::vector<Vertex> verts = {
                 // body
                 {{0.0f, -0.25f}, {0.0f, 0.25f}},
                 {{0.0f, -0.75f}, {0.0f, 0.75f}},
@@ -192,34 +386,42 @@ Geometry* ArrowGeometry::Generate(const Environment& env, Style style, Device& d
                 {{1.0f, -0.5f}, {1.0f, 0.5f}},
                 {{0.7f, -0.0f}, {0.7f, 0.0f}},
             };
-            geom = device.MakeGeometry("ArrowWireframe");
-            geom->SetVertexBuffer(verts, 16);
-            geom->AddDrawCmd(Geometry::DrawType::Lines);
+            geom = MakeStrokeGeometry(device, name, line_width, verts,
+                {{Geometry::DrawType::Lines, 0, verts.size()}});
         }
     }
     return geom;
 }
 
 // static
-Geometry* LineGeometry::Generate(const Environment& env, Style style, Device& device)
+Geometry* LineGeometry::Generate(const Environment& env, Style style, float line_width, Device& device)
 {
+    // horizontal line.
+    static const std::vector<Vertex> verts = {
+            {{0.0f,  -0.5f}, {0.0f, 0.5f}},
+            {{1.0f,  -0.5f}, {1.0f, 0.5f}}
+    };
+    if (Drawable::IsStrokeStyle(style))
+    {
+        const auto& name = NameStroke("LineSegment", line_width);
+        Geometry* geom = device.FindGeometry(name);
+        if (geom == nullptr)
+            geom = MakeStrokeGeometry(device, name, line_width, verts, {{Geometry::DrawType::Lines, 0, 2}});
+        return geom;
+    }
+
     Geometry* geom = device.FindGeometry("LineSegment");
     if (geom == nullptr)
     {
-        // horizontal line.
-        const gfx::Vertex verts[2] = {
-                {{0.0f,  -0.5f}, {0.0f, 0.5f}},
-                {{1.0f,  -0.5f}, {1.0f, 0.5f}}
-        };
         geom = device.MakeGeometry("LineSegment");
-        geom->SetVertexBuffer(verts, 2);
+        geom->SetVertexBuffer(verts);
         geom->AddDrawCmd(Geometry::DrawType::Lines);
     }
     return geom;
 }
 
 // static
-Geometry* CapsuleGeometry::Generate(const Environment& env, Style style, Device& device)
+Geometry* CapsuleGeometry::Generate(const Environment& env, Style style, float line_width, Device& device)
 {
     if (style == Style::Points)
         return nullptr;
@@ -252,13 +454,17 @@ Geometry* CapsuleGeometry::Generate(const Environment& env, Style style, Device&
         name = "Capsule";
     else BUG("???");
     name += NameAspectRatio(rect_width, rect_height, HalfRound, "%1.1f:%1.1f");
+    if (Drawable::IsStrokeStyle(style))
+        name = NameStroke(name, line_width);
 
     Geometry* geom = device.FindGeometry(name);
     if (!geom)
     {
-        geom = device.MakeGeometry(name);
+        if (style == Style::Solid)
+            geom = device.MakeGeometry(name);
 
         std::vector<Vertex> vs;
+        std::vector<LinePrimitive> lines;
         auto offset = 0;
 
         // semi-circle at the left end.
@@ -300,7 +506,7 @@ Geometry* CapsuleGeometry::Generate(const Environment& env, Style style, Device&
         if (style == Style::Solid)
             geom->AddDrawCmd(Geometry::DrawType::TriangleFan, offset, vs.size()-offset);
         else if (style == Style::Wireframe)
-            geom->AddDrawCmd(Geometry::DrawType::LineLoop, offset, vs.size()-offset);
+            lines.push_back({Geometry::DrawType::LineLoop, (size_t)offset, vs.size()-offset});
 
         if (style != Style::Outline)
         {
@@ -327,8 +533,8 @@ Geometry* CapsuleGeometry::Generate(const Environment& env, Style style, Device&
             }
             else
             {
-                geom->AddDrawCmd(Geometry::DrawType::LineLoop, offset + 0, 3);
-                geom->AddDrawCmd(Geometry::DrawType::LineLoop, offset + 3, 3);
+                lines.push_back({Geometry::DrawType::LineLoop, (size_t)offset + 0, 3});
+                lines.push_back({Geometry::DrawType::LineLoop, (size_t)offset + 3, 3});
             }
         }
 
@@ -374,18 +580,20 @@ Geometry* CapsuleGeometry::Generate(const Environment& env, Style style, Device&
         if (style == Style::Solid)
             geom->AddDrawCmd(Geometry::DrawType::TriangleFan, offset, vs.size()-offset);
         else if (style == Style::Wireframe)
-            geom->AddDrawCmd(Geometry::DrawType::LineLoop, offset, vs.size()-offset);
+            lines.push_back({Geometry::DrawType::LineLoop, (size_t)offset, vs.size()-offset});
 
         if (style == Style::Outline)
-            geom->AddDrawCmd(Geometry::DrawType::LineLoop);
+            lines.push_back({Geometry::DrawType::LineLoop, 0, vs.size()});
 
-        geom->SetVertexBuffer(std::move(vs));
+        if (style == Style::Solid)
+            geom->SetVertexBuffer(std::move(vs));
+        else geom = MakeStrokeGeometry(device, name, line_width, vs, lines);
     }
     return geom;
 }
 
 // static
-Geometry* SemiCircleGeometry::Generate(const Environment& env, Style style, Device& device)
+Geometry* SemiCircleGeometry::Generate(const Environment& env, Style style, float line_width, Device& device)
 {
     if (style == Style::Points)
         return nullptr;
@@ -394,9 +602,12 @@ Geometry* SemiCircleGeometry::Generate(const Environment& env, Style style, Devi
     // eventual transform on the screen and use that to compute
     // some kind of "LOD" value for figuring out how many slices we should have.
     const auto slices = 50;
-    const auto* name = style == Style::Outline   ? "SemiCircleOutline" :
+    std::string name = style == Style::Outline   ? "SemiCircleOutline" :
                        (style == Style::Wireframe ? "SemiCircleWireframe" : "SemiCircle");
 
+    if (Drawable::IsStrokeStyle(style))
+        name = NameStroke(name, line_width);
+
     Geometry* geom = device.FindGeometry(name);
     if (!geom)
     {
@@ -443,23 +654,20 @@ Geometry* SemiCircleGeometry::Generate(const Environment& env, Style style, Devi
                 vs.push_back(center);
             }
         }
-        geom = device.MakeGeometry(name);
-        geom->SetVertexBuffer(&vs[0], vs.size());
+        if (style == Style::Solid)
+        {
+            geom = device.MakeGeometry(name);
+            geom->SetVertexBuffer(&vs[0], vs.size());
+            geom->AddDrawCmd(Geometry::DrawType::TriangleFan);
+        }
+        else geom = MakeStrokeGeometry(device, name, line_width, vs, {{Geometry::DrawType::LineLoop, 0, vs.size()}});
     }
-    geom->ClearDraws();
-
-    if (style == Style::Solid)
-        geom->AddDrawCmd(Geometry::DrawType::TriangleFan);
-    else if (style == Style::Outline)
-        geom->AddDrawCmd(Geometry::DrawType::LineLoop);
-    else if (style == Style::Wireframe)
-        geom->AddDrawCmd(Geometry::DrawType::LineLoop);
     return geom;
 
 }
 
 // static
-Geometry* CircleGeometry::Generate(const Environment& env, Style style, Device& device)
+Geometry* CircleGeometry::Generate(const Environment& env, Style style, float line_width, Device& device)
 {
     if (style == Style::Points)
         return nullptr;
@@ -468,9 +676,12 @@ Geometry* CircleGeometry::Generate(const Environment& env, Style style, Device&
     // eventual transform on the screen and use that to compute
     // some kind of "LOD" value for figuring out how many slices we should have.
     const auto slices = 100;
-    const auto* name = style == Style::Outline   ? "CircleOutline" :
+    std::string name = style == Style::Outline   ? "CircleOutline" :
                       (style == Style::Wireframe ? "CircleWireframe" : "Circle");
 
+    if (Drawable::IsStrokeStyle(style))
+        name = NameStroke(name, line_width);
+
     Geometry* geom = device.FindGeometry(name);
     if (!geom)
     {
@@ -516,23 +727,19 @@ Geometry* CircleGeometry::Generate(const Environment& env, Style style, Device&
                 vs.push_back(center);
             }
         }
-        geom = device.MakeGeometry(name);
-        geom->SetVertexBuffer(&vs[0], vs.size());
-
+        if (style == Style::Solid)
+        {
+            geom = device.MakeGeometry(name);
+            geom->SetVertexBuffer(&vs[0], vs.size());
+            geom->AddDrawCmd(Geometry::DrawType::TriangleFan);
+        }
+        else geom = MakeStrokeGeometry(device, name, line_width, vs, {{Geometry::DrawType::LineLoop, 0, vs.size()}});
     }
-    geom->ClearDraws();
-
-    if (style == Style::Solid)
-        geom->AddDrawCmd(Geometry::DrawType::TriangleFan);
-    else if (style == Style::Outline)
-        geom->AddDrawCmd(Geometry::DrawType::LineLoop);
-    else if (style == Style::Wireframe)
-        geom->AddDrawCmd(Geometry::DrawType::LineLoop);
     return geom;
 }
 
 // static
-Geometry* RectangleGeometry::Generate(const Environment& env, Style style, Device& device)
+Geometry* RectangleGeometry::Generate(const Environment& env, Style style, float line_width, Device& device)
 {
     if (style == Style::Points)
         return nullptr;
@@ -541,26 +748,29 @@ Geometry* RectangleGeometry::Generate(const Environment& env, Style style, Devic
 
     if (style == Style::Outline)
     {
-        geom = device.FindGeometry("RectangleOutline");
+        const auto& name = NameStroke("RectangleOutline", line_width);
+        geom = device.FindGeometry(name);
         if (geom == nullptr)
         {
-            const Vertex verts[] = {
+            const std::vector<Vertex> verts = {
                 { {0.0f,  0.0f}, {0.0f, 0.0f} },
                 { {0.0f, -1.0f}, {0.0f, 1.0f} },
                 { {1.0f, -1.0f}, {1.0f, 1.0f} },
                 { {1.0f,  0.0f}, {1.0f, 0.0f} }
             };
-            geom = device.MakeGeometry("RectangleOutline");
-            geom->SetVertexBuffer(verts, 4);
-            geom->AddDrawCmd(Geometry::DrawType::LineLoop);
+            geom = MakeStrokeGeometry(device, name, line_width, verts,
+                {{Geometry::DrawType::LineLoop, 0, verts.size()}});
         }
     }
     else if (style == Style::Solid || style == Style::Wireframe)
     {
-        geom = device.FindGeometry("Rectangle");
+        const auto& name = style == Style::Solid
+            ? std::string("Rectangle")
+            : NameStroke("RectangleWireframe", line_width);
+        geom = device.FindGeometry(name);
         if (geom == nullptr)
         {
-            const Vertex verts[6] = {
+            const std::vector<Vertex> verts = {
                 { {0.0f,  0.0f}, {0.0f, 0.0f} },
                 { {0.0f, -1.0f}, {0.0f, 1.0f} },
                 { {1.0f, -1.0f}, {1.0f, 1.0f} },
@@ -569,74 +779,85 @@ Geometry* RectangleGeometry::Generate(const Environment& env, Style style, Devic
                 { {1.0f, -1.0f}, {1.0f, 1.0f} },
                 { {1.0f,  0.0f}, {1.0f, 0.0f} }
             };
-            geom = device.MakeGeometry("Rectangle");
-            geom->SetVertexBuffer(verts, 6);
+            if (style == Style::Solid)
+            {
+                geom = device.MakeGeometry(name);
+                geom->SetVertexBuffer(verts);
+                geom->AddDrawCmd(Geometry::DrawType::Triangles);
+            }
+            else geom = MakeStrokeGeometry(device, name, line_width, verts,
+                {{Geometry::DrawType::LineLoop, 0, verts.size()}});
         }
-        geom->ClearDraws();
-        if (style == Style::Solid)
-            geom->AddDrawCmd(Geometry::DrawType::Triangles);
-        else if (style == Style::Wireframe)
-            geom->AddDrawCmd(Geometry::DrawType::LineLoop);
     }
     return geom;
 }
 
 // static
-Geometry* IsoscelesTriangleGeometry::Generate(const Environment& env, Style style, Device& device)
+Geometry* IsoscelesTriangleGeometry::Generate(const Environment& env, Style style, float line_width, Device& device)
 {
     if (style == Style::Points)
         return nullptr;
 
-    Geometry* geom = device.FindGeometry("IsoscelesTriangle");
+    // the outline and the wireframe are the same thing
+    // for a single triangle.
+    const auto& name = Drawable::IsStrokeStyle(style)
+        ? NameStroke("IsoscelesTriangleOutline", line_width)
+        : std::string("IsoscelesTriangle");
+
+    Geometry* geom = device.FindGeometry(name);
     if (!geom)
     {
-        const Vertex verts[3] = {
+        const std::vector<Vertex> verts = {
                 { {0.5f,  0.0f}, {0.5f, 0.0f} },
                 { {0.0f, -1.0f}, {0.0f, 1.0f} },
                 { {1.0f, -1.0f}, {1.0f, 1.0f} }
         };
-        geom = device.MakeGeometry("IsoscelesTriangle");
-        geom->SetVertexBuffer(verts, 3);
+        if (style == Style::Solid)
+        {
+            geom = device.MakeGeometry(name);
+            geom->SetVertexBuffer(verts);
+            geom->AddDrawCmd(Geometry::DrawType::Triangles);
+        }
+        else geom = MakeStrokeGeometry(device, name, line_width, verts,
+            {{Geometry::DrawType::LineLoop, 0, verts.size()}});
     }
-    geom->ClearDraws();
-    if (style == Style::Solid)
-        geom->AddDrawCmd(Geometry::DrawType::Triangles);
-    else if (style == Style::Outline)
-        geom->AddDrawCmd(Geometry::DrawType::LineLoop); // this is not a mistake.
-    else if (style == Style::Wireframe)
-        geom->AddDrawCmd(Geometry::DrawType::LineLoop); // this is not a mistake.
     return geom;
 }
 
 // static
-Geometry* RightTriangleGeometry::Generate(const Environment& env, Style style, Device& device)
+Geometry* RightTriangleGeometry::Generate(const Environment& env, Style style, float line_width, Device& device)
 {
     if (style == Style::Points)
         return nullptr;
 
-    Geometry* geom = device.FindGeometry("RightTriangle");
+    // the outline and the wireframe are the same thing
+    // for a single triangle.
+    const auto& name = Drawable::IsStrokeStyle(style)
+        ? NameStroke("RightTriangleOutline", line_width)
+        : std::string("RightTriangle");
+
+    Geometry* geom = device.FindGeometry(name);
     if (!geom)
     {
-        const Vertex verts[3] = {
+        const std::vector<Vertex> verts = {
                 { {0.0f,  0.0f}, {0.0f, 0.0f} },
                 { {0.0f, -1.0f}, {0.0f, 1.0f} },
                 { {1.0f, -1.0f}, {1.0f, 1.0f} }
         };
-        geom = device.MakeGeometry("RightTriangle");
-        geom->SetVertexBuffer(verts, 3);
+        if (style == Style::Solid)
+        {
+            geom = device.MakeGeometry(name);
+            geom->SetVertexBuffer(verts);
+            geom->AddDrawCmd(Geometry::DrawType::Triangles);
+        }
+        else geom = MakeStrokeGeometry(device, name, line_width, verts,
+            {{Geometry::DrawType::LineLoop, 0, verts.size()}});
     }
-    geom->ClearDraws();
-    if (style == Style::Solid)
-        geom->AddDrawCmd(Geometry::DrawType::Triangles);
-    else if (style == Style::Outline)
-        geom->AddDrawCmd(Geometry::DrawType::LineLoop); // this is not a mistake.
-    else if (style == Style::Wireframe)
-        geom->AddDrawCmd(Geometry::DrawType::LineLoop); // this is not a mistake.
     return geom;
 }
 
 // static
-Geometry* TrapezoidGeometry::Generate(const Environment& env, Style style, Device& device)
+Geometry* TrapezoidGeometry::Generate(const Environment& env, Style style, float line_width, Device& device)
 {
     if (style == Style::Points)
         return nullptr;
@@ -644,27 +865,30 @@ Geometry* TrapezoidGeometry::Generate(const Environment& env, Style style, Devic
     Geometry* geom = nullptr;
     if (style == Style::Outline)
     {
-        geom = device.FindGeometry("TrapezoidOutline");
+        const auto& name = NameStroke("TrapezoidOutline", line_width);
+        geom = device.FindGeometry(name);
         if (!geom)
         {
-            const Vertex verts[] = {
+            const std::vector<Vertex> verts = {
                     { {0.2f,  0.0f}, {0.2f, 0.0f} },
                     { {0.0f, -1.0f}, {0.0f, 1.0f} },
                     { {1.0f, -1.0f}, {1.0f, 1.0f} },
                     { {0.8f,  0.0f}, {0.8f, 0.0f} }
             };
 
-            geom = device.MakeGeometry("TrapezoidOutline");
-            geom->SetVertexBuffer(verts, 4);
-            geom->AddDrawCmd(Geometry::DrawType::LineLoop);
+            geom = MakeStrokeGeometry(device, name, line_width, verts,
+                {{Geometry::DrawType::LineLoop, 0, verts.size()}});
         }
     }
     else if (style == Style::Solid || style == Style::Wireframe)
     {
-        geom = device.FindGeometry("Trapezoid");
+        const auto& name = style == Style::Solid
+            ? std::string("Trapezoid")
+            : NameStroke("TrapezoidWireframe", line_width);
+        geom = device.FindGeometry(name);
         if (!geom)
         {
-            const Vertex verts[] = {
+            const std::vector<Vertex> verts = {
                     {{0.2f,  0.0f}, {0.2f, 0.0f}},
                     {{0.0f, -1.0f}, {0.0f, 1.0f}},
                     {{0.2f, -1.0f}, {0.2f, 1.0f}},
@@ -681,25 +905,25 @@ Geometry* TrapezoidGeometry::Generate(const Environment& env, Style style, Devic
                     {{0.8f, -1.0f}, {0.8f, 1.0f}},
                     {{1.0f, -1.0f}, {1.0f, 1.0f}}
             };
-            geom = device.MakeGeometry("Trapezoid");
-            geom->SetVertexBuffer(verts, 12);
-        }
-        geom->ClearDraws();
-        if (style == Style::Solid)
-            geom->AddDrawCmd(Geometry::DrawType::Triangles);
-        else if (style == Style::Wireframe)
-        {
-            geom->AddDrawCmd(Geometry::DrawType::LineLoop, 0, 3);
-            geom->AddDrawCmd(Geometry::DrawType::LineLoop, 3, 3);
-            geom->AddDrawCmd(Geometry::DrawType::LineLoop, 6, 3);
-            geom->AddDrawCmd(Geometry::DrawType::LineLoop, 9, 3);
+            if (style == Style::Solid)
+            {
+                geom = device.MakeGeometry(name);
+                geom->SetVertexBuffer(verts);
+                geom->AddDrawCmd(Geometry::DrawType::Triangles);
+            }
+            else geom = MakeStrokeGeometry(device, name, line_width, verts, {
+                {Geometry::DrawType::LineLoop, 0, 3},
+                {Geometry::DrawType::LineLoop, 3, 3},
+                {Geometry::DrawType::LineLoop, 6, 3},
+                {Geometry::DrawType::LineLoop, 9, 3}
+            });
         }
     }
     return geom;
 }
 
 // static
-Geometry* ParallelogramGeometry::Generate(const Environment& env, Style style, Device& device)
+Geometry* ParallelogramGeometry::Generate(const Environment& env, Style style, float line_width, Device& device)
 {
     if (style == Style::Points)
         return nullptr;
@@ -707,26 +931,29 @@ Geometry* ParallelogramGeometry::Generate(const Environment& env, Style style, D
     Geometry* geom = nullptr;
     if (style == Style::Outline)
     {
-        geom = device.FindGeometry("ParallelogramOutline");
+        const auto& name = NameStroke("ParallelogramOutline", line_width);
+        geom = device.FindGeometry(name);
         if (!geom)
         {
-            const Vertex verts[] = {
+            const std::vector<Vertex> verts = {
                     { {0.2f,  0.0f}, {0.2f, 0.0f} },
                     { {0.0f, -1.0f}, {0.0f, 1.0f} },
                     { {0.8f, -1.0f}, {0.8f, 1.0f} },
                     { {1.0f,  0.0f}, {1.0f, 0.0f} }
             };
-            geom = device.MakeGeometry("ParallelogramOutline");
-            geom->SetVertexBuffer(verts, 4);
-            geom->AddDrawCmd(Geometry::DrawType::LineLoop);
+            geom = MakeStrokeGeometry(device, name, line_width, verts,
+                {{Geometry::DrawType::LineLoop, 0, verts.size()}});
         }
     }
     else if (style == Style::Solid || style == Style::Wireframe)
     {
-        geom = device.FindGeometry("Parallelogram");
+        const auto& name = style == Style::Solid
+            ? std::string("Parallelogram")
+            : NameStroke("ParallelogramWireframe", line_width);
+        geom = device.FindGeometry(name);
         if (!geom)
         {
-            const Vertex verts[] = {
+            const std::vector<Vertex> verts = {
                     {{0.2f,  0.0f}, {0.2f, 0.0f}},
                     {{0.0f, -1.0f}, {0.0f, 1.0f}},
                     {{0.8f, -1.0f}, {0.8f, 1.0f}},
@@ -735,16 +962,16 @@ Geometry* ParallelogramGeometry::Generate(const Environment& env, Style style, D
                     {{1.0f,  0.0f}, {1.0f, 0.0f}},
                     {{0.2f,  0.0f}, {0.2f, 0.0f}}
             };
-            geom = device.MakeGeometry("Parallelogram");
-            geom->SetVertexBuffer(verts, 6);
-        }
-        geom->ClearDraws();
-        if (style == Style::Solid)
-            geom->AddDrawCmd(Geometry::DrawType::Triangles);
-        else if (style == Style::Wireframe)
-        {
-            geom->AddDrawCmd(Geometry::DrawType::LineLoop, 0, 3);
-            geom->AddDrawCmd(Geometry::DrawType::LineLoop, 3, 3);
+            if (style == Style::Solid)
+            {
+                geom = device.MakeGeometry(name);
+                geom->SetVertexBuffer(verts);
+                geom->AddDrawCmd(Geometry::DrawType::Triangles);
+            }
+            else geom = MakeStrokeGeometry(device, name, line_width, verts, {
+                {Geometry::DrawType::LineLoop, 0, 3},
+                {Geometry::DrawType::LineLoop, 3, 3}
+            });
         }
     }
     return geom;
@@ -752,10 +979,14 @@ Geometry* ParallelogramGeometry::Generate(const Environment& env, Style style, D
 
 } // detail
 
-Shader* RoundRectangleClass::GetShader(Device& device) const
-{ return MakeVertexArrayShader(device); }
+Shader* RoundRectangleClass::GetShader(Drawable::Style style, Device& device) const
+{
+    if (Drawable::IsStrokeStyle(style))
+        return MakeStrokeShader(device);
+    return MakeVertexArrayShader(device);
+}
 
-Geometry* RoundRectangleClass::Upload(const Drawable::Environment& env, Drawable::Style style, Device& device) const
+Geometry* RoundRectangleClass::Upload(const Drawable::Environment& env, Drawable::Style style, float line_width, Device& device) const
 {
     using Style = Drawable::Style;
 
@@ -803,6 +1034,8 @@ Geometry* RoundRectangleClass::Upload(const Drawable::Environment& env, Drawable
     // for the generated geometry so that we can keep some of these
     // around and not have to regenerate the geometry all the time.
     name += NameAspectRatio(rect_width, rect_height, Truncate, "%d:%d");
+    if (Drawable::IsStrokeStyle(style))
+        name = NameStroke(name, line_width);
 
     if (style == Style::Outline)
     {
@@ -851,9 +1084,8 @@ Geometry* RoundRectangleClass::Upload(const Drawable::Environment& env, Drawable
                     vs.push_back(v1);
                 }
             }
-            geom = device.MakeGeometry(name);
-            geom->SetVertexBuffer(std::move(vs));
-            geom->AddDrawCmd(Geometry::DrawType::Lines);
+            geom = MakeStrokeGeometry(device, name, line_width, vs,
+                {{Geometry::DrawType::Lines, 0, vs.size()}});
         }
     }
     else if (style == Style::Solid || style == Style::Wireframe)
@@ -861,7 +1093,10 @@ Geometry* RoundRectangleClass::Upload(const Drawable::Environment& env, Drawable
         geom = device.FindGeometry(name);
         if (geom == nullptr)
         {
-            geom = device.MakeGeometry(name);
+            if (style == Style::Solid)
+                geom = device.MakeGeometry(name);
+
+            std::vector<LinePrimitive> lines;
 
             // center body
             std::vector<Vertex> vs = {
@@ -896,12 +1131,8 @@ Geometry* RoundRectangleClass::Upload(const Drawable::Environment& env, Drawable
             }
             else
             {
-                geom->AddDrawCmd(Geometry::DrawType::LineLoop, 0, 3);
-                geom->AddDrawCmd(Geometry::DrawType::LineLoop, 3, 3);
-                geom->AddDrawCmd(Geometry::DrawType::LineLoop, 6, 3);
-                geom->AddDrawCmd(Geometry::DrawType::LineLoop, 9, 3);
-                geom->AddDrawCmd(Geometry::DrawType::LineLoop, 12, 3);
-                geom->AddDrawCmd(Geometry::DrawType::LineLoop, 15, 3);
+                for (size_t i=0; i<6; ++i)
+                    lines.push_back({Geometry::DrawType::LineLoop, i * 3, 3});
             }
 
             // generate corners
@@ -953,10 +1184,12 @@ Geometry* RoundRectangleClass::Upload(const Drawable::Environment& env, Drawable
                 }
                 else if (style == Style::Wireframe)
                 {
-                    geom->AddDrawCmd(Geometry::DrawType::LineLoop, offset, vs.size() - offset);
+                    lines.push_back({Geometry::DrawType::LineLoop, offset, vs.size() - offset});
                 }
             }
-            geom->SetVertexBuffer(std::move(vs));
+            if (style == Style::Solid)
+                geom->SetVertexBuffer(std::move(vs));
+            else geom = MakeStrokeGeometry(device, name, line_width, vs, lines);
         }
     }
     return geom;
@@ -980,9 +1213,9 @@ bool RoundRectangleClass::LoadFromJson(const data::Reader& data)
 }
 
 Shader* GridClass::GetShader(Device& device) const
-{ return MakeVertexArrayShader(device); }
+{ return MakeStrokeShader(device); }
 
-Geometry* GridClass::Upload(Device& device) const
+Geometry* GridClass::Upload(float line_width, Device& device) const
 {
     // use the content properties to generate a name for the
     // gpu side geometry.
@@ -990,7 +1223,7 @@ Geometry* GridClass::Upload(Device& device) const
     hash = base::hash_combine(hash, mNumVerticalLines);
     hash = base::hash_combine(hash, mNumHorizontalLines);
     hash = base::hash_combine(hash, mBorderLines);
-    const auto& name = std::to_string(hash);
+    const auto& name = NameStroke(std::to_string(hash), line_width);
 
     Geometry* geom = device.FindGeometry(name);
     if (!geom)
@@ -1041,9 +1274,8 @@ Geometry* GridClass::Upload(Device& device) const
             verts.push_back(corners[1]);
             verts.push_back(corners[3]);
         }
-        geom = device.MakeGeometry(name);
-        geom->SetVertexBuffer(std::move(verts));
-        geom->AddDrawCmd(Geometry::DrawType::Lines);
+        geom = MakeStrokeGeometry(device, name, line_width, verts,
+            {{Geometry::DrawType::Lines, 0, verts.size()}});
     }
     return geom;
 }
@@ -1541,21 +1773,21 @@ void KinematicsParticleEngineClass::InitParticles(InstanceState& state, size_t n
 {
     for (size_t i=0; i<num; ++i)
     {
-        const auto velocity = math::rand(mParams.min_velocity, mParams.max_velocity);
-        const auto initx = math::rand(0.0f, mParams.init_rect_width);
-        const auto inity = math::rand(0.0f, mParams.init_rect_height);
-        const auto angle = math::rand(0.0f, mParams.direction_sector_size) +
+        const auto velocity = math::rand(mParams.min_velocity, mParams.max_velocity, state.random);
+        const auto initx = math::rand(0.0f, mParams.init_rect_width, state.random);
+        const auto inity = math::rand(0.0f, mParams.init_rect_height, state.random);
+        const auto angle = math::rand(0.0f, mParams.direction_sector_size, state.random) +
             mParams.direction_sector_start_angle;
 
         Particle p;
-        p.lifetime  = math::rand(mParams.min_lifetime, mParams.max_lifetime);
-        p.pointsize = math::rand(mParams.min_point_size, mParams.max_point_size);
-        p.alpha     = math::rand(mParams.min_alpha, mParams.max_alpha);
+        p.lifetime  = math::rand(mParams.min_lifetime, mParams.max_lifetime, state.random);
+        p.pointsize = math::rand(mParams.min_point_size, mParams.max_point_size, state.random);
+        p.alpha     = math::rand(mParams.min_alpha, mParams.max_alpha, state.random);
         p.position  = glm::vec2(mParams.init_rect_xpos + initx, mParams.init_rect_ypos + inity);
         // note that the velocity vector is baked into the
         // direction vector in order to save space.
         p.direction = glm::vec2(std::cos(angle), std::sin(angle)) * velocity;
-        p.randomizer = math::rand(0.0f, 1.0f);
+        p.randomizer = math::rand(0.0f, 1.0f, state.random);
         state.particles.push_back(p);
     }
 }
@@ -103,7 +103,8 @@ namespace gfx
             // Rasterize the outline of the shape as lines.
             // Only the fragments that are within the line are shaded.
             // Line width setting is applied to determine the width
-            // of the lines.
+            // of the lines. The lines are tessellated into triangles
+            // so any line width is supported.
             Outline,
             // Rasterize the individual triangles as lines.
             Wireframe,
@@ -175,7 +176,17 @@ namespace gfx
         // Get the ID of the drawable shape. Used to map the
         // drawable to a device specific program object.
         inline std::string GetId() const
-        { return typeid(*this).name(); }
+        {
+            // outlines are drawn as triangle strips that get extruded
+            // in the vertex shader, so they need a program of their own.
+            std::string id = typeid(*this).name();
+            if (IsStrokeStyle(GetStyle()))
+                id += "/stroke";
+            return id;
+        }
+        // Returns true if the style is rasterized as (stroked) lines.
+        static bool IsStrokeStyle(Style style)
+        { return style == Style::Outline || style == Style::Wireframe; }
     private:
     };
 
@@ -258,11 +269,19 @@ namespace gfx
             {
                 state.line_width = mLineWidth;
                 state.culling    = mCulling;
+                // the winding of the stroke triangles depends on the
+                // direction of the outline, never cull them.
+                if (IsStrokeStyle(mStyle))
+                    state.culling = Culling::None;
             }
             virtual Shader* GetShader(Device& device) const override
-            { return GeometryType::GetShader(device); }
+            {
+                if (IsStrokeStyle(mStyle))
+                    return GeometryType::GetStrokeShader(device);
+                return GeometryType::GetShader(device);
+            }
             virtual Geometry* Upload(const Environment& env, Device& device) const override
-            { return GeometryType::Generate(env, mStyle, device); }
+            { return GeometryType::Generate(env, mStyle, mLineWidth, device); }
             virtual void SetCulling(Culling culling) override
             { mCulling = culling; }
             virtual void SetLineWidth(float width) override
@@ -284,38 +303,39 @@ namespace gfx
             static constexpr Culling InitialCulling = Culling::Back;
             static constexpr Style   InitialStyle   = Style::Solid;
             static Shader* GetShader(Device& device);
+            static Shader* GetStrokeShader(Device& device);
         };
         struct ArrowGeometry : public GeometryBase {
-            static Geometry* Generate(const Environment& env, Style style, Device& device);
+            static Geometry* Generate(const Environment& env, Style style, float line_width, Device& device);
         };
         struct LineGeometry : public GeometryBase {
             static constexpr Culling InitialCulling = Culling::None;
             static constexpr Style   InitialStyle   = Style::Outline;
-            static Geometry* Generate(const Environment& env, Style style, Device& device);
+            static Geometry* Generate(const Environment& env, Style style, float line_width, Device& device);
         };
         struct CapsuleGeometry : public GeometryBase {
-            static Geometry* Generate(const Environment& env, Style style, Device& device);
+            static Geometry* Generate(const Environment& env, Style style, float line_width, Device& device);
         };
         struct SemiCircleGeometry : public GeometryBase {
-            static Geometry* Generate(const Environment& env, Style style, Device& device);
+            static Geometry* Generate(const Environment& env, Style style, float line_width, Device& device);
         };
         struct CircleGeometry : public GeometryBase {
-            static Geometry* Generate(const Environment& env, Style style, Device& device);
+            static Geometry* Generate(const Environment& env, Style style, float line_width, Device& device);
         };
         struct RectangleGeometry : public GeometryBase {
-            static Geometry* Generate(const Environment& env, Style style, Device& device);
+            static Geometry* Generate(const Environment& env, Style style, float line_width, Device& device);
         };
         struct IsoscelesTriangleGeometry : public GeometryBase {
-            static Geometry* Generate(const Environment& env, Style style, Device& device);
+            static Geometry* Generate(const Environment& env, Style style, float line_width, Device& device);
         };
         struct RightTriangleGeometry : public GeometryBase {
-            static Geometry* Generate(const Environment& env, Style style, Device& device);
+            static Geometry* Generate(const Environment& env, Style style, float line_width, Device& device);
         };
         struct TrapezoidGeometry : public GeometryBase {
-            static Geometry* Generate(const Environment& env, Style style, Device& device);
+            static Geometry* Generate(const Environment& env, Style style, float line_width, Device& device);
         };
         struct ParallelogramGeometry : public GeometryBase {
-            static Geometry* Generate(const Environment& env, Style style, Device& device);
+            static Geometry* Generate(const Environment& env, Style style, float line_width, Device& device);
         };
     } // namespace
 
@@ -357,8 +377,8 @@ namespace gfx
           , mRadius(radius)
         {}
 
-        Shader* GetShader(Device& device) const;
-        Geometry* Upload(const Drawable::Environment& env, Drawable::Style style, Device& device) const;
+        Shader* GetShader(Drawable::Style style, Device& device) const;
+        Geometry* Upload(const Drawable::Environment& env, Drawable::Style style, float line_width, Device& device) const;
 
         float GetRadius() const
         { return mRadius; }
@@ -410,12 +430,12 @@ namespace gfx
         virtual void ApplyState(Program& program, RasterState& state) const override
         {
             state.line_width = mLineWidth;
-            state.culling    = mCulling;
+            state.culling    = IsStrokeStyle(mStyle) ? Culling::None : mCulling;
         }
         virtual Shader* GetShader(Device& device) const override
-        { return mClass->GetShader(device); }
+        { return mClass->GetShader(mStyle, device); }
         virtual Geometry* Upload(const Environment& env, Device& device) const override
-        { return mClass->Upload(env, mStyle, device); }
+        { return mClass->Upload(env, mStyle, mLineWidth, device); }
         virtual void SetCulling(Culling cull) override
         { mCulling = cull; }
         virtual void SetStyle(Style style) override
@@ -437,7 +457,7 @@ namespace gfx
         GridClass()
         { mId = base::RandomString(10); }
         Shader* GetShader(Device& device) const;
-        Geometry* Upload(Device& device) const;
+        Geometry* Upload(float line_width, Device& device) const;
         void SetNumVerticalLines(unsigned lines)
         { mNumVerticalLines = lines; }
         void SetNumHorizontalLines(unsigned lines)
@@ -512,7 +532,7 @@ namespace gfx
         virtual Shader* GetShader(Device& device) const override
         { return mClass->GetShader(device); }
         virtual Geometry* Upload(const Environment& env, Device& device) const override
-        { return mClass->Upload(device); }
+        { return mClass->Upload(mLineWidth, device); }
         virtual void SetLineWidth(float width) override
         { mLineWidth = width; }
         virtual Style GetStyle() const override
@@ -871,6 +891,10 @@ namespace gfx
             float time     = 0.0f;
             // fractional count of new particles being hatched.
             float hatching = 0.0f;
+            // the random generator for the particle parameters. each
+            // instance has its own so that the simulation is the same
+            // regardless of which thread happens to update it.
+            std::default_random_engine random;
         };
 
         KinematicsParticleEngineClass()
@@ -937,16 +961,19 @@ namespace gfx
         KinematicsParticleEngine(std::shared_ptr<const KinematicsParticleEngineClass> klass)
             : mClass(klass)
         {
+            Seed();
             Restart();
         }
         KinematicsParticleEngine(const KinematicsParticleEngineClass& klass)
         {
             mClass = std::make_shared<KinematicsParticleEngineClass>(klass);
+            Seed();
             Restart();
         }
         KinematicsParticleEngine(const KinematicsParticleEngineClass::Params& params)
         {
             mClass = std::make_shared<KinematicsParticleEngineClass>(params);
+            Seed();
             Restart();
         }
         virtual void ApplyState(Program& program, RasterState& state) const override
@@ -987,6 +1014,13 @@ namespace gfx
         size_t GetNumParticlesAlive() const
         { return mState.particles.size(); }
 
+    private:
+        void Seed()
+        {
+            // the seed comes from the shared generator so seeding that
+            // makes the particles repeatable too.
+            mState.random.seed(math::rand<unsigned>(0, std::numeric_limits<unsigned>::max()));
+        }
     private:
         // this is the "class" object for this particle engine type.
         std::shared_ptr<const KinematicsParticleEngineClass> mClass;
@@ -0,0 +1,65 @@
+// Copyright (C) 2020-2021 Sami Väisänen
+// Copyright (C) 2020-2021 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "config.h"
+
+namespace gfx
+{
+    class Texture;
+
+    // FrameBuffer is an offscreen render target. Instead of rendering
+    // into the rendering surface (window) of the device context the
+    // rendering goes into the color texture of the frame buffer which
+    // can then be used just like any other texture, for example for
+    // post processing or rendering a scene inside a scene.
+    class FrameBuffer
+    {
+    public:
+        struct Config {
+            // the dimensions of the render target in pixels.
+            unsigned width  = 0;
+            unsigned height = 0;
+            // whether the frame buffer should have a stencil buffer
+            // for doing masked drawing.
+            bool stencil = true;
+        };
+        virtual ~FrameBuffer() = default;
+        // Set the frame buffer configuration. If the configuration is
+        // different from the current configuration the underlying
+        // buffers are (re)created when the frame buffer is next used.
+        // Any previous contents are then lost.
+        virtual void SetConfig(const Config& config) = 0;
+        // Get the current frame buffer configuration.
+        virtual const Config& GetConfig() const = 0;
+        // Get the texture that contains the rendered colors. The texture
+        // is owned by the frame buffer and is valid for as long as the
+        // frame buffer is. The texture is RGBA and the first scan row
+        // (in memory) is the bottom row of the rendered image.
+        virtual Texture* GetColorTexture() = 0;
+        // Returns true if the frame buffer is complete and can be used
+        // as a render target.
+        virtual bool IsValid() const = 0;
+
+        unsigned GetWidth() const
+        { return GetConfig().width; }
+        unsigned GetHeight() const
+        { return GetConfig().height; }
+    };
+
+} // namespace
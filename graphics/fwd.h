@@ -27,6 +27,7 @@ namespace gfx
     class DrawableClass;
     class Transform;
     class Device;
+    class FrameBuffer;
     class IBitmap;
     class IBitmapGenerator;
     class Image;
@@ -153,7 +153,11 @@ namespace gfx
             Lines,
             // Draw a line between the given vertices looping back
             // from the last vertex to the first.
-            LineLoop
+            LineLoop,
+            // Draw a series of triangles where each vertex after
+            // the first two forms a triangle with the 2 previous
+            // vertices.
+            TriangleStrip
         };
 
         virtual ~Geometry() = default;
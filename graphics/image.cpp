@@ -73,4 +73,28 @@ bool Image::Load(const std::string& URI)
     return true;
 }
 
+// static
+bool Image::Probe(const std::string& URI, unsigned* width, unsigned* height, unsigned* depth_bits)
+{
+    const auto& buffer = gfx::LoadResource(URI);
+    if (!buffer)
+    {
+        ERROR("Failed to load image: '%1' buffer", URI);
+        return false;
+    }
+    int xres  = 0;
+    int yres  = 0;
+    int depth = 0;
+    if (!stbi_info_from_memory((const stbi_uc*)buffer->GetData(),
+                               (int)buffer->GetSize(), &xres, &yres, &depth))
+    {
+        ERROR("Reading image file '%1' header failed.", URI);
+        return false;
+    }
+    *width      = static_cast<unsigned>(xres);
+    *height     = static_cast<unsigned>(yres);
+    *depth_bits = static_cast<unsigned>(depth) * 8;
+    return true;
+}
+
 } // namespace
@@ -56,6 +56,12 @@ namespace gfx
         // unchanged.
         bool Load(const std::string& URI);
 
+        // Read only the image header of the image file identified by the
+        // given file resource identifier and get the image dimensions and
+        // the depth in bits without decoding the image data.
+        // On error returns false.
+        static bool Probe(const std::string& URI, unsigned* width, unsigned* height, unsigned* depth_bits);
+
         // Copy (and optionally convert) the pixel contents of the
         // image into a specific type of a bitmap object.
         // The bitmap allows for more fine grained control over
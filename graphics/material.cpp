@@ -21,6 +21,8 @@
 #include "warnpop.h"
 
 #include <set>
+#include <cstring>
+#include <cmath>
 
 #include "base/logging.h"
 #include "base/format.h"
@@ -100,11 +102,100 @@ namespace {
         }
         return code;
     }
+
+    // Specialize the material shader source by turning the shader features
+    // into preprocessor defines. The defines must come after the #version
+    // directive if there is one.
+    std::string SpecializeShader(const std::string& src, gfx::MaterialClass::ShaderFeatures features)
+    {
+        using Feature = gfx::MaterialClass::ShaderFeature;
+        std::string defines;
+        if (features.test(Feature::RenderPoints))
+            defines += "#define FEATURE_POINTS\n";
+        if (features.test(Feature::ParticleRotation))
+            defines += "#define FEATURE_PARTICLE_ROTATION\n";
+        if (features.test(Feature::BlendFrames))
+            defines += "#define FEATURE_BLEND_FRAMES\n";
+        if (features.test(Feature::TextureRectClampX))
+            defines += "#define FEATURE_CLAMP_X\n";
+        if (features.test(Feature::TextureRectRepeatX))
+            defines += "#define FEATURE_REPEAT_X\n";
+        if (features.test(Feature::TextureRectClampY))
+            defines += "#define FEATURE_CLAMP_Y\n";
+        if (features.test(Feature::TextureRectRepeatY))
+            defines += "#define FEATURE_REPEAT_Y\n";
+        if (defines.empty())
+            return src;
+
+        std::string::size_type pos = 0;
+        const auto version = src.find("#version");
+        if (version != std::string::npos)
+        {
+            pos = src.find('\n', version);
+            pos = pos == std::string::npos ? src.size() : pos + 1;
+        }
+        std::string ret = src;
+        ret.insert(pos, defines);
+        return ret;
+    }
+
+    // padding in pixels between the frames in a sprite atlas
+    // so that filtering doesn't bleed into the neighbouring frames.
+    constexpr unsigned SpriteAtlasPadding = 2;
+    // the maximum sprite atlas texture dimension.
+    constexpr unsigned MaxSpriteAtlasSize = 2048;
+
+    // If a texture sub-rectangle is used the texture coordinates must be
+    // wrapped/clamped in the shader in order to wrap/clamp properly within
+    // the bounds of the sub rect. The hardware sampler can only do that
+    // for the whole texture.
+    gfx::MaterialClass::ShaderFeatures GetTextureRectFeatures(const gfx::FRect& rect,
+                                                              gfx::Texture::Wrapping wrap_x,
+                                                              gfx::Texture::Wrapping wrap_y)
+    {
+        using Feature = gfx::MaterialClass::ShaderFeature;
+        gfx::MaterialClass::ShaderFeatures features;
+        const float eps = 0.001;
+        if (math::equals(0.0f, rect.GetX(), eps) &&
+            math::equals(0.0f, rect.GetY(), eps) &&
+            math::equals(1.0f, rect.GetWidth(), eps) &&
+            math::equals(1.0f, rect.GetHeight(), eps))
+            return features;
+        if (wrap_x == gfx::Texture::Wrapping::Clamp)
+            features.set(Feature::TextureRectClampX);
+        else features.set(Feature::TextureRectRepeatX);
+        if (wrap_y == gfx::Texture::Wrapping::Clamp)
+            features.set(Feature::TextureRectClampY);
+        else features.set(Feature::TextureRectRepeatY);
+        return features;
+    }
 } // namespace
 
 namespace gfx
 {
 
+bool TextureSource::Upload(Texture* texture) const
+{
+    auto bitmap = GetData();
+    if (!bitmap)
+        return false;
+    const auto width  = bitmap->GetWidth();
+    const auto height = bitmap->GetHeight();
+    const auto format = Texture::DepthToFormat(bitmap->GetDepthBits());
+    texture->Upload(bitmap->GetDataPtr(), width, height, format);
+    return true;
+}
+bool TextureSource::ProbeData(unsigned* width, unsigned* height, unsigned* depth_bits) const
+{
+    auto bitmap = GetData();
+    if (!bitmap)
+        return false;
+    *width      = bitmap->GetWidth();
+    *height     = bitmap->GetHeight();
+    *depth_bits = bitmap->GetDepthBits();
+    return true;
+}
+
 std::shared_ptr<IBitmap> detail::TextureFileSource::GetData() const
 {
     try
@@ -131,6 +222,46 @@ std::shared_ptr<IBitmap> detail::TextureFileSource::GetData() const
     }
     return nullptr;
 }
+bool detail::TextureFileSource::Upload(Texture* texture) const
+{
+    try
+    {
+        // upload straight from the decoder's buffer instead of going
+        // through GetData which would first copy the pixels into a bitmap.
+        // the decoded data is released as soon as the image goes out of scope.
+        Image file(mFile);
+        if (!file.IsValid())
+        {
+            ERROR("Failed to load texture. '%1'", mFile);
+            return false;
+        }
+        const auto depth = file.GetDepthBits();
+        if (depth != 8 && depth != 24 && depth != 32)
+        {
+            ERROR("Unsupported texture bit depth %1. '%2'", depth, mFile);
+            return false;
+        }
+        texture->Upload(file.GetData(), file.GetWidth(), file.GetHeight(),
+                        Texture::DepthToFormat(depth));
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        ERROR(e.what());
+        ERROR("Failed to load texture. '%1'", mFile);
+    }
+    return false;
+}
+bool detail::TextureFileSource::ProbeData(unsigned* width, unsigned* height, unsigned* depth_bits) const
+{
+    // only the image header is read, the image isn't decoded.
+    if (!Image::Probe(mFile, width, height, depth_bits))
+    {
+        ERROR("Failed to load texture. '%1'", mFile);
+        return false;
+    }
+    return true;
+}
 void detail::TextureFileSource::IntoJson(data::Writer& data) const
 {
     data.Write("id",   mId);
@@ -272,6 +403,13 @@ SpriteMap::SpriteMap(const SpriteMap& other, bool copy)
         s.rect = sprite.rect;
         mSprites.push_back(std::move(s));
     }
+    // the frame content is the same so the atlas layout carries over.
+    mAtlasDirty  = other.mAtlasDirty;
+    mAtlasHash   = other.mAtlasHash;
+    mAtlas       = other.mAtlas;
+    mAtlasWidth  = other.mAtlasWidth;
+    mAtlasHeight = other.mAtlasHeight;
+    mAtlasDepth  = other.mAtlasDepth;
 }
 
 void SpriteMap::DeleteTextureById(const std::string& id)
@@ -281,6 +419,7 @@ void SpriteMap::DeleteTextureById(const std::string& id)
         if (it->source && it->source->GetId() == id)
         {
             mSprites.erase(it);
+            mAtlasDirty = true;
             return;
         }
     }
@@ -309,7 +448,11 @@ TextureSource* SpriteMap::FindTextureSourceById(const std::string& id)
     for (const auto& it : mSprites)
     {
         if (it.source->GetId() == id)
+        {
+            // the caller can modify the source.
+            mAtlasDirty = true;
             return it.source.get();
+        }
     }
     return nullptr;
 }
@@ -318,7 +461,11 @@ TextureSource* SpriteMap::FindTextureSourceByName(const std::string& name)
     for (const auto& it : mSprites)
     {
         if (it.source->GetName() == name)
+        {
+            // the caller can modify the source.
+            mAtlasDirty = true;
             return it.source.get();
+        }
     }
     return nullptr;
 }
@@ -343,6 +490,7 @@ bool SpriteMap::SetTextureRect(const TextureSource* source, const FRect& rect)
         if (it.source.get() == source)
         {
             it.rect = rect;
+            mAtlasDirty = true;
             return true;
         }
     }
@@ -356,6 +504,7 @@ bool SpriteMap::DeleteTexture(const TextureSource* source)
         if (it->source.get() == source)
         {
             mSprites.erase(it);
+            mAtlasDirty = true;
             return true;
         } else ++it;
     }
@@ -402,13 +551,11 @@ void SpriteMap::BindTextures(const BindingState& state, Device& device, BoundSta
         if (!texture)
         {
             texture = device.MakeTexture(name);
-            auto bitmap = source->GetData();
-            if (!bitmap)
+            // rasterized text doesn't get minified, don't waste time on mips.
+            if (source->GetSourceType() == TextureSource::Source::TextBuffer)
+                texture->SetMipmapPolicy(Texture::MipmapPolicy::Never);
+            if (!source->Upload(texture))
                 continue;
-            const auto width = bitmap->GetWidth();
-            const auto height = bitmap->GetHeight();
-            const auto format = Texture::DepthToFormat(bitmap->GetDepthBits());
-            texture->Upload(bitmap->GetDataPtr(), width, height, format);
         }
         result.textures[i]      = texture;
         result.rects[i]         = sprite.rect;
@@ -418,6 +565,166 @@ void SpriteMap::BindTextures(const BindingState& state, Device& device, BoundSta
     result.blend_coefficient = blend_coeff;
 }
 
+void SpriteMap::PackFrameAtlas() const
+{
+    mAtlasDirty = false;
+    mAtlasHash  = 0;
+    mAtlas.reset();
+    if (mSprites.size() < 2)
+        return;
+
+    const float eps = 0.001;
+    unsigned frame_width  = 0;
+    unsigned frame_height = 0;
+    unsigned depth = 0;
+    for (const auto& sprite : mSprites)
+    {
+        // frames using a texture rect are likely already packed
+        // by the resource packer. leave them alone.
+        const auto& rect = sprite.rect;
+        if (!sprite.source ||
+            !math::equals(0.0f, rect.GetX(), eps) ||
+            !math::equals(0.0f, rect.GetY(), eps) ||
+            !math::equals(1.0f, rect.GetWidth(), eps) ||
+            !math::equals(1.0f, rect.GetHeight(), eps))
+            return;
+        unsigned width  = 0;
+        unsigned height = 0;
+        unsigned bits   = 0;
+        if (!sprite.source->ProbeData(&width, &height, &bits))
+            return;
+        if (depth && (width != frame_width || height != frame_height || bits != depth))
+            return;
+        frame_width  = width;
+        frame_height = height;
+        depth = bits;
+    }
+    if (depth != 8 && depth != 24 && depth != 32)
+        return;
+
+    const auto frame_count  = (unsigned)mSprites.size();
+    const auto cell_width   = frame_width + SpriteAtlasPadding;
+    const auto cell_height  = frame_height + SpriteAtlasPadding;
+    const auto cols = (unsigned)std::ceil(std::sqrt((float)frame_count));
+    const auto rows = (frame_count + cols - 1) / cols;
+    const auto atlas_width  = cols * cell_width;
+    const auto atlas_height = rows * cell_height;
+    if (atlas_width > MaxSpriteAtlasSize || atlas_height > MaxSpriteAtlasSize)
+    {
+        DEBUG("Sprite frames don't fit in an atlas (%1x%2 px).", atlas_width, atlas_height);
+        return;
+    }
+
+    size_t hash = 0;
+    for (const auto& sprite : mSprites)
+    {
+        hash = base::hash_combine(hash, sprite.source->GetContentHash());
+        hash = base::hash_combine(hash, sprite.rect);
+    }
+
+    const auto border = SpriteAtlasPadding / 2;
+    FrameAtlas atlas;
+    atlas.cols         = cols;
+    atlas.rows         = rows;
+    atlas.frame_count  = frame_count;
+    atlas.cell_width   = (float)cell_width / atlas_width;
+    atlas.cell_height  = (float)cell_height / atlas_height;
+    atlas.frame_width  = (float)frame_width / atlas_width;
+    atlas.frame_height = (float)frame_height / atlas_height;
+    atlas.frame_x      = (float)border / atlas_width;
+    atlas.frame_y      = (float)border / atlas_height;
+    mAtlas       = atlas;
+    mAtlasHash   = hash;
+    mAtlasWidth  = atlas_width;
+    mAtlasHeight = atlas_height;
+    mAtlasDepth  = depth;
+}
+
+const SpriteMap::FrameAtlas* SpriteMap::GetFrameAtlas() const
+{
+    if (mAtlasDirty)
+        PackFrameAtlas();
+    return mAtlas ? &mAtlas.value() : nullptr;
+}
+
+Texture* SpriteMap::BindFrameAtlas(Device& device) const
+{
+    const auto* atlas = GetFrameAtlas();
+    if (!atlas)
+        return nullptr;
+
+    const auto& name = "SpriteAtlas/" + std::to_string(mAtlasHash);
+    if (auto* texture = device.FindTexture(name))
+        return texture;
+
+    const auto cols = atlas->cols;
+    const auto frame_count = atlas->frame_count;
+    const auto cell_width  = mAtlasWidth / cols;
+    const auto cell_height = mAtlasHeight / atlas->rows;
+    const auto frame_width  = cell_width - SpriteAtlasPadding;
+    const auto frame_height = cell_height - SpriteAtlasPadding;
+    const auto format = Texture::DepthToFormat(mAtlasDepth);
+
+    auto* texture = device.MakeTexture(name);
+    // the gutter between the frames is only wide enough for the first
+    // level. the lower mip levels would mix the neighbouring frames.
+    texture->SetMipmapPolicy(Texture::MipmapPolicy::Never);
+    // allocate the texture storage only, the frames are uploaded
+    // one cell at a time below.
+    texture->Upload(nullptr, mAtlasWidth, mAtlasHeight, format);
+
+    // each frame is placed in the middle of its cell and the edge texels
+    // are replicated into the gutter around it so that filtering at the
+    // frame edges samples the frame itself and not black or the
+    // neighbouring frame. only a single cell is ever held on the CPU side
+    // and each decoded frame is released right after its upload.
+    const auto border = SpriteAtlasPadding / 2;
+    const auto bytes_per_pixel = mAtlasDepth / 8;
+    const auto frame_pitch = frame_width * bytes_per_pixel;
+    const auto cell_pitch  = cell_width * bytes_per_pixel;
+    std::vector<std::uint8_t> cell(cell_pitch * cell_height);
+    for (unsigned i=0; i<frame_count; ++i)
+    {
+        const auto& bitmap = mSprites[i].source->GetData();
+        if (!bitmap || bitmap->GetWidth() != frame_width ||
+                       bitmap->GetHeight() != frame_height ||
+                       bitmap->GetDepthBits() != mAtlasDepth)
+        {
+            // the frame content doesn't match what was probed.
+            // fall back on binding the frames one at a time.
+            WARN("Failed to pack sprite frame %1 into atlas.", i);
+            device.DeleteTexture(name);
+            mAtlas.reset();
+            return nullptr;
+        }
+        const auto* src = (const std::uint8_t*)bitmap->GetDataPtr();
+        for (unsigned y=0; y<frame_height; ++y)
+        {
+            const auto* src_row = src + y * frame_pitch;
+            auto* dst_row = &cell[(y + border) * cell_pitch];
+            for (unsigned x=0; x<border; ++x)
+            {
+                std::memcpy(dst_row + x * bytes_per_pixel, src_row, bytes_per_pixel);
+                std::memcpy(dst_row + (border + frame_width + x) * bytes_per_pixel,
+                            src_row + frame_pitch - bytes_per_pixel, bytes_per_pixel);
+            }
+            std::memcpy(dst_row + border * bytes_per_pixel, src_row, frame_pitch);
+        }
+        // replicate the first and last (padded) rows.
+        for (unsigned y=0; y<border; ++y)
+        {
+            std::memcpy(&cell[y * cell_pitch], &cell[border * cell_pitch], cell_pitch);
+            std::memcpy(&cell[(border + frame_height + y) * cell_pitch],
+                        &cell[(border + frame_height - 1) * cell_pitch], cell_pitch);
+        }
+        const auto col = i % cols;
+        const auto row = i / cols;
+        texture->UploadSubRect(&cell[0], col * cell_width, row * cell_height, cell_width, cell_height);
+    }
+    DEBUG("Packed %1 sprite frames into %2x%3 px atlas.", frame_count, mAtlasWidth, mAtlasHeight);
+    return texture;
+}
+
 void SpriteMap::IntoJson(data::Writer& data) const
 {
     data.Write("fps", mFps);
@@ -471,6 +778,9 @@ bool SpriteMap::FromJson(const data::Reader& data)
         sprite.source = std::move(source);
         mSprites.push_back(std::move(sprite));
     }
+    // compute the atlas layout now so that the frames don't
+    // need to be probed in the middle of drawing.
+    PackFrameAtlas();
     return true;
 }
 
@@ -485,6 +795,12 @@ SpriteMap& SpriteMap::operator=(const SpriteMap& other)
     std::swap(mSamplerName[1], tmp.mSamplerName[1]);
     std::swap(mRectUniformName[0], tmp.mRectUniformName[0]);
     std::swap(mRectUniformName[1], tmp.mRectUniformName[1]);
+    std::swap(mAtlasDirty,  tmp.mAtlasDirty);
+    std::swap(mAtlasHash,   tmp.mAtlasHash);
+    std::swap(mAtlas,       tmp.mAtlas);
+    std::swap(mAtlasWidth,  tmp.mAtlasWidth);
+    std::swap(mAtlasHeight, tmp.mAtlasHeight);
+    std::swap(mAtlasDepth,  tmp.mAtlasDepth);
     return *this;
 }
 
@@ -517,13 +833,11 @@ void TextureMap2D::BindTextures(const BindingState& state, Device& device, Bound
     if (!texture)
     {
         texture = device.MakeTexture(name);
-        auto bitmap = source->GetData();
-        if (!bitmap)
+        // rasterized text doesn't get minified, don't waste time on mips.
+        if (source->GetSourceType() == TextureSource::Source::TextBuffer)
+            texture->SetMipmapPolicy(Texture::MipmapPolicy::Never);
+        if (!source->Upload(texture))
             return;
-        const auto width  = bitmap->GetWidth();
-        const auto height = bitmap->GetHeight();
-        const auto format = Texture::DepthToFormat(bitmap->GetDepthBits());
-        texture->Upload(bitmap->GetDataPtr(), width, height, format);
     }
     result.textures[0] = texture;
     result.rects[0]    = mRect;
@@ -657,9 +971,9 @@ std::unique_ptr<MaterialClass> MaterialClass::FromJson(const data::Reader& data)
     return klass;
 }
 
-Shader* ColorClass::GetShader(Device& device) const
+Shader* ColorClass::GetShader(ShaderFeatures features, Device& device) const
 {
-    if (auto* shader = device.FindShader(GetProgramId()))
+    if (auto* shader = device.FindShader(GetVariantId(features)))
         return shader;
 
 constexpr auto* src = R"(
@@ -679,11 +993,12 @@ void main()
   gl_FragColor = pow(color, vec4(kGamma));
 }
 )";
-    auto* shader = device.MakeShader(GetProgramId());
+    auto* shader = device.MakeShader(GetVariantId(features));
     ShaderData data;
     data.gamma      = mGamma;
     data.base_color = mColor;
-    shader->CompileSource(mStatic ? FoldUniforms(src, data) : src);
+    const auto& source = SpecializeShader(src, features);
+    shader->CompileSource(mStatic ? FoldUniforms(source, data) : source);
     return shader;
 }
 size_t ColorClass::GetHash() const
@@ -748,9 +1063,9 @@ bool ColorClass::FromJson2(const data::Reader& data)
     return true;
 }
 
-Shader* GradientClass::GetShader(Device& device) const
+Shader* GradientClass::GetShader(ShaderFeatures features, Device& device) const
 {
-    if (auto* shader = device.FindShader(GetProgramId()))
+    if (auto* shader = device.FindShader(GetVariantId(features)))
         return shader;
 
 constexpr auto* src = R"(
@@ -763,7 +1078,6 @@ uniform vec4 kColor2;
 uniform vec4 kColor3;
 uniform vec2 kOffset;
 uniform float kGamma;
-uniform float kRenderPoints;
 
 varying float vAlpha;
 varying vec2 vTexCoord;
@@ -778,7 +1092,11 @@ vec4 MixGradient(vec2 coords)
 
 void main()
 {
-  vec2 coords = mix(vTexCoord, gl_PointCoord, kRenderPoints);
+#ifdef FEATURE_POINTS
+  vec2 coords = gl_PointCoord;
+#else
+  vec2 coords = vTexCoord;
+#endif
   coords = (coords - kOffset) + vec2(0.5, 0.5);
   coords = clamp(coords, vec2(0.0, 0.0), vec2(1.0, 1.0));
   vec4 color  = MixGradient(coords);
@@ -787,7 +1105,7 @@ void main()
 }
 )";
 
-    auto* shader = device.MakeShader(GetProgramId());
+    auto* shader = device.MakeShader(GetVariantId(features));
     ShaderData data;
     data.gamma = mGamma;
     data.color_map[0] = mColorMap[0];
@@ -795,9 +1113,16 @@ void main()
     data.color_map[2] = mColorMap[2];
     data.color_map[3] = mColorMap[3];
     data.gradient_offset = mOffset;
-    shader->CompileSource(mStatic ? FoldUniforms(src, data) : src);
+    const auto& source = SpecializeShader(src, features);
+    shader->CompileSource(mStatic ? FoldUniforms(source, data) : source);
     return shader;
 }
+MaterialClass::ShaderFeatures GradientClass::GetShaderFeatures(const State& state) const
+{
+    ShaderFeatures features;
+    features.set(ShaderFeature::RenderPoints, state.render_points);
+    return features;
+}
 size_t GradientClass::GetHash() const
 {
     size_t hash = 0;
@@ -837,8 +1162,6 @@ void GradientClass::ApplyDynamicState(State& state, Device& device, Program& pro
     else if (mSurfaceType == SurfaceType::Emissive)
         state.blending = State::Blending::Additive;
 
-    program.SetUniform("kRenderPoints", state.render_points ? 1.0f : 0.0f);
-
     if (!mStatic)
     {
         SetUniform("kGamma",  state.uniforms, mGamma, program);
@@ -908,9 +1231,9 @@ SpriteClass::SpriteClass(const SpriteClass& other, bool copy)
 }
 
 
-Shader* SpriteClass::GetShader(Device& device) const
+Shader* SpriteClass::GetShader(ShaderFeatures features, Device& device) const
 {
-    if (auto* shader = device.FindShader(GetProgramId()))
+    if (auto* shader = device.FindShader(GetVariantId(features)))
         return shader;
 
     // todo: maybe pack some of shader uniforms
@@ -919,19 +1242,28 @@ constexpr auto* src = R"(
 precision highp float;
 
 uniform sampler2D kTexture0;
-uniform sampler2D kTexture1;
+#ifdef FEATURE_FRAME_ATLAS
+// xy = normalized grid cell size, zw = normalized frame size
+uniform vec4 kFrameSize;
+// x = number of grid columns, y = number of frames
+uniform vec2 kFrameGrid;
+// normalized offset of the frame inside the grid cell
+uniform vec2 kFrameOffset;
+uniform float kFps;
+#else
 uniform vec4 kTextureBox0;
+#endif
+#if defined(FEATURE_BLEND_FRAMES) && !defined(FEATURE_FRAME_ATLAS)
+uniform sampler2D kTexture1;
 uniform vec4 kTextureBox1;
+uniform float kBlendCoeff;
+#endif
 uniform vec4 kBaseColor;
-uniform float kRenderPoints;
 uniform float kGamma;
 uniform float kRuntime;
-uniform float kBlendCoeff;
-uniform float kApplyRandomParticleRotation;
 uniform vec2 kTextureScale;
 uniform vec2 kTextureVelocityXY;
 uniform float kTextureVelocityZ;
-uniform ivec2 kTextureWrap;
 
 varying vec2 vTexCoord;
 varying float vRandomValue;
@@ -949,22 +1281,28 @@ vec2 WrapTextureCoords(vec2 coords, vec2 box)
   float x = coords.x;
   float y = coords.y;
 
-  if (kTextureWrap.x == 1)
-    x = clamp(x, 0.0, box.x);
-  else if (kTextureWrap.x == 2)
-    x = fract(x / box.x) * box.x;
+#if defined(FEATURE_CLAMP_X)
+  x = clamp(x, 0.0, box.x);
+#elif defined(FEATURE_REPEAT_X)
+  x = fract(x / box.x) * box.x;
+#endif
 
-  if (kTextureWrap.y == 1)
-    y = clamp(y, 0.0, box.y);
-  else if (kTextureWrap.y == 2)
-    y = fract(y / box.y) * box.y;
+#if defined(FEATURE_CLAMP_Y)
+  y = clamp(y, 0.0, box.y);
+#elif defined(FEATURE_REPEAT_Y)
+  y = fract(y / box.y) * box.y;
+#endif
 
   return vec2(x, y);
 }
 
 vec2 RotateCoords(vec2 coords)
 {
-    float random_angle = mix(0.0, vRandomValue, kApplyRandomParticleRotation);
+#ifdef FEATURE_PARTICLE_ROTATION
+    float random_angle = vRandomValue;
+#else
+    float random_angle = 0.0;
+#endif
     float angle = kTextureVelocityZ * kRuntime + random_angle * 3.1415926;
     coords = coords - vec2(0.5, 0.5);
     coords = mat2(cos(angle), -sin(angle),
@@ -973,53 +1311,104 @@ vec2 RotateCoords(vec2 coords)
     return coords;
 }
 
+#ifdef FEATURE_FRAME_ATLAS
+// compute the texture box of the frame in the atlas grid.
+vec4 FrameBox(float index)
+{
+    float col = mod(index, kFrameGrid.x);
+    float row = floor(index / kFrameGrid.x);
+    return vec4(col * kFrameSize.x + kFrameOffset.x,
+                row * kFrameSize.y + kFrameOffset.y, kFrameSize.zw);
+}
+#endif
+
 void main()
 {
     // for texture coords we need either the coords from the
     // vertex data or gl_PointCoord if the geometry is being
     // rasterized as points.
-    // we set kRenderPoints to 1.0f when rendering points.
     // note about gl_PointCoord:
     // "However, the gl_PointCoord fragment shader input defines
     // a per-fragment coordinate space (s, t) where s varies from
     // 0 to 1 across the point horizontally left-to-right, and t
     // ranges from 0 to 1 across the point vertically top-to-bottom."
-    vec2 coords = mix(vTexCoord, gl_PointCoord, kRenderPoints);
+#ifdef FEATURE_POINTS
+    vec2 coords = gl_PointCoord;
+#else
+    vec2 coords = vTexCoord;
+#endif
     coords = RotateCoords(coords);
 
     coords += kTextureVelocityXY * kRuntime;
     coords = coords * kTextureScale;
 
-    // apply texture box transformation.
-    vec2 scale_tex0 = kTextureBox0.zw;
-    vec2 scale_tex1 = kTextureBox1.zw;
-    vec2 trans_tex0 = kTextureBox0.xy;
-    vec2 trans_tex1 = kTextureBox1.xy;
+#ifdef FEATURE_FRAME_ATLAS
+    // select the current frame from the atlas based on the time.
+    float frame_time  = kRuntime * kFps;
+    float frame_index = mod(floor(frame_time), kFrameGrid.y);
+    vec4 box0 = FrameBox(frame_index);
+#else
+    vec4 box0 = kTextureBox0;
+#endif
 
     // scale and transform based on texture box. (todo: maybe use texture matrix?)
-    vec2 c1 = WrapTextureCoords(coords * scale_tex0, scale_tex0) + trans_tex0;
-    vec2 c2 = WrapTextureCoords(coords * scale_tex1, scale_tex1) + trans_tex1;
+    vec2 c1 = WrapTextureCoords(coords * box0.zw, box0.zw) + box0.xy;
 
     // sample textures, if texture is a just an alpha mask we use
     // only the alpha channel later.
     vec4 tex0 = texture2D(kTexture0, c1);
+#if defined(FEATURE_BLEND_FRAMES) && defined(FEATURE_FRAME_ATLAS)
+    // blend partner is the next frame in the same atlas.
+    vec4 box1 = FrameBox(mod(frame_index + 1.0, kFrameGrid.y));
+    vec2 c2 = WrapTextureCoords(coords * box1.zw, box1.zw) + box1.xy;
+    vec4 tex1 = texture2D(kTexture0, c2);
+    vec4 color = mix(tex0, tex1, fract(frame_time)) * kBaseColor;
+#elif defined(FEATURE_BLEND_FRAMES)
+    vec4 box1 = kTextureBox1;
+    vec2 c2 = WrapTextureCoords(coords * box1.zw, box1.zw) + box1.xy;
     vec4 tex1 = texture2D(kTexture1, c2);
     vec4 color = mix(tex0, tex1, kBlendCoeff) * kBaseColor;
+#else
+    vec4 color = tex0 * kBaseColor;
+#endif
     color.a *= vAlpha;
 
     // apply gamma (in)correction.
     gl_FragColor = pow(color, vec4(kGamma));
 }
 )";
-    auto* shader = device.MakeShader(GetProgramId());
+    auto* shader = device.MakeShader(GetVariantId(features));
     ShaderData data;
     data.gamma = mGamma;
     data.texture_scale = mTextureScale;
     data.texture_velocity = mTextureVelocity;
-    shader->CompileSource(mStatic ? FoldUniforms(src, data) : src);
+    const auto& source = SpecializeShader(src, features);
+    shader->CompileSource(mStatic ? FoldUniforms(source, data) : source);
     return shader;
 }
 
+MaterialClass::ShaderFeatures SpriteClass::GetShaderFeatures(const State& state) const
+{
+    ShaderFeatures features;
+    features.set(ShaderFeature::RenderPoints, state.render_points);
+    features.set(ShaderFeature::ParticleRotation, state.render_points && mParticleAction == ParticleAction::Rotate);
+    features.set(ShaderFeature::BlendFrames, mBlendFrames);
+    if (const auto* atlas = mSprite.GetFrameAtlas())
+    {
+        // frames are always sub rects inside the atlas.
+        const FRect frame(0.0f, 0.0f, atlas->frame_width, atlas->frame_height);
+        features.set(ShaderFeature::FrameAtlas);
+        features |= GetTextureRectFeatures(frame, mWrapX, mWrapY);
+        return features;
+    }
+    // the frames can use different texture rects but the program is picked
+    // before binding the frames so if any of the frames needs the wrapping
+    // then all of them get it.
+    for (size_t i=0; i<mSprite.GetNumTextures(); ++i)
+        features |= GetTextureRectFeatures(mSprite.GetTextureRect(i), mWrapX, mWrapY);
+    return features;
+}
+
 std::size_t SpriteClass::GetHash() const
 {
     size_t hash = 0;
@@ -1070,14 +1459,49 @@ void SpriteClass::ApplyDynamicState(State& state, Device& device, Program& progr
     else if (mSurfaceType == SurfaceType::Emissive)
         state.blending = State::Blending::Additive;
 
+    program.SetUniform("kRuntime", (float)state.material_time);
+    if (!mStatic)
+    {
+        SetUniform("kBaseColor",         state.uniforms, mBaseColor, program);
+        SetUniform("kGamma",             state.uniforms, mGamma, program);
+        SetUniform("kTextureScale",      state.uniforms, glm::vec2(mTextureScale.x, mTextureScale.y), program);
+        SetUniform("kTextureVelocityXY", state.uniforms, glm::vec2(mTextureVelocity.x, mTextureVelocity.y), program);
+        SetUniform("kTextureVelocityZ",  state.uniforms, mTextureVelocity.z, program);
+    }
+
+    if (const auto* atlas = mSprite.GetFrameAtlas())
+    {
+        // all the frames are in a single texture and the shader selects
+        // the current frame (and the blend partner) based on the runtime.
+        // the texture binding stays the same for the whole animation.
+        program.SetTextureCount(1);
+        program.SetUniform("kFrameSize", atlas->cell_width, atlas->cell_height,
+                                         atlas->frame_width, atlas->frame_height);
+        program.SetUniform("kFrameGrid", (float)atlas->cols, (float)atlas->frame_count);
+        program.SetUniform("kFrameOffset", atlas->frame_x, atlas->frame_y);
+        program.SetUniform("kFps", std::max(mSprite.GetFps(), 0.001f));
+        // bind last, a failed atlas upload drops the atlas layout.
+        if (auto* texture = mSprite.BindFrameAtlas(device))
+        {
+            texture->EnableGarbageCollection(mGarbageCollect);
+            texture->SetFilter(mMinFilter);
+            texture->SetFilter(mMagFilter);
+            texture->SetWrapX(mWrapX);
+            texture->SetWrapY(mWrapY);
+            program.SetTexture("kTexture0", 0, *texture);
+        }
+        return;
+    }
+
     TextureMap::BindingState ts;
     ts.time = state.material_time;
 
     TextureMap::BoundState binds;
     mSprite.BindTextures(ts, device,  binds);
 
-    bool need_software_wrap = true;
-    for (unsigned i=0; i<2; ++i)
+    // without frame blending the shader only samples the current frame.
+    const unsigned num_textures = mBlendFrames ? 2 : 1;
+    for (unsigned i=0; i<num_textures; ++i)
     {
         auto* texture = binds.textures[i];
         // set texture properties *before* setting it to the program.
@@ -1096,43 +1520,10 @@ void SpriteClass::ApplyDynamicState(State& state, Device& device, Program& progr
         const auto& kTextureRect = "kTextureBox" + std::to_string(i);
         program.SetTexture(kTextureName.c_str(), i, *texture);
         program.SetUniform(kTextureRect.c_str(), x, y, sx, sy);
-
-        // if a sub-rectangle is defined we need to use software (shader)
-        // based wrapping/clamping in order to wrap/clamp properly within
-        // the bounds of the sub rect.
-        // we do this check here rather than introduce a specific flag for this purpose.
-        const float eps = 0.001;
-        if (math::equals(0.0f, x, eps) &&
-            math::equals(0.0f, y, eps) &&
-            math::equals(1.0f, sx, eps) &&
-            math::equals(1.0f, sy, eps))
-            need_software_wrap = false;
-    }
-    program.SetTextureCount(2);
-    program.SetUniform("kBlendCoeff", mBlendFrames ? binds.blend_coefficient : 0.0f);
-    program.SetUniform("kRuntime", (float)state.material_time);
-    program.SetUniform("kRenderPoints", state.render_points ? 1.0f : 0.0f);
-    program.SetUniform("kApplyRandomParticleRotation",
-                    state.render_points && mParticleAction == ParticleAction::Rotate ? 1.0f : 0.0f);
-    // set software wrap/clamp. 0 = disabled.
-    if (need_software_wrap)
-    {
-        const auto wrap_x = mWrapX == TextureWrapping::Clamp ? 1 : 2;
-        const auto wrap_y = mWrapY == TextureWrapping::Clamp ? 1 : 2;
-        program.SetUniform("kTextureWrap", wrap_x, wrap_y);
-    }
-    else
-    {
-        program.SetUniform("kTextureWrap", 0, 0);
-    }
-    if (!mStatic)
-    {
-        SetUniform("kBaseColor",         state.uniforms, mBaseColor, program);
-        SetUniform("kGamma",             state.uniforms, mGamma, program);
-        SetUniform("kTextureScale",      state.uniforms, glm::vec2(mTextureScale.x, mTextureScale.y), program);
-        SetUniform("kTextureVelocityXY", state.uniforms, glm::vec2(mTextureVelocity.x, mTextureVelocity.y), program);
-        SetUniform("kTextureVelocityZ",  state.uniforms, mTextureVelocity.z, program);
     }
+    program.SetTextureCount(num_textures);
+    if (mBlendFrames)
+        program.SetUniform("kBlendCoeff", binds.blend_coefficient);
 }
 
 void SpriteClass::ApplyStaticState(Device& device, Program& prog) const
@@ -1302,9 +1693,9 @@ TextureMap2DClass::TextureMap2DClass(const TextureMap2DClass& other, bool copy)
     mParticleAction  = other.mParticleAction;
 }
 
-Shader* TextureMap2DClass::GetShader(Device& device) const
+Shader* TextureMap2DClass::GetShader(ShaderFeatures features, Device& device) const
 {
-    if (auto* shader = device.FindShader(GetProgramId()))
+    if (auto* shader = device.FindShader(GetVariantId(features)))
         return shader;
 
 // todo: pack some of the uniforms ?
@@ -1315,16 +1706,12 @@ precision highp float;
 uniform sampler2D kTexture;
 uniform vec4 kTextureBox;
 uniform float kAlphaMask;
-uniform float kRenderPoints;
 uniform float kGamma;
-uniform float kApplyRandomParticleRotation;
 uniform float kRuntime;
 uniform vec2 kTextureScale;
 uniform vec2 kTextureVelocityXY;
 uniform float kTextureVelocityZ;
 uniform vec4 kBaseColor;
-// 0 disabled, 1 clamp, 2 wrap
-uniform ivec2 kTextureWrap;
 
 varying vec2 vTexCoord;
 varying float vRandomValue;
@@ -1342,22 +1729,28 @@ vec2 WrapTextureCoords(vec2 coords, vec2 box)
   float x = coords.x;
   float y = coords.y;
 
-  if (kTextureWrap.x == 1)
-    x = clamp(x, 0.0, box.x);
-  else if (kTextureWrap.x == 2)
-    x = fract(x / box.x) * box.x;
+#if defined(FEATURE_CLAMP_X)
+  x = clamp(x, 0.0, box.x);
+#elif defined(FEATURE_REPEAT_X)
+  x = fract(x / box.x) * box.x;
+#endif
 
-  if (kTextureWrap.y == 1)
-    y = clamp(y, 0.0, box.y);
-  else if (kTextureWrap.y == 2)
-    y = fract(y / box.y) * box.y;
+#if defined(FEATURE_CLAMP_Y)
+  y = clamp(y, 0.0, box.y);
+#elif defined(FEATURE_REPEAT_Y)
+  y = fract(y / box.y) * box.y;
+#endif
 
   return vec2(x, y);
 }
 
 vec2 RotateCoords(vec2 coords)
 {
-    float random_angle = mix(0.0, vRandomValue, kApplyRandomParticleRotation);
+#ifdef FEATURE_PARTICLE_ROTATION
+    float random_angle = vRandomValue;
+#else
+    float random_angle = 0.0;
+#endif
     float angle = kTextureVelocityZ * kRuntime + random_angle * 3.1415926;
     coords = coords - vec2(0.5, 0.5);
     coords = mat2(cos(angle), -sin(angle),
@@ -1371,13 +1764,16 @@ void main()
     // for texture coords we need either the coords from the
     // vertex data or gl_PointCoord if the geometry is being
     // rasterized as points.
-    // we set kRenderPoints to 1.0f when rendering points.
     // note about gl_PointCoord:
     // "However, the gl_PointCoord fragment shader input defines
     // a per-fragment coordinate space (s, t) where s varies from
     // 0 to 1 across the point horizontally left-to-right, and t
     // ranges from 0 to 1 across the point vertically top-to-bottom."
-    vec2 coords = mix(vTexCoord, gl_PointCoord, kRenderPoints);
+#ifdef FEATURE_POINTS
+    vec2 coords = gl_PointCoord;
+#else
+    vec2 coords = vTexCoord;
+#endif
     coords = RotateCoords(coords);
     coords += kTextureVelocityXY * kRuntime;
     coords = coords * kTextureScale;
@@ -1404,15 +1800,24 @@ void main()
     gl_FragColor = pow(col, vec4(kGamma));
 }
 )";
-    auto* shader = device.MakeShader(GetProgramId());
+    auto* shader = device.MakeShader(GetVariantId(features));
     ShaderData data;
     data.gamma            = mGamma;
     data.base_color       = mBaseColor;
     data.texture_scale    = mTextureScale;
     data.texture_velocity = mTextureVelocity;
-    shader->CompileSource(mStatic ? FoldUniforms(src, data) : src);
+    const auto& source = SpecializeShader(src, features);
+    shader->CompileSource(mStatic ? FoldUniforms(source, data) : source);
     return shader;
 }
+MaterialClass::ShaderFeatures TextureMap2DClass::GetShaderFeatures(const State& state) const
+{
+    ShaderFeatures features;
+    features.set(ShaderFeature::RenderPoints, state.render_points);
+    features.set(ShaderFeature::ParticleRotation, state.render_points && mParticleAction == ParticleAction::Rotate);
+    features |= GetTextureRectFeatures(mTexture.GetTextureRect(), mWrapX, mWrapY);
+    return features;
+}
 std::size_t TextureMap2DClass::GetHash() const
 {
     size_t hash = 0;
@@ -1478,38 +1883,12 @@ void TextureMap2DClass::ApplyDynamicState(State& state, Device& device, Program&
     const float sx = rect.GetWidth();
     const float sy = rect.GetHeight();
 
-    bool need_software_wrap = true;
-    // if a sub-rectangle is defined we need to use software (shader)
-    // based wrapping/clamping in order to wrap/clamp properly within
-    // the bounds of the sub rect.
-    // we do this check here rather than introduce a specific flag for this purpose.
-    const float eps = 0.001;
-    if (math::equals(0.0f, x, eps) &&
-        math::equals(0.0f, y, eps) &&
-        math::equals(1.0f, sx, eps) &&
-        math::equals(1.0f, sy, eps))
-        need_software_wrap = false;
-
     program.SetTexture("kTexture", 0, *texture);
     program.SetUniform("kTextureBox", x, y, sx, sy);
     program.SetTextureCount(1);
-    program.SetUniform("kApplyRandomParticleRotation",
-                    state.render_points && mParticleAction == ParticleAction::Rotate ? 1.0f : 0.0f);
-    program.SetUniform("kRenderPoints", state.render_points ? 1.0f : 0.0f);
     program.SetUniform("kRuntime", (float)state.material_time);
     program.SetUniform("kAlphaMask", binds.textures[0]->GetFormat() == Texture::Format::Grayscale ? 1.0f : 0.0f);
 
-    // set software wrap/clamp. 0 = disabled.
-    if (need_software_wrap)
-    {
-        const auto wrap_x = mWrapX == TextureWrapping::Clamp ? 1 : 2;
-        const auto wrap_y = mWrapY == TextureWrapping::Clamp ? 1 : 2;
-        program.SetUniform("kTextureWrap", wrap_x, wrap_y);
-    }
-    else
-    {
-        program.SetUniform("kTextureWrap", 0, 0);
-    }
     if (!mStatic)
     {
         SetUniform("kGamma",             state.uniforms, mGamma, program);
@@ -1754,14 +2133,36 @@ std::unordered_set<std::string> CustomMaterialClass::GetTextureMapNames() const
     return set;
 }
 
-gfx::Shader* CustomMaterialClass::GetShader(Device& device) const
+gfx::Shader* CustomMaterialClass::GetShader(ShaderFeatures features, Device& device) const
 {
-    if (auto* shader = device.FindShader(mClassId))
+    if (auto* shader = device.FindShader(GetVariantId(features)))
+        return shader;
+    auto* shader = device.MakeShader(GetVariantId(features));
+    if (!features.value())
+    {
+        shader->CompileFile(mShaderUri);
+        return shader;
+    }
+    const auto& buffer = gfx::LoadResource(mShaderUri);
+    if (!buffer)
+    {
+        ERROR("Failed to load shader source: '%1'", mShaderUri);
         return shader;
-    auto* shader = device.MakeShader(mClassId);
-    shader->CompileFile(mShaderUri);
+    }
+    const char* beg = (const char*)buffer->GetData();
+    const char* end = beg + buffer->GetSize();
+    if (!shader->CompileSource(SpecializeShader(std::string(beg, end), features)))
+        ERROR("Failed to compile shader source file: '%1'", mShaderUri);
     return shader;
 }
+MaterialClass::ShaderFeatures CustomMaterialClass::GetShaderFeatures(const State& state) const
+{
+    // custom shaders can choose to use FEATURE_POINTS. kRenderPoints is
+    // still set for the existing shaders that use the uniform.
+    ShaderFeatures features;
+    features.set(ShaderFeature::RenderPoints, state.render_points);
+    return features;
+}
 std::size_t CustomMaterialClass::GetHash() const
 {
     size_t hash = 0;
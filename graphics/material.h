@@ -28,10 +28,12 @@
 #include <unordered_set>
 #include <variant>
 #include <cmath>
+#include <cstdint>
 
 #include "base/utility.h"
 #include "base/assert.h"
 #include "base/hash.h"
+#include "base/bitflag.h"
 #include "data/fwd.h"
 #include "graphics/texture.h"
 #include "graphics/resource.h"
@@ -87,6 +89,15 @@ namespace gfx
         // error this function should return empty shared pointer.
         // The returned bitmap can be potentially immutably shared.
         virtual std::shared_ptr<IBitmap> GetData() const = 0;
+        // Upload the content into the given texture object. The default
+        // implementation goes through GetData. Sources that can hand their
+        // pixel data to the texture without building an intermediate bitmap
+        // should override this. Returns false if there's a content error.
+        virtual bool Upload(Texture* texture) const;
+        // Get the dimensions and the bit depth of the content without
+        // producing the content when possible. The default implementation
+        // goes through GetData. Returns false if there's a content error.
+        virtual bool ProbeData(unsigned* width, unsigned* height, unsigned* depth_bits) const;
         // Create a similar clone of this texture source but
         // with unique id.
         virtual std::unique_ptr<TextureSource> Clone() const = 0;
@@ -132,6 +143,8 @@ namespace gfx
             virtual void SetName(const std::string& name)
             { mName = name; }
             virtual std::shared_ptr<IBitmap> GetData() const override;
+            virtual bool Upload(Texture* texture) const override;
+            virtual bool ProbeData(unsigned* width, unsigned* height, unsigned* depth_bits) const override;
             virtual std::unique_ptr<TextureSource> Clone() const override
             {
                 auto ret = std::make_unique<TextureFileSource>(*this);
@@ -213,6 +226,13 @@ namespace gfx
             { mName = name; }
             virtual std::shared_ptr<IBitmap> GetData() const override
             { return mBitmap; }
+            virtual bool ProbeData(unsigned* width, unsigned* height, unsigned* depth_bits) const override
+            {
+                *width      = mBitmap->GetWidth();
+                *height     = mBitmap->GetHeight();
+                *depth_bits = mBitmap->GetDepthBits();
+                return true;
+            }
             virtual std::unique_ptr<TextureSource> Clone() const override
             {
                 auto ret = std::make_unique<TextureBitmapBufferSource>(*this);
@@ -553,28 +573,43 @@ namespace gfx
         {
             mSprites.emplace_back();
             mSprites.back().source = std::move(source);
+            mAtlasDirty = true;
         }
         void AddTexture(std::unique_ptr<TextureSource> source, const FRect& rect)
         {
             mSprites.emplace_back();
             mSprites.back().source = std::move(source);
             mSprites.back().rect = rect;
+            mAtlasDirty = true;
         }
         void DeleteTexture(size_t index)
-        { base::SafeErase(mSprites, index); }
+        {
+            base::SafeErase(mSprites, index);
+            mAtlasDirty = true;
+        }
         void DeleteTextureById(const std::string& id);
         const TextureSource* GetTextureSource(size_t index) const
         { return base::SafeIndex(mSprites, index).source.get(); }
         TextureSource* GetTextureSource(size_t index)
-        { return base::SafeIndex(mSprites, index).source.get(); }
+        {
+            // the caller can modify the source.
+            mAtlasDirty = true;
+            return base::SafeIndex(mSprites, index).source.get();
+        }
         void SetSamplerName(const std::string& name, size_t index)
         { mSamplerName[index] = name; }
         void SetRectUniformName(const std::string& name, size_t index)
         { mRectUniformName[index] = name; }
         void SetTextureRect(std::size_t index, const FRect& rect)
-        { base::SafeIndex(mSprites, index).rect = rect; }
+        {
+            base::SafeIndex(mSprites, index).rect = rect;
+            mAtlasDirty = true;
+        }
         void SetTextureSource(std::size_t index, std::unique_ptr<TextureSource> source)
-        { base::SafeIndex(mSprites, index).source = std::move(source); }
+        {
+            base::SafeIndex(mSprites, index).source = std::move(source);
+            mAtlasDirty = true;
+        }
         void SetFps(float fps) { mFps = fps; }
         std::string GetSamplerName(size_t index) const
         { return mSamplerName[index]; }
@@ -604,8 +639,51 @@ namespace gfx
         virtual bool SetTextureRect(const TextureSource* source, const FRect& rect) override;
         virtual bool DeleteTexture(const TextureSource* source) override;
         virtual void ResetTextures() override
-        { mSprites.clear(); }
+        {
+            mSprites.clear();
+            mAtlasDirty = true;
+        }
         SpriteMap& operator=(const SpriteMap& other);
+
+        // Layout of the sprite frames packed into a single atlas texture
+        // in a regular grid. The frames are in row order starting from the
+        // top left corner so the shader can compute the rectangle of any
+        // frame from the frame index and select the current frame itself.
+        struct FrameAtlas {
+            // the grid dimensions in cells.
+            unsigned cols = 0;
+            unsigned rows = 0;
+            // the number of frames in the atlas.
+            unsigned frame_count = 0;
+            // the normalized size of a grid cell. the cells have some
+            // padding to avoid bleeding between frames when filtering.
+            float cell_width  = 0.0f;
+            float cell_height = 0.0f;
+            // the normalized size of the frame inside the cell.
+            float frame_width  = 0.0f;
+            float frame_height = 0.0f;
+            // the normalized offset of the frame from the cell origin.
+            // the frame is surrounded by a gutter of replicated edge texels.
+            float frame_x = 0.0f;
+            float frame_y = 0.0f;
+        };
+        // Compute the layout for packing the sprite frames into an atlas.
+        // The frames can be packed when there are 2 or more frames, each
+        // frame is a different texture that is used whole (no texture rect)
+        // and all the frames have the same size and format. Only the frame
+        // sizes are probed, the frame images are decoded when the atlas
+        // texture is created in BindFrameAtlas.
+        void PackFrameAtlas() const;
+        // Get the frame atlas layout for the sprite frames. Returns nullptr if
+        // the frames can't be packed into an atlas. If the frames have changed
+        // since the atlas was last packed the atlas is packed again.
+        const FrameAtlas* GetFrameAtlas() const;
+        // Find or create the atlas texture on the device. Creating the texture
+        // decodes each frame and uploads it directly into its atlas cell.
+        // Returns nullptr if there's no atlas or the atlas texture could not
+        // be created. In the latter case the atlas is dropped until the
+        // frames are changed.
+        Texture* BindFrameAtlas(Device& device) const;
     private:
         float mFps = 0.0f;
         struct Sprite {
@@ -615,6 +693,15 @@ namespace gfx
         std::vector<Sprite> mSprites;
         std::string mSamplerName[2];
         std::string mRectUniformName[2];
+        // the cached frame atlas layout. packed when the sprite is
+        // loaded and again only when the frames have been changed.
+        mutable bool mAtlasDirty = true;
+        mutable std::size_t mAtlasHash = 0;
+        mutable std::optional<FrameAtlas> mAtlas;
+        // the atlas texture dimensions and the frame format.
+        mutable unsigned mAtlasWidth  = 0;
+        mutable unsigned mAtlasHeight = 0;
+        mutable unsigned mAtlasDepth  = 0;
     };
 
     // Implements texture mapping by always mapping a single 2D texture object
@@ -729,6 +816,37 @@ namespace gfx
             Custom
         };
 
+        // Material shader features that are resolved when the shader
+        // is compiled. Each feature maps to a preprocessor define in the
+        // material shader source so the shader is specialized instead of
+        // branching on uniforms at runtime. Every combination of features
+        // that is actually used compiles into its own shader and program
+        // variant identified by the feature bits.
+        enum class ShaderFeature {
+            // Rasterizing points, texture coordinates come from gl_PointCoord.
+            // FEATURE_POINTS
+            RenderPoints,
+            // Rotate the particle texture coordinates by a random angle.
+            // FEATURE_PARTICLE_ROTATION
+            ParticleRotation,
+            // Blend between two sprite animation frames.
+            // FEATURE_BLEND_FRAMES
+            BlendFrames,
+            // Clamp/repeat the texture coordinates within a texture sub
+            // rectangle in the shader since the hardware sampler would
+            // clamp/repeat on the whole texture.
+            // FEATURE_CLAMP_X, FEATURE_REPEAT_X, FEATURE_CLAMP_Y, FEATURE_REPEAT_Y
+            TextureRectClampX,
+            TextureRectRepeatX,
+            TextureRectClampY,
+            TextureRectRepeatY,
+            // Sprite frames are packed into a single atlas texture and the
+            // shader selects the current frame based on the material time.
+            // FEATURE_FRAME_ATLAS
+            FrameAtlas
+        };
+        using ShaderFeatures = base::bitflag<ShaderFeature>;
+
         // Material/Shader uniform.
         using Uniform = std::variant<float, int,
                 gfx::Color4f,
@@ -779,10 +897,13 @@ namespace gfx
         // Set the material class id. Used when creating specific materials with
         // fixed static ids. Todo: refactor away and use constructor.
         virtual void SetId(const std::string& id) = 0;
-        // Create the shader for this material on the given device.
-        // Returns the new shader object or nullptr if the shader
-        // failed to compile.
-        virtual Shader* GetShader(Device& device) const = 0;
+        // Get the shader features needed to draw with the given state.
+        virtual ShaderFeatures GetShaderFeatures(const State& state) const
+        { return ShaderFeatures(); }
+        // Create the shader variant with the given features for this
+        // material on the given device. Returns the new shader object
+        // or nullptr if the shader failed to compile.
+        virtual Shader* GetShader(ShaderFeatures features, Device& device) const = 0;
         // Apply the material properties onto the given program object based
         // on the material class and the material instance state.
         virtual void ApplyDynamicState(State& state, Device& device, Program& program) const = 0;
@@ -805,6 +926,14 @@ namespace gfx
         // information the packer and updating the material's state.
         virtual void FinishPacking(const ResourcePacker* packer) = 0;
 
+        // Get the ID of the shader/program variant with the given features.
+        std::string GetVariantId(ShaderFeatures features) const
+        {
+            if (!features.value())
+                return GetProgramId();
+            return GetProgramId() + "#" + std::to_string(features.value());
+        }
+
         // Helpers
         inline BuiltInMaterialClass* AsBuiltIn()
         { return MaterialCast<BuiltInMaterialClass>(this); }
@@ -920,7 +1049,7 @@ namespace gfx
         const Color4f& GetBaseColor() const
         { return mColor; }
         virtual Type GetType() const override { return Type::Color; }
-        virtual gfx::Shader* GetShader(Device& device) const override;
+        virtual gfx::Shader* GetShader(ShaderFeatures features, Device& device) const override;
         virtual std::size_t GetHash() const override;
         virtual std::string GetProgramId() const override;
         virtual std::unique_ptr<MaterialClass> Copy() const override
@@ -981,7 +1110,8 @@ namespace gfx
         void SetOffset(const glm::vec2& offset)
         { mOffset = offset; }
         virtual Type GetType() const override { return Type::Gradient; }
-        virtual gfx::Shader* GetShader(Device& device) const override;
+        virtual gfx::Shader* GetShader(ShaderFeatures features, Device& device) const override;
+        virtual ShaderFeatures GetShaderFeatures(const State& state) const override;
         virtual std::size_t GetHash() const override;
         virtual std::string GetProgramId() const override;
         virtual std::unique_ptr<MaterialClass> Copy() const override
@@ -1103,7 +1233,8 @@ namespace gfx
         { return mParticleAction; }
 
         virtual Type GetType() const override { return Type::Sprite; }
-        virtual gfx::Shader* GetShader(Device& device) const override;
+        virtual gfx::Shader* GetShader(ShaderFeatures features, Device& device) const override;
+        virtual ShaderFeatures GetShaderFeatures(const State& state) const override;
         virtual std::size_t GetHash() const override;
         virtual std::string GetProgramId() const override;
         virtual std::unique_ptr<MaterialClass> Copy() const override;
@@ -1207,7 +1338,8 @@ namespace gfx
         ParticleAction GetParticleAction() const
         { return mParticleAction; }
         virtual Type GetType() const override { return Type::Texture; }
-        virtual gfx::Shader* GetShader(Device& device) const override;
+        virtual gfx::Shader* GetShader(ShaderFeatures features, Device& device) const override;
+        virtual ShaderFeatures GetShaderFeatures(const State& state) const override;
         virtual std::size_t GetHash() const override;
         virtual std::string GetProgramId() const override;
         virtual std::unique_ptr<MaterialClass> Copy() const override;
@@ -1331,7 +1463,8 @@ namespace gfx
         { mClassId = id; }
         virtual Type GetType() const override { return Type::Custom; }
         virtual SurfaceType GetSurfaceType() const override { return mSurfaceType; }
-        virtual gfx::Shader* GetShader(Device& device) const override;
+        virtual gfx::Shader* GetShader(ShaderFeatures features, Device& device) const override;
+        virtual ShaderFeatures GetShaderFeatures(const State& state) const override;
         virtual std::size_t GetHash() const override;
         virtual std::string GetId() const override { return mClassId; }
         virtual std::string GetProgramId() const override;
@@ -1384,6 +1517,15 @@ namespace gfx
             Blending blending = Blending::None;
         };
 
+        // Get the material shader features needed to draw in the given environment.
+        MaterialClass::ShaderFeatures GetShaderFeatures(const Environment& env) const
+        {
+            MaterialClass::State state;
+            state.material_time = mRuntime;
+            state.render_points = env.render_points;
+            return mClass->GetShaderFeatures(state);
+        }
+
         // Apply the material properties to the given program object and set the rasterizer state.
         void ApplyDynamicState(const Environment& env, Device& device, Program& program, RasterState& raster) const
         {
@@ -24,6 +24,9 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <chrono>
 
 #include "base/assert.h"
 #include "base/logging.h"
@@ -34,6 +37,7 @@
 #include "graphics/device.h"
 #include "graphics/geometry.h"
 #include "graphics/texture.h"
+#include "graphics/framebuffer.h"
 #include "graphics/color4f.h"
 
 #define GL_CALL(x)                                      \
@@ -48,9 +52,58 @@ do {                                                    \
     }                                                   \
 } while(0)
 
+// These are not part of ES2 but are needed for doing asynchronous
+// pixel reads through pixel buffer objects when the context is
+// actually ES3 (or desktop GL 3.2+) capable.
+#ifndef GL_PIXEL_PACK_BUFFER
+#  define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#  define GL_STREAM_READ 0x88E1
+#endif
+#ifndef GL_MAP_READ_BIT
+#  define GL_MAP_READ_BIT 0x0001
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#  define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_TIMEOUT_EXPIRED
+#  define GL_TIMEOUT_EXPIRED 0x911B
+#endif
+#ifndef GL_WAIT_FAILED
+#  define GL_WAIT_FAILED 0x911D
+#endif
+#ifndef GL_SYNC_FLUSH_COMMANDS_BIT
+#  define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#endif
+// EXT_disjoint_timer_query
+#ifndef GL_TIME_ELAPSED_EXT
+#  define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#ifndef GL_QUERY_RESULT_EXT
+#  define GL_QUERY_RESULT_EXT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE_EXT
+#  define GL_QUERY_RESULT_AVAILABLE_EXT 0x8867
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#  define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
 
 namespace
 {
+using GLsyncObject = void*;
+typedef void* (GL_APIENTRYP PFNGLMAPBUFFERRANGEPROC_) (GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+typedef GLboolean (GL_APIENTRYP PFNGLUNMAPBUFFERPROC_) (GLenum target);
+typedef GLsyncObject (GL_APIENTRYP PFNGLFENCESYNCPROC_) (GLenum condition, GLbitfield flags);
+typedef GLenum (GL_APIENTRYP PFNGLCLIENTWAITSYNCPROC_) (GLsyncObject sync, GLbitfield flags, uint64_t timeout);
+typedef void (GL_APIENTRYP PFNGLDELETESYNCPROC_) (GLsyncObject sync);
+typedef void (GL_APIENTRYP PFNGLGENQUERIESEXTPROC_) (GLsizei n, GLuint* ids);
+typedef void (GL_APIENTRYP PFNGLDELETEQUERIESEXTPROC_) (GLsizei n, const GLuint* ids);
+typedef void (GL_APIENTRYP PFNGLBEGINQUERYEXTPROC_) (GLenum target, GLuint id);
+typedef void (GL_APIENTRYP PFNGLENDQUERYEXTPROC_) (GLenum target);
+typedef void (GL_APIENTRYP PFNGLGETQUERYOBJECTUIVEXTPROC_) (GLuint id, GLenum pname, GLuint* params);
+typedef void (GL_APIENTRYP PFNGLGETQUERYOBJECTUI64VEXTPROC_) (GLuint id, GLenum pname, uint64_t* params);
 
 const char* GLEnumToStr(GLenum eval)
 {
@@ -168,6 +221,7 @@ struct OpenGLFunctions
     PFNGLACTIVETEXTUREPROC           glActiveTexture;
     PFNGLGENERATEMIPMAPPROC          glGenerateMipmap;
     PFNGLTEXIMAGE2DPROC              glTexImage2D;
+    PFNGLTEXSUBIMAGE2DPROC           glTexSubImage2D;
     PFNGLTEXPARAMETERIPROC           glTexParameteri;
     PFNGLPIXELSTOREIPROC             glPixelStorei;
     PFNGLENABLEPROC                  glEnable;
@@ -178,8 +232,154 @@ struct OpenGLFunctions
     PFNGLSCISSORPROC                 glScissor;
     PFNGLCULLFACEPROC                glCullFace;
     PFNGLFRONTFACEPROC               glFrontFace;
+    PFNGLGENFRAMEBUFFERSPROC         glGenFramebuffers;
+    PFNGLDELETEFRAMEBUFFERSPROC      glDeleteFramebuffers;
+    PFNGLBINDFRAMEBUFFERPROC         glBindFramebuffer;
+    PFNGLFRAMEBUFFERTEXTURE2DPROC    glFramebufferTexture2D;
+    PFNGLCHECKFRAMEBUFFERSTATUSPROC  glCheckFramebufferStatus;
+    PFNGLGENRENDERBUFFERSPROC        glGenRenderbuffers;
+    PFNGLDELETERENDERBUFFERSPROC     glDeleteRenderbuffers;
+    PFNGLBINDRENDERBUFFERPROC        glBindRenderbuffer;
+    PFNGLRENDERBUFFERSTORAGEPROC     glRenderbufferStorage;
+    PFNGLFRAMEBUFFERRENDERBUFFERPROC glFramebufferRenderbuffer;
+    PFNGLGENBUFFERSPROC              glGenBuffers;
+    PFNGLDELETEBUFFERSPROC           glDeleteBuffers;
+    PFNGLBINDBUFFERPROC              glBindBuffer;
+    PFNGLBUFFERDATAPROC              glBufferData;
+    PFNGLFINISHPROC                  glFinish;
+    // ES3 entry points. These are optional and can be null.
+    PFNGLMAPBUFFERRANGEPROC_         glMapBufferRange;
+    PFNGLUNMAPBUFFERPROC_            glUnmapBuffer;
+    PFNGLFENCESYNCPROC_              glFenceSync;
+    PFNGLCLIENTWAITSYNCPROC_         glClientWaitSync;
+    PFNGLDELETESYNCPROC_             glDeleteSync;
+    // EXT_disjoint_timer_query entry points. Optional.
+    PFNGLGENQUERIESEXTPROC_          glGenQueriesEXT;
+    PFNGLDELETEQUERIESEXTPROC_       glDeleteQueriesEXT;
+    PFNGLBEGINQUERYEXTPROC_          glBeginQueryEXT;
+    PFNGLENDQUERYEXTPROC_            glEndQueryEXT;
+    PFNGLGETQUERYOBJECTUIVEXTPROC_   glGetQueryObjectuivEXT;
+    PFNGLGETQUERYOBJECTUI64VEXTPROC_ glGetQueryObjectui64vEXT;
 };
 
+class ResourceList;
+
+// Base for the device resources that can be garbage collected. The node
+// links the resource into the device's intrusive LRU list and keeps track
+// of the frame number when the resource was last used.
+class ResourceNode
+{
+public:
+    enum class Kind {
+        Program, Texture, Geometry, Shader
+    };
+    ResourceNode(ResourceList& list, Kind kind)
+      : mList(list)
+      , mKind(kind)
+    {}
+    ResourceNode(const ResourceNode&) = delete;
+   ~ResourceNode();
+    // Mark the resource as used in the current frame.
+    void Touch();
+
+    void SetResourceName(const std::string& name)
+    { mResourceName = name; }
+    const std::string& GetResourceName() const
+    { return mResourceName; }
+    Kind GetResourceKind() const
+    { return mKind; }
+    std::size_t GetLastUsedFrameNumber() const
+    { return mFrameNumber; }
+
+    ResourceNode& operator=(const ResourceNode&) = delete;
+private:
+    friend class ResourceList;
+    ResourceList& mList;
+    const Kind mKind;
+    // the name (key) of the resource in the device's resource map.
+    std::string mResourceName;
+    ResourceNode* mPrev = nullptr;
+    ResourceNode* mNext = nullptr;
+    std::size_t mFrameNumber = 0;
+    bool mLinked = false;
+};
+
+// Intrusive doubly linked list of resources ordered by the frame
+// number when they were last used. The most recently used resources
+// are at the head and the least recently used at the tail. This lets
+// the garbage collection look at only the resources that have actually
+// expired instead of having to scan every resource every frame.
+class ResourceList
+{
+public:
+    void SetFrameNumber(std::size_t frame)
+    { mFrameNumber = frame; }
+    void Link(ResourceNode* node)
+    {
+        if (node->mLinked)
+            return;
+        node->mFrameNumber = mFrameNumber;
+        PushFront(node);
+    }
+    void Unlink(ResourceNode* node)
+    {
+        if (!node->mLinked)
+            return;
+        if (node->mPrev)
+            node->mPrev->mNext = node->mNext;
+        else mHead = node->mNext;
+        if (node->mNext)
+            node->mNext->mPrev = node->mPrev;
+        else mTail = node->mPrev;
+        node->mPrev   = nullptr;
+        node->mNext   = nullptr;
+        node->mLinked = false;
+        --mSize;
+    }
+    void Touch(ResourceNode* node)
+    {
+        // the list only needs to be ordered by frames so if the node
+        // has already been used this frame it's already in the right spot.
+        if (node->mFrameNumber == mFrameNumber)
+            return;
+        node->mFrameNumber = mFrameNumber;
+        if (!node->mLinked)
+            return;
+        Unlink(node);
+        PushFront(node);
+    }
+    ResourceNode* GetTail() const
+    { return mTail; }
+    std::size_t GetSize() const
+    { return mSize; }
+private:
+    void PushFront(ResourceNode* node)
+    {
+        node->mPrev = nullptr;
+        node->mNext = mHead;
+        if (mHead)
+            mHead->mPrev = node;
+        else mTail = node;
+        mHead = node;
+        node->mLinked = true;
+        ++mSize;
+    }
+private:
+    ResourceNode* mHead = nullptr;
+    ResourceNode* mTail = nullptr;
+    std::size_t mSize = 0;
+    std::size_t mFrameNumber = 0;
+};
+
+ResourceNode::~ResourceNode()
+{
+    mList.Unlink(this);
+}
+void ResourceNode::Touch()
+{
+    mList.Touch(this);
+}
+
 //
 // OpenGL ES 2.0 based custom graphics device implementation
 // try to keep this implementantation free of Qt in
@@ -240,6 +440,7 @@ public:
         RESOLVE(glActiveTexture);
         RESOLVE(glGenerateMipmap);
         RESOLVE(glTexImage2D);
+        RESOLVE(glTexSubImage2D);
         RESOLVE(glTexParameteri);
         RESOLVE(glPixelStorei);
         RESOLVE(glEnable);
@@ -250,6 +451,32 @@ public:
         RESOLVE(glScissor);
         RESOLVE(glCullFace);
         RESOLVE(glFrontFace);
+        RESOLVE(glGenFramebuffers);
+        RESOLVE(glDeleteFramebuffers);
+        RESOLVE(glBindFramebuffer);
+        RESOLVE(glFramebufferTexture2D);
+        RESOLVE(glCheckFramebufferStatus);
+        RESOLVE(glGenRenderbuffers);
+        RESOLVE(glDeleteRenderbuffers);
+        RESOLVE(glBindRenderbuffer);
+        RESOLVE(glRenderbufferStorage);
+        RESOLVE(glFramebufferRenderbuffer);
+        RESOLVE(glGenBuffers);
+        RESOLVE(glDeleteBuffers);
+        RESOLVE(glBindBuffer);
+        RESOLVE(glBufferData);
+        RESOLVE(glFinish);
+        RESOLVE(glMapBufferRange);
+        RESOLVE(glUnmapBuffer);
+        RESOLVE(glFenceSync);
+        RESOLVE(glClientWaitSync);
+        RESOLVE(glDeleteSync);
+        RESOLVE(glGenQueriesEXT);
+        RESOLVE(glDeleteQueriesEXT);
+        RESOLVE(glBeginQueryEXT);
+        RESOLVE(glEndQueryEXT);
+        RESOLVE(glGetQueryObjectuivEXT);
+        RESOLVE(glGetQueryObjectui64vEXT);
     #undef RESOLVE
 
         GLint stencil_bits = 0;
@@ -295,6 +522,29 @@ public:
         DEBUG("Fragment shader texture units: %1", max_texture_units);
         mTextureUnits.resize(max_texture_units);
 
+        // Asynchronous pixel reads need pixel buffer objects and fences
+        // which are only available when the context is actually version 3
+        // or better. Resolving the function pointers isn't enough since
+        // the pointers can be valid even when the context doesn't support
+        // the functionality.
+        const char* version = (const char*)mGL.glGetString(GL_VERSION);
+        const char* digit   = version ? std::strpbrk(version, "0123456789") : nullptr;
+        const int major_version = digit ? std::atoi(digit) : 0;
+        mHaveFences = major_version >= 3 &&
+            mGL.glFenceSync && mGL.glClientWaitSync && mGL.glDeleteSync;
+        mHavePixelBufferRead = mHaveFences &&
+            mGL.glMapBufferRange && mGL.glUnmapBuffer;
+        DEBUG("Async pixel buffer reads: %1", mHavePixelBufferRead ? "yes" : "no");
+
+        // GPU timers need the disjoint timer query extension, same deal
+        // with the function pointers as above.
+        const char* extensions = (const char*)mGL.glGetString(GL_EXTENSIONS);
+        mHaveTimerQueries = extensions && std::strstr(extensions, "GL_EXT_disjoint_timer_query") &&
+            mGL.glGenQueriesEXT && mGL.glDeleteQueriesEXT &&
+            mGL.glBeginQueryEXT && mGL.glEndQueryEXT &&
+            mGL.glGetQueryObjectuivEXT && mGL.glGetQueryObjectui64vEXT;
+        DEBUG("GPU timer queries: %1", mHaveTimerQueries ? "yes" : "no");
+
         // set some initial state
         GL_CALL(glDisable(GL_DEPTH_TEST));
         GL_CALL(glEnable(GL_CULL_FACE));
@@ -309,8 +559,20 @@ public:
    ~OpenGLES2GraphicsDevice()
     {
         DEBUG("~OpenGLES2GraphicsDevice");
+       for (auto& read : mPendingReads)
+           DeletePendingRead(read);
+       mPendingReads.clear();
+       for (auto& timer : mPendingTimers)
+       {
+           if (timer.query)
+               mGL.glDeleteQueriesEXT(1, &timer.query);
+       }
+       mPendingTimers.clear();
        // make sure our cleanup order is specific so that the
        // resources are deleted before the context is deleted.
+       if (mCurrentFrameBuffer)
+           GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, mDefaultFrameBuffer));
+       mFrameBuffers.clear();
        mTextures.clear();
        mShaders.clear();
        mPrograms.clear();
@@ -327,6 +589,14 @@ public:
         GL_CALL(glClearStencil(value));
         GL_CALL(glClear(GL_STENCIL_BUFFER_BIT));
     }
+    virtual void ClearStencil(int value, const IRect& rect) override
+    {
+        GL_CALL(glEnable(GL_SCISSOR_TEST));
+        GL_CALL(glScissor(rect.GetX(), rect.GetY(), rect.GetWidth(), rect.GetHeight()));
+        GL_CALL(glClearStencil(value));
+        GL_CALL(glClear(GL_STENCIL_BUFFER_BIT));
+        GL_CALL(glDisable(GL_SCISSOR_TEST));
+    }
 
     virtual void SetDefaultTextureFilter(MinFilter filter)
     {
@@ -347,8 +617,10 @@ public:
 
     virtual Shader* MakeShader(const std::string& name) override
     {
-        auto shader = std::make_unique<ShaderImpl>(mGL);
+        auto shader = std::make_unique<ShaderImpl>(mGL, mResources, mStats);
         auto* ret   = shader.get();
+        shader->SetResourceName(name);
+        mResources.Link(ret);
         mShaders[name] = std::move(shader);
         return ret;
     }
@@ -363,8 +635,10 @@ public:
 
     virtual Program* MakeProgram(const std::string& name) override
     {
-        auto program = std::make_unique<ProgImpl>(mGL);
+        auto program = std::make_unique<ProgImpl>(mGL, mResources, mTexturedPrograms, mStats);
         auto* ret    = program.get();
+        program->SetResourceName(name);
+        mResources.Link(ret);
         mPrograms[name] = std::move(program);
         return ret;
     }
@@ -379,8 +653,10 @@ public:
 
     virtual Geometry* MakeGeometry(const std::string& name) override
     {
-        auto geometry = std::make_unique<GeomImpl>(mGL);
+        auto geometry = std::make_unique<GeomImpl>(mGL, mResources, mStats);
         auto* ret = geometry.get();
+        geometry->SetResourceName(name);
+        mResources.Link(ret);
         mGeoms[name] = std::move(geometry);
         return ret;
     }
@@ -395,8 +671,11 @@ public:
 
     virtual Texture* MakeTexture(const std::string& name) override
     {
-        auto texture = std::make_unique<TextureImpl>(mGL);
+        auto texture = std::make_unique<TextureImpl>(mGL, mResources, mTextureUnits, mStats);
         auto* ret = texture.get();
+        // textures are linked into the resource list only once they're
+        // marked as eligible for garbage collection.
+        texture->SetResourceName(name);
         mTextures[name] = std::move(texture);
         return ret;
     }
@@ -417,6 +696,85 @@ public:
     {
         mTextures.clear();
     }
+    virtual void DeleteShader(const std::string& name) override
+    { DeleteNamedResource<ShaderImpl>(mShaders, name); }
+    virtual void DeleteProgram(const std::string& name) override
+    { DeleteNamedResource<ProgImpl>(mPrograms, name); }
+    virtual void DeleteGeometry(const std::string& name) override
+    { DeleteNamedResource<GeomImpl>(mGeoms, name); }
+    virtual void DeleteTexture(const std::string& name) override
+    { DeleteNamedResource<TextureImpl>(mTextures, name); }
+
+    virtual FrameBuffer* FindFrameBuffer(const std::string& name) override
+    {
+        auto it = mFrameBuffers.find(name);
+        if (it == std::end(mFrameBuffers))
+            return nullptr;
+        return it->second.get();
+    }
+    virtual FrameBuffer* MakeFrameBuffer(const std::string& name) override
+    {
+        auto fbo = std::make_unique<FrameBufferImpl>(mGL, mResources, mTextureUnits, mStats);
+        auto* ret = fbo.get();
+        mFrameBuffers[name] = std::move(fbo);
+        return ret;
+    }
+    virtual void DeleteFrameBuffers() override
+    {
+        SetFrameBuffer(nullptr);
+        for (auto& pair : mFrameBuffers)
+        {
+            const auto* impl = static_cast<FrameBufferImpl*>(pair.second.get());
+            // the color texture is owned by the frame buffer so make
+            // sure that we don't leave the texture units with dangling
+            // pointers to it.
+            for (auto& unit : mTextureUnits)
+            {
+                if (unit.texture == impl->GetColorTextureImpl())
+                    unit.texture = nullptr;
+            }
+        }
+        mFrameBuffers.clear();
+    }
+    virtual bool SetFrameBuffer(FrameBuffer* fbo) override
+    {
+        auto* impl = static_cast<FrameBufferImpl*>(fbo);
+        if (impl == mCurrentFrameBuffer)
+            return true;
+
+        // the default frame buffer isn't necessarily 0, for example
+        // Qt renders the widget contents into an FBO of its own.
+        // so remember what was bound when we leave the default target.
+        if (mCurrentFrameBuffer == nullptr)
+        {
+            GLint current = 0;
+            GL_CALL(glGetIntegerv(GL_FRAMEBUFFER_BINDING, &current));
+            mDefaultFrameBuffer = current;
+        }
+
+        if (impl)
+        {
+            // if the frame buffer (re)creates its color texture that
+            // texture could still be cached as bound to some unit.
+            for (auto& unit : mTextureUnits)
+            {
+                if (unit.texture == impl->GetColorTextureImpl())
+                    unit.texture = nullptr;
+            }
+            if (!impl->Bind())
+            {
+                GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, mDefaultFrameBuffer));
+                mCurrentFrameBuffer = nullptr;
+                return false;
+            }
+        }
+        else
+        {
+            GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, mDefaultFrameBuffer));
+        }
+        mCurrentFrameBuffer = impl;
+        return true;
+    }
 
     virtual void Draw(const Program& program, const Geometry& geometry, const State& state) override
     {
@@ -440,61 +798,55 @@ public:
 
         auto* myprog = (ProgImpl*)(&program);
         auto* mygeom = (GeomImpl*)(&geometry);
-        myprog->SetLastUseFrameNumber(mFrameNumber);
+        myprog->Touch();
         myprog->SetState(mTextureUnits, default_texture_min_filter, default_texture_mag_filter);
-        mygeom->SetLastUseFrameNumber(mFrameNumber);
+        mygeom->Touch();
         mygeom->Draw(myprog->GetName());
     }
 
     virtual Type GetDeviceType() const override
     { return Type::OpenGL_ES2; }
+    virtual std::size_t GetFrameNumber() const override
+    { return mFrameNumber; }
 
-    virtual void CleanGarbage(size_t max_num_idle_frames) override
+    virtual void CleanGarbage(size_t max_num_idle_frames, unsigned max_time_us) override
     {
-        for (auto it = mPrograms.begin(); it != mPrograms.end();)
+        using clock = std::chrono::steady_clock;
+        const auto start = clock::now();
+        const auto budget = std::chrono::microseconds(max_time_us);
+
+        // walk the resource list from the least recently used end and
+        // delete resources until we find one that is still in use or the
+        // time budget has run out. Whatever is left over will be looked
+        // at again on the next call.
+        while (auto* node = mResources.GetTail())
         {
-            auto* impl = static_cast<ProgImpl*>(it->second.get());
-            const auto last_used_frame_number = impl->GetLastUsedFrameNumber();
-            if (mFrameNumber - last_used_frame_number >= max_num_idle_frames)
-                it = mPrograms.erase(it);
-            else ++it;
-        }
-
-        for (auto it = mTextures.begin(); it != mTextures.end();)
-        {
-            auto* impl = static_cast<TextureImpl*>(it->second.get());
-            const auto last_used_frame_number = impl->GetLastUsedFrameNumber();
-            const auto is_eligible = impl->IsEligibleForGarbageCollection();
-            const auto is_expired  = mFrameNumber - last_used_frame_number >= max_num_idle_frames;
-            if (is_eligible && is_expired)
-            {
-                size_t unit = 0;
-                for (unit=0; unit<mTextureUnits.size(); ++unit)
-                {
-                    if (mTextureUnits[unit].texture == impl)
-                    {
-                        mTextureUnits[unit].texture = nullptr;
-                        break;
-                    }
-                }
-                // delete the texture
-                it = mTextures.erase(it);
-            }
-            else ++it;
+            if (mFrameNumber - node->GetLastUsedFrameNumber() < max_num_idle_frames)
+                break;
+            if (max_time_us && clock::now() - start >= budget)
+                break;
+            DeleteResource(node);
         }
     }
 
+    virtual FrameStats GetFrameStats() const override
+    { return mStats; }
+    virtual void ResetFrameStats() override
+    { mStats = FrameStats(); }
+
     virtual void BeginFrame() override
     {
-        for (auto& pair : mPrograms)
-        {
-            auto* impl = static_cast<ProgImpl*>(pair.second.get());
+        mStats = FrameStats();
+        // only the programs that have had textures set on them need
+        // their state reset.
+        for (auto* impl : mTexturedPrograms)
             impl->BeginFrame();
-        }
+        mTexturedPrograms.clear();
     }
     virtual void EndFrame(bool display) override
     {
         mFrameNumber++;
+        mResources.SetFrameNumber(mFrameNumber);
         if (display)
             mContext->Display();
     }
@@ -522,7 +874,246 @@ public:
         return bmp;
     }
 
+    virtual unsigned ReadColorBufferAsync(unsigned x, unsigned y,
+                                          unsigned width, unsigned height) override
+    {
+        PendingRead read;
+        read.handle = ++mReadHandle;
+        read.width  = width;
+        read.height = height;
+        if (!mHavePixelBufferRead)
+        {
+            // no way to do this asynchronously so just read the pixels
+            // right away and hand them out when they're asked for.
+            read.bitmap = ReadColorBuffer(x, y, width, height);
+            mPendingReads.push_back(std::move(read));
+            return mReadHandle;
+        }
+        // read the pixels into a pixel buffer object. the read pixels
+        // call will return immediately and the transfer will complete
+        // some time later when the GPU has finished rendering. the fence
+        // will then tell us when the transfer has been done.
+        GL_CALL(glGenBuffers(1, &read.buffer));
+        GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, read.buffer));
+        GL_CALL(glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, nullptr, GL_STREAM_READ));
+        GL_CALL(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+        GL_CALL(glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr));
+        GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+        read.fence = mGL.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        mPendingReads.push_back(std::move(read));
+        return mReadHandle;
+    }
+    virtual bool PollColorBufferRead(unsigned handle, Bitmap<RGBA>* bitmap) override
+    {
+        auto it = std::find_if(mPendingReads.begin(), mPendingReads.end(),
+            [handle](const PendingRead& read) { return read.handle == handle; });
+        if (it == mPendingReads.end())
+        {
+            WARN("No such pending color buffer read %1", handle);
+            return false;
+        }
+        auto& read = *it;
+        if (read.buffer == 0)
+        {
+            *bitmap = std::move(read.bitmap);
+            mPendingReads.erase(it);
+            return true;
+        }
+        // the fence might still be sitting in the client side command
+        // queue, in which case it'd never signal. so flush on the first
+        // poll to make sure it gets submitted.
+        const GLbitfield flags = read.flushed ? 0 : GL_SYNC_FLUSH_COMMANDS_BIT;
+        read.flushed = true;
+        const auto status = mGL.glClientWaitSync(read.fence, flags, 0);
+        if (status == GL_TIMEOUT_EXPIRED)
+            return false;
+        else if (status == GL_WAIT_FAILED)
+            WARN("Color buffer read fence wait failed.");
+
+        Bitmap<RGBA> bmp(read.width, read.height);
+        const auto bytes = read.width * read.height * 4;
+        GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, read.buffer));
+        if (const void* ptr = mGL.glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT))
+        {
+            std::memcpy((void*)bmp.GetDataPtr(), ptr, bytes);
+            mGL.glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        else
+        {
+            ERROR("Failed to map pixel buffer for reading.");
+        }
+        GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+        bmp.FlipHorizontally();
+        *bitmap = std::move(bmp);
+
+        DeletePendingRead(read);
+        mPendingReads.erase(it);
+        return true;
+    }
+
+    virtual unsigned BeginTimer() override
+    {
+        PendingTimer timer;
+        timer.handle = ++mTimerHandle;
+        if (mHaveTimerQueries)
+        {
+            mGL.glGenQueriesEXT(1, &timer.query);
+            GL_CALL(glBeginQueryEXT(GL_TIME_ELAPSED_EXT, timer.query));
+        }
+        else
+        {
+            // wait for the previous work to finish so that only
+            // the work issued after this gets measured.
+            WaitForGpu();
+            timer.start = std::chrono::steady_clock::now();
+        }
+        mPendingTimers.push_back(timer);
+        return mTimerHandle;
+    }
+    virtual void EndTimer(unsigned handle) override
+    {
+        auto it = std::find_if(mPendingTimers.begin(), mPendingTimers.end(),
+            [handle](const PendingTimer& timer) { return timer.handle == handle; });
+        if (it == mPendingTimers.end())
+        {
+            WARN("No such timer %1", handle);
+            return;
+        }
+        auto& timer = *it;
+        if (timer.query)
+        {
+            GL_CALL(glEndQueryEXT(GL_TIME_ELAPSED_EXT));
+        }
+        else
+        {
+            WaitForGpu();
+            const auto end = std::chrono::steady_clock::now();
+            timer.seconds = std::chrono::duration<double>(end - timer.start).count();
+        }
+        timer.ended = true;
+    }
+    virtual bool PollTimer(unsigned handle, double* seconds) override
+    {
+        auto it = std::find_if(mPendingTimers.begin(), mPendingTimers.end(),
+            [handle](const PendingTimer& timer) { return timer.handle == handle; });
+        if (it == mPendingTimers.end())
+        {
+            WARN("No such timer %1", handle);
+            return false;
+        }
+        auto& timer = *it;
+        if (!timer.ended)
+            return false;
+
+        if (timer.query)
+        {
+            GLuint available = 0;
+            mGL.glGetQueryObjectuivEXT(timer.query, GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+            if (!available)
+                return false;
+            // if something happened that made the GPU timings unreliable
+            // (such as the GPU changing its clock) the result is garbage.
+            GLint disjoint = 0;
+            GL_CALL(glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint));
+            uint64_t nanos = 0;
+            mGL.glGetQueryObjectui64vEXT(timer.query, GL_QUERY_RESULT_EXT, &nanos);
+            mGL.glDeleteQueriesEXT(1, &timer.query);
+            timer.seconds = disjoint ? -1.0 : nanos / 1000000000.0;
+        }
+        *seconds = timer.seconds;
+        mPendingTimers.erase(it);
+        return true;
+    }
+
 private:
+    void WaitForGpu()
+    {
+        if (mHaveFences)
+        {
+            auto fence = mGL.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            const auto status = mGL.glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+            if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+                WARN("GPU fence wait failed.");
+            mGL.glDeleteSync(fence);
+        }
+        else
+        {
+            GL_CALL(glFinish());
+        }
+    }
+
+    void DeleteResource(ResourceNode* node)
+    {
+        // unlink first so that the node is removed from the list
+        // even if the map has somehow lost track of the resource.
+        mResources.Unlink(node);
+        const auto& name = node->GetResourceName();
+        const auto kind  = node->GetResourceKind();
+        if (kind == ResourceNode::Kind::Program)
+            EraseResource(mPrograms, name, static_cast<ProgImpl*>(node));
+        else if (kind == ResourceNode::Kind::Geometry)
+            EraseResource(mGeoms, name, static_cast<GeomImpl*>(node));
+        else if (kind == ResourceNode::Kind::Shader)
+            EraseResource(mShaders, name, static_cast<ShaderImpl*>(node));
+        else if (kind == ResourceNode::Kind::Texture)
+        {
+            auto* impl = static_cast<TextureImpl*>(node);
+            for (auto& unit : mTextureUnits)
+            {
+                if (unit.texture == impl)
+                    unit.texture = nullptr;
+            }
+            EraseResource(mTextures, name, impl);
+        }
+    }
+    template<typename Impl, typename Map>
+    void DeleteNamedResource(Map& map, const std::string& name)
+    {
+        auto it = map.find(name);
+        if (it == map.end())
+            return;
+        DeleteResource(static_cast<Impl*>(it->second.get()));
+    }
+    template<typename Map, typename Resource>
+    static void EraseResource(Map& map, const std::string& name, const Resource* resource)
+    {
+        auto it = map.find(name);
+        if (it == map.end() || it->second.get() != resource)
+            return;
+        map.erase(it);
+    }
+
+    struct PendingRead {
+        unsigned handle = 0;
+        unsigned width  = 0;
+        unsigned height = 0;
+        // the pixel buffer object and the fence for async transfer.
+        GLuint buffer = 0;
+        GLsyncObject fence = nullptr;
+        // whether the commands up to the fence have been flushed.
+        bool flushed = false;
+        // the synchronously read pixels when the async read isn't available.
+        Bitmap<RGBA> bitmap;
+    };
+    struct PendingTimer {
+        unsigned handle = 0;
+        // the timer query object when using the GPU timers.
+        GLuint query = 0;
+        // the CPU side start time when using the fallback.
+        std::chrono::steady_clock::time_point start;
+        double seconds = 0.0;
+        bool ended = false;
+    };
+    void DeletePendingRead(PendingRead& read)
+    {
+        if (read.fence)
+            mGL.glDeleteSync(read.fence);
+        if (read.buffer)
+            GL_CALL(glDeleteBuffers(1, &read.buffer));
+        read.fence  = nullptr;
+        read.buffer = 0;
+    }
+
     bool EnableIf(GLenum flag, bool on_off)
     {
         if (on_off)
@@ -656,18 +1247,25 @@ private:
 
     using TextureUnits = std::vector<TextureUnit>;
 
-    class TextureImpl : public Texture
+    class TextureImpl : public Texture, public ResourceNode
     {
     public:
-        TextureImpl(const OpenGLFunctions& funcs) : mGL(funcs)
+        TextureImpl(const OpenGLFunctions& funcs, ResourceList& list, TextureUnits& units, FrameStats& stats)
+          : ResourceNode(list, ResourceNode::Kind::Texture)
+          , mList(list)
+          , mGL(funcs)
+          , mUnits(units)
+          , mStats(stats)
         {
             GL_CALL(glGenTextures(1, &mName));
             DEBUG("New texture object %1 name = %2", (void*)this, mName);
+            mStats.resources_created++;
         }
         ~TextureImpl()
         {
             GL_CALL(glDeleteTextures(1, &mName));
             DEBUG("Deleted texture %1", mName);
+            mStats.resources_destroyed++;
         }
 
         virtual void Upload(const void* bytes, unsigned xres, unsigned yres, Format format) override
@@ -695,36 +1293,99 @@ private:
             }
 
             GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
-            GL_CALL(glActiveTexture(GL_TEXTURE0));
+            Bind();
+            if (bytes)
+                mStats.buffer_upload_bytes += xres * yres * GetBytesPerPixel(format);
+
+            // if the texture shape doesn't change we can just replace
+            // the contents of the existing storage instead of having
+            // the driver reallocate (and possibly orphan) it.
+            if (bytes && xres == mWidth && yres == mHeight && format == mFormat)
+            {
+                GL_CALL(glTexSubImage2D(GL_TEXTURE_2D,
+                    0, // mip level
+                    0, 0, // x, y offset
+                    xres,
+                    yres,
+                    baseFormat,
+                    GL_UNSIGNED_BYTE,
+                    bytes));
+            }
+            else
+            {
+                GL_CALL(glTexImage2D(GL_TEXTURE_2D,
+                    0, // mip level
+                    sizeFormat,
+                    xres,
+                    yres,
+                    0, // border must be 0
+                    baseFormat,
+                    GL_UNSIGNED_BYTE,
+                    bytes));
+            }
+            // the mips are generated lazily when the texture is actually
+            // sampled with a mipmapping filter. See ProgImpl::SetState
+            mMipsDirty = true;
+            mWidth  = xres;
+            mHeight = yres;
+            mFormat = format;
+        }
+        virtual void UploadSubRect(const void* bytes, unsigned x, unsigned y,
+                                   unsigned width, unsigned height) override
+        {
+            ASSERT(x + width <= mWidth && y + height <= mHeight);
 
-            // In order to upload the texture data we must bind the texture
-            // to a texture unit. we must make sure not to overwrite any other
-            // texture objects that might be bound to the unit. for example
-            // if the rendering code is running a loop where it's first creating
-            // texture objects if they don't exist and then setting them to a
-            // sampler (which will do a bind). Then going another iteration of this
-            // loop would overwrite the texture from before. Oooops!
-            GLint current_texture = 0;
-            GL_CALL(glGetIntegerv(GL_TEXTURE_BINDING_2D, &current_texture));
-            // bind our texture here.
-            GL_CALL(glBindTexture(GL_TEXTURE_2D, mName));
-            GL_CALL(glTexImage2D(GL_TEXTURE_2D,
+            GLenum baseFormat = GL_NONE;
+            switch (mFormat)
+            {
+                case Format::RGB:       baseFormat = GL_RGB;   break;
+                case Format::RGBA:      baseFormat = GL_RGBA;  break;
+                case Format::Grayscale: baseFormat = GL_ALPHA; break;
+                default: assert(!"unknown texture format."); break;
+            }
+            GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+            Bind();
+            mStats.buffer_upload_bytes += width * height * GetBytesPerPixel(mFormat);
+            GL_CALL(glTexSubImage2D(GL_TEXTURE_2D,
                 0, // mip level
-                sizeFormat,
-                xres,
-                yres,
-                0, // border must be 0
+                x, y,
+                width,
+                height,
                 baseFormat,
                 GL_UNSIGNED_BYTE,
                 bytes));
-            GL_CALL(glGenerateMipmap(GL_TEXTURE_2D));
+            mMipsDirty = true;
+        }
+        virtual void SetMipmapPolicy(MipmapPolicy policy) override
+        { mMipmaps = policy; }
+        virtual MipmapPolicy GetMipmapPolicy() const override
+        { return mMipmaps; }
+
+        // Allocate the texture storage without any contents and
+        // without mips. Used for render target textures.
+        void Allocate(unsigned xres, unsigned yres)
+        {
+            Bind();
+            GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, xres, yres, 0,
+                GL_RGBA, GL_UNSIGNED_BYTE, nullptr));
             mWidth  = xres;
             mHeight = yres;
-            mFormat = format;
+            mFormat = Format::RGBA;
+            mMipmaps = MipmapPolicy::Never;
+        }
 
-            // restore previous texture.
-            GL_CALL(glBindTexture(GL_TEXTURE_2D, current_texture));
+        // Generate the mips if they're needed. The texture must
+        // be bound to the currently active texture unit.
+        void GenerateMips() const
+        {
+            if (!mMipsDirty || mMipmaps == MipmapPolicy::Never)
+                return;
+            GL_CALL(glGenerateMipmap(GL_TEXTURE_2D));
+            mStats.texture_mip_generations++;
+            mMipsDirty = false;
         }
+        bool HasDirtyMips() const
+        { return mMipsDirty && mMipmaps != MipmapPolicy::Never; }
 
         // refer actual state setting to the point when
         // when the texture is actually used in a program's
@@ -753,23 +1414,53 @@ private:
         virtual Texture::Format GetFormat() const override
         { return mFormat; }
         virtual void EnableGarbageCollection(bool gc) override
-        { mEnableGC = gc; }
+        {
+            mEnableGC = gc;
+            if (gc)
+                mList.Link(this);
+            else mList.Unlink(this);
+        }
 
         // internal
         GLuint GetName() const
         { return mName; }
 
-        void SetLastUseFrameNumber(size_t frame_number)
-        { mFrameNumber = frame_number; }
-
-        size_t GetLastUsedFrameNumber() const
-        { return mFrameNumber; }
-
         bool IsEligibleForGarbageCollection() const
         { return mEnableGC; }
-
     private:
+        static unsigned GetBytesPerPixel(Format format)
+        {
+            if (format == Format::RGB)
+                return 3;
+            else if (format == Format::RGBA)
+                return 4;
+            return 1;
+        }
+        // In order to upload the texture data we must bind the texture
+        // to a texture unit. Previously the current binding was queried
+        // and restored after the upload but glGet calls can stall the
+        // pipeline. Instead bind to unit 0 and update the device's cached
+        // unit state so that the next draw using unit 0 will rebind its
+        // texture and reapply its sampler state.
+        void Bind()
+        {
+            GL_CALL(glActiveTexture(GL_TEXTURE0));
+            GL_CALL(glBindTexture(GL_TEXTURE_2D, mName));
+            mStats.texture_binds++;
+            if (mUnits.empty())
+                return;
+            auto& unit = mUnits[0];
+            unit.texture    = this;
+            unit.min_filter = GL_NONE;
+            unit.mag_filter = GL_NONE;
+            unit.wrap_x     = GL_NONE;
+            unit.wrap_y     = GL_NONE;
+        }
+    private:
+        ResourceList& mList;
         const OpenGLFunctions& mGL;
+        TextureUnits& mUnits;
+        FrameStats& mStats;
 
         GLuint mName = 0;
     private:
@@ -777,19 +1468,142 @@ private:
         MagFilter mMagFilter = MagFilter::Default;
         Wrapping mWrapX = Wrapping::Repeat;
         Wrapping mWrapY = Wrapping::Repeat;
+        MipmapPolicy mMipmaps = MipmapPolicy::OnDemand;
     private:
         unsigned mWidth  = 0;
         unsigned mHeight = 0;
         Format mFormat = Texture::Format::Grayscale;
-        std::size_t mFrameNumber = 0;
         bool mEnableGC = false;
+        // true when the contents have changed since the
+        // last time the mips were generated.
+        mutable bool mMipsDirty = false;
     };
 
-    class GeomImpl : public Geometry
+    class FrameBufferImpl : public FrameBuffer
     {
     public:
-        GeomImpl(const OpenGLFunctions& funcs) : mGL(funcs)
+        FrameBufferImpl(const OpenGLFunctions& funcs, ResourceList& list, TextureUnits& units, FrameStats& stats)
+          : mGL(funcs)
+          , mList(list)
+          , mUnits(units)
+          , mStats(stats)
         {}
+       ~FrameBufferImpl()
+        {
+            Destroy();
+        }
+        virtual void SetConfig(const Config& config) override
+        {
+            if (config.width == mConfig.width &&
+                config.height == mConfig.height &&
+                config.stencil == mConfig.stencil)
+                return;
+            mConfig = config;
+            mDirty  = true;
+        }
+        virtual const Config& GetConfig() const override
+        { return mConfig; }
+        virtual Texture* GetColorTexture() override
+        { return mTexture.get(); }
+        virtual bool IsValid() const override
+        { return mHandle != 0; }
+
+        const TextureImpl* GetColorTextureImpl() const
+        { return mTexture.get(); }
+
+        bool Bind()
+        {
+            if (mDirty)
+            {
+                Create();
+                mDirty = false;
+            }
+            if (!mHandle)
+                return false;
+            GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, mHandle));
+            return true;
+        }
+    private:
+        void Create()
+        {
+            Destroy();
+            if (!mConfig.width || !mConfig.height)
+            {
+                ERROR("Invalid frame buffer size %1x%2", mConfig.width, mConfig.height);
+                return;
+            }
+            // the color texture is recreated as well since the texture
+            // units might still have the old one cached.
+            mTexture = std::make_unique<TextureImpl>(mGL, mList, mUnits, mStats);
+            mTexture->Allocate(mConfig.width, mConfig.height);
+            mTexture->SetFilter(Texture::MinFilter::Linear);
+            mTexture->SetFilter(Texture::MagFilter::Linear);
+            mTexture->SetWrapX(Texture::Wrapping::Clamp);
+            mTexture->SetWrapY(Texture::Wrapping::Clamp);
+
+            GL_CALL(glGenFramebuffers(1, &mHandle));
+            GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, mHandle));
+            mStats.resources_created++;
+            GL_CALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                GL_TEXTURE_2D, mTexture->GetName(), 0));
+            if (mConfig.stencil)
+            {
+                GL_CALL(glGenRenderbuffers(1, &mStencil));
+                GL_CALL(glBindRenderbuffer(GL_RENDERBUFFER, mStencil));
+                GL_CALL(glRenderbufferStorage(GL_RENDERBUFFER, GL_STENCIL_INDEX8,
+                    mConfig.width, mConfig.height));
+                GL_CALL(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT,
+                    GL_RENDERBUFFER, mStencil));
+            }
+            const auto status = mGL.glCheckFramebufferStatus(GL_FRAMEBUFFER);
+            if (status != GL_FRAMEBUFFER_COMPLETE)
+            {
+                ERROR("Frame buffer is not complete (%1)", GLEnumToStr(status));
+                Destroy();
+                return;
+            }
+            DEBUG("New frame buffer %1 %2x%3 px", mHandle, mConfig.width, mConfig.height);
+        }
+        void Destroy()
+        {
+            if (mStencil)
+                GL_CALL(glDeleteRenderbuffers(1, &mStencil));
+            if (mHandle)
+            {
+                GL_CALL(glDeleteFramebuffers(1, &mHandle));
+                mStats.resources_destroyed++;
+            }
+            mStencil = 0;
+            mHandle  = 0;
+        }
+    private:
+        const OpenGLFunctions& mGL;
+        // the color texture is never garbage collected but it
+        // still needs a list.
+        ResourceList& mList;
+        TextureUnits& mUnits;
+        FrameStats& mStats;
+        GLuint mHandle  = 0;
+        GLuint mStencil = 0;
+        Config mConfig;
+        bool mDirty = true;
+        std::unique_ptr<TextureImpl> mTexture;
+    };
+
+    class GeomImpl : public Geometry, public ResourceNode
+    {
+    public:
+        GeomImpl(const OpenGLFunctions& funcs, ResourceList& list, FrameStats& stats)
+          : ResourceNode(list, ResourceNode::Kind::Geometry)
+          , mGL(funcs)
+          , mStats(stats)
+        {
+            mStats.resources_created++;
+        }
+       ~GeomImpl()
+        {
+            mStats.resources_destroyed++;
+        }
         virtual void ClearDraws() override
         {
             mDrawCommands.clear();
@@ -821,6 +1635,9 @@ private:
             ASSERT(mBuffer);
             if (!mBuffer->GetCount())
                 return;
+            // the vertex data is in client side arrays so the
+            // whole buffer is transferred again on every draw.
+            mStats.buffer_upload_bytes += mBuffer->GetCount() * mLayout.vertex_struct_size;
             for (const auto& attr : mLayout.attributes)
             {
                 const uint8_t* base = reinterpret_cast<const uint8_t*>(mBuffer->GetRawPtr());
@@ -844,15 +1661,16 @@ private:
                     GL_CALL(glDrawArrays(GL_POINTS, offset, count));
                 else if (type == DrawType::TriangleFan)
                     GL_CALL(glDrawArrays(GL_TRIANGLE_FAN, offset, count));
+                else if (type == DrawType::TriangleStrip)
+                    GL_CALL(glDrawArrays(GL_TRIANGLE_STRIP, offset, count));
                 else if (type == DrawType::Lines)
                     GL_CALL(glDrawArrays(GL_LINES, offset, count));
                 else if (type == DrawType::LineLoop)
                     GL_CALL(glDrawArrays(GL_LINE_LOOP, offset, count));
+                mStats.draw_calls++;
+                mStats.vertices += count;
             }
         }
-        void SetLastUseFrameNumber(size_t frame_number)
-        { mFrameNumber = frame_number; }
-
     private:
         struct DrawCommand {
             DrawType type = DrawType::Triangles;
@@ -861,25 +1679,37 @@ private:
         };
     private:
         const OpenGLFunctions& mGL;
-        std::size_t mFrameNumber = 0;
+        FrameStats& mStats;
         std::vector<DrawCommand> mDrawCommands;
         std::unique_ptr<VertexBuffer> mBuffer;
         VertexLayout mLayout;
     };
 
-    class ProgImpl : public Program
+    class ProgImpl : public Program, public ResourceNode
     {
     public:
-        ProgImpl(const OpenGLFunctions& funcs) : mGL(funcs)
-        {}
+        ProgImpl(const OpenGLFunctions& funcs, ResourceList& list, std::vector<ProgImpl*>& textured, FrameStats& stats)
+          : ResourceNode(list, ResourceNode::Kind::Program)
+          , mGL(funcs)
+          , mTexturedPrograms(textured)
+          , mStats(stats)
+        {
+            mStats.resources_created++;
+        }
 
        ~ProgImpl()
         {
+            if (mHasTextures)
+            {
+                mTexturedPrograms.erase(std::find(mTexturedPrograms.begin(),
+                                                  mTexturedPrograms.end(), this));
+            }
             if (mProgram)
             {
                 GL_CALL(glDeleteProgram(mProgram));
                 DEBUG("Delete program %1", mProgram);
             }
+            mStats.resources_destroyed++;
         }
         virtual bool Build(const std::vector<const Shader*>& shaders) override
         {
@@ -889,6 +1719,9 @@ private:
             for (const auto* shader : shaders)
             {
                 ASSERT(shader->IsValid());
+                // keep the shaders alive in the resource list for as
+                // long as they're being used to build programs.
+                const_cast<ShaderImpl*>(static_cast<const ShaderImpl*>(shader))->Touch();
                 GL_CALL(glAttachShader(prog,
                     static_cast<const ShaderImpl*>(shader)->GetName()));
             }
@@ -940,7 +1773,10 @@ private:
                 GL_CALL(glUseProgram(mProgram));
                 GL_CALL(glUniform1i(ret.location, x));
                 ret.hash = hash;
+                mStats.program_binds++;
+                mStats.uniform_uploads++;
             }
+            else mStats.uniform_skips++;
         }
         virtual void SetUniform(const char* name, int x, int y) override
         {
@@ -956,7 +1792,10 @@ private:
                 GL_CALL(glUseProgram(mProgram));
                 GL_CALL(glUniform2i(ret.location, x, y));
                 ret.hash = hash;
+                mStats.program_binds++;
+                mStats.uniform_uploads++;
             }
+            else mStats.uniform_skips++;
         }
 
         virtual void SetUniform(const char* name, float x) override
@@ -971,7 +1810,10 @@ private:
                 GL_CALL(glUseProgram(mProgram));
                 GL_CALL(glUniform1f(ret.location, x));
                 ret.hash = hash;
+                mStats.program_binds++;
+                mStats.uniform_uploads++;
             }
+            else mStats.uniform_skips++;
         }
         virtual void SetUniform(const char* name, float x, float y) override
         {
@@ -987,7 +1829,10 @@ private:
                 GL_CALL(glUseProgram(mProgram));
                 GL_CALL(glUniform2f(ret.location, x, y));
                 ret.hash = hash;
+                mStats.program_binds++;
+                mStats.uniform_uploads++;
             }
+            else mStats.uniform_skips++;
         }
         virtual void SetUniform(const char* name, float x, float y, float z) override
         {
@@ -1004,7 +1849,10 @@ private:
                 GL_CALL(glUseProgram(mProgram));
                 GL_CALL(glUniform3f(ret.location, x, y, z));
                 ret.hash = hash;
+                mStats.program_binds++;
+                mStats.uniform_uploads++;
             }
+            else mStats.uniform_skips++;
         }
         virtual void SetUniform(const char* name, float x, float y, float z, float w) override
         {
@@ -1022,7 +1870,10 @@ private:
                 GL_CALL(glUseProgram(mProgram));
                 GL_CALL(glUniform4f(ret.location, x, y, z, w));
                 ret.hash = hash;
+                mStats.program_binds++;
+                mStats.uniform_uploads++;
             }
+            else mStats.uniform_skips++;
         }
         virtual void SetUniform(const char* name, const Color4f& color) override
         {
@@ -1035,7 +1886,10 @@ private:
                 GL_CALL(glUseProgram(mProgram));
                 GL_CALL(glUniform4f(ret.location, color.Red(), color.Green(), color.Blue(), color.Alpha()));
                 ret.hash = hash;
+                mStats.program_binds++;
+                mStats.uniform_uploads++;
             }
+            else mStats.uniform_skips++;
         }
         virtual void SetUniform(const char* name, const Matrix2x2& matrix) override
         {
@@ -1053,7 +1907,10 @@ private:
                 GL_CALL(glUseProgram(mProgram));
                 GL_CALL(glUniformMatrix2fv(ret.location, 1, GL_FALSE /* transpose */, (const float*)&matrix));
                 ret.hash = hash;
+                mStats.program_binds++;
+                mStats.uniform_uploads++;
             }
+            else mStats.uniform_skips++;
         }
         virtual void SetUniform(const char* name, const Matrix3x3& matrix) override
         {
@@ -1072,7 +1929,10 @@ private:
                 GL_CALL(glUseProgram(mProgram));
                 GL_CALL(glUniformMatrix3fv(ret.location, 1, GL_FALSE /*transpose*/, (const float*)&matrix));
                 ret.hash = hash;
+                mStats.program_binds++;
+                mStats.uniform_uploads++;
             }
+            else mStats.uniform_skips++;
         }
         virtual void SetUniform(const char* name, const Matrix4x4& matrix) override
         {
@@ -1091,7 +1951,10 @@ private:
                 GL_CALL(glUseProgram(mProgram));
                 GL_CALL(glUniformMatrix4fv(ret.location, 1, GL_FALSE /*transpose*/, (const float*)&matrix));
                 ret.hash = hash;
+                mStats.program_binds++;
+                mStats.uniform_uploads++;
             }
+            else mStats.uniform_skips++;
         }
 
         virtual void SetTexture(const char* sampler, unsigned unit, const Texture& texture) override
@@ -1148,6 +2011,13 @@ private:
             // texture binds.
             mTextures[unit].texture  = const_cast<TextureImpl*>(impl);
             mTextures[unit].location = ret.location;
+            // let the device know that this program needs its texture
+            // state reset on the next frame.
+            if (!mHasTextures)
+            {
+                mTexturedPrograms.push_back(this);
+                mHasTextures = true;
+            }
         }
         virtual void SetTextureCount(unsigned count) override
         {
@@ -1158,6 +2028,7 @@ private:
             GLenum default_texture_min_filter, GLenum default_texture_mag_filter) //const
         {
             GL_CALL(glUseProgram(mProgram));
+            mStats.program_binds++;
 
             size_t num_textures = mTextures.size();
             if (num_textures > units.size())
@@ -1253,10 +2124,20 @@ private:
                 ASSERT(texture_min_filter != GL_NONE);
                 ASSERT(texture_mag_filter != GL_NONE);
 
+                const bool mip_filter = texture_min_filter == GL_NEAREST_MIPMAP_NEAREST ||
+                                        texture_min_filter == GL_NEAREST_MIPMAP_LINEAR ||
+                                        texture_min_filter == GL_LINEAR_MIPMAP_NEAREST ||
+                                        texture_min_filter == GL_LINEAR_MIPMAP_LINEAR;
+                // a texture without mips can't be sampled with a mip filter.
+                if (mip_filter && texture->GetMipmapPolicy() == Texture::MipmapPolicy::Never)
+                    texture_min_filter = GL_LINEAR;
+                const bool generate_mips = mip_filter && texture->HasDirtyMips();
+
                 const GLenum texture_wrap_x = texture->GetWrapX() == Texture::Wrapping::Clamp ? GL_CLAMP_TO_EDGE : GL_REPEAT;
                 const GLenum texture_wrap_y = texture->GetWrapY() == Texture::Wrapping::Clamp ? GL_CLAMP_TO_EDGE : GL_REPEAT;
                 // if nothing has changed then skip all of the work
                 if (units[unit].texture    == texture &&
+                    !generate_mips &&
                     units[unit].min_filter == texture_min_filter &&
                     units[unit].mag_filter == texture_mag_filter &&
                     units[unit].wrap_x     == texture_wrap_x &&
@@ -1264,6 +2145,7 @@ private:
                 {
                     // set the texture unit to the sampler
                     GL_CALL(glUniform1i(mTextures[i].location, unit));
+                    mStats.uniform_uploads++;
                     continue;
                 }
 
@@ -1275,6 +2157,10 @@ private:
                 GL_CALL(glActiveTexture(GL_TEXTURE0 + unit));
                 // bind the 2D texture.
                 GL_CALL(glBindTexture(GL_TEXTURE_2D, texture_name));
+                mStats.texture_binds++;
+                // generate the mips now that we know they're actually needed.
+                if (generate_mips)
+                    texture->GenerateMips();
                 // set texture parameters, wrapping and min/mag filters.
                 GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, texture_wrap_x));
                 GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, texture_wrap_y));
@@ -1282,6 +2168,7 @@ private:
                 GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, texture_min_filter));
                 // set the texture unit to the sampler
                 GL_CALL(glUniform1i(mTextures[i].location, unit));
+                mStats.uniform_uploads++;
 
                 // store current binding and the sampler state.
                 units[unit].texture    = texture;
@@ -1294,9 +2181,9 @@ private:
         GLuint GetName() const
         { return mProgram; }
 
-        void SetLastUseFrameNumber(size_t frame_number)
+        void Touch()
         {
-            mFrameNumber = frame_number;
+            ResourceNode::Touch();
             for (auto& it : mTextures)
             {
                 // shader compiler optimized texture that isn't used.
@@ -1305,7 +2192,7 @@ private:
                 // which the glUniformLocation returns -1
                 if (!it.texture)
                     continue;
-                it.texture->SetLastUseFrameNumber(frame_number);
+                it.texture->Touch();
             }
         }
         void BeginFrame()
@@ -1317,9 +2204,8 @@ private:
             // However doing this clear means that the program cannot be
             // used across frame's without having it's state reset.
             mTextures.clear();
+            mHasTextures = false;
         }
-        size_t GetLastUsedFrameNumber() const
-        { return mFrameNumber; }
 
     private:
         struct Uniform {
@@ -1350,14 +2236,21 @@ private:
             TextureImpl* texture = nullptr;
         };
         std::vector<Sampler> mTextures;
-        std::size_t mFrameNumber = 0;
+        std::vector<ProgImpl*>& mTexturedPrograms;
+        FrameStats& mStats;
+        bool mHasTextures = false;
     };
 
-    class ShaderImpl : public Shader
+    class ShaderImpl : public Shader, public ResourceNode
     {
     public:
-        ShaderImpl(const OpenGLFunctions& funcs) : mGL(funcs)
-        {}
+        ShaderImpl(const OpenGLFunctions& funcs, ResourceList& list, FrameStats& stats)
+          : ResourceNode(list, ResourceNode::Kind::Shader)
+          , mGL(funcs)
+          , mStats(stats)
+        {
+            mStats.resources_created++;
+        }
 
        ~ShaderImpl()
         {
@@ -1365,6 +2258,7 @@ private:
             {
                 GL_CALL(glDeleteShader(mShader));
             }
+            mStats.resources_destroyed++;
         }
         virtual bool CompileFile(const std::string& URI) override
         {
@@ -1507,14 +2401,24 @@ private:
         const OpenGLFunctions& mGL;
 
     private:
+        FrameStats& mStats;
         GLuint mShader  = 0;
         GLuint mVersion = 0;
     };
 private:
+    // the LRU list of resources that can be garbage collected. this
+    // must outlive the resources since they unlink themselves on delete.
+    ResourceList mResources;
+    // the current frame statistics. also shared with the resources
+    // so this must outlive them.
+    FrameStats mStats;
+    // programs that have texture state that needs to be reset.
+    std::vector<ProgImpl*> mTexturedPrograms;
     std::map<std::string, std::unique_ptr<Geometry>> mGeoms;
     std::map<std::string, std::unique_ptr<Shader>> mShaders;
     std::map<std::string, std::unique_ptr<Program>> mPrograms;
     std::map<std::string, std::unique_ptr<Texture>> mTextures;
+    std::map<std::string, std::unique_ptr<FrameBuffer>> mFrameBuffers;
     std::shared_ptr<Context> mContextImpl;
     Context* mContext = nullptr;
     std::size_t mFrameNumber = 0;
@@ -1523,6 +2427,17 @@ private:
     MagFilter mDefaultMagTextureFilter = MagFilter::Nearest;
     // texture units and their current settings.
     TextureUnits mTextureUnits;
+    // the currently bound render target or nullptr for the default.
+    FrameBufferImpl* mCurrentFrameBuffer = nullptr;
+    GLuint mDefaultFrameBuffer = 0;
+    // pending asynchronous color buffer reads.
+    std::vector<PendingRead> mPendingReads;
+    unsigned mReadHandle = 0;
+    bool mHavePixelBufferRead = false;
+    bool mHaveFences = false;
+    std::vector<PendingTimer> mPendingTimers;
+    unsigned mTimerHandle = 0;
+    bool mHaveTimerQueries = false;
 };
 
 // static
@@ -23,12 +23,16 @@
 
 #include <string>
 #include <map>
+#include <algorithm>
 #include <stdexcept>
 #include <fstream>
+#include <limits>
+#include <cstdint>
 
 #include "base/assert.h"
 #include "base/logging.h"
 #include "graphics/device.h"
+#include "graphics/framebuffer.h"
 #include "graphics/shader.h"
 #include "graphics/program.h"
 #include "graphics/geometry.h"
@@ -47,9 +51,11 @@ public:
     StandardPainter(std::shared_ptr<Device> device)
       : mDeviceInst(device)
       , mDevice(device.get())
+      , mMaskMaterial(CreateMaterialFromColor(gfx::Color::White))
     {}
     StandardPainter(Device* device)
       : mDevice(device)
+      , mMaskMaterial(CreateMaterialFromColor(gfx::Color::White))
     {}
     virtual void SetPixelRatio(const glm::vec2& ratio) override
     {
@@ -59,6 +65,14 @@ public:
     {
         mSurfacesize = ISize((int)width, (int)height);
     }
+    virtual void SetRenderTarget(FrameBuffer* target) override
+    {
+        mRenderTarget = target;
+    }
+    virtual FrameBuffer* GetRenderTarget() const override
+    {
+        return mRenderTarget;
+    }
     virtual void SetViewport(int x, int y, unsigned width, unsigned height) override
     {
         mViewport = IRect(x, y, width, height);
@@ -81,11 +95,15 @@ public:
     }
     virtual void Clear(const Color4f& color) override
     {
+        if (!BindRenderTarget())
+            return;
         mDevice->ClearColor(color);
     }
 
     virtual void Draw(const Drawable& shape, const Transform& transform, const Material& mat) override
     {
+        if (!BindRenderTarget())
+            return;
         // create simple orthographic projection matrix.
         // 0,0 is the window top left, x grows left and y grows down
         const auto& kProjMatrix = mProjection;
@@ -97,19 +115,20 @@ public:
         draw_env.proj_matrix = &kProjMatrix;
         draw_env.view_matrix = &kViewMatrix;
 
-        Geometry* geom = shape.Upload(draw_env, *mDevice);
-        Program* prog = GetProgram(shape, mat);
-        if (!prog || !geom)
-            return;
-
         Material::RasterState material_raster_state;
         Material::Environment material_env;
         material_env.render_points = style == Drawable::Style::Points;
 
+        Geometry* geom = shape.Upload(draw_env, *mDevice);
+        Program* prog = GetProgram(shape, mat, material_env);
+        if (!prog || !geom)
+            return;
+
         prog->SetUniform("kProjectionMatrix",
             *(const Program::Matrix4x4*)glm::value_ptr(kProjMatrix));
         prog->SetUniform("kViewMatrix",
             *(const Program::Matrix4x4*)glm::value_ptr(kViewMatrix));
+        prog->SetUniform("kPixelRatio", mPixelRatio);
 
         mat.ApplyDynamicState(material_env, *mDevice, *prog, material_raster_state);
 
@@ -150,20 +169,28 @@ public:
 
     virtual void Draw(const std::vector<DrawShape>& draw_list, const std::vector<MaskShape>& mask_list) override
     {
-        mDevice->ClearStencil(1);
+        if (!BindRenderTarget())
+            return;
+        // Every masked draw gets its own stencil reference value. The mask
+        // pass writes the reference value into the stencil buffer and the
+        // draw pass then draws where the stencil value is something else.
+        // Any values left behind by previous masked draws are different
+        // from the current reference value so they don't need to be
+        // cleared, only once we run out of values.
+        const auto stencil_ref = NextStencilRef();
 
         const auto& kProjMatrix = mProjection;
+        const auto& mask_material = mMaskMaterial;
 
         Device::State state;
         state.viewport      = MapToDevice(mViewport);
         state.scissor       = MapToDevice(mScissor);
         state.stencil_func  = Device::State::StencilFunc::PassAlways;
         state.stencil_dpass = Device::State::StencilOp::WriteRef;
-        state.stencil_ref   = 0;
+        state.stencil_ref   = stencil_ref;
         state.bWriteColor   = false;
         state.blending      = Device::State::BlendOp::None;
 
-        Material mask_material = CreateMaterialFromColor(gfx::Color::White);
         // do the masking pass
         for (const auto& mask : mask_list)
         {
@@ -175,7 +202,10 @@ public:
             Geometry* geom = mask.drawable->Upload(draw_env, *mDevice);
             if (geom == nullptr)
                 continue;
-            Program* prog = GetProgram(*mask.drawable, mask_material);
+            Material::RasterState material_raster_state;
+            Material::Environment material_env;
+            material_env.render_points = mask.drawable->GetStyle() == Drawable::Style::Points;
+            Program* prog = GetProgram(*mask.drawable, mask_material, material_env);
             if (prog == nullptr)
                 continue;
 
@@ -183,10 +213,8 @@ public:
                 *(const Program::Matrix4x4*)glm::value_ptr(kProjMatrix));
             prog->SetUniform("kViewMatrix",
                 *(const Program::Matrix4x4*)glm::value_ptr(kViewMatrix));
+            prog->SetUniform("kPixelRatio", mPixelRatio);
 
-            Material::RasterState material_raster_state;
-            Material::Environment material_env;
-            material_env.render_points = mask.drawable->GetStyle() == Drawable::Style::Points;
             mask_material.ApplyDynamicState(material_env, *mDevice, *prog, material_raster_state);
 
             Drawable::RasterState drawable_raster_state;
@@ -197,9 +225,9 @@ public:
             mDevice->Draw(*prog, *geom, state);
         }
 
-        state.stencil_func  = Device::State::StencilFunc::RefIsEqual;
-        state.stencil_dpass = Device::State::StencilOp::WriteRef;
-        state.stencil_ref   = 1;
+        state.stencil_func  = Device::State::StencilFunc::RefIsNotEqual;
+        state.stencil_dpass = Device::State::StencilOp::DontModify;
+        state.stencil_ref   = stencil_ref;
         state.bWriteColor   = true;
 
         // do the render pass.
@@ -213,7 +241,10 @@ public:
             Geometry* geom = draw.drawable->Upload(draw_env, *mDevice);
             if (geom == nullptr)
                 continue;
-            Program* prog = GetProgram(*draw.drawable, *draw.material);
+            Material::RasterState material_raster_state;
+            Material::Environment material_env;
+            material_env.render_points = draw.drawable->GetStyle() == Drawable::Style::Points;
+            Program* prog = GetProgram(*draw.drawable, *draw.material, material_env);
             if (prog == nullptr)
                 continue;
 
@@ -221,10 +252,7 @@ public:
                 *(const Program::Matrix4x4*)glm::value_ptr(kProjMatrix));
             prog->SetUniform("kViewMatrix",
                *(const Program::Matrix4x4*)glm::value_ptr(kViewMatrix));
-
-            Material::RasterState material_raster_state;
-            Material::Environment material_env;
-            material_env.render_points = draw.drawable->GetStyle() == Drawable::Style::Points;
+            prog->SetUniform("kPixelRatio", mPixelRatio);
 
             draw.material->ApplyDynamicState(material_env, *mDevice, *prog, material_raster_state);
             state.blending = material_raster_state.blending;
@@ -240,6 +268,8 @@ public:
 
     virtual void Draw(const std::vector<DrawShape>& shapes) override
     {
+        if (!BindRenderTarget())
+            return;
         const auto& kProjMatrix = mProjection;
 
         for (const auto& draw : shapes)
@@ -252,7 +282,10 @@ public:
             Geometry* geom = draw.drawable->Upload(draw_env, *mDevice);
             if (geom == nullptr)
                 continue;
-            Program* program = GetProgram(*draw.drawable, *draw.material);
+            Material::RasterState material_raster_state;
+            Material::Environment material_env;
+            material_env.render_points = draw.drawable->GetStyle() == Drawable::Style::Points;
+            Program* program = GetProgram(*draw.drawable, *draw.material, material_env);
             if (program == nullptr)
                 continue;
 
@@ -260,10 +293,8 @@ public:
                 *(const Program::Matrix4x4 *) glm::value_ptr(kProjMatrix));
             program->SetUniform("kViewMatrix",
                 *(const Program::Matrix4x4 *) glm::value_ptr(kViewMatrix));
+            program->SetUniform("kPixelRatio", mPixelRatio);
 
-            Material::RasterState material_raster_state;
-            Material::Environment material_env;
-            material_env.render_points = draw.drawable->GetStyle() == Drawable::Style::Points;
             draw.material->ApplyDynamicState(material_env, *mDevice, *program, material_raster_state);
 
             Drawable::RasterState drawable_raster_state;
@@ -281,17 +312,116 @@ public:
         }
     }
 
+    virtual void EnablePassTimers(bool on) override
+    {
+        // end the open pass so that the device timer doesn't keep
+        // running. the ended segments are still picked up normally.
+        if (mPassTimers && !on && !mPassStack.empty())
+        {
+            EndPassSegment();
+            mPassStack.clear();
+        }
+        mPassTimers = on;
+    }
+    virtual bool HasPassTimers() const override
+    {
+        return mPassTimers;
+    }
+    virtual void BeginPass(const std::string& name) override
+    {
+        if (!mPassTimers)
+            return;
+        // the device timers can't nest so the outer pass is
+        // suspended for the duration of the inner pass.
+        if (!mPassStack.empty())
+            EndPassSegment();
+        mPassStack.push_back(name);
+        BeginPassSegment();
+    }
+    virtual void EndPass() override
+    {
+        if (!mPassTimers || mPassStack.empty())
+            return;
+        EndPassSegment();
+        mPassStack.pop_back();
+        if (!mPassStack.empty())
+            BeginPassSegment();
+    }
+    virtual std::vector<PassTiming> GetPassTimings() override
+    {
+        for (auto it = mPassSegments.begin(); it != mPassSegments.end();)
+        {
+            double seconds = 0.0;
+            if (!it->ended || !mDevice->PollTimer(it->timer, &seconds))
+            {
+                ++it;
+                continue;
+            }
+            auto& timings = mPassFrames[it->frame];
+            auto pass = std::find_if(timings.begin(), timings.end(),
+                [&it](const PassTiming& timing) { return timing.name == it->name; });
+            if (pass == timings.end())
+            {
+                timings.push_back({it->name, 0.0});
+                pass = timings.end() - 1;
+            }
+            if (seconds < 0.0 || pass->gpu_time < 0.0)
+                pass->gpu_time = -1.0;
+            else pass->gpu_time += seconds;
+            it = mPassSegments.erase(it);
+        }
+
+        // a frame is complete once it's no longer the current frame
+        // and it has no more segments in flight.
+        const auto current = mDevice->GetFrameNumber();
+        for (auto it = mPassFrames.rbegin(); it != mPassFrames.rend(); ++it)
+        {
+            const auto frame = it->first;
+            if (frame == current)
+                continue;
+            const auto pending = std::any_of(mPassSegments.begin(), mPassSegments.end(),
+                [frame](const PassSegment& segment) { return segment.frame == frame; });
+            if (pending)
+                continue;
+            mPassTimings = std::move(it->second);
+            // discard this frame and anything older.
+            mPassFrames.erase(mPassFrames.begin(), mPassFrames.upper_bound(frame));
+            break;
+        }
+        return mPassTimings;
+    }
+
 private:
-    Program* GetProgram(const Drawable& drawable, const Material& material)
+    void BeginPassSegment()
+    {
+        PassSegment segment;
+        segment.name  = mPassStack.back();
+        segment.frame = mDevice->GetFrameNumber();
+        segment.timer = mDevice->BeginTimer();
+        // make sure the frame shows up even if it has no completed segments yet.
+        mPassFrames[segment.frame];
+        mPassSegments.push_back(std::move(segment));
+    }
+    void EndPassSegment()
     {
-        const std::string& name = drawable.GetId() + "/" + material->GetProgramId();
+        auto& segment = mPassSegments.back();
+        mDevice->EndTimer(segment.timer);
+        segment.ended = true;
+    }
+
+    Program* GetProgram(const Drawable& drawable, const Material& material, const Material::Environment& env)
+    {
+        // each used combination of material shader features gets its own
+        // specialized program variant.
+        const auto features = material.GetShaderFeatures(env);
+        const std::string& name = drawable.GetId() + "/" + material->GetVariantId(features);
         Program* prog = mDevice->FindProgram(name);
         if (!prog)
         {
             Shader* drawable_shader = drawable.GetShader(*mDevice);
             if (!drawable_shader || !drawable_shader->IsValid())
                 return nullptr;
-            Shader* material_shader = material->GetShader(*mDevice);
+            Shader* material_shader = material->GetShader(features, *mDevice);
             if (!material_shader || !material_shader->IsValid())
                 return nullptr;
 
@@ -310,20 +440,80 @@ private:
         return nullptr;
     }
 
+    // Get the next unused stencil reference value for masking. The stencil
+    // buffer is cleared only when the values run out or when the contents
+    // of the stencil buffer are unknown, i.e. on a new frame, on a new
+    // render target or when drawing outside the area cleared before.
+    // The clear is limited to the area the painter can currently draw to.
+    std::uint8_t NextStencilRef()
+    {
+        IRect region = MapToDevice(mViewport);
+        if (!mScissor.IsEmpty())
+            region = Intersect(region, MapToDevice(mScissor));
+
+        const auto frame = mDevice->GetFrameNumber();
+        const bool need_clear = frame != mStencilFrame ||
+                                mStencilTarget != mRenderTarget ||
+                                mStencilRef == 0xff ||
+                                !IsInside(region, mStencilClearRect);
+        if (need_clear)
+        {
+            // an empty region means that the viewport hasn't been set
+            // so just clear everything.
+            if (region.IsEmpty())
+                mDevice->ClearStencil(0);
+            else mDevice->ClearStencil(0, region);
+            mStencilRef       = 0;
+            mStencilFrame     = frame;
+            mStencilTarget    = mRenderTarget;
+            mStencilClearRect = region;
+        }
+        return ++mStencilRef;
+    }
+    // Check whether the inner rect is completely inside the outer rect.
+    // An empty outer rect is the whole render target.
+    static bool IsInside(const IRect& inner, const IRect& outer)
+    {
+        if (outer.IsEmpty())
+            return true;
+        if (inner.IsEmpty())
+            return false;
+        return inner.GetX() >= outer.GetX() &&
+               inner.GetY() >= outer.GetY() &&
+               inner.GetX() + inner.GetWidth() <= outer.GetX() + outer.GetWidth() &&
+               inner.GetY() + inner.GetHeight() <= outer.GetY() + outer.GetHeight();
+    }
+
+    // The device render target is shared by everyone using the
+    // device so every draw needs to make sure it's drawing into
+    // the right target.
+    bool BindRenderTarget()
+    {
+        if (mDevice->SetFrameBuffer(mRenderTarget))
+            return true;
+        WARN("Failed to set painter render target.");
+        return false;
+    }
+
     IRect MapToDevice(const IRect& rect) const
     {
         if (rect.IsEmpty())
             return rect;
+        const int target_height = mRenderTarget
+            ? (int)mRenderTarget->GetHeight()
+            : mSurfacesize.GetHeight();
         // map from window coordinates (top left origin) to device
         // coords (bottom left origin)
         const auto bottom = rect.GetY() + rect.GetHeight();
         const auto x = rect.GetX();
-        const auto y = mSurfacesize.GetHeight() - bottom;
+        const auto y = target_height - bottom;
         return IRect(x, y, rect.GetWidth(), rect.GetHeight());
     }
 private:
     std::shared_ptr<Device> mDeviceInst;
     Device* mDevice = nullptr;
+    // the current render target or nullptr for the device's default.
+    FrameBuffer* mRenderTarget = nullptr;
 private:
     // Expected Size of the rendering surface.
     ISize mSurfacesize;
@@ -342,6 +532,31 @@ private:
     // when everything that is to be drawn needs to get
     // transformed in some additional way.
     glm::mat4 mViewMatrix {1.0f};
+    // the material for drawing masks into the stencil buffer.
+    const Material mMaskMaterial;
+    // the last stencil reference value used for masking.
+    std::uint8_t mStencilRef = 0;
+    // the device frame and the render target the stencil buffer was last
+    // cleared for and the area that was cleared.
+    std::size_t mStencilFrame = std::numeric_limits<std::size_t>::max();
+    FrameBuffer* mStencilTarget = nullptr;
+    IRect mStencilClearRect;
+    // pass timing state.
+    struct PassSegment {
+        std::string name;
+        std::size_t frame = 0;
+        unsigned timer = 0;
+        bool ended = false;
+    };
+    bool mPassTimers = false;
+    // the currently open passes, innermost last.
+    std::vector<std::string> mPassStack;
+    // the timed segments whose results haven't been picked up yet.
+    std::vector<PassSegment> mPassSegments;
+    // accumulated pass timings per frame for frames that are still in flight.
+    std::map<std::size_t, std::vector<PassTiming>> mPassFrames;
+    // the latest complete results.
+    std::vector<PassTiming> mPassTimings;
 };
 
 // static
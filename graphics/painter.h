@@ -25,6 +25,7 @@
 
 #include <memory>
 #include <vector>
+#include <string>
 
 #include "graphics/types.h"
 #include "graphics/color4f.h"
@@ -33,6 +34,7 @@ namespace gfx
 {
     // fwd declarations
     class Device;
+    class FrameBuffer;
     class Drawable;
     class Material;
     class Transform;
@@ -52,6 +54,14 @@ namespace gfx
         // has been resized. The setting will be kept until the next call
         // to surface size.
         virtual void SetSurfaceSize(unsigned width, unsigned height) = 0;
+        // Set the render target for the painter's drawing operations.
+        // When the target is nullptr (the default) the painter draws into
+        // the rendering surface of the device. Otherwise the painter draws
+        // into the given frame buffer and the viewport and scissor settings
+        // are relative to the frame buffer instead of the surface.
+        virtual void SetRenderTarget(FrameBuffer* target) = 0;
+        // Get the current render target if any.
+        virtual FrameBuffer* GetRenderTarget() const = 0;
         // Set the current render target/device view port.
         // x and y are the top left coordinate (in pixels) of the
         // viewport's location wrt to the actual render target.
@@ -104,6 +114,31 @@ namespace gfx
         // todo:
         virtual void Draw(const std::vector<DrawShape>& shapes) = 0;
 
+        // Enable/disable measuring the GPU time taken by the render passes.
+        // Note that when the device doesn't support GPU timers the time is
+        // measured on the CPU by waiting for the GPU which will stall the
+        // rendering. Off by default.
+        virtual void EnablePassTimers(bool on) = 0;
+        virtual bool HasPassTimers() const = 0;
+        // Begin/end a named render pass. Everything drawn between the calls
+        // is accounted to the pass. Passes can nest in which case the time
+        // spent in the inner pass is not included in the outer pass. If the
+        // same pass is begun several times during a frame the times are summed.
+        // When the pass timers are not enabled these do nothing.
+        virtual void BeginPass(const std::string& name) = 0;
+        virtual void EndPass() = 0;
+
+        struct PassTiming {
+            std::string name;
+            // the GPU time in seconds or negative if the
+            // measurement was lost.
+            double gpu_time = 0.0;
+        };
+        // Get the pass timings of the latest frame whose results are
+        // available. The results lag behind the current frame by a
+        // frame or few since the GPU runs behind the CPU.
+        virtual std::vector<PassTiming> GetPassTimings() = 0;
+
         // Create new painter implementation using the given graphics device.
         static std::unique_ptr<Painter> Create(std::shared_ptr<Device> device);
         static std::unique_ptr<Painter> Create(Device* device);
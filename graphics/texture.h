@@ -78,6 +78,20 @@ namespace gfx
             Repeat
         };
 
+        // Policy for generating the mipmaps, i.e. the precomputed
+        // minified versions of the texture.
+        enum class MipmapPolicy {
+            // Generate the mips when the texture is sampled with a mipmapping
+            // minification filter and the contents have changed since the
+            // mips were last generated. Textures that are never minified
+            // with a mipmapping filter never pay for the mips.
+            OnDemand,
+            // Never generate mips. For example text and other dynamic content
+            // that is updated often and not expected to be minified. If a
+            // mipmapping filter is used anyway it falls back to linear filtering.
+            Never
+        };
+
         // Identify texture format based on the bit depth
         static Format DepthToFormat(unsigned bit_depth)
         {
@@ -93,6 +107,17 @@ namespace gfx
             // of expected formats needs to be done elsewhere.
             BUG("Unexpected bit depth.");
         }
+        // Get the number of bytes per pixel in the given format.
+        static unsigned GetBytesPerPixel(Format format)
+        {
+            if (format == Format::RGB)
+                return 3;
+            else if (format == Format::RGBA)
+                return 4;
+            else if (format == Format::Grayscale)
+                return 1;
+            BUG("Unexpected texture format.");
+        }
 
         // Set texture minification filter.
         virtual void SetFilter(MinFilter filter) = 0;
@@ -112,7 +137,19 @@ namespace gfx
         virtual Wrapping GetWrapY() const = 0;
         // Upload the texture contents from the given buffer.
         // Will overwrite any previous contents and reshape the texture dimensions.
+        // If the dimensions and the format are the same as before the contents
+        // are updated in place without reallocating the texture storage.
         virtual void Upload(const void* bytes, unsigned xres, unsigned yres, Format format) = 0;
+        // Update a (dirty) sub-rectangle of the texture contents in place.
+        // The texture must have been uploaded before and the rectangle must
+        // be within the texture. The data is expected to be tightly packed
+        // rows of width pixels in the texture's current format.
+        virtual void UploadSubRect(const void* bytes, unsigned x, unsigned y,
+                                   unsigned width, unsigned height) = 0;
+        // Set the mipmap generation policy. The default is OnDemand.
+        virtual void SetMipmapPolicy(MipmapPolicy policy) = 0;
+        // Get the current mipmap generation policy.
+        virtual MipmapPolicy GetMipmapPolicy() const = 0;
         // Get the texture width. Initially 0 until Upload is called
         // and new texture contents are uploaded.
         virtual unsigned GetWidth() const = 0;
@@ -0,0 +1,1276 @@
+// Copyright (C) 2020-2021 Sami Väisänen
+// Copyright (C) 2020-2021 Ensisoft http://www.ensisoft.com
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "config.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <string>
+#include <list>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <type_traits>
+
+#include "base/assert.h"
+#include "base/logging.h"
+#include "graphics/device.h"
+#include "graphics/shader.h"
+#include "graphics/program.h"
+#include "graphics/geometry.h"
+#include "graphics/texture.h"
+#include "graphics/framebuffer.h"
+#include "graphics/color4f.h"
+
+// The threaded device is a front for a real device that lives on a
+// separate render thread. All the device and resource calls made on the
+// main thread are recorded into a command list. At the end of each frame
+// the list is handed over to the render thread which executes it against
+// the real device while the main thread records the next frame.
+// The resource objects handed out to the caller are proxies that keep
+// a shadow copy of the state that can be queried without a round trip
+// to the render thread. The few calls that need a result from the real
+// device (shader compilation, program linking and synchronous color
+// buffer reads) flush the current list and wait for it to complete.
+
+namespace {
+using namespace gfx;
+
+class ThreadedDevice;
+
+// Bookkeeping common to all the resource proxies.
+class ProxyBase
+{
+public:
+    enum class Kind {
+        Shader, Program, Geometry, Texture, FrameBuffer
+    };
+    ProxyBase(ThreadedDevice* device, Kind kind, const std::string& name)
+      : mDevice(device)
+      , mKind(kind)
+      , mName(name)
+    {}
+    virtual ~ProxyBase() = default;
+    // Forget the real resource object. Called on the render
+    // thread when the real object is deleted or replaced.
+    virtual void ClearReal() = 0;
+
+    Kind GetKind() const
+    { return mKind; }
+    const std::string& GetName() const
+    { return mName; }
+
+    // main thread state for the garbage collection.
+    std::size_t last_used_frame = 0;
+    std::list<ProxyBase*>::iterator lru;
+    bool linked  = false;
+    bool retired = false;
+protected:
+    ThreadedDevice* const mDevice;
+private:
+    const Kind mKind;
+    const std::string mName;
+};
+
+class TextureProxy;
+class FrameBufferProxy;
+
+// Program state change that has been recorded but not yet
+// sent over to the render thread.
+struct ProgramOp {
+    enum class Type {
+        Int, Int2, Float, Float2, Float3, Float4, Color,
+        Matrix2, Matrix3, Matrix4, Texture, TextureCount
+    };
+    Type type = Type::Int;
+    std::string name;
+    int ivec[2] = {0};
+    float fvec[16] = {0.0f};
+    Color4f color;
+    unsigned unit = 0;
+    TextureProxy* texture = nullptr;
+};
+
+class ShaderProxy : public Shader, public ProxyBase
+{
+public:
+    ShaderProxy(ThreadedDevice* device, const std::string& name)
+      : ProxyBase(device, Kind::Shader, name)
+    {}
+    virtual bool CompileSource(const std::string& source) override;
+    virtual bool CompileFile(const std::string& file) override;
+    virtual bool IsValid() const override
+    { return mValid; }
+    virtual void ClearReal() override
+    { mReal = nullptr; }
+
+    // render thread
+    Shader* GetReal() const
+    { return mReal; }
+    void SetReal(Shader* shader)
+    { mReal = shader; }
+private:
+    Shader* mReal = nullptr;
+    bool mValid = false;
+};
+
+class ProgramProxy : public Program, public ProxyBase
+{
+public:
+    using Type = ProgramOp::Type;
+
+    ProgramProxy(ThreadedDevice* device, const std::string& name)
+      : ProxyBase(device, Kind::Program, name)
+    {}
+    virtual bool Build(const std::vector<const Shader*>& shaders) override;
+    virtual bool IsValid() const override
+    { return mValid; }
+    virtual void SetUniform(const char* name, int x) override
+    {
+        auto& op = PushOp(Type::Int, name);
+        op.ivec[0] = x;
+    }
+    virtual void SetUniform(const char* name, int x, int y) override
+    {
+        auto& op = PushOp(Type::Int2, name);
+        op.ivec[0] = x;
+        op.ivec[1] = y;
+    }
+    virtual void SetUniform(const char* name, float x) override
+    {
+        auto& op = PushOp(Type::Float, name);
+        op.fvec[0] = x;
+    }
+    virtual void SetUniform(const char* name, float x, float y) override
+    {
+        auto& op = PushOp(Type::Float2, name);
+        op.fvec[0] = x;
+        op.fvec[1] = y;
+    }
+    virtual void SetUniform(const char* name, float x, float y, float z) override
+    {
+        auto& op = PushOp(Type::Float3, name);
+        op.fvec[0] = x;
+        op.fvec[1] = y;
+        op.fvec[2] = z;
+    }
+    virtual void SetUniform(const char* name, float x, float y, float z, float w) override
+    {
+        auto& op = PushOp(Type::Float4, name);
+        op.fvec[0] = x;
+        op.fvec[1] = y;
+        op.fvec[2] = z;
+        op.fvec[3] = w;
+    }
+    virtual void SetUniform(const char* name, const Color4f& color) override
+    {
+        auto& op = PushOp(Type::Color, name);
+        op.color = color;
+    }
+    virtual void SetUniform(const char* name, const Matrix2x2& matrix) override
+    {
+        auto& op = PushOp(Type::Matrix2, name);
+        std::memcpy(op.fvec, &matrix[0][0], sizeof(matrix));
+    }
+    virtual void SetUniform(const char* name, const Matrix3x3& matrix) override
+    {
+        auto& op = PushOp(Type::Matrix3, name);
+        std::memcpy(op.fvec, &matrix[0][0], sizeof(matrix));
+    }
+    virtual void SetUniform(const char* name, const Matrix4x4& matrix) override
+    {
+        auto& op = PushOp(Type::Matrix4, name);
+        std::memcpy(op.fvec, &matrix[0][0], sizeof(matrix));
+    }
+    virtual void SetTexture(const char* sampler, unsigned unit, const Texture& texture) override;
+    virtual void SetTextureCount(unsigned count) override
+    {
+        auto& op = PushOp(Type::TextureCount, "");
+        op.unit = count;
+    }
+    virtual void ClearReal() override
+    { mReal = nullptr; }
+
+    // main thread. take the pending state changes out to be
+    // recorded into the command list.
+    std::vector<ProgramOp> TakeOps()
+    {
+        std::vector<ProgramOp> ret;
+        std::swap(ret, mOps);
+        return ret;
+    }
+    bool HasOps() const
+    { return !mOps.empty(); }
+    const std::vector<ProgramOp>& GetOps() const
+    { return mOps; }
+    bool IsDirty() const
+    { return mDirty; }
+    void SetDirty(bool dirty)
+    { mDirty = dirty; }
+
+    // render thread
+    Program* GetReal() const
+    { return mReal; }
+    void SetReal(Program* program)
+    { mReal = program; }
+private:
+    ProgramOp& PushOp(Type type, const char* name);
+private:
+    Program* mReal = nullptr;
+    std::vector<ProgramOp> mOps;
+    bool mValid = false;
+    bool mDirty = false;
+};
+
+class GeometryProxy : public Geometry, public ProxyBase
+{
+public:
+    GeometryProxy(ThreadedDevice* device, const std::string& name)
+      : ProxyBase(device, Kind::Geometry, name)
+    {}
+    virtual void ClearDraws() override;
+    virtual void AddDrawCmd(DrawType type) override;
+    virtual void AddDrawCmd(DrawType type, size_t offset, size_t count) override;
+    virtual void SetVertexBuffer(std::unique_ptr<VertexBuffer> buffer) override;
+    virtual void SetVertexLayout(const VertexLayout& layout) override;
+    virtual void ClearReal() override
+    { mReal = nullptr; }
+
+    // render thread
+    Geometry* GetReal() const
+    { return mReal; }
+    void SetReal(Geometry* geometry)
+    { mReal = geometry; }
+private:
+    Geometry* mReal = nullptr;
+};
+
+class TextureProxy : public Texture, public ProxyBase
+{
+public:
+    TextureProxy(ThreadedDevice* device, const std::string& name)
+      : ProxyBase(device, Kind::Texture, name)
+    {}
+    // Proxy for the color texture owned by a frame buffer.
+    TextureProxy(ThreadedDevice* device, FrameBufferProxy* owner)
+      : ProxyBase(device, Kind::Texture, "")
+      , mOwner(owner)
+    {}
+    virtual void SetFilter(MinFilter filter) override;
+    virtual void SetFilter(MagFilter filter) override;
+    virtual MinFilter GetMinFilter() const override
+    { return mMinFilter; }
+    virtual MagFilter GetMagFilter() const override
+    { return mMagFilter; }
+    virtual void SetWrapX(Wrapping w) override;
+    virtual void SetWrapY(Wrapping w) override;
+    virtual Wrapping GetWrapX() const override
+    { return mWrapX; }
+    virtual Wrapping GetWrapY() const override
+    { return mWrapY; }
+    virtual void Upload(const void* bytes, unsigned xres, unsigned yres, Format format) override;
+    virtual void UploadSubRect(const void* bytes, unsigned x, unsigned y,
+                               unsigned width, unsigned height) override;
+    virtual void SetMipmapPolicy(MipmapPolicy policy) override;
+    virtual MipmapPolicy GetMipmapPolicy() const override
+    { return mMipmaps; }
+    virtual unsigned GetWidth() const override;
+    virtual unsigned GetHeight() const override;
+    virtual Format GetFormat() const override
+    { return mOwner ? Format::RGBA : mFormat; }
+    virtual void EnableGarbageCollection(bool gc) override;
+    virtual void ClearReal() override
+    { mReal = nullptr; }
+
+    // render thread
+    Texture* GetReal() const;
+    void SetReal(Texture* texture)
+    { mReal = texture; }
+private:
+    FrameBufferProxy* const mOwner = nullptr;
+    Texture* mReal = nullptr;
+    MinFilter mMinFilter = MinFilter::Default;
+    MagFilter mMagFilter = MagFilter::Default;
+    Wrapping mWrapX = Wrapping::Repeat;
+    Wrapping mWrapY = Wrapping::Repeat;
+    MipmapPolicy mMipmaps = MipmapPolicy::OnDemand;
+    unsigned mWidth  = 0;
+    unsigned mHeight = 0;
+    Format mFormat = Format::Grayscale;
+};
+
+class FrameBufferProxy : public FrameBuffer, public ProxyBase
+{
+public:
+    FrameBufferProxy(ThreadedDevice* device, const std::string& name)
+      : ProxyBase(device, Kind::FrameBuffer, name)
+      , mColorTexture(device, this)
+    {}
+    virtual void SetConfig(const Config& config) override;
+    virtual const Config& GetConfig() const override
+    { return mConfig; }
+    virtual Texture* GetColorTexture() override
+    { return &mColorTexture; }
+    // the real frame buffer is only created once it's first used
+    // as a render target. predict the outcome based on the config
+    // until the render thread has told us otherwise.
+    virtual bool IsValid() const override
+    { return mUsed && !mFailed && mConfig.width && mConfig.height; }
+    virtual void ClearReal() override
+    { mReal = nullptr; }
+
+    void SetUsed()
+    { mUsed = true; }
+
+    // render thread
+    FrameBuffer* GetReal() const
+    { return mReal; }
+    void SetReal(FrameBuffer* fbo)
+    { mReal = fbo; }
+    void SetFailed(bool failed)
+    { mFailed = failed; }
+private:
+    FrameBuffer* mReal = nullptr;
+    TextureProxy mColorTexture;
+    Config mConfig;
+    bool mUsed = false;
+    // set by the render thread when binding the real frame buffer
+    // fails, cleared when the config changes.
+    std::atomic<bool> mFailed{false};
+};
+
+void ApplyProgramOp(Program& program, const ProgramOp& op)
+{
+    using Type = ProgramOp::Type;
+    const char* name = op.name.c_str();
+    switch (op.type)
+    {
+        case Type::Int:
+            program.SetUniform(name, op.ivec[0]);
+            break;
+        case Type::Int2:
+            program.SetUniform(name, op.ivec[0], op.ivec[1]);
+            break;
+        case Type::Float:
+            program.SetUniform(name, op.fvec[0]);
+            break;
+        case Type::Float2:
+            program.SetUniform(name, op.fvec[0], op.fvec[1]);
+            break;
+        case Type::Float3:
+            program.SetUniform(name, op.fvec[0], op.fvec[1], op.fvec[2]);
+            break;
+        case Type::Float4:
+            program.SetUniform(name, op.fvec[0], op.fvec[1], op.fvec[2], op.fvec[3]);
+            break;
+        case Type::Color:
+            program.SetUniform(name, op.color);
+            break;
+        case Type::Matrix2:
+            program.SetUniform(name, *reinterpret_cast<const Program::Matrix2x2*>(op.fvec));
+            break;
+        case Type::Matrix3:
+            program.SetUniform(name, *reinterpret_cast<const Program::Matrix3x3*>(op.fvec));
+            break;
+        case Type::Matrix4:
+            program.SetUniform(name, *reinterpret_cast<const Program::Matrix4x4*>(op.fvec));
+            break;
+        case Type::Texture:
+            // the texture could have been deleted (or never created
+            // as in the case of a frame buffer that hasn't been used yet)
+            if (const auto* texture = op.texture->GetReal())
+                program.SetTexture(name, op.unit, *texture);
+            break;
+        case Type::TextureCount:
+            program.SetTextureCount(op.unit);
+            break;
+    }
+}
+
+class ThreadedDevice : public Device
+{
+public:
+    using Command = std::function<void (Device&)>;
+
+    ThreadedDevice(Type type, Context* context)
+      : mType(type)
+      , mContext(context)
+    {
+        // the context can only be current in one thread at a time.
+        mContext->ReleaseCurrent();
+        mThread = std::thread(&ThreadedDevice::RenderThread, this);
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [this] { return mReady; });
+        DEBUG("Render thread started.");
+    }
+   ~ThreadedDevice()
+    {
+        Finish();
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mShutdown = true;
+            mCondition.notify_all();
+        }
+        mThread.join();
+        // give the context back to the thread that created the device.
+        mContext->MakeCurrent();
+        DEBUG("Render thread stopped.");
+    }
+
+    // Record a command to be executed on the render thread.
+    void Record(Command cmd)
+    { mRecording.push_back(std::move(cmd)); }
+    // Record a command and wait for it to complete. Only for
+    // the calls that need a result from the real device.
+    void Execute(Command cmd)
+    {
+        Record(std::move(cmd));
+        Finish();
+    }
+    // Mark the resource as used in the current frame.
+    void Touch(ProxyBase* proxy)
+    {
+        if (proxy->retired || proxy->last_used_frame == mFrameNumber)
+            return;
+        proxy->last_used_frame = mFrameNumber;
+        if (proxy->linked)
+            mLRU.splice(mLRU.begin(), mLRU, proxy->lru);
+    }
+    void Link(ProxyBase* proxy)
+    {
+        if (proxy->linked || proxy->retired)
+            return;
+        mLRU.push_front(proxy);
+        proxy->lru    = mLRU.begin();
+        proxy->linked = true;
+        proxy->last_used_frame = mFrameNumber;
+    }
+    void Unlink(ProxyBase* proxy)
+    {
+        if (!proxy->linked)
+            return;
+        mLRU.erase(proxy->lru);
+        proxy->linked = false;
+    }
+    void SetProgramDirty(ProgramProxy* program)
+    {
+        program->SetDirty(true);
+        mDirtyPrograms.push_back(program);
+    }
+
+    // Device implementation.
+    virtual void ClearColor(const Color4f& color) override
+    {
+        Record([color](Device& device) {
+            device.ClearColor(color);
+        });
+    }
+    virtual void ClearStencil(int value) override
+    {
+        Record([value](Device& device) {
+            device.ClearStencil(value);
+        });
+    }
+    virtual void ClearStencil(int value, const IRect& rect) override
+    {
+        Record([value, rect](Device& device) {
+            device.ClearStencil(value, rect);
+        });
+    }
+    virtual void SetDefaultTextureFilter(MinFilter filter) override
+    {
+        Record([filter](Device& device) {
+            device.SetDefaultTextureFilter(filter);
+        });
+    }
+    virtual void SetDefaultTextureFilter(MagFilter filter) override
+    {
+        Record([filter](Device& device) {
+            device.SetDefaultTextureFilter(filter);
+        });
+    }
+    virtual Shader* FindShader(const std::string& name) override
+    { return FindProxy(mShaders, name); }
+    virtual Shader* MakeShader(const std::string& name) override
+    {
+        auto* proxy = InsertProxy(mShaders, std::make_unique<ShaderProxy>(this, name));
+        Link(proxy);
+        Record([proxy, name](Device& device) {
+            proxy->SetReal(device.MakeShader(name));
+        });
+        return proxy;
+    }
+    virtual Program* FindProgram(const std::string& name) override
+    { return FindProxy(mPrograms, name); }
+    virtual Program* MakeProgram(const std::string& name) override
+    {
+        auto* proxy = InsertProxy(mPrograms, std::make_unique<ProgramProxy>(this, name));
+        Link(proxy);
+        Record([proxy, name](Device& device) {
+            proxy->SetReal(device.MakeProgram(name));
+        });
+        return proxy;
+    }
+    virtual Geometry* FindGeometry(const std::string& name) override
+    { return FindProxy(mGeoms, name); }
+    virtual Geometry* MakeGeometry(const std::string& name) override
+    {
+        auto* proxy = InsertProxy(mGeoms, std::make_unique<GeometryProxy>(this, name));
+        Link(proxy);
+        Record([proxy, name](Device& device) {
+            proxy->SetReal(device.MakeGeometry(name));
+        });
+        return proxy;
+    }
+    virtual Texture* FindTexture(const std::string& name) override
+    { return FindProxy(mTextures, name); }
+    virtual Texture* MakeTexture(const std::string& name) override
+    {
+        // textures are only eligible for garbage collection once
+        // they're explicitly marked so. see EnableGarbageCollection.
+        auto* proxy = InsertProxy(mTextures, std::make_unique<TextureProxy>(this, name));
+        Record([proxy, name](Device& device) {
+            proxy->SetReal(device.MakeTexture(name));
+        });
+        return proxy;
+    }
+    virtual FrameBuffer* FindFrameBuffer(const std::string& name) override
+    { return FindProxy(mFrameBuffers, name); }
+    virtual FrameBuffer* MakeFrameBuffer(const std::string& name) override
+    {
+        auto* proxy = InsertProxy(mFrameBuffers, std::make_unique<FrameBufferProxy>(this, name));
+        Record([proxy, name](Device& device) {
+            proxy->SetReal(device.MakeFrameBuffer(name));
+        });
+        return proxy;
+    }
+    virtual void DeleteShaders() override
+    {
+        RetireAll(mShaders);
+        Record([](Device& device) { device.DeleteShaders(); });
+    }
+    virtual void DeletePrograms() override
+    {
+        RetireAll(mPrograms);
+        Record([](Device& device) { device.DeletePrograms(); });
+    }
+    virtual void DeleteGeometries() override
+    {
+        RetireAll(mGeoms);
+        Record([](Device& device) { device.DeleteGeometries(); });
+    }
+    virtual void DeleteTextures() override
+    {
+        RetireAll(mTextures);
+        Record([](Device& device) { device.DeleteTextures(); });
+    }
+    virtual void DeleteFrameBuffers() override
+    {
+        mCurrentFrameBuffer = nullptr;
+        RetireAll(mFrameBuffers);
+        Record([](Device& device) { device.DeleteFrameBuffers(); });
+    }
+    virtual void DeleteShader(const std::string& name) override
+    { DeleteProxy(mShaders, name, &Device::DeleteShader); }
+    virtual void DeleteProgram(const std::string& name) override
+    { DeleteProxy(mPrograms, name, &Device::DeleteProgram); }
+    virtual void DeleteGeometry(const std::string& name) override
+    { DeleteProxy(mGeoms, name, &Device::DeleteGeometry); }
+    virtual void DeleteTexture(const std::string& name) override
+    { DeleteProxy(mTextures, name, &Device::DeleteTexture); }
+
+    virtual bool SetFrameBuffer(FrameBuffer* fbo) override
+    {
+        auto* proxy = static_cast<FrameBufferProxy*>(fbo);
+        // if a previously recorded bind failed on the render thread the
+        // render target is whatever the real device was left with. forget
+        // the cached target so that this bind isn't skipped.
+        if (mFrameBufferFailed.exchange(false))
+            mCurrentFrameBufferKnown = false;
+        if (mCurrentFrameBufferKnown && proxy == mCurrentFrameBuffer)
+            return true;
+        mCurrentFrameBuffer = proxy;
+        mCurrentFrameBufferKnown = true;
+        if (proxy)
+            proxy->SetUsed();
+
+        const std::string name = proxy ? proxy->GetName() : "default";
+        Record([this, proxy, name](Device& device) {
+            const bool ok = device.SetFrameBuffer(proxy ? proxy->GetReal() : nullptr);
+            if (proxy)
+                proxy->SetFailed(!ok);
+            if (ok)
+                return;
+            WARN("Failed to set frame buffer '%1' as the render target.", name);
+            mFrameBufferFailed = true;
+        });
+        // we can't know whether the real frame buffer is complete
+        // without waiting for the render thread. a failure is reported
+        // back through IsValid and the next bind once the commands
+        // have been submitted.
+        return proxy == nullptr || proxy->IsValid();
+    }
+
+    virtual void Draw(const Program& program, const Geometry& geometry, const State& state) override
+    {
+        // the proxies are ours and the const is only a promise about
+        // the resource contents not the bookkeeping.
+        auto* prog = const_cast<ProgramProxy*>(static_cast<const ProgramProxy*>(&program));
+        auto* geom = const_cast<GeometryProxy*>(static_cast<const GeometryProxy*>(&geometry));
+        Touch(prog);
+        Touch(geom);
+        for (const auto& op : prog->GetOps())
+        {
+            if (op.texture)
+                Touch(op.texture);
+        }
+        // batch all the pending program state changes with the draw
+        // so that there's only one command per draw call.
+        Record([prog, geom, ops=prog->TakeOps(), state](Device& device) {
+            auto* program  = prog->GetReal();
+            auto* geometry = geom->GetReal();
+            if (program == nullptr || geometry == nullptr)
+                return;
+            for (const auto& op : ops)
+                ApplyProgramOp(*program, op);
+            device.Draw(*program, *geometry, state);
+        });
+    }
+
+    virtual Type GetDeviceType() const override
+    { return mType; }
+
+    virtual std::size_t GetFrameNumber() const override
+    { return mFrameNumber; }
+
+    virtual void CleanGarbage(size_t max_num_idle_frames, unsigned max_time_us) override
+    {
+        using clock = std::chrono::steady_clock;
+        const auto start = clock::now();
+        const auto budget = std::chrono::microseconds(max_time_us);
+
+        // same policy as the real device except that the LRU list
+        // is maintained here on the recording side and the deletes
+        // are recorded as commands. Any resource deleted this way
+        // can still be referred to by the commands in flight.
+        while (!mLRU.empty())
+        {
+            auto* proxy = mLRU.back();
+            if (mFrameNumber - proxy->last_used_frame < max_num_idle_frames)
+                break;
+            if (max_time_us && clock::now() - start >= budget)
+                break;
+
+            const auto& name = proxy->GetName();
+            const auto kind  = proxy->GetKind();
+            if (kind == ProxyBase::Kind::Program)
+                DeleteProxy(mPrograms, name, &Device::DeleteProgram);
+            else if (kind == ProxyBase::Kind::Geometry)
+                DeleteProxy(mGeoms, name, &Device::DeleteGeometry);
+            else if (kind == ProxyBase::Kind::Shader)
+                DeleteProxy(mShaders, name, &Device::DeleteShader);
+            else if (kind == ProxyBase::Kind::Texture)
+                DeleteProxy(mTextures, name, &Device::DeleteTexture);
+            // make sure we make progress even if the maps have
+            // somehow lost track of the resource.
+            Unlink(proxy);
+        }
+    }
+
+    virtual FrameStats GetFrameStats() const override
+    {
+        // asking the render thread for the current stats would mean
+        // waiting for it so return the stats of the latest frame that
+        // the render thread has completed instead.
+        std::lock_guard<std::mutex> lock(mReadMutex);
+        return mFrameStats;
+    }
+    virtual void ResetFrameStats() override
+    {
+        Record([](Device& device) { device.ResetFrameStats(); });
+    }
+    virtual void BeginFrame() override
+    {
+        FlushPrograms();
+        Record([](Device& device) { device.BeginFrame(); });
+    }
+    virtual void EndFrame(bool display) override
+    {
+        Record([this, display](Device& device) {
+            device.EndFrame(display);
+            std::lock_guard<std::mutex> lock(mReadMutex);
+            mFrameStats = device.GetFrameStats();
+        });
+        mFrameNumber++;
+        // hand the frame over to the render thread. If the render thread
+        // is still busy with the previous frame this will block, i.e. the
+        // main thread can be at most one frame ahead.
+        Submit();
+    }
+
+    virtual Bitmap<RGBA> ReadColorBuffer(unsigned width, unsigned height) const override
+    {
+        Bitmap<RGBA> ret;
+        const_cast<ThreadedDevice*>(this)->Execute([&ret, width, height](Device& device) {
+            ret = device.ReadColorBuffer(width, height);
+        });
+        return ret;
+    }
+    virtual Bitmap<RGBA> ReadColorBuffer(unsigned x, unsigned y, unsigned width, unsigned height) const override
+    {
+        Bitmap<RGBA> ret;
+        const_cast<ThreadedDevice*>(this)->Execute([&ret, x, y, width, height](Device& device) {
+            ret = device.ReadColorBuffer(x, y, width, height);
+        });
+        return ret;
+    }
+    virtual unsigned ReadColorBufferAsync(unsigned x, unsigned y, unsigned width, unsigned height) override
+    {
+        const auto handle = ++mReadHandle;
+        Record([this, handle, x, y, width, height](Device& device) {
+            PendingRead read;
+            read.handle = handle;
+            read.device_handle = device.ReadColorBufferAsync(x, y, width, height);
+            mPendingReads.push_back(read);
+        });
+        return handle;
+    }
+    virtual bool PollColorBufferRead(unsigned handle, Bitmap<RGBA>* bitmap) override
+    {
+        // if the read is still sitting in the current command list
+        // nothing is going to happen until the list is submitted.
+        if (handle > mSubmittedReadHandle)
+            Submit();
+
+        std::lock_guard<std::mutex> lock(mReadMutex);
+        auto it = mCompletedReads.find(handle);
+        if (it == mCompletedReads.end())
+            return false;
+        *bitmap = std::move(it->second);
+        mCompletedReads.erase(it);
+        return true;
+    }
+    virtual unsigned BeginTimer() override
+    {
+        const auto handle = ++mTimerHandle;
+        Record([this, handle](Device& device) {
+            PendingTimer timer;
+            timer.handle = handle;
+            timer.device_handle = device.BeginTimer();
+            mPendingTimers.push_back(timer);
+        });
+        return handle;
+    }
+    virtual void EndTimer(unsigned handle) override
+    {
+        Record([this, handle](Device& device) {
+            for (auto& timer : mPendingTimers)
+            {
+                if (timer.handle != handle)
+                    continue;
+                device.EndTimer(timer.device_handle);
+                timer.ended = true;
+                return;
+            }
+            WARN("No such timer %1", handle);
+        });
+    }
+    virtual bool PollTimer(unsigned handle, double* seconds) override
+    {
+        if (handle > mSubmittedTimerHandle)
+            Submit();
+
+        std::lock_guard<std::mutex> lock(mReadMutex);
+        auto it = mCompletedTimers.find(handle);
+        if (it == mCompletedTimers.end())
+            return false;
+        *seconds = it->second;
+        mCompletedTimers.erase(it);
+        return true;
+    }
+private:
+    template<typename Map>
+    static typename Map::mapped_type::pointer FindProxy(Map& map, const std::string& name)
+    {
+        auto it = map.find(name);
+        if (it == std::end(map))
+            return nullptr;
+        return it->second.get();
+    }
+    template<typename Map, typename Proxy>
+    Proxy* InsertProxy(Map& map, std::unique_ptr<Proxy> proxy)
+    {
+        auto* ret = proxy.get();
+        auto it = map.find(ret->GetName());
+        if (it == map.end())
+        {
+            map[ret->GetName()] = std::move(proxy);
+            return ret;
+        }
+        // the real device replaces the resource with the same name.
+        Retire(std::move(it->second));
+        it->second = std::move(proxy);
+        return ret;
+    }
+    template<typename Map>
+    void DeleteProxy(Map& map, const std::string& name, void (Device::*del)(const std::string&))
+    {
+        auto it = map.find(name);
+        if (it == map.end())
+            return;
+        Retire(std::move(it->second));
+        map.erase(it);
+        Record([name, del](Device& device) {
+            (device.*del)(name);
+        });
+    }
+    template<typename Map>
+    void RetireAll(Map& map)
+    {
+        for (auto& pair : map)
+            Retire(std::move(pair.second));
+        map.clear();
+    }
+    template<typename Proxy>
+    void Retire(std::unique_ptr<Proxy> proxy)
+    {
+        if constexpr (std::is_same_v<Proxy, ProgramProxy>)
+        {
+            // any pending state changes are moot now.
+            auto* program = proxy.get();
+            mDirtyPrograms.erase(std::remove(mDirtyPrograms.begin(), mDirtyPrograms.end(), program),
+                                 mDirtyPrograms.end());
+        }
+        if constexpr (std::is_same_v<Proxy, FrameBufferProxy>)
+        {
+            if (proxy.get() == mCurrentFrameBuffer)
+                mCurrentFrameBuffer = nullptr;
+        }
+        Unlink(proxy.get());
+        proxy->retired = true;
+        // the proxy itself must stay alive for as long as there are
+        // commands that refer to it. it's deleted once the render thread
+        // has completed the command list it was retired in.
+        Record([ptr=proxy.get()](Device&) {
+            ptr->ClearReal();
+        });
+        mRecordingGarbage.push_back(std::move(proxy));
+    }
+    // Record the pending state changes of programs that haven't been
+    // drawn with so that they don't leak into another command list.
+    void FlushPrograms()
+    {
+        for (auto* prog : mDirtyPrograms)
+        {
+            prog->SetDirty(false);
+            if (!prog->HasOps())
+                continue;
+            Record([prog, ops=prog->TakeOps()](Device&) {
+                if (auto* program = prog->GetReal())
+                {
+                    for (const auto& op : ops)
+                        ApplyProgramOp(*program, op);
+                }
+            });
+        }
+        mDirtyPrograms.clear();
+    }
+    // Hand the current command list over to the render thread.
+    void Submit()
+    {
+        FlushPrograms();
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [this] { return !mHaveWork; });
+        // the render thread is done with the previous list so whatever
+        // was retired while recording it can now be deleted.
+        mExecutingGarbage.clear();
+        std::swap(mExecutingGarbage, mRecordingGarbage);
+        std::swap(mExecuting, mRecording);
+        mSubmittedReadHandle = mReadHandle;
+        mSubmittedTimerHandle = mTimerHandle;
+        mHaveWork = true;
+        mCondition.notify_all();
+    }
+    // Submit the current command list and wait for it to complete.
+    void Finish()
+    {
+        Submit();
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [this] { return !mHaveWork; });
+    }
+
+    void RenderThread()
+    {
+        mContext->MakeCurrent();
+        mDevice = Device::Create(mType, mContext);
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mReady = true;
+            mCondition.notify_all();
+        }
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (true)
+        {
+            const auto have_work = [this] { return mHaveWork || mShutdown; };
+            // keep polling the async reads and timers while there are some in flight.
+            if (mPendingReads.empty() && mPendingTimers.empty())
+                mCondition.wait(lock, have_work);
+            else mCondition.wait_for(lock, std::chrono::milliseconds(1), have_work);
+
+            if (mHaveWork)
+            {
+                lock.unlock();
+                for (auto& cmd : mExecuting)
+                    cmd(*mDevice);
+                mExecuting.clear();
+                PollReads();
+                lock.lock();
+                mHaveWork = false;
+                mCondition.notify_all();
+            }
+            else if (mShutdown)
+            {
+                break;
+            }
+            else
+            {
+                lock.unlock();
+                PollReads();
+                lock.lock();
+            }
+        }
+        lock.unlock();
+
+        mPendingReads.clear();
+        mPendingTimers.clear();
+        mDevice.reset();
+        mContext->ReleaseCurrent();
+    }
+    void PollReads()
+    {
+        for (auto it = mPendingReads.begin(); it != mPendingReads.end();)
+        {
+            Bitmap<RGBA> bitmap;
+            if (!mDevice->PollColorBufferRead(it->device_handle, &bitmap))
+            {
+                ++it;
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(mReadMutex);
+            mCompletedReads[it->handle] = std::move(bitmap);
+            it = mPendingReads.erase(it);
+        }
+        for (auto it = mPendingTimers.begin(); it != mPendingTimers.end();)
+        {
+            double seconds = 0.0;
+            if (!it->ended || !mDevice->PollTimer(it->device_handle, &seconds))
+            {
+                ++it;
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(mReadMutex);
+            mCompletedTimers[it->handle] = seconds;
+            it = mPendingTimers.erase(it);
+        }
+    }
+private:
+    const Type mType;
+    Context* mContext = nullptr;
+    std::thread mThread;
+    // these are only accessed on the main thread.
+    std::map<std::string, std::unique_ptr<ShaderProxy>> mShaders;
+    std::map<std::string, std::unique_ptr<ProgramProxy>> mPrograms;
+    std::map<std::string, std::unique_ptr<GeometryProxy>> mGeoms;
+    std::map<std::string, std::unique_ptr<TextureProxy>> mTextures;
+    std::map<std::string, std::unique_ptr<FrameBufferProxy>> mFrameBuffers;
+    std::vector<ProgramProxy*> mDirtyPrograms;
+    std::list<ProxyBase*> mLRU;
+    std::vector<Command> mRecording;
+    std::vector<std::unique_ptr<ProxyBase>> mRecordingGarbage;
+    FrameBufferProxy* mCurrentFrameBuffer = nullptr;
+    bool mCurrentFrameBufferKnown = true;
+    std::size_t mFrameNumber = 0;
+    unsigned mReadHandle = 0;
+    unsigned mSubmittedReadHandle = 0;
+    unsigned mTimerHandle = 0;
+    unsigned mSubmittedTimerHandle = 0;
+    // these are shared between the threads and protected by mMutex.
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::vector<Command> mExecuting;
+    std::vector<std::unique_ptr<ProxyBase>> mExecutingGarbage;
+    bool mHaveWork = false;
+    bool mShutdown = false;
+    bool mReady = false;
+    // set by the render thread when a frame buffer bind fails.
+    std::atomic<bool> mFrameBufferFailed{false};
+    // completed async reads and timers waiting to be picked up by the main
+    // thread and the stats of the latest frame completed on the render thread.
+    mutable std::mutex mReadMutex;
+    FrameStats mFrameStats;
+    std::map<unsigned, Bitmap<RGBA>> mCompletedReads;
+    std::map<unsigned, double> mCompletedTimers;
+    // these are only accessed on the render thread.
+    std::shared_ptr<Device> mDevice;
+    struct PendingRead {
+        unsigned handle = 0;
+        unsigned device_handle = 0;
+    };
+    std::vector<PendingRead> mPendingReads;
+    struct PendingTimer {
+        unsigned handle = 0;
+        unsigned device_handle = 0;
+        bool ended = false;
+    };
+    std::vector<PendingTimer> mPendingTimers;
+};
+
+bool ShaderProxy::CompileSource(const std::string& source)
+{
+    bool ok = false;
+    mDevice->Touch(this);
+    mDevice->Execute([this, &source, &ok](Device&) {
+        if (mReal)
+            ok = mReal->CompileSource(source);
+    });
+    mValid = ok;
+    return ok;
+}
+bool ShaderProxy::CompileFile(const std::string& file)
+{
+    bool ok = false;
+    mDevice->Touch(this);
+    mDevice->Execute([this, &file, &ok](Device&) {
+        if (mReal)
+            ok = mReal->CompileFile(file);
+    });
+    mValid = ok;
+    return ok;
+}
+
+bool ProgramProxy::Build(const std::vector<const Shader*>& shaders)
+{
+    std::vector<const ShaderProxy*> proxies;
+    for (const auto* shader : shaders)
+    {
+        auto* proxy = const_cast<ShaderProxy*>(static_cast<const ShaderProxy*>(shader));
+        mDevice->Touch(proxy);
+        proxies.push_back(proxy);
+    }
+    mDevice->Touch(this);
+
+    bool ok = false;
+    mDevice->Execute([this, &proxies, &ok](Device&) {
+        std::vector<const Shader*> real;
+        for (const auto* proxy : proxies)
+        {
+            if (auto* shader = proxy->GetReal())
+                real.push_back(shader);
+        }
+        if (mReal && real.size() == proxies.size())
+            ok = mReal->Build(real);
+    });
+    mValid = ok;
+    return ok;
+}
+void ProgramProxy::SetTexture(const char* sampler, unsigned unit, const Texture& texture)
+{
+    auto& op = PushOp(Type::Texture, sampler);
+    op.unit    = unit;
+    op.texture = const_cast<TextureProxy*>(static_cast<const TextureProxy*>(&texture));
+}
+ProgramOp& ProgramProxy::PushOp(Type type, const char* name)
+{
+    if (!mDirty)
+        mDevice->SetProgramDirty(this);
+    auto& op = mOps.emplace_back();
+    op.type = type;
+    op.name = name;
+    return op;
+}
+
+void GeometryProxy::ClearDraws()
+{
+    mDevice->Record([this](Device&) {
+        if (mReal)
+            mReal->ClearDraws();
+    });
+}
+void GeometryProxy::AddDrawCmd(DrawType type)
+{
+    mDevice->Record([this, type](Device&) {
+        if (mReal)
+            mReal->AddDrawCmd(type);
+    });
+}
+void GeometryProxy::AddDrawCmd(DrawType type, size_t offset, size_t count)
+{
+    mDevice->Record([this, type, offset, count](Device&) {
+        if (mReal)
+            mReal->AddDrawCmd(type, offset, count);
+    });
+}
+void GeometryProxy::SetVertexBuffer(std::unique_ptr<VertexBuffer> buffer)
+{
+    // std::function needs a copyable callable so the buffer
+    // is moved into a shared holder and then out of it again.
+    auto holder = std::make_shared<std::unique_ptr<VertexBuffer>>(std::move(buffer));
+    mDevice->Record([this, holder](Device&) {
+        if (mReal)
+            mReal->SetVertexBuffer(std::move(*holder));
+    });
+}
+void GeometryProxy::SetVertexLayout(const VertexLayout& layout)
+{
+    mDevice->Record([this, layout](Device&) {
+        if (mReal)
+            mReal->SetVertexLayout(layout);
+    });
+}
+
+void TextureProxy::SetFilter(MinFilter filter)
+{
+    mMinFilter = filter;
+    mDevice->Record([this, filter](Device&) {
+        if (auto* texture = GetReal())
+            texture->SetFilter(filter);
+    });
+}
+void TextureProxy::SetFilter(MagFilter filter)
+{
+    mMagFilter = filter;
+    mDevice->Record([this, filter](Device&) {
+        if (auto* texture = GetReal())
+            texture->SetFilter(filter);
+    });
+}
+void TextureProxy::SetWrapX(Wrapping w)
+{
+    mWrapX = w;
+    mDevice->Record([this, w](Device&) {
+        if (auto* texture = GetReal())
+            texture->SetWrapX(w);
+    });
+}
+void TextureProxy::SetWrapY(Wrapping w)
+{
+    mWrapY = w;
+    mDevice->Record([this, w](Device&) {
+        if (auto* texture = GetReal())
+            texture->SetWrapY(w);
+    });
+}
+void TextureProxy::Upload(const void* bytes, unsigned xres, unsigned yres, Format format)
+{
+    ASSERT(mOwner == nullptr);
+    mWidth  = xres;
+    mHeight = yres;
+    mFormat = format;
+
+    // the caller owns the buffer so the contents need to be
+    // copied for the render thread.
+    std::vector<std::uint8_t> data;
+    if (bytes)
+    {
+        const auto* ptr = static_cast<const std::uint8_t*>(bytes);
+        data.assign(ptr, ptr + xres * yres * GetBytesPerPixel(format));
+    }
+    mDevice->Record([this, data=std::move(data), xres, yres, format](Device&) {
+        if (mReal)
+            mReal->Upload(data.empty() ? nullptr : data.data(), xres, yres, format);
+    });
+}
+void TextureProxy::UploadSubRect(const void* bytes, unsigned x, unsigned y,
+                                 unsigned width, unsigned height)
+{
+    ASSERT(mOwner == nullptr);
+    ASSERT(x + width <= mWidth && y + height <= mHeight);
+    const auto* ptr = static_cast<const std::uint8_t*>(bytes);
+    std::vector<std::uint8_t> data(ptr, ptr + width * height * GetBytesPerPixel(mFormat));
+    mDevice->Record([this, data=std::move(data), x, y, width, height](Device&) {
+        if (mReal)
+            mReal->UploadSubRect(data.data(), x, y, width, height);
+    });
+}
+void TextureProxy::SetMipmapPolicy(MipmapPolicy policy)
+{
+    mMipmaps = policy;
+    mDevice->Record([this, policy](Device&) {
+        if (auto* texture = GetReal())
+            texture->SetMipmapPolicy(policy);
+    });
+}
+unsigned TextureProxy::GetWidth() const
+{ return mOwner ? mOwner->GetWidth() : mWidth; }
+unsigned TextureProxy::GetHeight() const
+{ return mOwner ? mOwner->GetHeight() : mHeight; }
+void TextureProxy::EnableGarbageCollection(bool gc)
+{
+    // the frame buffer's color texture lives and dies with
+    // the frame buffer.
+    if (mOwner)
+        return;
+    if (gc)
+        mDevice->Link(this);
+    else mDevice->Unlink(this);
+    mDevice->Record([this, gc](Device&) {
+        if (mReal)
+            mReal->EnableGarbageCollection(gc);
+    });
+}
+Texture* TextureProxy::GetReal() const
+{
+    if (mOwner)
+    {
+        // the real frame buffer creates its color texture lazily.
+        auto* fbo = mOwner->GetReal();
+        return fbo ? fbo->GetColorTexture() : nullptr;
+    }
+    return mReal;
+}
+
+void FrameBufferProxy::SetConfig(const Config& config)
+{
+    mConfig = config;
+    mFailed = false;
+    mDevice->Record([this, config](Device&) {
+        if (mReal)
+            mReal->SetConfig(config);
+    });
+}
+
+} // namespace
+
+namespace gfx
+{
+
+// static
+std::shared_ptr<Device> Device::CreateThreaded(Type type, Context* context)
+{
+    return std::make_shared<ThreadedDevice>(type, context);
+}
+
+} // namespace
@@ -22,11 +22,16 @@
 
 #include "config.h"
 
+#include <chrono>
+#include <thread>
+#include <cstring>
+
 #include "base/test_minimal.h"
 #include "graphics/color4f.h"
 #include "graphics/device.h"
 #include "graphics/program.h"
 #include "graphics/texture.h"
+#include "graphics/framebuffer.h"
 #include "graphics/shader.h"
 #include "graphics/geometry.h"
 
@@ -35,6 +40,10 @@
 #include "wdk/opengl/config.h"
 #include "wdk/opengl/surface.h"
 
+// when set the context hides the timer query functions so
+// that the device falls back on the CPU timers.
+bool TestNoTimerQueries = false;
+
 // setup context for headless rendering.
 class TestContext : public gfx::Device::Context
 {
@@ -70,12 +79,18 @@ public:
     }
     virtual void* Resolve(const char* name) override
     {
+        if (TestNoTimerQueries && std::strstr(name, "Quer"))
+            return nullptr;
         return mContext->Resolve(name);
     }
     virtual void MakeCurrent() override
     {
         mContext->MakeCurrent(mSurface.get());
     }
+    virtual void ReleaseCurrent() override
+    {
+        mContext->MakeCurrent(nullptr);
+    }
 
 private:
     std::unique_ptr<wdk::Context> mContext;
@@ -83,12 +98,32 @@ private:
     std::unique_ptr<wdk::Config>  mConfig;
 };
 
+// when set the tests run against the threaded device that records
+// the calls and executes them on a separate render thread.
+bool TestThreadedDevice = false;
+
+std::shared_ptr<gfx::Device> CreateDevice(unsigned w, unsigned h)
+{
+    auto context = std::make_shared<TestContext>(w, h);
+    if (!TestThreadedDevice)
+        return gfx::Device::Create(gfx::Device::Type::OpenGL_ES2, context);
+
+    // the threaded device doesn't own the context so keep the context
+    // alive for as long as the device. the device is destroyed first.
+    struct ThreadedDevice {
+        std::shared_ptr<TestContext> context;
+        std::shared_ptr<gfx::Device> device;
+    };
+    auto holder = std::make_shared<ThreadedDevice>();
+    holder->context = context;
+    holder->device  = gfx::Device::CreateThreaded(gfx::Device::Type::OpenGL_ES2, context.get());
+    return std::shared_ptr<gfx::Device>(holder, holder->device.get());
+}
 
 
 void unit_test_device()
 {
-    auto dev = gfx::Device::Create(gfx::Device::Type::OpenGL_ES2,
-        std::make_shared<TestContext>(10, 10));
+    auto dev = CreateDevice(10, 10);
 
     // test clear color.
     const gfx::Color colors[] = {
@@ -137,8 +172,7 @@ void unit_test_device()
 
 void unit_test_shader()
 {
-    auto dev = gfx::Device::Create(gfx::Device::Type::OpenGL_ES2,
-        std::make_shared<TestContext>(10, 10));
+    auto dev = CreateDevice(10, 10);
 
     // junk
     {
@@ -193,8 +227,7 @@ void main() {
 
 void unit_test_texture()
 {
-    auto dev = gfx::Device::Create(gfx::Device::Type::OpenGL_ES2,
-        std::make_shared<TestContext>(10, 10));
+    auto dev = CreateDevice(10, 10);
 
     auto* texture = dev->MakeTexture("foo");
     TEST_REQUIRE(texture->GetWidth() == 0);
@@ -228,8 +261,7 @@ void unit_test_texture()
 
 void unit_test_program()
 {
-    auto dev = gfx::Device::Create(gfx::Device::Type::OpenGL_ES2,
-        std::make_shared<TestContext>(10, 10));
+    auto dev = CreateDevice(10, 10);
 
     auto* prog = dev->MakeProgram("foo");
 
@@ -294,8 +326,7 @@ void main() {
 
 void unit_test_render_color_only()
 {
-    auto dev = gfx::Device::Create(gfx::Device::Type::OpenGL_ES2,
-        std::make_shared<TestContext>(10, 10));
+    auto dev = CreateDevice(10, 10);
     dev->BeginFrame();
     dev->ClearColor(gfx::Color::Red);
 
@@ -352,8 +383,7 @@ void main() {
 
 void unit_test_render_with_single_texture()
 {
-    auto dev = gfx::Device::Create(gfx::Device::Type::OpenGL_ES2,
-        std::make_shared<TestContext>(4, 4));
+    auto dev = CreateDevice(4, 4);
 
     gfx::Bitmap<gfx::RGBA> data(4, 4);
     data.SetPixel(0, 0, gfx::Color::Red);
@@ -437,10 +467,167 @@ void main() {
     TEST_REQUIRE(gfx::Compare(bmp, data));
 }
 
+// setup for drawing a texture 1:1 into a 4x4 render target.
+struct TextureDraw {
+    gfx::Program* program   = nullptr;
+    gfx::Geometry* geometry = nullptr;
+    gfx::Device::State state;
+};
+TextureDraw MakeTextureDraw(gfx::Device& dev)
+{
+    auto* geom = dev.MakeGeometry("geom");
+    const gfx::Vertex verts[] = {
+        { {-1,  1}, {0, 0} },
+        { {-1, -1}, {0, 1} },
+        { { 1, -1}, {1, 1} },
+
+        { {-1,  1}, {0, 0} },
+        { { 1, -1}, {1, 1} },
+        { { 1,  1}, {1, 0} }
+    };
+    geom->SetVertexBuffer(verts, 6);
+    geom->AddDrawCmd(gfx::Geometry::DrawType::Triangles);
+
+    const std::string& fssrc =
+R"(#version 100
+precision mediump float;
+varying vec2 vTexCoord;
+uniform sampler2D kTexture;
+void main() {
+  gl_FragColor = texture2D(kTexture, vTexCoord.xy);
+})";
+
+    const std::string& vssrc =
+R"(#version 100
+attribute vec2 aPosition;
+attribute vec2 aTexCoord;
+varying vec2 vTexCoord;
+void main() {
+  gl_Position = vec4(aPosition.xy, 1.0, 1.0);
+  vTexCoord = aTexCoord;
+})";
+    auto* vs = dev.MakeShader("vert");
+    auto* fs = dev.MakeShader("frag");
+    TEST_REQUIRE(vs->CompileSource(vssrc));
+    TEST_REQUIRE(fs->CompileSource(fssrc));
+    std::vector<const gfx::Shader*> shaders;
+    shaders.push_back(vs);
+    shaders.push_back(fs);
+
+    auto* prog = dev.MakeProgram("prog");
+    TEST_REQUIRE(prog->Build(shaders));
+
+    TextureDraw ret;
+    ret.program  = prog;
+    ret.geometry = geom;
+    ret.state.blending = gfx::Device::State::BlendOp::None;
+    ret.state.bWriteColor = true;
+    ret.state.viewport = gfx::IRect(0, 0, 4, 4);
+    ret.state.stencil_func = gfx::Device::State::StencilFunc::Disabled;
+    return ret;
+}
+
+void DrawTexture(gfx::Device& dev, TextureDraw& draw, const gfx::Texture& texture)
+{
+    dev.BeginFrame();
+    dev.ClearColor(gfx::Color::White);
+    draw.program->SetTexture("kTexture", 0, texture);
+    dev.Draw(*draw.program, *draw.geometry, draw.state);
+    dev.EndFrame();
+}
+
+void unit_test_texture_upload_sub_rect()
+{
+    auto dev = CreateDevice(4, 4);
+    auto draw = MakeTextureDraw(*dev);
+
+    gfx::Bitmap<gfx::RGBA> data(4, 4);
+    data.Fill(gfx::Color::Red);
+
+    auto* texture = dev->MakeTexture("tex");
+    texture->SetFilter(gfx::Texture::MinFilter::Nearest);
+    texture->SetFilter(gfx::Texture::MagFilter::Nearest);
+    texture->Upload(data.GetDataPtr(), 4, 4, gfx::Texture::Format::RGBA);
+    DrawTexture(*dev, draw, *texture);
+    TEST_REQUIRE(dev->ReadColorBuffer(4, 4).Compare(gfx::Color::Red));
+
+    // update the top right 2x2 block of texels, x=2, y=0
+    gfx::Bitmap<gfx::RGBA> block(2, 2);
+    block.Fill(gfx::Color::Green);
+    texture->UploadSubRect(block.GetDataPtr(), 2, 0, 2, 2);
+    data.Fill(gfx::URect(2, 0, 2, 2), gfx::Color::Green);
+    TEST_REQUIRE(texture->GetWidth() == 4);
+    TEST_REQUIRE(texture->GetHeight() == 4);
+    DrawTexture(*dev, draw, *texture);
+    TEST_REQUIRE(gfx::Compare(dev->ReadColorBuffer(4, 4), data));
+
+    // a single texel, x=0, y=3
+    gfx::Bitmap<gfx::RGBA> texel(1, 1);
+    texel.Fill(gfx::Color::Blue);
+    texture->UploadSubRect(texel.GetDataPtr(), 0, 3, 1, 1);
+    data.SetPixel(3, 0, gfx::Color::Blue);
+    DrawTexture(*dev, draw, *texture);
+    TEST_REQUIRE(gfx::Compare(dev->ReadColorBuffer(4, 4), data));
+
+    // a full upload with the same size replaces everything.
+    data.Fill(gfx::Color::Yellow);
+    texture->Upload(data.GetDataPtr(), 4, 4, gfx::Texture::Format::RGBA);
+    DrawTexture(*dev, draw, *texture);
+    TEST_REQUIRE(dev->ReadColorBuffer(4, 4).Compare(gfx::Color::Yellow));
+}
+
+void unit_test_texture_lazy_mips()
+{
+    auto dev = CreateDevice(4, 4);
+    auto draw = MakeTextureDraw(*dev);
+
+    gfx::Bitmap<gfx::RGBA> data(4, 4);
+    data.Fill(gfx::Color::Red);
+
+    auto* texture = dev->MakeTexture("tex");
+    texture->SetFilter(gfx::Texture::MinFilter::Linear);
+    texture->Upload(data.GetDataPtr(), 4, 4, gfx::Texture::Format::RGBA);
+    // the upload doesn't generate the mips.
+    TEST_REQUIRE(dev->GetFrameStats().texture_mip_generations == 0);
+
+    // not needed with a non-mip filter.
+    DrawTexture(*dev, draw, *texture);
+    TEST_REQUIRE(dev->GetFrameStats().texture_mip_generations == 0);
+
+    // generated when the texture is first drawn with a mip filter.
+    texture->SetFilter(gfx::Texture::MinFilter::Trilinear);
+    DrawTexture(*dev, draw, *texture);
+    TEST_REQUIRE(dev->GetFrameStats().texture_mip_generations == 1);
+    TEST_REQUIRE(dev->ReadColorBuffer(4, 4).Compare(gfx::Color::Red));
+    // and only once.
+    DrawTexture(*dev, draw, *texture);
+    TEST_REQUIRE(dev->GetFrameStats().texture_mip_generations == 0);
+
+    // an update makes the mips stale but they're again only
+    // generated once they're needed.
+    gfx::Bitmap<gfx::RGBA> block(2, 2);
+    block.Fill(gfx::Color::Green);
+    texture->UploadSubRect(block.GetDataPtr(), 0, 0, 2, 2);
+    texture->SetFilter(gfx::Texture::MinFilter::Linear);
+    DrawTexture(*dev, draw, *texture);
+    TEST_REQUIRE(dev->GetFrameStats().texture_mip_generations == 0);
+    texture->SetFilter(gfx::Texture::MinFilter::Mipmap);
+    DrawTexture(*dev, draw, *texture);
+    TEST_REQUIRE(dev->GetFrameStats().texture_mip_generations == 1);
+
+    // textures that opt out never get mips and are sampled
+    // without them even with a mip filter.
+    texture->SetMipmapPolicy(gfx::Texture::MipmapPolicy::Never);
+    data.Fill(gfx::Color::Blue);
+    texture->Upload(data.GetDataPtr(), 4, 4, gfx::Texture::Format::RGBA);
+    DrawTexture(*dev, draw, *texture);
+    TEST_REQUIRE(dev->GetFrameStats().texture_mip_generations == 0);
+    TEST_REQUIRE(dev->ReadColorBuffer(4, 4).Compare(gfx::Color::Blue));
+}
+
 void unit_test_render_with_multiple_textures()
 {
-    auto dev = gfx::Device::Create(gfx::Device::Type::OpenGL_ES2,
-        std::make_shared<TestContext>(4, 4));
+    auto dev = CreateDevice(4, 4);
 
     // setup 4 textures and the output from fragment shader
     // is then the sum of all of these, i.e. white.
@@ -531,8 +718,7 @@ void main() {
 
 void unit_test_render_set_float_uniforms()
 {
-    auto dev = gfx::Device::Create(gfx::Device::Type::OpenGL_ES2,
-                                   std::make_shared<TestContext>(10, 10));
+    auto dev = CreateDevice(10, 10);
 
 
     auto* geom = dev->MakeGeometry("geom");
@@ -654,8 +840,7 @@ void main() {
 
 void unit_test_render_set_int_uniforms()
 {
-    auto dev = gfx::Device::Create(gfx::Device::Type::OpenGL_ES2,
-                                   std::make_shared<TestContext>(10, 10));
+    auto dev = CreateDevice(10, 10);
 
     auto *geom = dev->MakeGeometry("geom");
     const gfx::Vertex verts[] = {
@@ -740,8 +925,7 @@ void main() {
 }
 void unit_test_render_set_matrix2x2_uniform()
 {
-    auto dev = gfx::Device::Create(gfx::Device::Type::OpenGL_ES2,
-                                   std::make_shared<TestContext>(10, 10));
+    auto dev = CreateDevice(10, 10);
     auto* geom = dev->MakeGeometry("geom");
     const gfx::Vertex verts[] = {
             { {-1,  1}, {0, 1} },
@@ -807,8 +991,7 @@ void main() {
 
 void unit_test_render_set_matrix3x3_uniform()
 {
-    auto dev = gfx::Device::Create(gfx::Device::Type::OpenGL_ES2,
-                                   std::make_shared<TestContext>(10, 10));
+    auto dev = CreateDevice(10, 10);
     auto* geom = dev->MakeGeometry("geom");
     const gfx::Vertex verts[] = {
             { {-1,  1}, {0, 1} },
@@ -874,8 +1057,7 @@ void main() {
 
 void unit_test_render_set_matrix4x4_uniform()
 {
-    auto dev = gfx::Device::Create(gfx::Device::Type::OpenGL_ES2,
-                                   std::make_shared<TestContext>(10, 10));
+    auto dev = CreateDevice(10, 10);
     auto* geom = dev->MakeGeometry("geom");
     const gfx::Vertex verts[] = {
             { {-1,  1}, {0, 1} },
@@ -945,7 +1127,7 @@ void unit_test_uniform_sampler_optimize_bug()
 {
     // shader code doesn't actually use the material, the sampler/uniform location
     // is thus -1 and no texture will be set.
-    auto dev = gfx::Device::Create(gfx::Device::Type::OpenGL_ES2, std::make_shared<TestContext>(10, 10));
+    auto dev = CreateDevice(10, 10);
     dev->BeginFrame();
     dev->ClearColor(gfx::Color::Red);
 
@@ -1010,6 +1192,388 @@ void main() {
     dev->CleanGarbage(120);
 }
 
+void unit_test_garbage_collection()
+{
+    auto dev = CreateDevice(10, 10);
+
+    dev->MakeGeometry("geom");
+    dev->MakeShader("shader");
+    dev->MakeProgram("program");
+    dev->MakeTexture("texture");
+    dev->MakeTexture("gc-texture")->EnableGarbageCollection(true);
+
+    // nothing has expired yet.
+    dev->BeginFrame();
+    dev->EndFrame();
+    dev->CleanGarbage(2);
+    TEST_REQUIRE(dev->FindGeometry("geom"));
+    TEST_REQUIRE(dev->FindShader("shader"));
+    TEST_REQUIRE(dev->FindProgram("program"));
+    TEST_REQUIRE(dev->FindTexture("texture"));
+    TEST_REQUIRE(dev->FindTexture("gc-texture"));
+
+    dev->BeginFrame();
+    dev->EndFrame();
+    dev->CleanGarbage(2);
+    TEST_REQUIRE(dev->FindGeometry("geom") == nullptr);
+    TEST_REQUIRE(dev->FindShader("shader") == nullptr);
+    TEST_REQUIRE(dev->FindProgram("program") == nullptr);
+    TEST_REQUIRE(dev->FindTexture("gc-texture") == nullptr);
+    // not eligible for garbage collection.
+    TEST_REQUIRE(dev->FindTexture("texture"));
+
+    // replacing a resource with the same name must not leave
+    // the old resource in the garbage list.
+    dev->MakeGeometry("geom");
+    dev->MakeGeometry("geom");
+    dev->BeginFrame();
+    dev->EndFrame();
+    dev->BeginFrame();
+    dev->EndFrame();
+    dev->CleanGarbage(2);
+    TEST_REQUIRE(dev->FindGeometry("geom") == nullptr);
+}
+
+void unit_test_framebuffer()
+{
+    auto dev = CreateDevice(10, 10);
+
+    TEST_REQUIRE(dev->FindFrameBuffer("fbo") == nullptr);
+    auto* fbo = dev->MakeFrameBuffer("fbo");
+    TEST_REQUIRE(fbo);
+    TEST_REQUIRE(dev->FindFrameBuffer("fbo") == fbo);
+
+    gfx::FrameBuffer::Config conf;
+    conf.width   = 20;
+    conf.height  = 20;
+    conf.stencil = true;
+    fbo->SetConfig(conf);
+
+    dev->BeginFrame();
+    dev->ClearColor(gfx::Color::Red);
+    TEST_REQUIRE(dev->SetFrameBuffer(fbo));
+    TEST_REQUIRE(fbo->IsValid());
+    TEST_REQUIRE(fbo->GetColorTexture());
+    TEST_REQUIRE(fbo->GetColorTexture()->GetWidth() == 20);
+    TEST_REQUIRE(fbo->GetColorTexture()->GetHeight() == 20);
+    dev->ClearColor(gfx::Color::Green);
+    dev->ClearStencil(1);
+
+    // read the frame buffer contents.
+    auto bmp = dev->ReadColorBuffer(20, 20);
+    TEST_REQUIRE(bmp.Compare(gfx::Color::Green));
+
+    // async read. poll until the read completes.
+    const auto handle = dev->ReadColorBufferAsync(0, 0, 20, 20);
+    gfx::Bitmap<gfx::RGBA> async;
+    while (!dev->PollColorBufferRead(handle, &async))
+        ;
+    TEST_REQUIRE(async.GetWidth() == 20);
+    TEST_REQUIRE(async.GetHeight() == 20);
+    TEST_REQUIRE(async.Compare(gfx::Color::Green));
+
+    // back to the default target which should be unchanged.
+    TEST_REQUIRE(dev->SetFrameBuffer(nullptr));
+    bmp = dev->ReadColorBuffer(10, 10);
+    TEST_REQUIRE(bmp.Compare(gfx::Color::Red));
+    dev->EndFrame();
+
+    dev->DeleteFrameBuffers();
+    TEST_REQUIRE(dev->FindFrameBuffer("fbo") == nullptr);
+}
+
+void unit_test_frame_stats()
+{
+    auto dev = CreateDevice(10, 10);
+    dev->BeginFrame();
+    TEST_REQUIRE(dev->GetFrameStats().draw_calls == 0);
+    TEST_REQUIRE(dev->GetFrameStats().resources_created == 0);
+
+    auto* geom = dev->MakeGeometry("geom");
+    const gfx::Vertex verts[] = {
+        { {-1,  1}, {0, 1} },
+        { {-1, -1}, {0, 0} },
+        { { 1, -1}, {1, 0} },
+
+        { {-1,  1}, {0, 1} },
+        { { 1, -1}, {1, 0} },
+        { { 1,  1}, {1, 1} }
+    };
+    geom->SetVertexBuffer(verts, 6);
+    geom->AddDrawCmd(gfx::Geometry::DrawType::Triangles);
+
+    const std::string& fssrc =
+R"(#version 100
+precision mediump float;
+uniform float kValue;
+void main() {
+  gl_FragColor = vec4(kValue);
+})";
+
+    const std::string& vssrc =
+R"(#version 100
+attribute vec2 aPosition;
+void main() {
+  gl_Position = vec4(aPosition.xy, 1.0, 1.0);
+})";
+    auto* vs = dev->MakeShader("vert");
+    auto* fs = dev->MakeShader("frag");
+    TEST_REQUIRE(vs->CompileSource(vssrc));
+    TEST_REQUIRE(fs->CompileSource(fssrc));
+    std::vector<const gfx::Shader*> shaders;
+    shaders.push_back(vs);
+    shaders.push_back(fs);
+
+    auto* prog = dev->MakeProgram("prog");
+    TEST_REQUIRE(prog->Build(shaders));
+    TEST_REQUIRE(dev->GetFrameStats().resources_created == 4);
+
+    gfx::Device::State state;
+    state.blending = gfx::Device::State::BlendOp::None;
+    state.bWriteColor = true;
+    state.viewport = gfx::IRect(0, 0, 10, 10);
+    state.stencil_func = gfx::Device::State::StencilFunc::Disabled;
+
+    // the second upload of the same value is skipped.
+    prog->SetUniform("kValue", 1.0f);
+    dev->Draw(*prog, *geom, state);
+    prog->SetUniform("kValue", 1.0f);
+    dev->Draw(*prog, *geom, state);
+    dev->EndFrame();
+
+    // the stats stay around after the frame has ended.
+    auto stats = dev->GetFrameStats();
+    TEST_REQUIRE(stats.draw_calls == 2);
+    TEST_REQUIRE(stats.vertices == 12);
+    TEST_REQUIRE(stats.uniform_uploads == 1);
+    TEST_REQUIRE(stats.uniform_skips == 1);
+    TEST_REQUIRE(stats.program_binds >= 2);
+    TEST_REQUIRE(stats.texture_binds == 0);
+    TEST_REQUIRE(stats.buffer_upload_bytes == 2 * sizeof(verts));
+
+    // a new frame starts from zero.
+    dev->BeginFrame();
+    stats = dev->GetFrameStats();
+    TEST_REQUIRE(stats.draw_calls == 0);
+    TEST_REQUIRE(stats.resources_created == 0);
+    dev->Draw(*prog, *geom, state);
+    TEST_REQUIRE(dev->GetFrameStats().draw_calls == 1);
+    dev->ResetFrameStats();
+    TEST_REQUIRE(dev->GetFrameStats().draw_calls == 0);
+
+    dev->DeleteGeometry("geom");
+    TEST_REQUIRE(dev->GetFrameStats().resources_destroyed == 1);
+    dev->EndFrame();
+}
+
+void unit_test_timer()
+{
+    auto dev = CreateDevice(10, 10);
+
+    dev->BeginFrame();
+    const auto first = dev->BeginTimer();
+    dev->ClearColor(gfx::Color::Red);
+    dev->EndTimer(first);
+    // timers can be run back to back.
+    const auto second = dev->BeginTimer();
+    dev->ClearColor(gfx::Color::Green);
+    dev->EndTimer(second);
+    TEST_REQUIRE(first != second);
+    dev->EndFrame();
+
+    // whether this is the GPU timer or the CPU fallback the result
+    // is either some non-negative time or -1 when the measurement
+    // was lost.
+    double seconds = 0.0;
+    while (!dev->PollTimer(first, &seconds))
+        ;
+    TEST_REQUIRE(seconds >= 0.0 || seconds == -1.0);
+    while (!dev->PollTimer(second, &seconds))
+        ;
+    TEST_REQUIRE(seconds >= 0.0 || seconds == -1.0);
+    // once picked up the timer is gone.
+    TEST_REQUIRE(!dev->PollTimer(first, &seconds));
+
+    // the CPU fallback always has a result and it must
+    // include the known work done between begin and end.
+    TestNoTimerQueries = true;
+    dev = CreateDevice(10, 10);
+    TestNoTimerQueries = false;
+
+    dev->BeginFrame();
+    const auto timer = dev->BeginTimer();
+    for (int i=0; i<100; ++i)
+        dev->ClearColor(i % 2 ? gfx::Color::Red : gfx::Color::Green);
+    const auto sleep = std::chrono::milliseconds(5);
+    std::this_thread::sleep_for(sleep);
+    dev->EndTimer(timer);
+    dev->EndFrame();
+
+    seconds = 0.0;
+    while (!dev->PollTimer(timer, &seconds))
+        ;
+    TEST_REQUIRE(seconds > 0.0);
+    // the threaded device runs the timer on the render thread
+    // so the sleep on this thread isn't necessarily included.
+    if (!TestThreadedDevice)
+        TEST_REQUIRE(seconds >= std::chrono::duration<double>(sleep).count());
+}
+
+// threaded device specifics. the rest of the tests above are also run
+// against the threaded device.
+void unit_test_threaded_device()
+{
+    auto dev = CreateDevice(10, 10);
+
+    auto* geom = dev->MakeGeometry("geom");
+    const gfx::Vertex verts[] = {
+        { {-1,  1}, {0, 1} },
+        { {-1, -1}, {0, 0} },
+        { { 1, -1}, {1, 0} },
+
+        { {-1,  1}, {0, 1} },
+        { { 1, -1}, {1, 0} },
+        { { 1,  1}, {1, 1} }
+    };
+    geom->SetVertexBuffer(verts, 6);
+    geom->AddDrawCmd(gfx::Geometry::DrawType::Triangles);
+
+    const std::string& fssrc =
+R"(#version 100
+precision mediump float;
+uniform vec4 kColor;
+void main() {
+  gl_FragColor = kColor;
+})";
+
+    const std::string& vssrc =
+R"(#version 100
+attribute vec2 aPosition;
+void main() {
+  gl_Position = vec4(aPosition.xy, 1.0, 1.0);
+})";
+    auto* vs = dev->MakeShader("vert");
+    auto* fs = dev->MakeShader("frag");
+    TEST_REQUIRE(vs->CompileSource(vssrc));
+    TEST_REQUIRE(fs->CompileSource(fssrc));
+    std::vector<const gfx::Shader*> shaders;
+    shaders.push_back(vs);
+    shaders.push_back(fs);
+
+    auto* prog = dev->MakeProgram("prog");
+    TEST_REQUIRE(prog->Build(shaders));
+
+    gfx::Device::State state;
+    state.blending = gfx::Device::State::BlendOp::None;
+    state.bWriteColor = true;
+    state.viewport = gfx::IRect(0, 0, 10, 10);
+    state.stencil_func = gfx::Device::State::StencilFunc::Disabled;
+
+    // the uniform changes are batched with the draw and only the
+    // latest value is what the draw sees.
+    dev->BeginFrame();
+    dev->ClearColor(gfx::Color::Black);
+    prog->SetUniform("kColor", 1.0f, 0.0f, 0.0f, 1.0f);
+    prog->SetUniform("kColor", 0.0f, 1.0f, 0.0f, 1.0f);
+    dev->Draw(*prog, *geom, state);
+    dev->EndFrame();
+    TEST_REQUIRE(dev->ReadColorBuffer(10, 10).Compare(gfx::Color::Green));
+
+    // state set on a program that isn't drawn with during the frame
+    // must not get lost when the frame is submitted.
+    prog->SetUniform("kColor", 0.0f, 0.0f, 1.0f, 1.0f);
+    dev->BeginFrame();
+    dev->EndFrame();
+    dev->BeginFrame();
+    dev->ClearColor(gfx::Color::Black);
+    dev->Draw(*prog, *geom, state);
+    dev->EndFrame();
+    TEST_REQUIRE(dev->ReadColorBuffer(10, 10).Compare(gfx::Color::Blue));
+
+    // the frame stats are those of the latest frame completed by the
+    // render thread. the read waits for the render thread.
+    dev->BeginFrame();
+    dev->Draw(*prog, *geom, state);
+    dev->Draw(*prog, *geom, state);
+    dev->EndFrame();
+    dev->ReadColorBuffer(1, 1);
+    TEST_REQUIRE(dev->GetFrameStats().draw_calls == 2);
+    TEST_REQUIRE(dev->GetFrameStats().vertices == 12);
+    // the frame being recorded doesn't show up before it's done.
+    dev->BeginFrame();
+    dev->Draw(*prog, *geom, state);
+    TEST_REQUIRE(dev->GetFrameStats().draw_calls == 2);
+    // an explicit reset applies to the frame being recorded.
+    dev->ResetFrameStats();
+    TEST_REQUIRE(dev->GetFrameStats().draw_calls == 2);
+    dev->Draw(*prog, *geom, state);
+    dev->EndFrame();
+    dev->ReadColorBuffer(1, 1);
+    TEST_REQUIRE(dev->GetFrameStats().draw_calls == 1);
+    TEST_REQUIRE(dev->GetFrameStats().vertices == 6);
+
+    // resources can be deleted while there are still recorded commands
+    // that refer to them. the retired proxies must stay alive until the
+    // render thread has executed the commands.
+    dev->BeginFrame();
+    dev->ClearColor(gfx::Color::Black);
+    prog->SetUniform("kColor", 1.0f, 1.0f, 1.0f, 1.0f);
+    dev->Draw(*prog, *geom, state);
+    dev->DeleteGeometry("geom");
+    dev->DeleteProgram("prog");
+    TEST_REQUIRE(dev->FindGeometry("geom") == nullptr);
+    TEST_REQUIRE(dev->FindProgram("prog") == nullptr);
+    dev->EndFrame();
+    // the next submit deletes the garbage from the previous frame.
+    dev->BeginFrame();
+    dev->EndFrame();
+    TEST_REQUIRE(dev->ReadColorBuffer(10, 10).Compare(gfx::Color::White));
+
+    // the async reads complete in the order of the frames even when
+    // the main thread has already moved on.
+    dev->BeginFrame();
+    dev->ClearColor(gfx::Color::Green);
+    const auto first = dev->ReadColorBufferAsync(0, 0, 10, 10);
+    dev->EndFrame();
+    dev->BeginFrame();
+    dev->ClearColor(gfx::Color::Red);
+    const auto second = dev->ReadColorBufferAsync(0, 0, 10, 10);
+    dev->EndFrame();
+    TEST_REQUIRE(first != second);
+
+    gfx::Bitmap<gfx::RGBA> bmp;
+    while (!dev->PollColorBufferRead(second, &bmp))
+        ;
+    TEST_REQUIRE(bmp.Compare(gfx::Color::Red));
+    while (!dev->PollColorBufferRead(first, &bmp))
+        ;
+    TEST_REQUIRE(bmp.Compare(gfx::Color::Green));
+    // once picked up the read is gone.
+    TEST_REQUIRE(!dev->PollColorBufferRead(first, &bmp));
+
+    // a read recorded but not yet submitted is submitted by the poll.
+    dev->ClearColor(gfx::Color::Blue);
+    const auto third = dev->ReadColorBufferAsync(0, 0, 10, 10);
+    while (!dev->PollColorBufferRead(third, &bmp))
+        ;
+    TEST_REQUIRE(bmp.Compare(gfx::Color::Blue));
+
+    // shutting down with recorded commands, pending reads and timers
+    // must complete the commands and stop the render thread cleanly.
+    dev->BeginFrame();
+    dev->ClearColor(gfx::Color::White);
+    dev->ReadColorBufferAsync(0, 0, 10, 10);
+    dev->EndTimer(dev->BeginTimer());
+    dev.reset();
+
+    // the context is usable on this thread again after the device is gone.
+    auto next = CreateDevice(10, 10);
+    next->BeginFrame();
+    next->ClearColor(gfx::Color::Red);
+    next->EndFrame();
+    TEST_REQUIRE(next->ReadColorBuffer(10, 10).Compare(gfx::Color::Red));
+}
+
 int test_main(int argc, char* argv[])
 {
     unit_test_device();
@@ -1019,6 +1583,33 @@ int test_main(int argc, char* argv[])
 
     unit_test_render_color_only();
     unit_test_render_with_single_texture();
+    unit_test_texture_upload_sub_rect();
+    unit_test_render_with_multiple_textures();
+    unit_test_render_set_float_uniforms();
+    unit_test_render_set_int_uniforms();
+    unit_test_render_set_matrix2x2_uniform();
+    unit_test_render_set_matrix3x3_uniform();
+    unit_test_render_set_matrix4x4_uniform();
+    unit_test_uniform_sampler_optimize_bug();
+    unit_test_garbage_collection();
+    unit_test_framebuffer();
+    unit_test_frame_stats();
+    unit_test_texture_lazy_mips();
+    unit_test_timer();
+
+    // same again with the threaded device. the tests that check the
+    // frame stats are skipped since the threaded device only reports
+    // the stats of the latest frame completed on the render thread.
+    // unit_test_threaded_device checks those.
+    TestThreadedDevice = true;
+    unit_test_device();
+    unit_test_shader();
+    unit_test_texture();
+    unit_test_program();
+
+    unit_test_render_color_only();
+    unit_test_render_with_single_texture();
+    unit_test_texture_upload_sub_rect();
     unit_test_render_with_multiple_textures();
     unit_test_render_set_float_uniforms();
     unit_test_render_set_int_uniforms();
@@ -1026,5 +1617,9 @@ int test_main(int argc, char* argv[])
     unit_test_render_set_matrix3x3_uniform();
     unit_test_render_set_matrix4x4_uniform();
     unit_test_uniform_sampler_optimize_bug();
+    unit_test_garbage_collection();
+    unit_test_framebuffer();
+    unit_test_timer();
+    unit_test_threaded_device();
     return 0;
 }
@@ -18,6 +18,7 @@
 
 #include "base/test_minimal.h"
 #include "base/test_float.h"
+#include "base/threadpool.h"
 #include "data/json.h"
 #include "graphics/drawable.h"
 
@@ -347,11 +348,67 @@ void unit_test_particle_engine_data()
     }
 }
 
+void unit_test_particle_engine_parallel()
+{
+    gfx::KinematicsParticleEngineClass::Params params;
+    params.motion   = gfx::KinematicsParticleEngineClass::Motion::Linear;
+    params.mode     = gfx::KinematicsParticleEngineClass::SpawnPolicy::Maintain;
+    params.boundary = gfx::KinematicsParticleEngineClass::BoundaryPolicy::Kill;
+    params.num_particles = 50.0f;
+    params.min_lifetime  = 0.1f;
+    params.max_lifetime  = 0.5f;
+    params.min_velocity  = 1.0f;
+    params.max_velocity  = 2.0f;
+    params.direction_sector_size = 3.0f;
+    gfx::KinematicsParticleEngineClass klass(params);
+
+    using State = gfx::KinematicsParticleEngineClass::InstanceState;
+    // the particles keep dying and new ones with random parameters
+    // get created. the results must not depend on which thread
+    // updates which engine.
+    const auto& simulate = [&klass](base::ThreadPool* pool) {
+        std::vector<State> states(64);
+        for (size_t i=0; i<states.size(); ++i)
+        {
+            states[i].random.seed(i);
+            klass.Restart(states[i]);
+        }
+        for (int frame=0; frame<60; ++frame)
+        {
+            const auto& update = [&](size_t begin, size_t end, unsigned) {
+                for (size_t i=begin; i<end; ++i)
+                    klass.Update(states[i], 1.0f/60.0f);
+            };
+            if (pool)
+                pool->ParallelFor(states.size(), 1, update);
+            else update(0, states.size(), 0);
+        }
+        return states;
+    };
+    base::ThreadPool pool(4);
+    const auto& serial   = simulate(nullptr);
+    const auto& parallel = simulate(&pool);
+    TEST_REQUIRE(serial.size() == parallel.size());
+    for (size_t i=0; i<serial.size(); ++i)
+    {
+        const auto& a = serial[i].particles;
+        const auto& b = parallel[i].particles;
+        TEST_REQUIRE(a.size() == b.size());
+        for (size_t j=0; j<a.size(); ++j)
+        {
+            TEST_REQUIRE(a[j].position   == b[j].position);
+            TEST_REQUIRE(a[j].direction  == b[j].direction);
+            TEST_REQUIRE(a[j].lifetime   == b[j].lifetime);
+            TEST_REQUIRE(a[j].randomizer == b[j].randomizer);
+        }
+    }
+}
 
 int test_main(int argc, char* argv[])
 {
     unit_test_polygon_data();
     unit_test_polygon_vertex_operations();
     unit_test_particle_engine_data();
+    unit_test_particle_engine_parallel();
     return 0;
 }
\ No newline at end of file
@@ -22,8 +22,12 @@
 
 #include <iostream>
 #include <unordered_map>
+#include <unordered_set>
 #include <string>
 #include <any>
+#include <vector>
+#include <cstdint>
+#include <cstring>
 
 #include "base/test_minimal.h"
 #include "base/test_float.h"
@@ -36,6 +40,9 @@
 #include "graphics/program.h"
 #include "graphics/texture.h"
 #include "graphics/geometry.h"
+#include "graphics/painter.h"
+#include "graphics/framebuffer.h"
+#include "graphics/transform.h"
 
 class TestShader : public gfx::Shader
 {
@@ -87,7 +94,30 @@ public:
         mWidth  = xres;
         mHeight = yres;
         mFormat = format;
+        const auto* ptr = (const std::uint8_t*)bytes;
+        if (ptr)
+            mPixels.assign(ptr, ptr + xres * yres * GetBytesPerPixel(format));
+        else mPixels.assign(xres * yres * GetBytesPerPixel(format), 0);
     }
+    virtual void UploadSubRect(const void* bytes, unsigned x, unsigned y,
+                               unsigned width, unsigned height) override
+    {
+        TEST_REQUIRE(x + width <= mWidth && y + height <= mHeight);
+        const auto bpp = GetBytesPerPixel(mFormat);
+        const auto* ptr = (const std::uint8_t*)bytes;
+        for (unsigned row=0; row<height; ++row)
+        {
+            std::memcpy(&mPixels[((y + row) * mWidth + x) * bpp],
+                        ptr + row * width * bpp, width * bpp);
+        }
+        ++mSubRectUploads;
+    }
+    unsigned GetNumSubRectUploads() const
+    { return mSubRectUploads; }
+    virtual void SetMipmapPolicy(MipmapPolicy policy) override
+    { mMipmaps = policy; }
+    virtual MipmapPolicy GetMipmapPolicy() const override
+    { return mMipmaps; }
     virtual unsigned GetWidth() const override
     { return mWidth; }
     virtual unsigned GetHeight() const override
@@ -96,7 +126,13 @@ public:
     { return mFormat; }
     virtual void EnableGarbageCollection(bool gc) override
     {}
+    const std::uint8_t* GetPixel(unsigned x, unsigned y) const
+    { return &mPixels[(y * mWidth + x) * GetBytesPerPixel(mFormat)]; }
+    const std::vector<std::uint8_t>& GetPixels() const
+    { return mPixels; }
 private:
+    std::vector<std::uint8_t> mPixels;
+    unsigned mSubRectUploads = 0;
     unsigned mWidth  = 0;
     unsigned mHeight = 0;
     Format mFormat  = Format::Grayscale;
@@ -104,6 +140,7 @@ private:
     Wrapping mWrapY = Wrapping::Repeat;
     MinFilter mMinFilter = MinFilter::Default;
     MagFilter mMagFilter = MagFilter::Default;
+    MipmapPolicy mMipmaps = MipmapPolicy::OnDemand;
 };
 
 class TestProgram : public gfx::Program
@@ -224,17 +261,50 @@ private:
 class TestGeometry : public gfx::Geometry
 {
 public:
+    struct DrawCmd {
+        DrawType type;
+        size_t offset = 0;
+        size_t count  = 0;
+    };
     virtual void ClearDraws() override
-    {}
+    { mDraws.clear(); }
     virtual void AddDrawCmd(DrawType type) override
-    {}
+    { mDraws.push_back({type, 0, mVertexCount}); }
     virtual void AddDrawCmd(DrawType type, size_t offset, size_t count) override
-    {}
+    { mDraws.push_back({type, offset, count}); }
     virtual void SetVertexBuffer(std::unique_ptr<gfx::VertexBuffer> buffer) override
-    {}
+    { mVertexCount = buffer->GetCount(); }
     virtual void SetVertexLayout(const gfx::VertexLayout& layout) override
-    {}
+    { mLayout = layout; }
+
+    size_t GetVertexCount() const
+    { return mVertexCount; }
+    size_t GetNumDraws() const
+    { return mDraws.size(); }
+    const DrawCmd& GetDraw(size_t index) const
+    { return mDraws[index]; }
+    const gfx::VertexLayout& GetLayout() const
+    { return mLayout; }
+private:
+    std::vector<DrawCmd> mDraws;
+    gfx::VertexLayout mLayout;
+    size_t mVertexCount = 0;
+};
+
+class TestFrameBuffer : public gfx::FrameBuffer
+{
+public:
+    virtual void SetConfig(const Config& config) override
+    { mConfig = config; }
+    virtual const Config& GetConfig() const override
+    { return mConfig; }
+    virtual gfx::Texture* GetColorTexture() override
+    { return &mTexture; }
+    virtual bool IsValid() const override
+    { return true; }
 private:
+    Config mConfig;
+    TestTexture mTexture;
 };
 
 class TestDevice : public gfx::Device
@@ -243,7 +313,9 @@ public:
     virtual void ClearColor(const gfx::Color4f& color) override
     {}
     virtual void ClearStencil(int value) override
-    {}
+    { mStencilClears.push_back(gfx::IRect()); }
+    virtual void ClearStencil(int value, const gfx::IRect& rect) override
+    { mStencilClears.push_back(rect); }
 
     virtual void SetDefaultTextureFilter(MinFilter filter) override
     {}
@@ -267,19 +339,31 @@ public:
     }
     virtual gfx::Program* FindProgram(const std::string& name) override
     {
-        return nullptr;
+        auto it = mPrograms.find(name);
+        if (it == mPrograms.end())
+            return nullptr;
+        return it->second.get();
     }
     virtual gfx::Program* MakeProgram(const std::string& name) override
     {
-        return nullptr;
+        auto program = std::make_unique<TestProgram>();
+        auto* ret = program.get();
+        mPrograms[name] = std::move(program);
+        return ret;
     }
     virtual gfx::Geometry* FindGeometry(const std::string& name) override
     {
-        return nullptr;
+        auto it = mGeometries.find(name);
+        if (it == mGeometries.end())
+            return nullptr;
+        return it->second.get();
     }
     virtual gfx::Geometry* MakeGeometry(const std::string& name) override
     {
-        return nullptr;
+        auto geom = std::make_unique<TestGeometry>();
+        auto* ret = geom.get();
+        mGeometries[name] = std::move(geom);
+        return ret;
     }
     virtual gfx::Texture* FindTexture(const std::string& name) override
     {
@@ -303,18 +387,57 @@ public:
     virtual void DeleteGeometries() override
     {}
     virtual void DeleteTextures() override
+    { mTextureIndexMap.clear(); }
+    virtual void DeleteShader(const std::string&) override
     {}
+    virtual void DeleteProgram(const std::string&) override
+    {}
+    virtual void DeleteGeometry(const std::string&) override
+    {}
+    virtual void DeleteTexture(const std::string& name) override
+    { mTextureIndexMap.erase(name); }
+    virtual gfx::FrameBuffer* FindFrameBuffer(const std::string& name) override
+    {
+        auto it = mFrameBuffers.find(name);
+        if (it == mFrameBuffers.end())
+            return nullptr;
+        return it->second.get();
+    }
+    virtual gfx::FrameBuffer* MakeFrameBuffer(const std::string& name) override
+    {
+        auto fbo = std::make_unique<TestFrameBuffer>();
+        auto* ret = fbo.get();
+        mFrameBuffers[name] = std::move(fbo);
+        return ret;
+    }
+    virtual void DeleteFrameBuffers() override
+    { mFrameBuffers.clear(); }
+    virtual bool SetFrameBuffer(gfx::FrameBuffer* fbo) override
+    { return true; }
 
     virtual void Draw(const gfx::Program& program, const gfx::Geometry& geometry, const State& state) override
-    {}
+    {
+        mDrawStates.push_back(state);
+        mStats.draw_calls++;
+        mStats.vertices += static_cast<const TestGeometry&>(geometry).GetVertexCount();
+    }
 
     virtual Type GetDeviceType() const override
     { return Type::OpenGL_ES2; }
-    virtual void CleanGarbage(size_t) override
+    virtual std::size_t GetFrameNumber() const override
+    { return mFrameNumber; }
+    virtual void CleanGarbage(size_t, unsigned) override
     {}
 
+    virtual FrameStats GetFrameStats() const override
+    { return mStats; }
+    virtual void ResetFrameStats() override
+    { mStats = FrameStats(); }
     virtual void BeginFrame() override
-    {}
+    {
+        ++mFrameNumber;
+        mStats = FrameStats();
+    }
     virtual void EndFrame(bool display) override
     {}
     virtual gfx::Bitmap<gfx::RGBA> ReadColorBuffer(unsigned width, unsigned height) const override
@@ -332,12 +455,38 @@ public:
         bitmap.Fill(gfx::Color::DarkGreen);
         return bitmap;
     }
+    virtual unsigned ReadColorBufferAsync(unsigned x, unsigned y,
+                                          unsigned width, unsigned height) override
+    { return 0; }
+    virtual bool PollColorBufferRead(unsigned handle, gfx::Bitmap<gfx::RGBA>* bitmap) override
+    { return false; }
+    virtual unsigned BeginTimer() override
+    {
+        mRunningTimers.insert(++mTimerHandle);
+        return mTimerHandle;
+    }
+    virtual void EndTimer(unsigned handle) override
+    {
+        mRunningTimers.erase(handle);
+        mEndedTimers.push_back({handle, mTimerResult});
+    }
+    virtual bool PollTimer(unsigned handle, double* seconds) override
+    {
+        auto it = mCompletedTimers.find(handle);
+        if (it == mCompletedTimers.end())
+            return false;
+        *seconds = it->second;
+        mCompletedTimers.erase(it);
+        return true;
+    }
 
     const TestTexture& GetTexture(size_t index) const
     {
         TEST_REQUIRE(index < mTextures.size());
         return *mTextures[index].get();
     }
+    size_t GetNumTextures() const
+    { return mTextures.size(); }
 
     const TestShader& GetShader(size_t index) const
     {
@@ -351,6 +500,35 @@ public:
         mTextures.clear();
         mShaderIndexMap.clear();
         mShaders.clear();
+        mGeometries.clear();
+    }
+    size_t GetNumGeometries() const
+    { return mGeometries.size(); }
+    size_t GetNumRunningTimers() const
+    { return mRunningTimers.size(); }
+    // set the result that the timers ended after this call will report.
+    void SetTimerResult(double seconds)
+    { mTimerResult = seconds; }
+    // make the results of the oldest count ended timers available.
+    void CompleteTimers(size_t count)
+    {
+        for (size_t i=0; i<count && !mEndedTimers.empty(); ++i)
+        {
+            mCompletedTimers[mEndedTimers.front().first] = mEndedTimers.front().second;
+            mEndedTimers.erase(mEndedTimers.begin());
+        }
+    }
+    // the device state of each draw call so far.
+    const std::vector<State>& GetDrawStates() const
+    { return mDrawStates; }
+    // the rects of the stencil clears so far. an empty rect
+    // is a clear of the whole stencil buffer.
+    const std::vector<gfx::IRect>& GetStencilClears() const
+    { return mStencilClears; }
+    void ClearDrawLog()
+    {
+        mDrawStates.clear();
+        mStencilClears.clear();
     }
 
 private:
@@ -359,6 +537,22 @@ private:
 
     std::unordered_map<std::string, std::size_t> mShaderIndexMap;
     std::vector<std::unique_ptr<TestShader>> mShaders;
+
+    std::unordered_map<std::string, std::unique_ptr<TestGeometry>> mGeometries;
+
+    std::unordered_map<std::string, std::unique_ptr<TestProgram>> mPrograms;
+    std::unordered_map<std::string, std::unique_ptr<TestFrameBuffer>> mFrameBuffers;
+
+    std::unordered_set<unsigned> mRunningTimers;
+    unsigned mTimerHandle = 0;
+    double mTimerResult = 0.0;
+    std::vector<std::pair<unsigned, double>> mEndedTimers;
+    std::unordered_map<unsigned, double> mCompletedTimers;
+
+    std::vector<State> mDrawStates;
+    std::vector<gfx::IRect> mStencilClears;
+    std::size_t mFrameNumber = 0;
+    FrameStats mStats;
 };
 
 
@@ -445,22 +639,16 @@ void unit_test_material_uniforms()
         glm::vec2 texture_velocity_xy;
         glm::vec1 texture_velocity_z;
         glm::vec1 gamma;
-        glm::vec1 particle_rotation_flag;
-        glm::vec1 render_points_flag;
         glm::vec1 runtime;
         TEST_REQUIRE(program.GetUniform("kGamma", &gamma));
         TEST_REQUIRE(program.GetUniform("kTextureScale", &texture_scale));
         TEST_REQUIRE(program.GetUniform("kTextureVelocityXY", &texture_velocity_xy));
         TEST_REQUIRE(program.GetUniform("kTextureVelocityZ", &texture_velocity_z));
-        TEST_REQUIRE(program.GetUniform("kApplyRandomParticleRotation", &particle_rotation_flag));
-        TEST_REQUIRE(program.GetUniform("kRenderPoints", &render_points_flag));
         TEST_REQUIRE(program.GetUniform("kRuntime", &runtime));
         TEST_REQUIRE(texture_scale == glm::vec2(2.0f, 3.0f));
         TEST_REQUIRE(texture_velocity_xy == glm::vec2(4.0f, 5.0f));
         TEST_REQUIRE(texture_velocity_z == glm::vec1(-1.0f));
         TEST_REQUIRE(gamma == glm::vec1(2.0f));
-        TEST_REQUIRE(particle_rotation_flag == glm::vec1(0.0f));
-        TEST_REQUIRE(render_points_flag == glm::vec1(0.0f));
         TEST_REQUIRE(runtime == glm::vec1(2.0f));
 
     }
@@ -492,24 +680,18 @@ void unit_test_material_uniforms()
         glm::vec2 texture_velocity_xy;
         glm::vec1 texture_velocity_z;
         glm::vec1 gamma;
-        glm::vec1 particle_rotation_flag;
-        glm::vec1 render_points_flag;
         glm::vec1 runtime;
         gfx::Color4f base_color;
         TEST_REQUIRE(program.GetUniform("kGamma", &gamma));
         TEST_REQUIRE(program.GetUniform("kTextureScale", &texture_scale));
         TEST_REQUIRE(program.GetUniform("kTextureVelocityXY", &texture_velocity_xy));
         TEST_REQUIRE(program.GetUniform("kTextureVelocityZ", &texture_velocity_z));
-        TEST_REQUIRE(program.GetUniform("kApplyRandomParticleRotation", &particle_rotation_flag));
-        TEST_REQUIRE(program.GetUniform("kRenderPoints", &render_points_flag));
         TEST_REQUIRE(program.GetUniform("kRuntime", &runtime));
         TEST_REQUIRE(program.GetUniform("kBaseColor", &base_color));
         TEST_REQUIRE(texture_scale == glm::vec2(2.0f, 3.0f));
         TEST_REQUIRE(texture_velocity_xy == glm::vec2(4.0f, 5.0f));
         TEST_REQUIRE(texture_velocity_z == glm::vec1(-1.0f));
         TEST_REQUIRE(gamma == glm::vec1(2.0f));
-        TEST_REQUIRE(particle_rotation_flag == glm::vec1(0.0f));
-        TEST_REQUIRE(render_points_flag == glm::vec1(0.0f));
         TEST_REQUIRE(runtime == glm::vec1(2.0f));
         TEST_REQUIRE(base_color == gfx::Color::Green);
 
@@ -600,8 +782,6 @@ void unit_test_material_uniforms()
         glm::vec2 texture_velocity_xy;
         glm::vec1 texture_velocity_z;
         glm::vec1 gamma;
-        glm::vec1 particle_rotation_flag;
-        glm::vec1 render_points_flag;
         glm::vec1 runtime;
         TEST_REQUIRE(program.GetUniform("kGamma", &gamma));
         TEST_REQUIRE(program.GetUniform("kTextureScale", &texture_scale));
@@ -869,14 +1049,122 @@ void unit_test_material_textures()
         test.AddTexture(gfx::CreateTextureFromBitmap(one));
         test.AddTexture(gfx::CreateTextureFromBitmap(two));
 
+        // same size frames are packed into a single atlas texture
+        // and the shader selects the current frame.
+        gfx::MaterialClass::State env;
+        TEST_REQUIRE(test.GetShaderFeatures(env).test(gfx::MaterialClass::ShaderFeature::FrameAtlas));
+
+        TestDevice device;
+        TestProgram program;
+        {
+            env.material_time = 0.0f;
+            test.ApplyDynamicState(env, device, program);
+            const auto& atlas = device.GetTexture(0);
+            // 2 frames in a 2x1 grid with 2px padding.
+            TEST_REQUIRE(atlas.GetWidth() == 24);
+            TEST_REQUIRE(atlas.GetHeight() == 12);
+            // the gutter is too narrow for the lower mip levels.
+            TEST_REQUIRE(atlas.GetMipmapPolicy() == gfx::Texture::MipmapPolicy::Never);
+            // each frame is uploaded straight into its own cell.
+            TEST_REQUIRE(atlas.GetNumSubRectUploads() == 2);
+            TEST_REQUIRE(program.GetTextureBinding(0).unit == 0);
+            TEST_REQUIRE(program.GetTextureBinding(0).texture == &atlas);
+            glm::vec2 grid;
+            TEST_REQUIRE(program.GetUniform("kFrameGrid", &grid));
+            TEST_REQUIRE(grid == glm::vec2(2.0f, 2.0f));
+            glm::vec4 size;
+            TEST_REQUIRE(program.GetUniform("kFrameSize", &size));
+            TEST_REQUIRE(size == glm::vec4(12.0f/24.0f, 1.0f, 10.0f/24.0f, 10.0f/12.0f));
+            glm::vec2 offset;
+            TEST_REQUIRE(program.GetUniform("kFrameOffset", &offset));
+            TEST_REQUIRE(offset == glm::vec2(1.0f/24.0f, 1.0f/12.0f));
+            glm::vec1 fps;
+            TEST_REQUIRE(program.GetUniform("kFps", &fps));
+            TEST_REQUIRE(fps == glm::vec1(1.0f));
+            TEST_REQUIRE(!program.HasUniform("kBlendCoeff"));
+
+            // the frame edges are replicated into the gutter, none of
+            // the gutter is black or the color of the other frame.
+            const auto IsColor = [](const std::uint8_t* p, gfx::Color color) {
+                const gfx::RGB rgb(color);
+                return p[0] == rgb.r && p[1] == rgb.g && p[2] == rgb.b;
+            };
+            for (unsigned y=0; y<12; ++y)
+            {
+                TEST_REQUIRE(IsColor(atlas.GetPixel(0, y), gfx::Color::Red));
+                TEST_REQUIRE(IsColor(atlas.GetPixel(11, y), gfx::Color::Red));
+                TEST_REQUIRE(IsColor(atlas.GetPixel(12, y), gfx::Color::Green));
+                TEST_REQUIRE(IsColor(atlas.GetPixel(23, y), gfx::Color::Green));
+            }
+            for (unsigned x=0; x<24; ++x)
+            {
+                const auto& color = x < 12 ? gfx::Color::Red : gfx::Color::Green;
+                TEST_REQUIRE(IsColor(atlas.GetPixel(x, 0), color));
+                TEST_REQUIRE(IsColor(atlas.GetPixel(x, 11), color));
+            }
+        }
+        program.Clear();
+        {
+            env.material_time = 1.0f;
+            test.ApplyDynamicState(env, device, program);
+            // the atlas is reused, not packed again.
+            TEST_REQUIRE(device.GetNumTextures() == 1);
+            const auto& atlas = device.GetTexture(0);
+            TEST_REQUIRE(atlas.GetNumSubRectUploads() == 2);
+            TEST_REQUIRE(program.GetTextureBinding(0).unit == 0);
+            TEST_REQUIRE(program.GetTextureBinding(0).texture == &atlas);
+        }
+        program.Clear();
+        {
+            // a copy carries over the atlas layout and maps to the same texture.
+            gfx::SpriteClass copy(test);
+            TEST_REQUIRE(copy.GetShaderFeatures(env).test(gfx::MaterialClass::ShaderFeature::FrameAtlas));
+            copy.ApplyDynamicState(env, device, program);
+            TEST_REQUIRE(device.GetNumTextures() == 1);
+            TEST_REQUIRE(program.GetTextureBinding(0).texture == &device.GetTexture(0));
+        }
+        program.Clear();
+        {
+            // the atlas texture is packed again after it has been deleted.
+            device.DeleteTextures();
+            test.ApplyDynamicState(env, device, program);
+            TEST_REQUIRE(device.GetNumTextures() == 2);
+            const auto& atlas = device.GetTexture(1);
+            TEST_REQUIRE(atlas.GetWidth() == 24);
+            TEST_REQUIRE(atlas.GetHeight() == 12);
+            TEST_REQUIRE(atlas.GetNumSubRectUploads() == 2);
+            TEST_REQUIRE(program.GetTextureBinding(0).texture == &atlas);
+        }
+    }
+
+    // 2 textures that can't be packed into an atlas since
+    // the sizes don't match. the frames are selected on the CPU.
+    {
+        gfx::SpriteClass test;
+        test.SetFps(1.0f); // 1 frame per second.
+
+        gfx::RgbBitmap one;
+        one.Resize(10, 10);
+        one.Fill(gfx::Color::Red);
+        gfx::RgbBitmap two;
+        two.Resize(20, 20);
+        two.Fill(gfx::Color::Green);
+
+        test.AddTexture(gfx::CreateTextureFromBitmap(one));
+        test.AddTexture(gfx::CreateTextureFromBitmap(two));
+
+        gfx::MaterialClass::State env;
+        TEST_REQUIRE(!test.GetShaderFeatures(env).test(gfx::MaterialClass::ShaderFeature::FrameAtlas));
+
         TestDevice device;
         TestProgram program;
         {
-            gfx::MaterialClass::State env;
             env.material_time = 0.0f;
             test.ApplyDynamicState(env, device, program);
             const auto& tex0 = device.GetTexture(0);
             const auto& tex1 = device.GetTexture(1);
+            TEST_REQUIRE(tex0.GetWidth() == 10);
+            TEST_REQUIRE(tex1.GetWidth() == 20);
             TEST_REQUIRE(program.GetTextureBinding(0).unit == 0);
             TEST_REQUIRE(program.GetTextureBinding(0).texture == &tex0);
             TEST_REQUIRE(program.GetTextureBinding(1).unit == 1);
@@ -884,7 +1172,6 @@ void unit_test_material_textures()
         }
         program.Clear();
         {
-            gfx::MaterialClass::State env;
             env.material_time = 1.0f;
             test.ApplyDynamicState(env, device, program);
             const auto& tex0 = device.GetTexture(0);
@@ -969,7 +1256,7 @@ void unit_test_material_uniform_folding()
         klass.SetGamma(0.8f);
         klass.SetBaseColor(gfx::Color::White);
         klass.SetStatic(true);
-        klass.GetShader(device);
+        klass.GetShader(gfx::MaterialClass::ShaderFeatures(), device);
 
         const auto& shader = device.GetShader(0);
         const auto& source = shader.GetSource();
@@ -989,7 +1276,7 @@ void unit_test_material_uniform_folding()
         klass.SetColor(gfx::Color::Red,   gfx::GradientClass::ColorIndex::BottomRight);
         klass.SetColor(gfx::Color::White, gfx::GradientClass::ColorIndex::TopRight);
         klass.SetStatic(true);
-        klass.GetShader(device);
+        klass.GetShader(gfx::MaterialClass::ShaderFeatures(), device);
 
         const auto& shader = device.GetShader(0);
         const auto& source = shader.GetSource();
@@ -1017,7 +1304,7 @@ void unit_test_material_uniform_folding()
         klass.SetTextureVelocityZ(-1.0f);
         klass.SetTextureScaleX(2.0);
         klass.SetTextureScaleY(3.0);
-        klass.GetShader(device);
+        klass.GetShader(gfx::MaterialClass::ShaderFeatures(), device);
 
         const auto& shader = device.GetShader(0);
         const auto& source = shader.GetSource();
@@ -1044,7 +1331,7 @@ void unit_test_material_uniform_folding()
         klass.SetTextureVelocityZ(-1.0f);
         klass.SetTextureScaleX(2.0);
         klass.SetTextureScaleY(3.0);
-        klass.GetShader(device);
+        klass.GetShader(gfx::MaterialClass::ShaderFeatures(), device);
 
         const auto& shader = device.GetShader(0);
         const auto& source = shader.GetSource();
@@ -1157,12 +1444,432 @@ void unit_test_custom_textures()
 
 }
 
+void unit_test_material_features()
+{
+    using Feature = gfx::MaterialClass::ShaderFeature;
+
+    {
+        gfx::GradientClass test;
+        gfx::MaterialClass::State env;
+        env.render_points = false;
+        TEST_REQUIRE(test.GetShaderFeatures(env).value() == 0);
+        TEST_REQUIRE(test.GetVariantId(test.GetShaderFeatures(env)) == test.GetProgramId());
+        env.render_points = true;
+        TEST_REQUIRE(test.GetShaderFeatures(env).test(Feature::RenderPoints));
+        TEST_REQUIRE(test.GetVariantId(test.GetShaderFeatures(env)) != test.GetProgramId());
+
+        TestDevice device;
+        auto* points = test.GetShader(test.GetShaderFeatures(env), device);
+        env.render_points = false;
+        auto* triangles = test.GetShader(test.GetShaderFeatures(env), device);
+        TEST_REQUIRE(points != triangles);
+        TEST_REQUIRE(test.GetShader(test.GetShaderFeatures(env), device) == triangles);
+        TEST_REQUIRE(base::Contains(device.GetShader(0).GetSource(), "#define FEATURE_POINTS"));
+        TEST_REQUIRE(!base::Contains(device.GetShader(1).GetSource(), "#define FEATURE_POINTS"));
+    }
+
+    {
+        gfx::RgbBitmap bitmap;
+        bitmap.Resize(2, 2);
+
+        gfx::TextureMap2DClass test;
+        test.SetTexture(gfx::CreateTextureFromBitmap(bitmap));
+        test.SetTextureWrapX(gfx::MaterialClass::TextureWrapping::Clamp);
+        test.SetTextureWrapY(gfx::MaterialClass::TextureWrapping::Repeat);
+        test.SetParticleAction(gfx::TextureMap2DClass::ParticleAction::Rotate);
+
+        gfx::MaterialClass::State env;
+        env.render_points = false;
+        TEST_REQUIRE(test.GetShaderFeatures(env).value() == 0);
+        env.render_points = true;
+        TEST_REQUIRE(test.GetShaderFeatures(env).test(Feature::RenderPoints));
+        TEST_REQUIRE(test.GetShaderFeatures(env).test(Feature::ParticleRotation));
+
+        // texture sub rect needs the coordinate wrapping in the shader.
+        test.SetTextureRect(gfx::FRect(0.0f, 0.0f, 0.5f, 0.5f));
+        env.render_points = false;
+        const auto features = test.GetShaderFeatures(env);
+        TEST_REQUIRE(features.test(Feature::TextureRectClampX));
+        TEST_REQUIRE(features.test(Feature::TextureRectRepeatY));
+        TEST_REQUIRE(!features.test(Feature::TextureRectRepeatX));
+        TEST_REQUIRE(!features.test(Feature::TextureRectClampY));
+    }
+
+    {
+        gfx::RgbBitmap bitmap;
+        bitmap.Resize(2, 2);
+
+        gfx::SpriteClass test;
+        test.AddTexture(gfx::CreateTextureFromBitmap(bitmap));
+        test.AddTexture(gfx::CreateTextureFromBitmap(bitmap));
+
+        gfx::MaterialClass::State env;
+        test.SetBlendFrames(true);
+        TEST_REQUIRE(test.GetShaderFeatures(env).test(Feature::BlendFrames));
+        test.SetBlendFrames(false);
+        TEST_REQUIRE(!test.GetShaderFeatures(env).test(Feature::BlendFrames));
+
+        // without blending only the current frame is bound.
+        TestDevice device;
+        TestProgram program;
+        test.ApplyDynamicState(env, device, program);
+        TEST_REQUIRE(!program.HasUniform("kBlendCoeff"));
+    }
+}
+
+void unit_test_outline_geometry()
+{
+    const glm::mat4 identity(1.0f);
+    gfx::Drawable::Environment env;
+    env.proj_matrix = &identity;
+    env.view_matrix = &identity;
+
+    // outlines need their own program since they use a different vertex shader.
+    {
+        gfx::Rectangle solid(gfx::Drawable::Style::Solid);
+        gfx::Rectangle outline(gfx::Drawable::Style::Outline);
+        TEST_REQUIRE(solid.GetId() != outline.GetId());
+    }
+
+    // outline gets tessellated into a single triangle strip.
+    {
+        TestDevice device;
+        gfx::Rectangle rect(gfx::Drawable::Style::Outline, 2.0f);
+        const auto* geom = static_cast<const TestGeometry*>(rect.Upload(env, device));
+        TEST_REQUIRE(geom);
+        TEST_REQUIRE(geom->GetNumDraws() == 1);
+        TEST_REQUIRE(geom->GetDraw(0).type == gfx::Geometry::DrawType::TriangleStrip);
+        // 4 corners + the closing point, 2 vertices each.
+        TEST_REQUIRE(geom->GetVertexCount() == 10);
+        TEST_REQUIRE(geom->GetLayout().attributes.size() == 5);
+
+        // same class and width share the geometry
+        gfx::Rectangle other(gfx::Drawable::Style::Outline, 2.0f);
+        TEST_REQUIRE(other.Upload(env, device) == geom);
+        TEST_REQUIRE(device.GetNumGeometries() == 1);
+
+        // different width is a different geometry
+        other.SetLineWidth(4.0f);
+        TEST_REQUIRE(other.Upload(env, device) != geom);
+        TEST_REQUIRE(device.GetNumGeometries() == 2);
+    }
+
+    // separate lines are stitched together with degenerate triangles.
+    {
+        TestDevice device;
+        gfx::Grid grid(1, 1, false);
+        const auto* geom = static_cast<const TestGeometry*>(grid.Upload(env, device));
+        TEST_REQUIRE(geom);
+        TEST_REQUIRE(geom->GetNumDraws() == 1);
+        TEST_REQUIRE(geom->GetDraw(0).type == gfx::Geometry::DrawType::TriangleStrip);
+        // 2 lines with 4 vertices each + 2 vertices to connect them.
+        TEST_REQUIRE(geom->GetVertexCount() == 10);
+    }
+
+    // solid geometry is unchanged.
+    {
+        TestDevice device;
+        gfx::Rectangle rect(gfx::Drawable::Style::Solid);
+        const auto* geom = static_cast<const TestGeometry*>(rect.Upload(env, device));
+        TEST_REQUIRE(geom);
+        TEST_REQUIRE(geom->GetDraw(0).type == gfx::Geometry::DrawType::Triangles);
+        TEST_REQUIRE(geom->GetVertexCount() == 6);
+    }
+}
+
+void unit_test_pass_timers()
+{
+    TestDevice device;
+    auto painter = gfx::Painter::Create(&device);
+
+    painter->EnablePassTimers(true);
+    painter->BeginPass("outer");
+    painter->BeginPass("inner");
+    // the outer pass is suspended for the inner pass.
+    TEST_REQUIRE(device.GetNumRunningTimers() == 1);
+    painter->EndPass();
+    TEST_REQUIRE(device.GetNumRunningTimers() == 1);
+
+    // turning the timers off with a pass open must
+    // not leave the device timer running.
+    painter->EnablePassTimers(false);
+    TEST_REQUIRE(device.GetNumRunningTimers() == 0);
+    painter->EndPass();
+    TEST_REQUIRE(device.GetNumRunningTimers() == 0);
+
+    // the pass stack starts clean when turned back on.
+    painter->EnablePassTimers(true);
+    painter->BeginPass("outer");
+    TEST_REQUIRE(device.GetNumRunningTimers() == 1);
+    painter->EndPass();
+    TEST_REQUIRE(device.GetNumRunningTimers() == 0);
+}
+
+void unit_test_pass_timings()
+{
+    TestDevice device;
+    auto painter = gfx::Painter::Create(&device);
+    painter->EnablePassTimers(true);
+
+    const auto& GetTime = [](const std::vector<gfx::Painter::PassTiming>& timings, const std::string& name) {
+        for (const auto& timing : timings)
+        {
+            if (timing.name == name)
+                return timing.gpu_time;
+        }
+        TEST_REQUIRE(!"no such pass");
+        return 0.0;
+    };
+
+    device.BeginFrame();
+    // the outer pass is suspended for the inner pass and the
+    // suspended segments are summed. the time spent in the inner
+    // pass is not included in the outer pass.
+    device.SetTimerResult(0.125);
+    painter->BeginPass("outer");
+    device.SetTimerResult(0.25);
+    painter->BeginPass("inner");
+    painter->EndPass();
+    device.SetTimerResult(0.5);
+    painter->EndPass();
+    // same pass again later in the same frame.
+    device.SetTimerResult(1.0);
+    painter->BeginPass("outer");
+    painter->EndPass();
+    TEST_REQUIRE(painter->GetPassTimings().empty());
+
+    // the frame is over but not all segments are done yet.
+    device.BeginFrame();
+    device.CompleteTimers(3);
+    TEST_REQUIRE(painter->GetPassTimings().empty());
+    device.CompleteTimers(1);
+    auto timings = painter->GetPassTimings();
+    TEST_REQUIRE(timings.size() == 2);
+    TEST_REQUIRE(GetTime(timings, "outer") == 1.625);
+    TEST_REQUIRE(GetTime(timings, "inner") == 0.25);
+
+    // the segments of the current frame are done but the frame isn't
+    // over yet so the results are still those of the previous frame.
+    device.SetTimerResult(2.0);
+    painter->BeginPass("other");
+    painter->EndPass();
+    device.CompleteTimers(1);
+    timings = painter->GetPassTimings();
+    TEST_REQUIRE(timings.size() == 2);
+    TEST_REQUIRE(GetTime(timings, "outer") == 1.625);
+
+    device.BeginFrame();
+    timings = painter->GetPassTimings();
+    TEST_REQUIRE(timings.size() == 1);
+    TEST_REQUIRE(GetTime(timings, "other") == 2.0);
+
+    // a lost measurement taints the whole pass.
+    device.SetTimerResult(-1.0);
+    painter->BeginPass("other");
+    painter->EndPass();
+    device.SetTimerResult(1.0);
+    painter->BeginPass("other");
+    painter->EndPass();
+    device.CompleteTimers(2);
+    device.BeginFrame();
+    timings = painter->GetPassTimings();
+    TEST_REQUIRE(timings.size() == 1);
+    TEST_REQUIRE(GetTime(timings, "other") < 0.0);
+}
+
+void unit_test_painter_stencil()
+{
+    TestDevice device;
+    auto painter = gfx::Painter::Create(&device);
+    painter->SetSurfaceSize(100, 100);
+    painter->SetViewport(0, 0, 100, 100);
+
+    const gfx::Rectangle shape;
+    const gfx::Transform transform;
+    const gfx::Material material = gfx::CreateMaterialFromColor(gfx::Color::Red);
+
+    // every masked draw does a mask pass and a draw pass
+    // with the same stencil ref.
+    const auto& GetRef = [&device](size_t draw) {
+        const auto& states = device.GetDrawStates();
+        TEST_REQUIRE(states.size() == (draw + 1) * 2);
+        const auto& mask = states[draw * 2 + 0];
+        const auto& fill = states[draw * 2 + 1];
+        TEST_REQUIRE(mask.stencil_func  == gfx::Device::State::StencilFunc::PassAlways);
+        TEST_REQUIRE(mask.stencil_dpass == gfx::Device::State::StencilOp::WriteRef);
+        TEST_REQUIRE(fill.stencil_func  == gfx::Device::State::StencilFunc::RefIsNotEqual);
+        TEST_REQUIRE(mask.stencil_ref == fill.stencil_ref);
+        return (unsigned)mask.stencil_ref;
+    };
+    const auto& SameRect = [](const gfx::IRect& lhs, const gfx::IRect& rhs) {
+        return lhs.GetX() == rhs.GetX() && lhs.GetY() == rhs.GetY() &&
+               lhs.GetWidth() == rhs.GetWidth() && lhs.GetHeight() == rhs.GetHeight();
+    };
+
+    // several masked draws in one frame, the stencil is cleared
+    // only once and the refs increment.
+    device.BeginFrame();
+    for (unsigned i=0; i<3; ++i)
+    {
+        painter->Draw(shape, transform, shape, transform, material);
+        TEST_REQUIRE(GetRef(i) == i + 1);
+    }
+    TEST_REQUIRE(device.GetStencilClears().size() == 1);
+    TEST_REQUIRE(SameRect(device.GetStencilClears()[0], gfx::IRect(0, 0, 100, 100)));
+
+    // run out of refs, the stencil is cleared and the refs start over.
+    for (unsigned i=3; i<255; ++i)
+        painter->Draw(shape, transform, shape, transform, material);
+    TEST_REQUIRE(GetRef(254) == 255);
+    TEST_REQUIRE(device.GetStencilClears().size() == 1);
+    painter->Draw(shape, transform, shape, transform, material);
+    TEST_REQUIRE(GetRef(255) == 1);
+    TEST_REQUIRE(device.GetStencilClears().size() == 2);
+
+    // new frame, the stencil contents are unknown.
+    device.ClearDrawLog();
+    device.BeginFrame();
+    painter->Draw(shape, transform, shape, transform, material);
+    painter->Draw(shape, transform, shape, transform, material);
+    TEST_REQUIRE(GetRef(0) == 1);
+    TEST_REQUIRE(GetRef(1) == 2);
+    TEST_REQUIRE(device.GetStencilClears().size() == 1);
+
+    // new render target, same deal.
+    auto* fbo = device.MakeFrameBuffer("fbo");
+    gfx::FrameBuffer::Config conf;
+    conf.width  = 50;
+    conf.height = 50;
+    fbo->SetConfig(conf);
+    device.ClearDrawLog();
+    painter->SetRenderTarget(fbo);
+    painter->SetViewport(0, 0, 50, 50);
+    painter->Draw(shape, transform, shape, transform, material);
+    TEST_REQUIRE(GetRef(0) == 1);
+    TEST_REQUIRE(device.GetStencilClears().size() == 1);
+    TEST_REQUIRE(SameRect(device.GetStencilClears()[0], gfx::IRect(0, 0, 50, 50)));
+
+    // and back to the default target.
+    device.ClearDrawLog();
+    painter->SetRenderTarget(nullptr);
+    painter->SetViewport(0, 0, 100, 100);
+    painter->Draw(shape, transform, shape, transform, material);
+    TEST_REQUIRE(GetRef(0) == 1);
+    TEST_REQUIRE(device.GetStencilClears().size() == 1);
+
+    // drawing outside the cleared area needs a clear too.
+    device.ClearDrawLog();
+    painter->SetViewport(0, 0, 50, 50);
+    painter->Draw(shape, transform, shape, transform, material);
+    TEST_REQUIRE(GetRef(0) == 2);
+    TEST_REQUIRE(device.GetStencilClears().empty());
+    painter->SetViewport(50, 50, 100, 100);
+    painter->Draw(shape, transform, shape, transform, material);
+    TEST_REQUIRE(GetRef(1) == 1);
+    TEST_REQUIRE(device.GetStencilClears().size() == 1);
+}
+
+void unit_test_painter_draw_budget()
+{
+    TestDevice device;
+    auto painter = gfx::Painter::Create(&device);
+    painter->SetSurfaceSize(100, 100);
+    painter->SetViewport(0, 0, 100, 100);
+
+    const gfx::Rectangle rect;
+    const gfx::Transform transform;
+    const gfx::Material material = gfx::CreateMaterialFromColor(gfx::Color::Red);
+
+    device.BeginFrame();
+    painter->Draw(rect, transform, material);
+    const auto one = device.GetFrameStats();
+    TEST_REQUIRE(one.draw_calls == 1);
+    TEST_REQUIRE(one.vertices > 0);
+
+    // every painter draw is exactly one device draw.
+    device.BeginFrame();
+    TEST_REQUIRE(device.GetFrameStats().draw_calls == 0);
+    for (int i=0; i<10; ++i)
+        painter->Draw(rect, transform, material);
+    auto stats = device.GetFrameStats();
+    TEST_REQUIRE(stats.draw_calls == 10);
+    TEST_REQUIRE(stats.vertices == 10 * one.vertices);
+
+    // a masked draw costs one draw for each mask shape and
+    // one for each shape drawn.
+    const glm::mat4 model = transform.GetAsMatrix();
+    std::vector<gfx::Painter::DrawShape> draw_list;
+    std::vector<gfx::Painter::MaskShape> mask_list;
+    for (int i=0; i<2; ++i)
+    {
+        gfx::Painter::DrawShape shape;
+        shape.transform = &model;
+        shape.drawable  = &rect;
+        shape.material  = &material;
+        draw_list.push_back(shape);
+    }
+    gfx::Painter::MaskShape mask;
+    mask.transform = &model;
+    mask.drawable  = &rect;
+    mask_list.push_back(mask);
+
+    device.BeginFrame();
+    painter->Draw(draw_list, mask_list);
+    stats = device.GetFrameStats();
+    TEST_REQUIRE(stats.draw_calls == 3);
+    TEST_REQUIRE(stats.vertices == 3 * one.vertices);
+
+    // unmasked list draw, one device draw per shape.
+    device.BeginFrame();
+    painter->Draw(draw_list);
+    TEST_REQUIRE(device.GetFrameStats().draw_calls == 2);
+}
+
+void unit_test_texture_file_upload()
+{
+    // the file source uploads straight from the decoded image. the
+    // result must be the same as going through GetData.
+    for (const std::string file : {"4x4_square_grayscale.jpg",
+                                   "4x4_square_rgb.jpg",
+                                   "4x4_square_rgba.png"})
+    {
+        auto source = gfx::LoadTextureFromFile("../graphics/unit_test/" + file);
+        const auto& bitmap = source->GetData();
+        TEST_REQUIRE(bitmap);
+
+        TestTexture texture;
+        TEST_REQUIRE(source->Upload(&texture));
+        TEST_REQUIRE(texture.GetWidth() == bitmap->GetWidth());
+        TEST_REQUIRE(texture.GetHeight() == bitmap->GetHeight());
+        TEST_REQUIRE(texture.GetFormat() == gfx::Texture::DepthToFormat(bitmap->GetDepthBits()));
+
+        const auto bytes = bitmap->GetWidth() * bitmap->GetHeight() * bitmap->GetDepthBits() / 8;
+        TEST_REQUIRE(texture.GetPixels().size() == bytes);
+        TEST_REQUIRE(std::memcmp(texture.GetPixels().data(), bitmap->GetDataPtr(), bytes) == 0);
+    }
+
+    // content error.
+    {
+        auto source = gfx::LoadTextureFromFile("no-such-file.png");
+        TestTexture texture;
+        TEST_REQUIRE(source->Upload(&texture) == false);
+        TEST_REQUIRE(texture.GetWidth() == 0);
+    }
+}
+
 int test_main(int argc, char* argv[])
 {
     unit_test_material_uniforms();
     unit_test_material_textures();
+    unit_test_material_features();
     unit_test_material_uniform_folding();
     unit_test_custom_uniforms();
     unit_test_custom_textures();
+    unit_test_outline_geometry();
+    unit_test_pass_timers();
+    unit_test_pass_timings();
+    unit_test_painter_stencil();
+    unit_test_painter_draw_budget();
+    unit_test_texture_file_upload();
     return 0;
 }
\ No newline at end of file